@@ -1 +1,537 @@
-#include "include/analyzer.h"
\ No newline at end of file
+#include "include/analyzer.h"
+#include "include/intern.h"
+#include "include/scheduler.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Initial number of slots in a scope's table
+#define SCOPE_INIT_CAP 8
+
+// Fewest tasks worth starting another thread for
+#define A_TASKS_PER_THREAD 32
+
+void a_init(analyzer_t *a) {
+    *a = (analyzer_t){0};
+    arena_init(&a->arena);
+    arena_init(&a->scratch);
+}
+
+void a_free(analyzer_t *a) {
+    for (usz i = 0; i < a->errors.count; i++)
+        free(a->errors.items[i].msg);
+    free(a->errors.items);
+    free(a->imports);
+    free(a->counts);
+    for (usz i = 0; i < a->bodies.count; i++) {
+        arena_free(a->bodies.items[i]);
+        free(a->bodies.items[i]);
+    }
+    free(a->bodies.items);
+    arena_free(&a->arena);
+    arena_free(&a->scratch);
+}
+
+// Removes the diagnostics reported after the first `count`
+void a_drop_errors(analyzer_t *a, usz count) {
+    for (usz i = count; i < a->errors.count; i++)
+        free(a->errors.items[i].msg);
+    a->errors.count = count;
+}
+
+void a_report(analyzer_t *a, span_t span, bool warning, const char *fmt,
+              ...) {
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    usz size = vsnprintf(NULL, 0, fmt, ap2) + 1;
+    va_end(ap2);
+
+    char *message = malloc(size);
+    assert(message != NULL && "Buy more RAM lol");
+    vsnprintf(message, size, fmt, ap);
+    va_end(ap);
+
+    error_t err = (error_t){
+        .span = span,
+        .msg = message,
+        .warning = warning,
+    };
+    da_append(&a->errors, err);
+}
+
+/* -------------------- SCOPES -------------------- */
+
+static symbol_t *scope_alloc_symbols(analyzer_t *a, usz capacity) {
+    symbol_t *symbols = arena_alloc(&a->arena, capacity * sizeof(symbol_t));
+    memset(symbols, 0, capacity * sizeof(symbol_t));
+    return symbols;
+}
+
+static name_count_t *a_count_slot(analyzer_t *a, const char *sym) {
+    usz mask = a->counts_capacity - 1;
+    for (usz slot = intern_hash(sym) & mask;; slot = (slot + 1) & mask) {
+        name_count_t *count = &a->counts[slot];
+        if (count->sym == sym || count->sym == NULL) return count;
+    }
+}
+
+// How many open scopes declare `sym`
+static usz a_count(analyzer_t *a, const char *sym) {
+    return a->counts != NULL ? a_count_slot(a, sym)->scopes : 0;
+}
+
+// Names are never removed: one no scope declares any more counts 0
+static void a_count_bind(analyzer_t *a, const char *sym) {
+    if ((a->counts_used + 1) * 4 > a->counts_capacity * 3) {
+        name_count_t *old = a->counts;
+        usz old_capacity = a->counts_capacity;
+        a->counts_capacity = old != NULL ? old_capacity * 2 : SCOPE_INIT_CAP;
+        a->counts = calloc(a->counts_capacity, sizeof(name_count_t));
+        assert(a->counts != NULL && "Buy more RAM lol");
+        for (usz i = 0; i < old_capacity; i++)
+            if (old[i].sym != NULL) *a_count_slot(a, old[i].sym) = old[i];
+        free(old);
+    }
+
+    name_count_t *count = a_count_slot(a, sym);
+    if (count->sym == NULL) a->counts_used++;
+    count->sym = sym;
+    count->scopes++;
+}
+
+// Counts the names of `scope` and those around it, for an analyzer that
+// starts out inside scopes it shares
+static void a_count_scopes(analyzer_t *a, scope_t *scope) {
+    for (; scope != NULL; scope = scope->parent)
+        for (usz i = 0; i < scope->capacity; i++)
+            if (scope->symbols[i].sym != NULL)
+                a_count_bind(a, scope->symbols[i].sym);
+}
+
+void a_push_scope(analyzer_t *a) {
+    arena_mark_t mark = arena_mark(&a->arena);
+    scope_t *scope = arena_new(&a->arena, scope_t);
+    scope->parent = a->scope;
+    scope->capacity = SCOPE_INIT_CAP;
+    scope->count = 0;
+    scope->symbols = scope_alloc_symbols(a, SCOPE_INIT_CAP);
+    scope->mark = mark;
+    a->scope = scope;
+}
+
+void a_pop_scope(analyzer_t *a) {
+    scope_t *scope = a->scope;
+    assert(scope != NULL && "unbalanced scopes");
+    for (usz i = 0; i < scope->capacity; i++)
+        if (scope->symbols[i].sym != NULL)
+            a_count_slot(a, scope->symbols[i].sym)->scopes--;
+    a->scope = scope->parent;
+    arena_release(&a->arena, scope->mark);
+}
+
+// Finds `sym` in the table of a single scope, or the empty slot where it
+// would be inserted.
+static symbol_t *scope_find(scope_t *scope, const char *sym) {
+    usz mask = scope->capacity - 1;
+    for (usz slot = intern_hash(sym) & mask;; slot = (slot + 1) & mask) {
+        symbol_t *symbol = &scope->symbols[slot];
+        if (symbol->sym == sym || symbol->sym == NULL) return symbol;
+    }
+}
+
+static void scope_grow(analyzer_t *a, scope_t *scope) {
+    symbol_t *old = scope->symbols;
+    usz old_capacity = scope->capacity;
+
+    // the old table stays in the arena until the scope is popped
+    scope->capacity *= 2;
+    scope->symbols = scope_alloc_symbols(a, scope->capacity);
+    for (usz i = 0; i < old_capacity; i++)
+        if (old[i].sym != NULL) *scope_find(scope, old[i].sym) = old[i];
+}
+
+binding_t *a_lookup(analyzer_t *a, const char *sym) {
+    if (a_count(a, sym) == 0) return NULL;
+    for (scope_t *scope = a->scope; scope != NULL; scope = scope->parent) {
+        symbol_t *symbol = scope_find(scope, sym);
+        if (symbol->sym != NULL) return &symbol->binding;
+    }
+    return NULL;
+}
+
+static global_t *a_find_global(analyzer_t *, const char *);
+
+void a_bind(analyzer_t *a, const char *sym, span_t span, binding_t binding) {
+    scope_t *scope = a->scope;
+    symbol_t *symbol = scope_find(scope, sym);
+    if (symbol->sym != NULL) {
+        a_report(a, span, false, "redefinition of `%s`", sym);
+        return;
+    }
+
+    if (a_count(a, sym) > 0 || a_find_global(a, sym) != NULL)
+        a_report(a, span, true, "`%s` shadows an earlier declaration", sym);
+
+    if ((scope->count + 1) * 4 > scope->capacity * 3) {
+        scope_grow(a, scope);
+        symbol = scope_find(scope, sym);
+    }
+    *symbol = (symbol_t){sym, binding};
+    scope->count++;
+    a_count_bind(a, sym);
+}
+
+/* -------------------- GLOBALS -------------------- */
+
+// Top-level declarations in streaming mode are not in any scope: they are
+// registered up front from `unit_split`, so they can be used before the
+// declaration itself is parsed.
+void a_stream_init(analyzer_t *a, usz count, a_loader_t load, void *ctx) {
+    a->globals = arena_alloc(&a->arena, count * sizeof(global_t));
+    a->table_capacity = SCOPE_INIT_CAP;
+    while (a->table_capacity * 3 < count * 4)
+        a->table_capacity *= 2;
+    a->table = arena_alloc(&a->arena, a->table_capacity * sizeof(global_t *));
+    memset(a->table, 0, a->table_capacity * sizeof(global_t *));
+    a->load = load;
+    a->load_ctx = ctx;
+}
+
+static global_t **a_global_slot(analyzer_t *a, const char *id) {
+    usz mask = a->table_capacity - 1;
+    for (usz slot = intern_hash(id) & mask;; slot = (slot + 1) & mask)
+        if (a->table[slot] == NULL || a->table[slot]->id == id)
+            return &a->table[slot];
+}
+
+static global_t **a_import_slot(analyzer_t *a, const char *id) {
+    usz mask = a->import_capacity - 1;
+    for (usz slot = intern_hash(id) & mask;; slot = (slot + 1) & mask)
+        if (a->imports[slot] == NULL || a->imports[slot]->id == id)
+            return &a->imports[slot];
+}
+
+static global_t *a_find_import(analyzer_t *a, const char *id) {
+    return a->imports != NULL ? *a_import_slot(a, id) : NULL;
+}
+
+// Declarations of the file itself come before imported ones
+static global_t *a_find_global(analyzer_t *a, const char *id) {
+    global_t *global = a->table != NULL ? *a_global_slot(a, id) : NULL;
+    return global != NULL ? global : a_find_import(a, id);
+}
+
+global_t *a_declare_global(analyzer_t *a, usz index, const char *id,
+                           span_t span, bool constant) {
+    global_t *global = &a->globals[index];
+    *global = (global_t){.id = id,
+                         .span = span,
+                         .index = index,
+                         .ty = TID_ERROR,
+                         .state = D_UNCHECKED,
+                         .constant = constant};
+
+    global_t **slot = a_global_slot(a, id);
+    if (*slot != NULL)
+        a_report(a, span, false, "redefinition of `%s`", id);
+    else
+        *slot = global;
+    if (a_find_import(a, id) != NULL)
+        a_report(a, span, true, "`%s` shadows an earlier declaration", id);
+    return global;
+}
+
+static void a_grow_imports(analyzer_t *a) {
+    global_t **old = a->imports;
+    usz old_capacity = a->import_capacity;
+
+    a->import_capacity = old_capacity > 0 ? old_capacity * 2 : SCOPE_INIT_CAP;
+    a->imports = calloc(a->import_capacity, sizeof(global_t *));
+    assert(a->imports != NULL && "Buy more RAM lol");
+    for (usz i = 0; i < old_capacity; i++)
+        if (old[i] != NULL) *a_import_slot(a, old[i]->id) = old[i];
+    free(old);
+}
+
+// Makes a declaration of another module visible to this one. Returns NULL
+// if something of that name was already imported.
+global_t *a_import(analyzer_t *a, const char *id, tid_t ty, bool constant,
+                   span_t span) {
+    if ((a->import_count + 1) * 4 > a->import_capacity * 3) a_grow_imports(a);
+
+    global_t **slot = a_import_slot(a, id);
+    if (*slot != NULL) return NULL;
+
+    global_t *global = arena_new(&a->arena, global_t);
+    *global = (global_t){.id = id,
+                         .span = span,
+                         .ty = ty,
+                         .state = D_CHECKED,
+                         .constant = constant};
+    *slot = global;
+    a->import_count++;
+    return global;
+}
+
+/* -------------------- TASKS -------------------- */
+
+// Function bodies are analyzed as tasks on a work-stealing scheduler, each
+// worker with an analyzer of its own that shares the parent's scopes and
+// globals, which stay unchanged while the workers run. Every task collects
+// its diagnostics separately and records where it spawned others, so they
+// can be put back together in exactly the order a single thread would have
+// reported them.
+typedef struct a_task_t a_task_t;
+
+typedef struct {
+    usz at; // how many diagnostics the parent had when it spawned `task`
+    a_task_t *task;
+} a_child_t;
+
+struct a_task_t {
+    a_task_fn_t run;
+    void *item;
+    errors_t errors;
+    array_t(a_child_t) children;
+    errors_t body_errors;  // of the skipped bodies it parsed
+    errors_t *body_target; // where those would have gone
+};
+
+typedef struct {
+    analyzer_t a;
+    arena_t tasks;   // tasks spawned on this worker
+    arena_t *bodies; // owned by the parent, see `analyzer_t.bodies`
+} a_worker_t;
+
+static void a_run_task(sched_worker_t *worker, void *arg) {
+    a_worker_t *w = worker->ctx;
+    a_task_t *task = arg;
+    analyzer_t *a = &w->a;
+
+    a->worker = worker;
+    a->task = task;
+    a->errors = task->errors;
+    task->run(a, task->item);
+    task->errors = a->errors;
+    a->errors = (errors_t){0};
+    a->task = NULL;
+}
+
+// Appends the diagnostics of `task` and the tasks it spawned
+static void a_merge(analyzer_t *a, a_task_t *task) {
+    usz next = 0;
+    for (usz i = 0; i < task->children.count; i++) {
+        a_child_t *child = &task->children.items[i];
+        for (; next < child->at; next++)
+            da_append(&a->errors, task->errors.items[next]);
+        a_merge(a, child->task);
+    }
+    for (; next < task->errors.count; next++)
+        da_append(&a->errors, task->errors.items[next]);
+
+    for (usz i = 0; i < task->body_errors.count; i++)
+        da_append(task->body_target, task->body_errors.items[i]);
+    free(task->errors.items);
+    free(task->children.items);
+    free(task->body_errors.items);
+}
+
+// Runs `run` on every item, in parallel when there are enough of them, with
+// the same outcome as running them one after the other.
+void a_run(analyzer_t *a, void **items, usz count, a_task_fn_t run) {
+    usz jobs = a->jobs;
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (usz)cpus : 1;
+    }
+    usz useful = (count + A_TASKS_PER_THREAD - 1) / A_TASKS_PER_THREAD;
+    if (jobs > useful) jobs = useful;
+    if (jobs <= 1 || a->task != NULL) {
+        for (usz i = 0; i < count; i++)
+            run(a, items[i]);
+        return;
+    }
+
+    a_task_t *tasks = calloc(count, sizeof(a_task_t));
+    void **roots = malloc(count * sizeof(void *));
+    a_worker_t *workers = calloc(jobs, sizeof(a_worker_t));
+    void **contexts = malloc(jobs * sizeof(void *));
+    assert(tasks != NULL && roots != NULL && workers != NULL &&
+           contexts != NULL && "Buy more RAM lol");
+
+    for (usz i = 0; i < count; i++) {
+        tasks[i] = (a_task_t){.run = run, .item = items[i]};
+        roots[i] = &tasks[i];
+    }
+    for (usz i = 0; i < jobs; i++) {
+        a_worker_t *w = &workers[i];
+        w->a = (analyzer_t){.scope = a->scope,
+                            .globals = a->globals,
+                            .table = a->table,
+                            .table_capacity = a->table_capacity,
+                            .imports = a->imports,
+                            .import_capacity = a->import_capacity,
+                            .import_count = a->import_count};
+        a_count_scopes(&w->a, a->scope);
+        arena_init(&w->a.arena);
+        arena_init(&w->a.scratch);
+        arena_init(&w->tasks);
+        w->bodies = malloc(sizeof(arena_t));
+        assert(w->bodies != NULL && "Buy more RAM lol");
+        arena_init(w->bodies);
+        da_append(&a->bodies, w->bodies);
+        contexts[i] = w;
+    }
+
+    sched_run(roots, count, a_run_task, contexts, jobs);
+
+    for (usz i = 0; i < count; i++)
+        a_merge(a, &tasks[i]);
+    for (usz i = 0; i < jobs; i++) {
+        arena_free(&workers[i].a.arena);
+        arena_free(&workers[i].a.scratch);
+        arena_free(&workers[i].tasks);
+        free(workers[i].a.counts);
+    }
+    free(contexts);
+    free(workers);
+    free(roots);
+    free(tasks);
+}
+
+// Runs `run` on `item` after the current task, possibly on another thread,
+// or right away outside of `a_run`. Whatever `item` refers to outside of
+// itself must not change any more.
+void a_spawn(analyzer_t *a, a_task_fn_t run, void *item) {
+    if (a->task == NULL) {
+        run(a, item);
+        return;
+    }
+
+    sched_worker_t *worker = a->worker;
+    a_worker_t *w = worker->ctx;
+    a_task_t *task = arena_new(&w->tasks, a_task_t);
+    *task = (a_task_t){.run = run, .item = item};
+    da_append(&a->task->children, ((a_child_t){a->errors.count, task}));
+    sched_spawn(worker, task);
+}
+
+// `ast_fn_body` for tasks, which must not share where skipped bodies are
+// parsed into. Every skipped body of a unit reports to the same list.
+stmts_t *a_fn_body(analyzer_t *a, expr_t *fn) {
+    lazy_body_t *lazy = fn->fn.lazy;
+    if (lazy == NULL || a->task == NULL) return ast_fn_body(fn);
+
+    a_task_t *task = a->task;
+    if (task->body_target == NULL) task->body_target = lazy->errors;
+    assert(task->body_target == lazy->errors);
+    a_worker_t *w = ((sched_worker_t *)a->worker)->ctx;
+    return ast_fn_body_in(fn, w->bodies, &task->body_errors);
+}
+
+/* -------------------- RESOLUTION -------------------- */
+
+static void a_resolve_expr(analyzer_t *, expr_t *);
+
+static void a_resolve_decl(analyzer_t *a, decl_t *decl) {
+    binding_t binding = {.type = B_DECL, .decl = decl};
+
+    // constants are visible in their own value so local functions can
+    // recurse, variables only after their initializer
+    if (decl->constant) a_bind(a, decl->id, decl->span, binding);
+    a_resolve_expr(a, decl->value);
+    if (!decl->constant) a_bind(a, decl->id, decl->span, binding);
+}
+
+static void a_resolve_fn(analyzer_t *a, expr_t *fn) {
+    a_push_scope(a);
+
+    params_t *params = &fn->fn.params;
+    for (usz i = 0; i < params->count; i++) {
+        param_t *param = params->items[i];
+        if (param->expr != NULL) a_resolve_expr(a, param->expr);
+        a_bind(a, param->id, param->span,
+               (binding_t){.type = B_PARAM, .param = param});
+    }
+
+    stmts_t *stmts = a_fn_body(a, fn);
+    for (usz i = 0; i < stmts->count; i++) {
+        stmt_t *stmt = stmts->items[i];
+        switch (stmt->type) {
+        case S_DECL:
+            a_resolve_decl(a, stmt->decl);
+            break;
+
+        case S_EXPR:
+            a_resolve_expr(a, stmt->expr);
+            break;
+        }
+    }
+
+    a_pop_scope(a);
+}
+
+static void a_resolve_expr(analyzer_t *a, expr_t *expr) {
+    if (expr == NULL) return;
+
+    switch (expr->type) {
+    case E_IDENT: {
+        binding_t *binding = a_lookup(a, expr->ident);
+        global_t *global;
+        if (binding != NULL) {
+            expr->binding = *binding;
+        } else if ((global = a_find_global(a, expr->ident)) != NULL) {
+            expr->binding = (binding_t){.type = B_GLOBAL, .global = global};
+        } else {
+            a_report(a, expr->span, false, "undefined name `%s`", expr->ident);
+            expr->binding = (binding_t){B_UNRESOLVED};
+        }
+    } break;
+
+    case E_STRING:
+    case E_INT:
+    case E_FLOAT:
+        break;
+
+    case E_FN:
+        a_resolve_fn(a, expr);
+        break;
+
+    case E_BINOP:
+        a_resolve_expr(a, expr->binop.lhs);
+        a_resolve_expr(a, expr->binop.rhs);
+        break;
+
+    case E_UNARY:
+        a_resolve_expr(a, expr->unary.operand);
+        break;
+    }
+}
+
+static void a_resolve_task(analyzer_t *a, void *decl) {
+    a_resolve_expr(a, ((decl_t *)decl)->value);
+}
+
+// Resolves every identifier in a translation unit. All top-level
+// declarations are bound first, so they can refer to each other regardless
+// of order, and then each is resolved on its own.
+void a_resolve(analyzer_t *a, decls_t *decls) {
+    a_push_scope(a);
+
+    for (usz i = 0; i < decls->count; i++)
+        a_bind(a, decls->items[i]->id, decls->items[i]->span,
+               (binding_t){.type = B_DECL, .decl = decls->items[i]});
+    a_run(a, (void **)decls->items, decls->count, a_resolve_task);
+
+    a_pop_scope(a);
+}
+
+// Resolves a top-level declaration in streaming mode. The other top-level
+// declarations are globals, and so is this one within its own value.
+void a_resolve_global(analyzer_t *a, decl_t *decl) {
+    a_resolve_expr(a, decl->value);
+}
@@ -0,0 +1,115 @@
+#include "include/arena.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+void arena_init(arena_t *a) { *a = (arena_t){0}; }
+
+void arena_free(arena_t *a) {
+    arena_block_t *block = a->first;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    *a = (arena_t){0};
+}
+
+// Moves to the block after the current one, reusing a block left behind by
+// an earlier release when it is large enough and inserting a new one
+// otherwise.
+static arena_block_t *arena_grow(arena_t *a, usz size) {
+    arena_block_t *next = a->current != NULL ? a->current->next : a->first;
+    if (next != NULL && next->size >= size) {
+        next->used = 0;
+        a->current = next;
+        return next;
+    }
+
+    usz block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    arena_block_t *block = malloc(sizeof(arena_block_t) + block_size);
+    assert(block != NULL && "Buy more RAM lol");
+    block->size = block_size;
+    block->used = 0;
+    block->next = next;
+    if (a->current != NULL)
+        a->current->next = block;
+    else
+        a->first = block;
+    a->current = block;
+    a->reserved += block_size;
+    return block;
+}
+
+void *arena_alloc(arena_t *a, usz size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arena_block_t *block = a->current;
+    if (block == NULL || block->size - block->used < size)
+        block = arena_grow(a, size);
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+arena_mark_t arena_mark(arena_t *a) {
+    return (arena_mark_t){a->current, a->current ? a->current->used : 0};
+}
+
+void arena_release(arena_t *a, arena_mark_t mark) {
+    a->current = mark.block;
+    if (mark.block != NULL) mark.block->used = mark.used;
+}
+
+void arena_reset(arena_t *a) { a->current = NULL; }
+
+void arena_pool_init(arena_pool_t *pool) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->count = 0;
+    pool->reserved = 0;
+}
+
+void arena_pool_free(arena_pool_t *pool) {
+    for (usz i = 0; i < pool->count; i++) {
+        arena_free(pool->arenas[i]);
+        free(pool->arenas[i]);
+    }
+    pool->count = 0;
+    pool->reserved = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+arena_t *arena_pool_take(arena_pool_t *pool) {
+    arena_t *arena = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count > 0) {
+        arena = pool->arenas[--pool->count];
+        pool->reserved -= arena->reserved;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (arena == NULL) {
+        arena = malloc(sizeof(arena_t));
+        assert(arena != NULL && "Buy more RAM lol");
+        arena_init(arena);
+    }
+    return arena;
+}
+
+void arena_pool_give(arena_pool_t *pool, arena_t *arena) {
+    arena_reset(arena);
+    pthread_mutex_lock(&pool->lock);
+    bool kept = pool->count < ARENA_POOL_MAX &&
+                pool->reserved + arena->reserved <= ARENA_POOL_MAX_BYTES;
+    if (kept) {
+        pool->arenas[pool->count++] = arena;
+        pool->reserved += arena->reserved;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!kept) {
+        arena_free(arena);
+        free(arena);
+    }
+}
@@ -0,0 +1,1587 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "include/bench.h"
+#include "include/driver.h"
+#include "include/dump.h"
+#include "include/eval.h"
+#include "include/fold.h"
+#include "include/intern.h"
+#include "include/lexer.h"
+#include "include/log.h"
+#include "include/number.h"
+#include "include/parser.h"
+#include "include/sax.h"
+#include "include/unit.h"
+#include "include/utf8.h"
+#include "include/tokens.h"
+#include "include/walk.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Minimum wall-clock time a benchmark is repeated for
+#define BENCH_MIN_SECONDS 0.25
+
+typedef u64 (*bench_fn)(void *);
+
+static volatile u64 bench_sink;
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static u64 rng_state = 0x2545f4914f6cdd1d;
+
+static u64 rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// A file outside of any source manager, so its offsets start at 0
+static source_file_t bench_file(char *text, usz size) {
+    return (source_file_t){.name = "<bench>", .text = text, .length = size};
+}
+
+// Runs `fn` until at least BENCH_MIN_SECONDS have passed, doubling the number
+// of iterations every round, and reports the time per iteration. `items` and
+// `bytes` describe the work done by one iteration and are used for the
+// throughput columns; pass 0 to omit them.
+static void bench_run(const char *name, bench_fn fn, void *ctx, usz items,
+                      usz bytes) {
+    usz iterations = 1;
+    double elapsed = 0;
+    for (;;) {
+        double start = now();
+        for (usz i = 0; i < iterations; i++)
+            bench_sink += fn(ctx);
+        elapsed = now() - start;
+        if (elapsed >= BENCH_MIN_SECONDS) break;
+        iterations *= 2;
+    }
+
+    double per_iter = elapsed / (double)iterations;
+    printf("%-32s %12.1f us/iter", name, per_iter * 1e6);
+    if (items > 0) printf(" %10.2f ns/item", per_iter * 1e9 / (double)items);
+    if (bytes > 0) printf(" %10.1f MB/s", (double)bytes / per_iter / 1e6);
+    printf("\n");
+}
+
+/* -------------------- KEYWORDS -------------------- */
+
+#define WORD_COUNT 4096
+
+typedef struct {
+    char *text;
+    const char *words[WORD_COUNT];
+    usz lengths[WORD_COUNT];
+    usz size;
+} words_t;
+
+static const char *bench_keywords[] = {
+#define T(...)
+#define T_OP(...)
+#define T_KW(id, name) name,
+    TOKENS
+#undef T_KW
+#undef T_OP
+#undef T
+};
+
+// Builds a whitespace separated corpus of identifiers where roughly one word
+// in four is a keyword, which is in line with hand-written code.
+static void words_init(words_t *w) {
+    usz keyword_count = sizeof(bench_keywords) / sizeof(bench_keywords[0]);
+    w->text = malloc(WORD_COUNT * 16 + 1);
+    w->size = 0;
+
+    for (usz i = 0; i < WORD_COUNT; i++) {
+        char *word = w->text + w->size;
+        usz length;
+        if (rng_next() % 4 == 0) {
+            const char *kw = bench_keywords[rng_next() % keyword_count];
+            length = strlen(kw);
+            memcpy(word, kw, length);
+        } else {
+            length = 1 + rng_next() % 12;
+            word[0] = 'a' + rng_next() % 26;
+            for (usz j = 1; j < length; j++) {
+                u64 r = rng_next() % 36;
+                word[j] = r < 26 ? 'a' + r : '0' + (r - 26);
+            }
+        }
+        w->words[i] = word;
+        w->lengths[i] = length;
+        w->size += length;
+        w->text[w->size++] = i % 8 == 7 ? '\n' : ' ';
+    }
+    w->text[w->size] = '\0';
+}
+
+static u64 bench_keyword_hash(void *ctx) {
+    words_t *w = ctx;
+    u64 sum = 0;
+    for (usz i = 0; i < WORD_COUNT; i++)
+        sum += l_keyword(w->words[i], w->lengths[i]);
+    return sum;
+}
+
+static u64 bench_keyword_strcmp(void *ctx) {
+    words_t *w = ctx;
+    usz keyword_count = sizeof(bench_keywords) / sizeof(bench_keywords[0]);
+    u64 sum = 0;
+    for (usz i = 0; i < WORD_COUNT; i++) {
+        u8 type = T_IDENT;
+        for (usz k = 0; k < keyword_count; k++) {
+            if (strlen(bench_keywords[k]) == w->lengths[i] &&
+                strncmp(bench_keywords[k], w->words[i], w->lengths[i]) == 0) {
+                type = T_IF + k;
+                break;
+            }
+        }
+        sum += type;
+    }
+    return sum;
+}
+
+static u64 bench_lex(void *ctx) {
+    words_t *w = ctx;
+    source_file_t file = bench_file(w->text, w->size);
+    lexer_t lexer = {0};
+    l_init(&lexer, &file);
+
+    u64 sum = 0;
+    token_t token = {0};
+    for (;;) {
+        l_next(&lexer, &token);
+        if (token.type == T_EOF) break;
+        sum += token.type;
+    }
+    return sum;
+}
+
+/* -------------------- NUMBERS -------------------- */
+
+#define NUMBER_COUNT 4096
+
+typedef struct {
+    char *text;
+    usz size;
+    const char *floats[NUMBER_COUNT];
+    usz float_lengths[NUMBER_COUNT];
+    double values[NUMBER_COUNT]; // for the formatting benchmarks
+} numbers_t;
+
+// Builds a table-like corpus of integer, float and hex literals separated by
+// `;` which is what our data files mostly consist of.
+static void numbers_init(numbers_t *n) {
+    n->text = malloc(NUMBER_COUNT * 64 + 1);
+    n->size = 0;
+
+    for (usz i = 0; i < NUMBER_COUNT; i++) {
+        char *out = n->text + n->size;
+        usz length;
+        switch (rng_next() % 4) {
+        case 0:
+            length = sprintf(out, "0x%llx", rng_next() >> (rng_next() % 48));
+            break;
+        case 1:
+            length = sprintf(out, "%llu", rng_next() >> (rng_next() % 60));
+            break;
+        default:
+            length = sprintf(out, "%llu.%llu", rng_next() % 1000000,
+                             rng_next() >> (rng_next() % 40));
+            break;
+        }
+        n->floats[i] = strchr(out, '.') != NULL ? out : NULL;
+        n->float_lengths[i] = length;
+        n->values[i] = (double)rng_next() / (double)(rng_next() | 1);
+        n->size += length;
+        n->text[n->size++] = ';';
+        n->text[n->size++] = i % 8 == 7 ? '\n' : ' ';
+    }
+    n->text[n->size] = '\0';
+}
+
+static u64 bench_number_lex(void *ctx) {
+    numbers_t *n = ctx;
+    source_file_t file = bench_file(n->text, n->size);
+    lexer_t lexer = {0};
+    l_init(&lexer, &file);
+
+    u64 sum = 0;
+    token_t token = {0};
+    for (;;) {
+        l_next(&lexer, &token);
+        if (token.type == T_EOF) break;
+        sum += token.type == T_INT ? (u64)token.int_value : token.type;
+    }
+    return sum;
+}
+
+static u64 bench_number_float(void *ctx) {
+    numbers_t *n = ctx;
+    double sum = 0;
+    for (usz i = 0; i < NUMBER_COUNT; i++)
+        if (n->floats[i] != NULL)
+            sum += num_parse_float(n->floats[i], n->float_lengths[i]);
+    return (u64)sum;
+}
+
+static u64 bench_number_strtod(void *ctx) {
+    numbers_t *n = ctx;
+    double sum = 0;
+    for (usz i = 0; i < NUMBER_COUNT; i++)
+        if (n->floats[i] != NULL) sum += strtod(n->floats[i], NULL);
+    return (u64)sum;
+}
+
+/* -------------------- PARSER -------------------- */
+
+#define DECL_COUNT 2048
+
+typedef struct {
+    char *text;
+    usz size;
+    source_file_t file;
+    arena_t arena;
+} program_t;
+
+// Generates a translation unit of small functions and constants, roughly
+// the shape of our generated sources.
+static void program_init(program_t *prog) {
+    prog->text = malloc(DECL_COUNT * 160 + 1);
+    prog->size = 0;
+    arena_init(&prog->arena);
+
+    for (usz i = 0; i < DECL_COUNT; i++) {
+        char *out = prog->text + prog->size;
+        if (i % 2 == 0)
+            prog->size += sprintf(out,
+                                  "f%zu :: (a: int, b: *int) -> int {\n"
+                                  "    x :: a * %zu + b;\n"
+                                  "    x = x - -a / 3;\n"
+                                  "    \"result\"\n"
+                                  "}\n",
+                                  i, i);
+        else
+            prog->size += sprintf(out, "c%zu :: %zu + 0x%zx * %zu.5\n", i, i,
+                                  i, i);
+    }
+    prog->text[prog->size] = '\0';
+    prog->file = bench_file(prog->text, prog->size);
+}
+
+static u64 bench_parse(program_t *prog, bool skim) {
+    arena_reset(&prog->arena);
+    lexer_t lexer;
+    l_init(&lexer, &prog->file);
+    parser_t parser;
+    p_init(&parser, &lexer, &prog->arena);
+    parser.skim = skim;
+
+    u64 count = 0;
+    while (parser.token.type != T_EOF) {
+        if (p_parse_decl(&parser) == NULL) break;
+        count++;
+    }
+    free(parser.errors.items);
+    return count;
+}
+
+static u64 bench_parse_full(void *ctx) { return bench_parse(ctx, false); }
+
+static u64 bench_parse_skim(void *ctx) { return bench_parse(ctx, true); }
+
+static u64 bench_parse_lex(void *ctx) {
+    program_t *prog = ctx;
+    lexer_t lexer;
+    l_init(&lexer, &prog->file);
+
+    u64 sum = 0;
+    token_t token = {0};
+    for (;;) {
+        l_next(&lexer, &token);
+        if (token.type == T_EOF) break;
+        if (token.type == T_STRING) {
+            free(token.string_value);
+            token.string_value = NULL;
+        }
+        sum += token.type;
+    }
+    return sum;
+}
+
+static u64 bench_parse_unit(void *ctx) {
+    program_t *prog = ctx;
+    unit_t unit;
+    unit_parse(&unit, &prog->file, (unit_options_t){0});
+    u64 count = unit.decls.count;
+    unit_free(&unit);
+    return count;
+}
+
+// A stray character is skipped, with a diagnostic, and the name after it
+// is the one declared: the string of the error token is freed by then
+static bool stray_check(void) {
+    static const struct {
+        const char *source, *decl, *param, *import;
+    } cases[] = {
+        {"main :: ($x: int) -> int { x };", "main", "x", NULL},
+        {"$main :: () -> int { 0 };", "main", NULL, NULL},
+        {"f :: (a: int, $b := 1) { b };", "f", "b", NULL},
+        {"import $m;\nmain :: 0;", "main", NULL, "m"},
+        {"main :: 0; )", "main", NULL, NULL},
+    };
+
+    bool ok = true;
+    for (usz i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        usz size = strlen(cases[i].source);
+        char *text = malloc(size + 1);
+        assert(text != NULL && "Buy more RAM lol");
+        memcpy(text, cases[i].source, size + 1);
+
+        compilation_t c;
+        // imports are not looked for in symbols mode
+        options_t opts = {.jobs = 1, .symbols = cases[i].import != NULL};
+        if (!compile(&c, text, size, "<stray>", &opts, NULL)) {
+            free(text);
+            return false;
+        }
+        decl_t *decl = c.unit.decls.count == 1 ? c.unit.decls.items[0] : NULL;
+        bool found = decl != NULL && strcmp(decl->id, cases[i].decl) == 0;
+        if (found && cases[i].param != NULL) {
+            params_t *params = &decl->value->fn.params;
+            found = strcmp(params->items[params->count - 1]->id,
+                           cases[i].param) == 0;
+        }
+        if (found && cases[i].import != NULL)
+            found = c.unit.imports.count == 1 &&
+                    strcmp(c.unit.imports.items[0].name, cases[i].import) == 0;
+        found &= c.unit.errors.count == 1 && c.analyzer.errors.count == 0;
+        if (!found) {
+            log_error("parser/stray: `%s` is not parsed as declared",
+                      cases[i].source);
+            ok = false;
+        }
+        compilation_free(&c);
+        free(text);
+    }
+    return ok;
+}
+
+/* -------------------- DUMP -------------------- */
+
+typedef struct {
+    unit_t unit;
+    int fd; // /dev/null
+    dump_format_t format;
+} dump_t;
+
+static u64 bench_dump(void *ctx) {
+    dump_t *d = ctx;
+    writer_t w;
+    w_init(&w, d->fd);
+    dump_decls(&w, &d->unit.decls, d->format, NULL);
+    w_flush(&w);
+    w_free(&w);
+    return d->unit.decls.count;
+}
+
+static u64 bench_format_float(void *ctx) {
+    numbers_t *n = ctx;
+    char buf[NUM_FLOAT_MAX];
+    u64 sum = 0;
+    for (usz i = 0; i < NUMBER_COUNT; i++)
+        sum += num_format_float(n->values[i], buf);
+    return sum;
+}
+
+static u64 bench_format_snprintf(void *ctx) {
+    numbers_t *n = ctx;
+    char buf[32];
+    u64 sum = 0;
+    for (usz i = 0; i < NUMBER_COUNT; i++)
+        sum += snprintf(buf, sizeof(buf), "%.17g", n->values[i]);
+    return sum;
+}
+
+/* -------------------- WALKS -------------------- */
+
+#define WALK_DECLS (1 << 17)
+
+// An AST well past the size of the caches, walked by a few passes as cheap
+// as the ones the driver runs, either one traversal each or fused into one
+typedef struct {
+    program_t program;
+    unit_t unit;
+    usz nodes, folded, names;
+    pass_t passes[3];
+} walks_t;
+
+static bool walk_name(void *ctx, expr_t *expr) {
+    if (expr->type == E_IDENT) *(usz *)ctx += intern_length(expr->ident);
+    return true;
+}
+
+static void walks_init(walks_t *w) {
+    program_t *prog = &w->program;
+    prog->text = malloc(WALK_DECLS * 160 + 1);
+    prog->size = 0;
+    for (usz i = 0; i < WALK_DECLS; i++)
+        prog->size += sprintf(prog->text + prog->size,
+                              "f%zu :: (a: int) -> int {\n"
+                              "    x := a * %zu + -2;\n"
+                              "    x = x - a * 3 + f%zu;\n"
+                              "}\n",
+                              i, i, i / 2);
+    prog->file = bench_file(prog->text, prog->size);
+    unit_parse(&w->unit, &prog->file, (unit_options_t){.jobs = 1});
+    w->passes[0] = walk_counter(&w->nodes);
+    w->passes[1] = fold_pass(&w->folded);
+    w->passes[2] = (pass_t){.pre_expr = walk_name, .ctx = &w->names};
+}
+
+static u64 bench_walk_separate(void *ctx) {
+    walks_t *w = ctx;
+    for (usz i = 0; i < 3; i++) {
+        walker_t walker = {.passes = &w->passes[i], .count = 1};
+        walk_decls(&walker, &w->unit.decls);
+    }
+    return w->nodes + w->names;
+}
+
+static u64 bench_walk_fused(void *ctx) {
+    walks_t *w = ctx;
+    walker_t walker = {.passes = w->passes, .count = 3};
+    walk_decls(&walker, &w->unit.decls);
+    return w->nodes + w->names;
+}
+
+/* -------------------- EVALUATION -------------------- */
+
+#define EVAL_ROWS (1 << 20)
+
+// A formula over columns `a`, `b` and `c`, as coffee code
+typedef struct {
+    char *text;
+    arena_t arena;
+    expr_t *expr;
+    ev_column_t columns[3];
+    ev_program_t program;
+    void *out;
+} formula_t;
+
+// The float formula is the benchmark. The integer one is only checked, with
+// divisors of 0 and -1 and overflows among the values.
+static bool formula_init(formula_t *f, const char *source, bool ints) {
+    *f = (formula_t){.text = malloc(strlen(source) + 1)};
+    strcpy(f->text, source);
+    arena_init(&f->arena);
+    source_file_t file = bench_file(f->text, strlen(source));
+    errors_t errors = {0};
+    decl_t *decl = unit_parse_decl(&file, 0, file.length, &f->arena, false,
+                                   NULL, &errors);
+    f->expr = decl != NULL ? decl->value : NULL;
+
+    static const char *names[] = {"a", "b", "c"};
+    for (usz i = 0; i < 3; i++) {
+        f->columns[i].name = intern_cstr(names[i]);
+        f->columns[i].type = ints ? TID_INT : TID_FLOAT;
+        if (ints) {
+            i64 *values = malloc(EVAL_ROWS * sizeof(i64));
+            for (usz row = 0; row < EVAL_ROWS; row++) {
+                u64 r = rng_next();
+                values[row] = r % 4 == 0 ? (i64)(r >> 60) - 8 : (i64)r;
+            }
+            f->columns[i].ints = values;
+        } else {
+            double *values = malloc(EVAL_ROWS * sizeof(double));
+            for (usz row = 0; row < EVAL_ROWS; row++)
+                values[row] = (double)(rng_next() >> 11) / (1ull << 40) - 2048;
+            f->columns[i].floats = values;
+        }
+    }
+    f->out = malloc(EVAL_ROWS * 8);
+
+    bool ok = errors.count == 0 && f->expr != NULL &&
+              ev_compile(&f->program, f->expr, f->columns, 3, &errors);
+    for (usz i = 0; i < errors.count; i++) {
+        log_error("%s: %s", source, errors.items[i].msg);
+        free(errors.items[i].msg);
+    }
+    free(errors.items);
+    return ok;
+}
+
+static void formula_free(formula_t *f) {
+    ev_free(&f->program);
+    for (usz i = 0; i < 3; i++)
+        free((void *)f->columns[i].ints);
+    free(f->out);
+    arena_free(&f->arena);
+    free(f->text);
+}
+
+// A tree walk per row, looking identifiers up by name, the way an
+// interpreter would
+static double naive_float(formula_t *f, expr_t *expr, usz row) {
+    switch (expr->type) {
+    case E_FLOAT:
+        return expr->float_;
+    case E_IDENT:
+        for (usz i = 0;; i++)
+            if (f->columns[i].name == expr->ident)
+                return f->columns[i].floats[row];
+    case E_UNARY:
+        return -naive_float(f, expr->unary.operand, row);
+    default: {
+        double a = naive_float(f, expr->binop.lhs, row);
+        double b = naive_float(f, expr->binop.rhs, row);
+        switch (expr->binop.op) {
+        case T_PLUS:
+            return a + b;
+        case T_MINUS:
+            return a - b;
+        case T_ASTERISK:
+            return a * b;
+        case T_SLASH:
+            return a / b;
+        default:
+            return fmod(a, b);
+        }
+    }
+    }
+}
+
+static i64 naive_int(formula_t *f, expr_t *expr, usz row) {
+    switch (expr->type) {
+    case E_INT:
+        return expr->int_;
+    case E_IDENT:
+        for (usz i = 0;; i++)
+            if (f->columns[i].name == expr->ident)
+                return f->columns[i].ints[row];
+    case E_UNARY:
+        return (i64)(0 - (u64)naive_int(f, expr->unary.operand, row));
+    default: {
+        u64 a = naive_int(f, expr->binop.lhs, row);
+        u64 b = naive_int(f, expr->binop.rhs, row);
+        switch (expr->binop.op) {
+        case T_PLUS:
+            return (i64)(a + b);
+        case T_MINUS:
+            return (i64)(a - b);
+        case T_ASTERISK:
+            return (i64)(a * b);
+        case T_SLASH:
+            return b == 0 ? 0 : (i64)b == -1 ? (i64)(0 - a) : (i64)a / (i64)b;
+        default:
+            return b == 0 || (i64)b == -1 ? 0 : (i64)a % (i64)b;
+        }
+    }
+    }
+}
+
+// Runs the formula on a few row counts, whole batches or not, and compares
+// every value with the tree walk's
+static bool eval_check(formula_t *f, const char *source) {
+    static const usz counts[] = {EVAL_ROWS, EVAL_ROWS - 3, EV_BATCH + 2, 5, 1};
+    bool ints = f->program.type == TID_INT;
+    for (usz i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        memset(f->out, 0, EVAL_ROWS * 8);
+        ev_run(&f->program, counts[i], f->out);
+        for (usz row = 0; row < EVAL_ROWS; row++) {
+            u64 expected = 0;
+            if (row < counts[i] && ints) {
+                i64 value = naive_int(f, f->expr, row);
+                memcpy(&expected, &value, 8);
+            } else if (row < counts[i]) {
+                double value = naive_float(f, f->expr, row);
+                memcpy(&expected, &value, 8);
+            }
+            if (memcmp((u64 *)f->out + row, &expected, 8) != 0) {
+                log_error("%s: row %zu of %zu differs", source, row,
+                          counts[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static u64 bench_eval_columns(void *ctx) {
+    formula_t *f = ctx;
+    ev_run(&f->program, EVAL_ROWS, f->out);
+    return ((u64 *)f->out)[EVAL_ROWS - 1];
+}
+
+static u64 bench_eval_rows(void *ctx) {
+    formula_t *f = ctx;
+    double *out = f->out;
+    for (usz row = 0; row < EVAL_ROWS; row++)
+        out[row] = naive_float(f, f->expr, row);
+    return ((u64 *)f->out)[EVAL_ROWS - 1];
+}
+
+/* -------------------- UTF-8 -------------------- */
+
+#define TEXT_SIZE (1 << 20)
+
+// Mostly ASCII source with a localized string literal every few lines
+typedef struct {
+    char *text;
+    usz size;
+} text_t;
+
+static void text_init(text_t *t) {
+    static const char *strings[] = {"Grüße", "日本語", "Ελληνικά", "😀"};
+    t->text = malloc(TEXT_SIZE + 256);
+    t->size = 0;
+    while (t->size < TEXT_SIZE) {
+        u64 r = rng_next();
+        t->size += sprintf(t->text + t->size,
+                           "value%u :: (a: int) -> int { a + %u; };\n",
+                           (unsigned)(r % 10000), (unsigned)(r >> 40));
+        if (r % 4 == 0)
+            t->size += sprintf(t->text + t->size, "label :: \"%s\";\n",
+                               strings[(r >> 8) % 4]);
+    }
+}
+
+static u64 bench_utf8_simd(void *ctx) {
+    text_t *t = ctx;
+    usz error;
+    return utf8_validate(t->text, t->size, &error);
+}
+
+static u64 bench_utf8_scalar(void *ctx) {
+    text_t *t = ctx;
+    usz error;
+    return utf8_validate_scalar(t->text, t->size, &error);
+}
+
+/* -------------------- LARGE FILES -------------------- */
+
+#define LARGE_SIZE (8 << 20)
+
+// One function body of many megabytes, the case `l_lex` is for: string
+// literals spanning lines, so that cuts fall into them, and unless `valid`,
+// literals the lexer reports, so that diagnostics have to stay in order. The
+// parser gives up on the body at the first of those.
+static void large_init(text_t *t, bool unterminated, bool valid) {
+    t->text = malloc(LARGE_SIZE + 256);
+    t->size = sprintf(t->text, "main :: () -> int {\n");
+    while (t->size < LARGE_SIZE) {
+        u64 r = rng_next();
+        char *out = t->text + t->size;
+        switch (r % 16) {
+        case 0:
+            t->size += sprintf(out, "    s := \"line\n\n  %u\n\";\n",
+                               (unsigned)(r >> 32));
+            break;
+        case 1:
+            if (valid) continue;
+            t->size += sprintf(out, "    0x + 99999999999999999999 @;\n");
+            break;
+        default:
+            t->size += sprintf(out, "    x%u := x%u * %u.25 + \"%u\";\n",
+                               (unsigned)(r >> 40), (unsigned)(r >> 20 & 0xff),
+                               (unsigned)(r >> 8 & 0xfff), (unsigned)r % 7);
+            break;
+        }
+    }
+    t->size += sprintf(t->text + t->size, unterminated ? "    \"0\n}\n" : "}\n");
+}
+
+static bool token_equal(const token_t *a, const token_t *b) {
+    if (a->type != b->type || a->span.start != b->span.start ||
+        a->span.length != b->span.length)
+        return false;
+    switch (a->type) {
+    case T_IDENT:
+        return a->string_value == b->string_value;
+    case T_STRING:
+    case T_ERROR:
+        return strcmp(a->string_value, b->string_value) == 0;
+    case T_INT:
+        return a->int_value == b->int_value;
+    case T_FLOAT:
+        return memcmp(&a->float_value, &b->float_value, sizeof(double)) == 0;
+    default:
+        return true;
+    }
+}
+
+// Lexes `t` with `l_next` and either with `l_lex` on `jobs` threads, handing
+// out the latter's tokens through a lexer too, or, for 0 jobs, on a pipelined
+// lexer, and checks that the tokens and the diagnostics reported after each
+// of them are the same.
+static bool lex_check(text_t *t, usz jobs) {
+    source_file_t file = bench_file(t->text, t->size);
+    lexer_t serial, parallel;
+    l_init(&serial, &file);
+    if (jobs == 0) {
+        l_init_pipelined(&parallel, &file, 0, t->size);
+    } else {
+        tokens_t tokens = {0};
+        errors_t errors = {0};
+        l_lex(&file, 0, t->size, jobs, &tokens, &errors);
+        l_init_lexed(&parallel, &file, 0, t->size, &tokens, &errors);
+    }
+
+    bool ok = true;
+    for (usz i = 0, checked = 0; ok; i++) {
+        token_t a, b;
+        l_next(&serial, &a);
+        l_next(&parallel, &b);
+        ok = token_equal(&a, &b) && serial.errors.count == parallel.errors.count;
+        for (usz j = checked; ok && j < serial.errors.count; j++)
+            ok = serial.errors.items[j].span.start ==
+                     parallel.errors.items[j].span.start &&
+                 strcmp(serial.errors.items[j].msg,
+                        parallel.errors.items[j].msg) == 0;
+        checked = serial.errors.count;
+        if (!ok && jobs == 0)
+            log_error("pipelined lexer: token %zu differs at %u", i,
+                      a.span.start);
+        else if (!ok)
+            log_error("l_lex on %zu threads: token %zu differs at %u", jobs, i,
+                      a.span.start);
+        if (a.type == T_STRING || a.type == T_ERROR) {
+            free(a.string_value);
+            free(b.string_value);
+        }
+        if (a.type == T_EOF) break;
+    }
+    l_stop(&parallel);
+    for (usz i = 0; i < serial.errors.count; i++) {
+        free(serial.errors.items[i].msg);
+        free(parallel.errors.items[i].msg);
+    }
+    free(serial.errors.items);
+    free(parallel.errors.items);
+    return ok;
+}
+
+static u64 bench_lex_file(text_t *t, usz jobs) {
+    source_file_t file = bench_file(t->text, t->size);
+    tokens_t tokens = {0};
+    errors_t errors = {0};
+    l_lex(&file, 0, t->size, jobs, &tokens, &errors);
+    u64 count = tokens.count;
+    for (usz i = 0; i < tokens.count; i++)
+        if (tokens.items[i].type == T_STRING || tokens.items[i].type == T_ERROR)
+            free(tokens.items[i].string_value);
+    for (usz i = 0; i < errors.count; i++)
+        free(errors.items[i].msg);
+    free(tokens.items);
+    free(errors.items);
+    return count;
+}
+
+static u64 bench_lex_serial(void *ctx) { return bench_lex_file(ctx, 1); }
+
+static u64 bench_lex_parallel(void *ctx) { return bench_lex_file(ctx, 0); }
+
+// Parses `t` on one thread, lexing as it goes or on a thread of its own
+static void parse_file(text_t *t, bool pipeline, source_file_t *file,
+                       unit_t *unit) {
+    *file = bench_file(t->text, t->size);
+    unit_parse(unit, file,
+               (unit_options_t){.jobs = 1, .pipeline = pipeline});
+}
+
+// The pipelined parser has to build the same AST and report the same
+// diagnostics, in the same order
+static bool parse_check(text_t *t) {
+    source_file_t files[2];
+    unit_t sync, pipelined;
+    parse_file(t, false, &files[0], &sync);
+    parse_file(t, true, &files[1], &pipelined);
+
+    usz sync_nodes = 0, pipelined_nodes = 0;
+    pass_t counter = walk_counter(&sync_nodes);
+    walker_t walker = {.passes = &counter, .count = 1};
+    walk_decls(&walker, &sync.decls);
+    counter = walk_counter(&pipelined_nodes);
+    walk_decls(&walker, &pipelined.decls);
+
+    bool ok = sync_nodes == pipelined_nodes &&
+              sync.decls.count == pipelined.decls.count &&
+              sync.errors.count == pipelined.errors.count;
+    for (usz i = 0; ok && i < sync.errors.count; i++)
+        ok = sync.errors.items[i].span.start ==
+                 pipelined.errors.items[i].span.start &&
+             strcmp(sync.errors.items[i].msg, pipelined.errors.items[i].msg) ==
+                 0;
+    if (!ok)
+        log_error("pipelined parser: %zu nodes and %zu diagnostics, "
+                  "expected %zu and %zu",
+                  pipelined_nodes, pipelined.errors.count, sync_nodes,
+                  sync.errors.count);
+    unit_free(&sync);
+    unit_free(&pipelined);
+    return ok;
+}
+
+static u64 bench_parse_file(text_t *t, bool pipeline) {
+    source_file_t file;
+    unit_t unit;
+    parse_file(t, pipeline, &file, &unit);
+    u64 count = unit.errors.count;
+    unit_free(&unit);
+    return count;
+}
+
+static u64 bench_parse_sync(void *ctx) { return bench_parse_file(ctx, false); }
+
+static u64 bench_parse_pipelined(void *ctx) {
+    return bench_parse_file(ctx, true);
+}
+
+/* -------------------- SCALING -------------------- */
+
+// Inputs of each shape are SCALE_START bytes, doubling SCALE_STEPS - 1 times
+#define SCALE_START (32 * 1024)
+#define SCALE_STEPS 7
+#define SCALE_RUNS 3 // of each size, of which the fastest counts
+
+// How much faster than n log n time and memory may grow, as a difference of
+// exponents, before it is a regression; a quadratic path is about 1 over
+#define SCALE_SLACK 0.35
+
+// Writes an input of the shape of `size` bytes, give or take a line
+typedef void (*scale_init_t)(text_t *, usz size);
+
+// Diagnostics on every line, half of them syntax errors
+static void scale_errors(text_t *t, usz size) {
+    for (usz i = 0; t->size < size; i++) {
+        char *out = t->text + t->size;
+        if (i % 2 == 0)
+            t->size += sprintf(out, "e%zu :: %zu + 0.5;\n", i, i);
+        else
+            t->size += sprintf(out, "s%zu :: @ %zu;\n", i, i);
+    }
+}
+
+// One expression of ever more terms, each the left operand of the next
+static void scale_chain(text_t *t, usz size) {
+    t->size += sprintf(t->text, "main :: 1");
+    for (usz i = 0; t->size < size; i++)
+        t->size += sprintf(t->text + t->size, " + %zu * 2 - 3", i);
+    t->size += sprintf(t->text + t->size, ";\n");
+}
+
+// Functions in functions
+static void scale_nesting(text_t *t, usz size) {
+    static const char open[] = "f := () -> int {\n", close[] = "};\n";
+    usz depth = size / (sizeof(open) - 1 + sizeof(close) - 1);
+    t->size += sprintf(t->text, "main :: () -> int {\n");
+    for (usz i = 0; i < depth; i++)
+        t->size += sprintf(t->text + t->size, "%s", open);
+    t->size += sprintf(t->text + t->size, "x := 1;\n");
+    for (usz i = 0; i < depth; i++)
+        t->size += sprintf(t->text + t->size, "%s", close);
+    t->size += sprintf(t->text + t->size, "}\n");
+}
+
+// One body of ever more statements
+static void scale_statements(text_t *t, usz size) {
+    t->size += sprintf(t->text, "main :: () -> int {\n    x := 0;\n");
+    for (usz i = 0; t->size < size; i++)
+        t->size += sprintf(t->text + t->size, "    x = x + %zu;\n", i);
+    t->size += sprintf(t->text + t->size, "}\n");
+}
+
+// One run of prefix operators, nested past P_MAX_DEPTH in the larger inputs
+static void scale_prefix(text_t *t, usz size) {
+    t->size += sprintf(t->text, "main :: ");
+    while (t->size < size) {
+        t->text[t->size++] = '-';
+        t->text[t->size++] = ' ';
+    }
+    t->size += sprintf(t->text + t->size, "1;\n");
+}
+
+static void scale_literal(text_t *t, const char *head, char fill, usz size,
+                          const char *tail) {
+    t->size += sprintf(t->text + t->size, "%s", head);
+    memset(t->text + t->size, fill, size);
+    t->size += size;
+    t->size += sprintf(t->text + t->size, "%s", tail);
+}
+
+// A string, an integer, a float and a name, each a quarter of the input
+static void scale_literals(text_t *t, usz size) {
+    scale_literal(t, "s :: \"", 'a', size / 4, "\";\n");
+    scale_literal(t, "i :: 1", '7', size / 4, ";\n");
+    scale_literal(t, "f :: 0.", '3', size / 4, "1;\n");
+    scale_literal(t, "n :: x", 'y', size / 4, ";\n");
+}
+
+static const struct {
+    const char *name;
+    scale_init_t init;
+} scale_shapes[] = {
+    {"scaling/errors", scale_errors},
+    {"scaling/chain", scale_chain},
+    {"scaling/nesting", scale_nesting},
+    {"scaling/statements", scale_statements},
+    {"scaling/literals", scale_literals},
+    {"scaling/prefix", scale_prefix},
+};
+
+// Heap in use, in KB
+static double heap_kb(void) {
+    struct mallinfo2 info = mallinfo2();
+    return (double)(info.uordblks + info.hblkhd) / 1024;
+}
+
+// Compiles and reports an input of the shape in a child process, so that a
+// crash is just a failed measurement. Memory is how much the heap grew,
+// with the whole compilation still allocated.
+static bool scale_measure(scale_init_t init, usz size, double *seconds,
+                          double *kb) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        double result[2] = {0, -heap_kb()};
+        text_t t = {.text = malloc(size + 256)};
+        init(&t, size);
+        t.text[t.size] = '\0';
+
+        int null = open("/dev/null", O_WRONLY);
+        // JSON, as text is indented as deep as it nests
+        options_t opts = {.jobs = 1, .format = DUMP_JSON};
+        compilation_t c;
+        double start = now();
+        if (compile(&c, t.text, t.size, "<scaling>", &opts, NULL))
+            report(&c, &opts, null, null);
+        result[0] = now() - start;
+        result[1] += heap_kb();
+        _exit(write(fds[1], result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    double result[2];
+    bool ok = read(fds[0], result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    int status;
+    ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+          WEXITSTATUS(status) == 0;
+    *seconds = result[0];
+    *kb = result[1];
+    return ok;
+}
+
+// Least-squares slope of log y over log x: the exponent of the growth
+static double scale_exponent(const double *x, const double *y, usz count) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (usz i = 0; i < count; i++) {
+        double lx = log(x[i]), ly = log(y[i] > 1e-9 ? y[i] : 1e-9);
+        sx += lx;
+        sy += ly;
+        sxx += lx * lx;
+        sxy += lx * ly;
+    }
+    return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+// Fits how time and memory grow with the size of each shape's input, and
+// fails if either grows faster than n log n by more than SCALE_SLACK
+static bool scale_check(const char *name, scale_init_t init) {
+    double sizes[SCALE_STEPS], seconds[SCALE_STEPS], kbs[SCALE_STEPS];
+    double n_log_n[SCALE_STEPS];
+    for (usz i = 0; i < SCALE_STEPS; i++) {
+        sizes[i] = (double)(SCALE_START << i);
+        n_log_n[i] = sizes[i] * log(sizes[i]);
+        seconds[i] = kbs[i] = INFINITY;
+        for (usz run = 0; run < SCALE_RUNS; run++) {
+            double s, kb;
+            if (!scale_measure(init, SCALE_START << i, &s, &kb)) {
+                log_error("%s: failed on %zu bytes", name, SCALE_START << i);
+                return false;
+            }
+            seconds[i] = fmin(seconds[i], s);
+            kbs[i] = fmin(kbs[i], kb);
+        }
+    }
+
+    double limit = scale_exponent(sizes, n_log_n, SCALE_STEPS) + SCALE_SLACK;
+    double time = scale_exponent(sizes, seconds, SCALE_STEPS);
+    double memory = scale_exponent(sizes, kbs, SCALE_STEPS);
+    printf("%-32s time n^%.2f, memory n^%.2f, at most n^%.2f (%.1f ms, "
+           "%.0f KB at %zu KB)\n",
+           name, time, memory, limit, seconds[SCALE_STEPS - 1] * 1e3,
+           kbs[SCALE_STEPS - 1], (usz)(SCALE_START << (SCALE_STEPS - 1)) / 1024);
+    if (time <= limit && memory <= limit) return true;
+    log_error("%s: grows faster than n log n", name);
+    return false;
+}
+
+/* -------------------- EVENTS -------------------- */
+
+// Most a `sax_parse` of LARGE_SIZE bytes may have on the heap at a time
+#define SAX_HEAP_LIMIT_KB 64.0
+
+// A node as `sax_parse` leaves it, or as a walk of the tree does
+typedef struct {
+    u8 node, type;
+    span_t span;
+} sax_node_t;
+
+typedef struct {
+    array_t(sax_node_t) nodes;
+    usz committed; // nodes up to the last top-level declaration left
+    errors_t errors;
+} sax_record_t;
+
+// Declarations given up on are not in the tree, so their nodes are dropped
+static void sax_record_enter(void *ctx, const sax_event_t *event) {
+    sax_record_t *r = ctx;
+    if (event->depth == 0) r->nodes.count = r->committed;
+}
+
+// Types are not nodes the walks see, and imports are not in declarations
+static void sax_record_leave(void *ctx, const sax_event_t *event) {
+    sax_record_t *r = ctx;
+    if (event->node != SAX_TYPE && event->node != SAX_IMPORT)
+        da_append(&r->nodes,
+                  ((sax_node_t){event->node, event->type, event->span}));
+    if (event->depth == 0) r->committed = r->nodes.count;
+}
+
+static void sax_record_error(void *ctx, const error_t *error) {
+    sax_record_t *r = ctx;
+    usz size = strlen(error->msg) + 1;
+    error_t copy = {.span = error->span, .msg = malloc(size)};
+    memcpy(copy.msg, error->msg, size);
+    da_append(&r->errors, copy);
+}
+
+static void sax_tree_decl(void *ctx, decl_t *decl) {
+    da_append(&((sax_record_t *)ctx)->nodes,
+              ((sax_node_t){SAX_DECL, 0, decl->span}));
+}
+
+static void sax_tree_param(void *ctx, param_t *param) {
+    da_append(&((sax_record_t *)ctx)->nodes,
+              ((sax_node_t){SAX_PARAM, 0, param->span}));
+}
+
+static void sax_tree_expr(void *ctx, expr_t *expr) {
+    da_append(&((sax_record_t *)ctx)->nodes,
+              ((sax_node_t){SAX_EXPR, expr->type, expr->span}));
+}
+
+// `sax_parse` has to report what `unit_parse` does and, where that builds
+// a tree, leave its nodes in the order a walk of it does
+static bool sax_check(const char *name, char *text, usz size) {
+    source_file_t file = bench_file(text, size);
+    unit_t unit;
+    unit_parse(&unit, &file, (unit_options_t){.jobs = 1});
+    sax_record_t tree = {0}, events = {0};
+    pass_t pass = {.post_decl = sax_tree_decl,
+                   .post_param = sax_tree_param,
+                   .post_expr = sax_tree_expr,
+                   .ctx = &tree};
+    walk_decls(&(walker_t){.passes = &pass, .count = 1}, &unit.decls);
+    sax_parse(&file, &(sax_handler_t){.enter = sax_record_enter,
+                                      .leave = sax_record_leave,
+                                      .error = sax_record_error,
+                                      .ctx = &events});
+    events.nodes.count = events.committed;
+
+    bool ok = unit.errors.count == events.errors.count;
+    for (usz i = 0; ok && i < unit.errors.count; i++)
+        ok = unit.errors.items[i].span.start ==
+                 events.errors.items[i].span.start &&
+             strcmp(unit.errors.items[i].msg, events.errors.items[i].msg) == 0;
+    if (!ok)
+        log_error("%s: %zu diagnostics from events, expected %zu", name,
+                  events.errors.count, unit.errors.count);
+
+    // a declaration followed by something else is left, but not kept
+    if (ok && unit.errors.count == 0) {
+        usz i = 0;
+        for (; i < tree.nodes.count && i < events.nodes.count; i++) {
+            sax_node_t *a = &tree.nodes.items[i], *b = &events.nodes.items[i];
+            if (a->node != b->node || a->type != b->type ||
+                a->span.start != b->span.start ||
+                a->span.length != b->span.length)
+                break;
+        }
+        ok = i == tree.nodes.count && i == events.nodes.count;
+        if (!ok)
+            log_error("%s: node %zu of %zu differs in events", name, i,
+                      tree.nodes.count);
+    }
+
+    for (usz i = 0; i < events.errors.count; i++)
+        free(events.errors.items[i].msg);
+    free(events.errors.items);
+    free(events.nodes.items);
+    free(tree.nodes.items);
+    unit_free(&unit);
+    return ok;
+}
+
+static const char *const sax_sources[] = {
+    "import a;\nimport b;\nmain :: () -> int {\n    x := -1 + 2 * 3 % 4;\n"
+    "    y :: (p: *int, q := 2, r: int = !x) -> **int { p; };\n"
+    "    s := \"a string\";\n    x = x += 1.5 ?? y == 2 < 3;\n};\n"
+    "other := main;\n",
+    // every diagnostic of parser.c, a declaration each
+    "a :: 1 +;\nb :: () -> int { x := @ 2; };\nc :: 0x + 99999999999999999999;"
+    "\nd :: (p) -> int {};\ne :: (p: ) {};\nf :: () -> { };\n"
+    "g :: () -> int { 1 2 };\nh :: () -> int { x :: ; };\ni :: (a := 1 {};\n"
+    "j :: () -> int { 1;\nk :: 1 l\nimport m;\n",
+    "@ $ stray :: 1 @;",
+    "import ;",
+    "import a",
+    "unterminated :: () -> int { \"",
+    "",
+    "\xff :: 1;",
+};
+
+// Prefix operators in a run, more than recursion once per operator has the
+// stack for
+#define SAX_PREFIXES 1500000
+
+static void sax_prefix_init(text_t *t) {
+    t->text = malloc(2 * SAX_PREFIXES + 32);
+    assert(t->text != NULL && "Buy more RAM lol");
+    t->size = sprintf(t->text, "main :: ");
+    for (usz i = 0; i < SAX_PREFIXES; i++) {
+        t->text[t->size++] = i % 2 ? '!' : '-';
+        t->text[t->size++] = ' ';
+    }
+    t->size += sprintf(t->text + t->size, "1;\n");
+}
+
+typedef struct {
+    usz events;
+    double base, peak; // heap in use, in KB
+} sax_heap_t;
+
+// The heap is looked at every so many events, which is enough to see
+// anything that grows with the file
+static void sax_heap_event(void *ctx, const sax_event_t *event) {
+    sax_heap_t *h = ctx;
+    (void)event;
+    if (h->events++ % 4096 == 0) h->peak = fmax(h->peak, heap_kb() - h->base);
+}
+
+static bool sax_heap_check(text_t *t) {
+    source_file_t file = bench_file(t->text, t->size);
+    sax_heap_t h = {.base = heap_kb()};
+    sax_parse(&file, &(sax_handler_t){.enter = sax_heap_event, .ctx = &h});
+    if (h.peak <= SAX_HEAP_LIMIT_KB) return true;
+    log_error("sax_parse: %.0f KB on the heap for %zu KB of source", h.peak,
+              t->size / 1024);
+    return false;
+}
+
+static u64 bench_sax_check(void *ctx) {
+    text_t *t = ctx;
+    source_file_t file = bench_file(t->text, t->size);
+    return sax_parse(&file, &(sax_handler_t){0});
+}
+
+// What checking costs at least: lexing without keeping anything
+static u64 bench_sax_lex(void *ctx) {
+    text_t *t = ctx;
+    source_file_t file = bench_file(t->text, t->size);
+    lexer_t lexer;
+    l_init(&lexer, &file);
+    lexer.raw = true;
+    u64 count = 0;
+    for (token_t token = {0}; token.type != T_EOF; count++)
+        l_next(&lexer, &token);
+    for (usz i = 0; i < lexer.errors.count; i++)
+        free(lexer.errors.items[i].msg);
+    free(lexer.errors.items);
+    return count;
+}
+
+/* -------------------- DAG -------------------- */
+
+#define DAG_SIZE (1 << 20)
+
+// Most of the tree's nodes the DAG of generated code may take, side table
+// of spans included
+#define DAG_MEMORY_RATIO 0.6
+
+// Generated code: functions of the same few statements over and over, one
+// of them a type error at every occurrence
+static void dag_init_text(text_t *t) {
+    static const char *const lines[] = {
+        "    x%zu := a * 4 + b * 4 - 1;\n",
+        "    y%zu := c * 2.5 + 1.5 * 4.0 - c / 2.0;\n",
+        "    z%zu := -a * 4 + b * 4 - 1 + 2 * 3;\n",
+        "    a = a * 4 + b %% %zu;\n",
+        "    w%zu := a + c;\n",
+    };
+    t->text = malloc(DAG_SIZE + 4096);
+    assert(t->text != NULL && "Buy more RAM lol");
+    t->size = 0;
+    for (usz i = 0; t->size < DAG_SIZE; i++) {
+        t->size += sprintf(t->text + t->size,
+                           "f%zu :: (a: int, b: int, c: float) -> int {\n", i);
+        for (usz j = 0; j < 16; j++) {
+            u64 r = rng_next() % 16;
+            usz line = r < 14 ? r % 4 : 4;
+            t->size += sprintf(t->text + t->size, lines[line], j);
+        }
+        t->size += sprintf(t->text + t->size, "    a * 4 + b * 4 - 1\n};\n");
+    }
+    t->text[t->size] = '\0';
+}
+
+// Everything `report` writes, the dump and the diagnostics in one
+static char *dag_output(char *text, usz size, const options_t *opts,
+                        usz *length) {
+    FILE *out = tmpfile();
+    if (out == NULL) return NULL;
+    compilation_t c;
+    if (compile(&c, text, size, "<dag>", opts, NULL)) {
+        report(&c, opts, fileno(out), fileno(out));
+        compilation_free(&c);
+    }
+
+    *length = lseek(fileno(out), 0, SEEK_END);
+    char *output = malloc(*length + 1);
+    assert(output != NULL && "Buy more RAM lol");
+    bool ok = pread(fileno(out), output, *length, 0) == (ssize_t)*length;
+    fclose(out);
+    if (ok) return output;
+    free(output);
+    return NULL;
+}
+
+// A compilation in DAG mode has to output what one of the tree does: every
+// occurrence of a shared node dumped and diagnosed at its own span
+static bool dag_check(const char *name, char *text, usz size) {
+    for (int json = 0; json < 2; json++)
+        for (int fold = 0; fold < 2; fold++) {
+            options_t opts = {.format = json ? DUMP_JSON : DUMP_TEXT,
+                              .fold = fold};
+            usz tree_size = 0, dag_size = 0;
+            char *tree = dag_output(text, size, &opts, &tree_size);
+            opts.dag = true;
+            char *dag = dag_output(text, size, &opts, &dag_size);
+
+            usz i = 0;
+            if (tree != NULL && dag != NULL)
+                while (i < tree_size && i < dag_size && tree[i] == dag[i])
+                    i++;
+            bool ok = tree != NULL && dag != NULL && i == tree_size &&
+                      i == dag_size;
+            free(tree);
+            free(dag);
+            if (!ok) {
+                log_error("%s: %s%s output differs in DAG mode at byte %zu",
+                          name, json ? "JSON" : "text", fold ? ", folded" : "",
+                          i);
+                return false;
+            }
+        }
+    return true;
+}
+
+static const char *const dag_sources[] = {
+    "k :: 1 + 2 * 3;\nmain :: () -> int {\n    a := 1;\n    b := 2.0;\n"
+    "    x := a + 1 * 3;\n    y := a + 1 * 3;\n    z := a + b;\n"
+    "    w := a + b;\n    a = a + b;\n    a = 4;\n    a = a + 1;\n"
+    "    q := nope + 1;\n    r := nope + 1;\n    a := 2.5;\n"
+    "    s := a + 1;\n    t := -1 + -1;\n    u := -1 + -1;\n"
+    "    f := (p: int = 1.5, o: int = 1.5) -> int { p + 1 * 3; a + 1 };\n"
+    "    a + 1\n};\ng :: () { 1 + 2.0; 1 + 2.0; 1    +   2.0 };\n",
+    // names shadowed and redeclared between their uses
+    "x :: 1;\nmain :: () -> int {\n    y := x + 1;\n    x := 2.5;\n"
+    "    z := x + 1;\n    g :: () -> int { x + 1; y + 1 };\n    x + 1\n};\n"
+    "h :: (p := q + 1, r := q + 1) { q + 1; p + 1; p + 1 };\n",
+    "z :: () { 0.0 + 1; -0.0 + 1; 0.0 + 1; x :: 1; x = 2; x = 2; x + 1 };",
+    // syntax errors part way through a shared expression
+    "a :: () { 1 + 2; 1 + 2 +; 1 + 2 };\nb :: () { 1 + 2; 1 + 2 };",
+};
+
+typedef struct {
+    source_file_t file;
+    bool dag;
+} dag_parse_t;
+
+// Bytes of nodes in the arenas of a unit and of its spans in the side table
+static usz dag_bytes(unit_t *unit) {
+    usz bytes = unit->repeats.capacity * sizeof(dag_repeat_t);
+    for (usz i = 0; i < unit->arenas.count; i++)
+        for (arena_block_t *b = unit->arenas.items[i]->first; b != NULL;
+             b = b->next)
+            bytes += b->used;
+    return bytes;
+}
+
+static bool dag_memory_check(text_t *t) {
+    source_file_t file = bench_file(t->text, t->size);
+    usz bytes[2];
+    for (int dag = 0; dag < 2; dag++) {
+        unit_t unit;
+        unit_parse(&unit, &file, (unit_options_t){.dag = dag});
+        bytes[dag] = dag_bytes(&unit);
+        unit_free(&unit);
+    }
+    double ratio = (double)bytes[1] / (double)bytes[0];
+    printf("%-32s %zu KB as a tree, %zu KB as a DAG (%.0f%%)\n",
+           "dag/memory", bytes[0] / 1024, bytes[1] / 1024, ratio * 100);
+    if (ratio <= DAG_MEMORY_RATIO) return true;
+    log_error("dag/memory: the DAG takes %.0f%% of the tree, at most %.0f%%",
+              ratio * 100, DAG_MEMORY_RATIO * 100);
+    return false;
+}
+
+static u64 bench_dag_parse(void *ctx) {
+    dag_parse_t *p = ctx;
+    unit_t unit;
+    unit_parse(&unit, &p->file, (unit_options_t){.jobs = 1, .dag = p->dag});
+    u64 count = unit.decls.count;
+    unit_free(&unit);
+    return count;
+}
+
+/* -------------------- LOGGING -------------------- */
+
+#define LOG_COUNT 1024
+
+// Trace messages to /dev/null. In async mode this is the caller's cost only
+// when the background thread has a core of its own; otherwise its formatting
+// is included once the ring fills up.
+static u64 bench_log(void *ctx) {
+    (void)ctx;
+    for (usz i = 0; i < LOG_COUNT; i++)
+        log_trace("parsed declarations %zu..%zu of %s", i, i + 16, "<bench>");
+    return LOG_COUNT;
+}
+
+/* -------------------- DRIVER -------------------- */
+
+static bool bench_enabled(const char *name, int argc, char **argv) {
+    if (argc < 2) return true;
+    for (int i = 1; i < argc; i++)
+        if (strstr(name, argv[i]) != NULL) return true;
+    return false;
+}
+
+int bench_main(int argc, char **argv) {
+    int status = 0;
+    words_t words;
+    words_init(&words);
+    numbers_t numbers;
+    numbers_init(&numbers);
+    program_t program;
+    program_init(&program);
+
+#define BENCH(name, fn, ctx, items, bytes)                                     \
+    if (bench_enabled((name), argc, argv))                                     \
+    bench_run((name), (fn), (ctx), (items), (bytes))
+
+    BENCH("keyword/perfect-hash", bench_keyword_hash, &words, WORD_COUNT, 0);
+    BENCH("keyword/strcmp-chain", bench_keyword_strcmp, &words, WORD_COUNT,
+          0);
+    BENCH("lexer/identifiers", bench_lex, &words, WORD_COUNT, words.size);
+    BENCH("lexer/numbers", bench_number_lex, &numbers, NUMBER_COUNT,
+          numbers.size);
+    BENCH("number/eisel-lemire", bench_number_float, &numbers, NUMBER_COUNT,
+          0);
+    BENCH("number/strtod", bench_number_strtod, &numbers, NUMBER_COUNT, 0);
+    BENCH("number/format-ryu", bench_format_float, &numbers, NUMBER_COUNT,
+          0);
+    BENCH("number/format-snprintf", bench_format_snprintf, &numbers,
+          NUMBER_COUNT, 0);
+    BENCH("parser/lex-only", bench_parse_lex, &program, DECL_COUNT,
+          program.size);
+    BENCH("parser/full", bench_parse_full, &program, DECL_COUNT,
+          program.size);
+    BENCH("parser/skim", bench_parse_skim, &program, DECL_COUNT,
+          program.size);
+    BENCH("parser/unit", bench_parse_unit, &program, DECL_COUNT,
+          program.size);
+
+    // not a benchmark: what follows a stray character
+    if (bench_enabled("parser/stray", argc, argv) && !stray_check())
+        status = 1;
+
+    if (bench_enabled("dump/", argc, argv)) {
+        dump_t dump = {.fd = open("/dev/null", O_WRONLY)};
+        unit_parse(&dump.unit, &program.file, (unit_options_t){0});
+        dump.format = DUMP_TEXT;
+        BENCH("dump/text", bench_dump, &dump, DECL_COUNT, 0);
+        dump.format = DUMP_SEXPR;
+        BENCH("dump/sexpr", bench_dump, &dump, DECL_COUNT, 0);
+        dump.format = DUMP_JSON;
+        BENCH("dump/json", bench_dump, &dump, DECL_COUNT, 0);
+        unit_free(&dump.unit);
+        close(dump.fd);
+    }
+
+    if (bench_enabled("walk/", argc, argv)) {
+        walks_t walks = {0};
+        walks_init(&walks);
+        BENCH("walk/separate", bench_walk_separate, &walks, WALK_DECLS, 0);
+        BENCH("walk/fused", bench_walk_fused, &walks, WALK_DECLS, 0);
+        unit_free(&walks.unit);
+        free(walks.program.text);
+    }
+
+    // not a benchmark only: the kernels have to agree with a tree walk
+    if (bench_enabled("eval/", argc, argv)) {
+        static const char *sources[] = {
+            "f :: a * 2.5 + b * b - c / 4.0 + a * c - 1.5 * b + 3.0 * 2.0;",
+            "f :: a * 3 + b % 7 - a / b + -c * c - 2 * -4 + b / 0 + c % a;",
+            "f :: a;",
+            "f :: 2.0 * -0.5;",
+        };
+        for (usz i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+            formula_t f;
+            if (!formula_init(&f, sources[i], i == 1) ||
+                !eval_check(&f, sources[i]))
+                status = 1;
+            else if (i == 0) {
+                BENCH("eval/columns", bench_eval_columns, &f, EVAL_ROWS, 0);
+                BENCH("eval/per-row", bench_eval_rows, &f, EVAL_ROWS, 0);
+            }
+            formula_free(&f);
+        }
+    }
+
+    if (bench_enabled("utf8/", argc, argv)) {
+        text_t text;
+        text_init(&text);
+        BENCH("utf8/simd", bench_utf8_simd, &text, 1, text.size);
+        BENCH("utf8/scalar", bench_utf8_scalar, &text, 1, text.size);
+        free(text.text);
+    }
+
+    // not a benchmark only: the parallel and pipelined lexers have to agree
+    // with `l_next`
+    if (bench_enabled("lexer/file", argc, argv)) {
+        for (int unterminated = 0; unterminated < 2; unterminated++) {
+            text_t large;
+            large_init(&large, unterminated, false);
+            for (usz jobs = 0; jobs <= 8; jobs++)
+                if (!lex_check(&large, jobs)) status = 1;
+            // the parser stops early, and the lexer thread with it
+            if (!parse_check(&large)) status = 1;
+            if (!unterminated) {
+                BENCH("lexer/file-serial", bench_lex_serial, &large, 1,
+                      large.size);
+                BENCH("lexer/file-parallel", bench_lex_parallel, &large, 1,
+                      large.size);
+            }
+            free(large.text);
+        }
+    }
+
+    if (bench_enabled("parser/file", argc, argv)) {
+        text_t large;
+        large_init(&large, false, true);
+        if (!parse_check(&large)) status = 1;
+        BENCH("parser/file-sync", bench_parse_sync, &large, 1, large.size);
+        BENCH("parser/file-pipelined", bench_parse_pipelined, &large, 1,
+              large.size);
+        free(large.text);
+    }
+
+    if (bench_enabled("sax/", argc, argv)) {
+        for (usz i = 0; i < sizeof(sax_sources) / sizeof(sax_sources[0]); i++)
+            if (!sax_check("sax/sources", (char *)sax_sources[i],
+                           strlen(sax_sources[i])))
+                status = 1;
+        for (usz i = 0; i < sizeof(scale_shapes) / sizeof(scale_shapes[0]);
+             i++) {
+            text_t t = {.text = malloc(SCALE_START + 256)};
+            scale_shapes[i].init(&t, SCALE_START);
+            if (!sax_check(scale_shapes[i].name, t.text, t.size)) status = 1;
+            free(t.text);
+        }
+
+        text_t prefix;
+        sax_prefix_init(&prefix);
+        if (!sax_check("sax/prefix", prefix.text, prefix.size)) status = 1;
+        free(prefix.text);
+
+        for (int valid = 0; valid < 2; valid++) {
+            text_t large;
+            large_init(&large, false, valid);
+            if (!sax_check("sax/file", large.text, large.size) ||
+                !sax_heap_check(&large))
+                status = 1;
+            if (valid) {
+                BENCH("sax/file-lex", bench_sax_lex, &large, 1, large.size);
+                BENCH("sax/file-check", bench_sax_check, &large, 1,
+                      large.size);
+                BENCH("sax/file-tree", bench_parse_sync, &large, 1,
+                      large.size);
+            }
+            free(large.text);
+        }
+    }
+    // not a benchmark: front end paths that are quietly superlinear fail it
+    for (usz i = 0; i < sizeof(scale_shapes) / sizeof(scale_shapes[0]); i++)
+        if (bench_enabled(scale_shapes[i].name, argc, argv) &&
+            !scale_check(scale_shapes[i].name, scale_shapes[i].init))
+            status = 1;
+
+    if (bench_enabled("dag/", argc, argv)) {
+        for (usz i = 0; i < sizeof(dag_sources) / sizeof(dag_sources[0]); i++)
+            if (!dag_check("dag/sources", (char *)dag_sources[i],
+                           strlen(dag_sources[i])))
+                status = 1;
+
+        text_t t;
+        dag_init_text(&t);
+        if (!dag_check("dag/generated", t.text, t.size) ||
+            !dag_memory_check(&t))
+            status = 1;
+        dag_parse_t parse = {.file = bench_file(t.text, t.size)};
+        BENCH("dag/parse-tree", bench_dag_parse, &parse, 1, t.size);
+        parse.dag = true;
+        BENCH("dag/parse-dag", bench_dag_parse, &parse, 1, t.size);
+        free(t.text);
+    }
+
+    if (bench_enabled("log/", argc, argv)) {
+        FILE *null = fopen("/dev/null", "w");
+        log_set_quiet(true);
+        log_add_fp(null, LOG_TRACE);
+        BENCH("log/sync", bench_log, NULL, LOG_COUNT, 0);
+        log_set_async(true);
+        BENCH("log/async", bench_log, NULL, LOG_COUNT, 0);
+        log_set_async(false);
+        log_set_quiet(false);
+    }
+
+#undef BENCH
+
+    arena_free(&program.arena);
+    free(program.text);
+    free(numbers.text);
+    free(words.text);
+    return status;
+}
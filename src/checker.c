@@ -0,0 +1,350 @@
+#include "include/analyzer.h"
+#include "include/types.h"
+#include <stdlib.h>
+
+// Size of the buffers type names are formatted into for diagnostics
+#define TYPE_NAME_MAX 128
+
+static tid_t a_check_expr(analyzer_t *, expr_t *);
+static void a_check_body(analyzer_t *, expr_t *);
+
+tid_t a_resolve_type(analyzer_t *a, type_t *type) {
+    switch (type->type) {
+    case TY_UD: {
+        tid_t ty = ty_builtin(type->ud);
+        if (ty == TID_ERROR)
+            a_report(a, type->span, false, "unknown type `%s`", type->ud);
+        return ty;
+    }
+
+    case TY_PTR: {
+        tid_t inner = a_resolve_type(a, type->ptr.inner);
+        return inner == TID_ERROR ? TID_ERROR : ty_ptr(inner);
+    }
+    }
+    return TID_ERROR;
+}
+
+// Diagnostics with type names are reported out of line, so that the buffers
+// are not in the frames of the checks, which recurse as deep as expressions.
+// `fmt` takes the names of `lhs` and `rhs`, and then `what`.
+__attribute__((noinline)) static void a_mismatch(analyzer_t *a, span_t span,
+                                                 const char *fmt, tid_t lhs,
+                                                 tid_t rhs, const char *what) {
+    char l[TYPE_NAME_MAX], r[TYPE_NAME_MAX];
+    ty_format(lhs, l, sizeof(l));
+    ty_format(rhs, r, sizeof(r));
+    a_report(a, span, false, fmt, l, r, what);
+}
+
+// `fmt` takes `op` and then the name of `ty`
+__attribute__((noinline)) static void a_operand(analyzer_t *a, span_t span,
+                                                const char *fmt, u8 op,
+                                                tid_t ty) {
+    char name[TYPE_NAME_MAX];
+    ty_format(ty, name, sizeof(name));
+    a_report(a, span, false, fmt, tt_name(op), name);
+}
+
+// Computes the type of a function from its parameters and return type
+// without looking at the body, so functions can refer to each other in any
+// order.
+static tid_t a_fn_signature(analyzer_t *a, expr_t *fn) {
+    params_t *params = &fn->fn.params;
+    tid_t small[16] = {0};
+    tid_t *tys = params->count <= 16 ? small
+                                     : malloc(params->count * sizeof(tid_t));
+
+    for (usz i = 0; i < params->count; i++) {
+        param_t *param = params->items[i];
+        tid_t ty = param->type != NULL ? a_resolve_type(a, param->type)
+                                       : TID_ERROR;
+        if (param->expr != NULL) {
+            tid_t value = a_check_expr(a, param->expr);
+            if (param->type == NULL)
+                ty = value;
+            else if (ty != value && ty != TID_ERROR && value != TID_ERROR)
+                a_mismatch(a, param->expr->span,
+                           "default value of type `%2$s` for a parameter of "
+                           "type `%1$s`",
+                           ty, value, "");
+        }
+        param->ty = ty;
+        tys[i] = ty;
+    }
+
+    tid_t ret = fn->fn.ret_type != NULL ? a_resolve_type(a, fn->fn.ret_type)
+                                        : TID_VOID;
+    fn->ty = ty_fn(tys, params->count, ret);
+    if (tys != small) free(tys);
+    return fn->ty;
+}
+
+// Returns the type of a declaration, checking it first if needed. For
+// functions that is only the signature; bodies are checked separately.
+static tid_t a_decl_type(analyzer_t *a, decl_t *decl) {
+    switch (decl->state) {
+    case D_CHECKED:
+        return decl->ty;
+
+    case D_CHECKING:
+        a_report(a, decl->span, false,
+                 "the type of `%s` depends on its own value", decl->id);
+        return TID_ERROR;
+
+    case D_UNCHECKED:
+        break;
+    }
+
+    decl->state = D_CHECKING;
+    tid_t ty = decl->value->type == E_FN ? a_fn_signature(a, decl->value)
+                                         : a_check_expr(a, decl->value);
+    if (decl->type != NULL) {
+        tid_t declared = a_resolve_type(a, decl->type);
+        if (declared != ty && declared != TID_ERROR && ty != TID_ERROR)
+            a_mismatch(a, decl->value->span,
+                       "`%3$s` is declared as `%1$s`, but its value is `%2$s`",
+                       declared, ty, decl->id);
+        ty = declared;
+    }
+
+    decl->ty = ty;
+    decl->state = D_CHECKED;
+    return ty;
+}
+
+// The type of a top-level declaration in streaming mode. One used before it
+// is reached is parsed on its own, and only its type is kept.
+static tid_t a_global_type(analyzer_t *a, global_t *global) {
+    switch (global->state) {
+    case D_CHECKED:
+        return global->ty;
+
+    case D_CHECKING:
+        a_report(a, global->span, false,
+                 "the type of `%s` depends on its own value", global->id);
+        return TID_ERROR;
+
+    default:
+        break;
+    }
+
+    global->state = D_CHECKING;
+    arena_mark_t mark = arena_mark(&a->scratch);
+    decl_t *decl = a->load(a->load_ctx, global, &a->scratch);
+    tid_t ty = TID_ERROR;
+    if (decl != NULL) {
+        // name errors are reported when the declaration is reached, type
+        // errors only now
+        usz count = a->errors.count;
+        a_resolve_global(a, decl);
+        a_drop_errors(a, count);
+        ty = a_decl_type(a, decl);
+    }
+    arena_release(&a->scratch, mark);
+
+    global->ty = ty;
+    global->state = D_CHECKED;
+    return ty;
+}
+
+void a_check_global(analyzer_t *a, global_t *global, decl_t *decl) {
+    if (global->state == D_UNCHECKED) {
+        global->state = D_CHECKING;
+        global->ty = a_decl_type(a, decl);
+        global->state = D_CHECKED;
+    } else {
+        // typed on its own when something before it used it, and checked
+        // again for the types in the tree without reporting twice
+        usz count = a->errors.count;
+        a_decl_type(a, decl);
+        a_drop_errors(a, count);
+    }
+
+    if (decl->value->type == E_FN) a_check_body(a, decl->value);
+}
+
+static void a_check_task(analyzer_t *a, void *fn) { a_check_body(a, fn); }
+
+// A local function's body is a task of its own: once the function's
+// signature is known, nothing the body can see is checked any further.
+static void a_check_local_decl(analyzer_t *a, decl_t *decl) {
+    a_decl_type(a, decl);
+    if (decl->value->type == E_FN) a_spawn(a, a_check_task, decl->value);
+}
+
+static void a_check_body(analyzer_t *a, expr_t *fn) {
+    stmts_t *stmts = ast_fn_body(fn);
+    for (usz i = 0; i < stmts->count; i++) {
+        stmt_t *stmt = stmts->items[i];
+        switch (stmt->type) {
+        case S_DECL:
+            a_check_local_decl(a, stmt->decl);
+            break;
+
+        case S_EXPR:
+            a_check_expr(a, stmt->expr);
+            break;
+        }
+    }
+}
+
+static bool is_assignment(u8 op) {
+    return (tt_info[op].flags & TT_RIGHT) != 0;
+}
+
+static tid_t a_check_assignment(analyzer_t *a, expr_t *expr, tid_t lhs,
+                                tid_t rhs) {
+    expr_t *target = expr->binop.lhs;
+    u8 op = expr->binop.op;
+
+    if (target->type != E_IDENT) {
+        a_report(a, target->span, false, "cannot assign to this expression");
+        return TID_ERROR;
+    }
+    if ((target->binding.type == B_DECL && target->binding.decl->constant) ||
+        (target->binding.type == B_GLOBAL &&
+         target->binding.global->constant)) {
+        a_report(a, target->span, false, "cannot assign to constant `%s`",
+                 target->ident);
+        return TID_ERROR;
+    }
+
+    if (lhs == TID_ERROR || rhs == TID_ERROR) return TID_ERROR;
+    if (op != T_EQUALS && !ty_is_numeric(lhs)) {
+        a_operand(a, expr->span, "`%s` expects a number, but got `%s`", op,
+                  lhs);
+        return TID_ERROR;
+    }
+    if (lhs != rhs) {
+        a_mismatch(a, expr->binop.rhs->span,
+                   "cannot assign a value of type `%2$s` to `%1$s`", lhs, rhs,
+                   "");
+        return TID_ERROR;
+    }
+    return lhs;
+}
+
+static tid_t a_check_binop(analyzer_t *a, expr_t *expr) {
+    tid_t lhs = a_check_expr(a, expr->binop.lhs);
+    tid_t rhs = a_check_expr(a, expr->binop.rhs);
+    u8 op = expr->binop.op;
+
+    if (is_assignment(op)) return a_check_assignment(a, expr, lhs, rhs);
+    if (lhs == TID_ERROR || rhs == TID_ERROR) return TID_ERROR;
+
+    if (lhs != rhs) {
+        a_mismatch(a, expr->span, "mismatched types `%s` and `%s` for `%s`",
+                   lhs, rhs, tt_name(op));
+        return TID_ERROR;
+    }
+
+    switch (op) {
+    case T_EQUALS_EQUALS:
+    case T_BANG_EQUALS:
+        return TID_BOOL;
+
+    case T_QUESTION_QUESTION:
+        return lhs;
+
+    default:
+        break;
+    }
+
+    if (!ty_is_numeric(lhs)) {
+        a_operand(a, expr->span, "`%s` expects numbers, but got `%s`", op,
+                  lhs);
+        return TID_ERROR;
+    }
+
+    switch (op) {
+    case T_LESS_THAN:
+    case T_LESS_THAN_EQUALS:
+    case T_GREATER_THAN:
+    case T_GREATER_THAN_EQUALS:
+        return TID_BOOL;
+
+    default:
+        return lhs;
+    }
+}
+
+static tid_t a_check_unary(analyzer_t *a, expr_t *expr) {
+    tid_t operand = a_check_expr(a, expr->unary.operand);
+    if (operand == TID_ERROR) return TID_ERROR;
+
+    bool ok = expr->unary.op == T_BANG ? operand == TID_BOOL
+                                       : ty_is_numeric(operand);
+    if (!ok) {
+        a_operand(a, expr->span, "`%s` cannot be applied to `%s`",
+                  expr->unary.op, operand);
+        return TID_ERROR;
+    }
+    return operand;
+}
+
+static tid_t a_check_expr(analyzer_t *a, expr_t *expr) {
+    tid_t ty = TID_ERROR;
+
+    switch (expr->type) {
+    case E_IDENT:
+        switch (expr->binding.type) {
+        case B_DECL:
+            ty = a_decl_type(a, expr->binding.decl);
+            break;
+        case B_PARAM:
+            ty = expr->binding.param->ty;
+            break;
+        case B_GLOBAL:
+            ty = a_global_type(a, expr->binding.global);
+            break;
+        case B_UNRESOLVED:
+            break;
+        }
+        break;
+
+    case E_STRING:
+        ty = TID_STRING;
+        break;
+
+    case E_INT:
+        ty = TID_INT;
+        break;
+
+    case E_FLOAT:
+        ty = TID_FLOAT;
+        break;
+
+    case E_FN:
+        ty = a_fn_signature(a, expr);
+        a_check_body(a, expr);
+        break;
+
+    case E_BINOP:
+        ty = a_check_binop(a, expr);
+        break;
+
+    case E_UNARY:
+        ty = a_check_unary(a, expr);
+        break;
+    }
+
+    expr->ty = ty;
+    return ty;
+}
+
+// Type checks a resolved translation unit. Top-level declarations get their
+// types on demand, so they may be used before they are defined; function
+// bodies are checked once every signature is known, independently of each
+// other.
+void a_check(analyzer_t *a, decls_t *decls) {
+    for (usz i = 0; i < decls->count; i++)
+        a_decl_type(a, decls->items[i]);
+
+    array_t(void *) fns = {0};
+    for (usz i = 0; i < decls->count; i++)
+        if (decls->items[i]->value->type == E_FN)
+            da_append(&fns, decls->items[i]->value);
+    a_run(a, fns.items, fns.count, a_check_task);
+    free(fns.items);
+}
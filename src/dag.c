@@ -0,0 +1,283 @@
+#include "include/dag.h"
+#include "include/hash.h"
+#include "include/tokens.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial number of slots of a thread's table
+#define DAG_INIT_CAP 256
+
+void dag_init(dag_t *dag) { *dag = (dag_t){.last = DAG_MADE}; }
+
+void dag_free(dag_t *dag) { free(dag->entries); }
+
+u32 dag_enter(dag_t *dag) {
+    u32 outer = dag->scope;
+    dag->scope = ++dag->scopes;
+    return outer;
+}
+
+void dag_leave(dag_t *dag, u32 scope) { dag->scope = scope; }
+
+// Nodes of earlier declarations are never found again, so their slots are
+// emptied rather than left to slow down every lookup
+void dag_start(dag_t *dag) {
+    if (dag->count > 0) {
+        memset(dag->entries, 0, dag->capacity * sizeof(dag_entry_t));
+        dag->count = 0;
+    }
+    dag_enter(dag);
+}
+
+// Assignments are never shared: they are not worth it, and what they report
+// on is reported in their context
+static bool dag_shares(const expr_t *expr) {
+    switch (expr->type) {
+    case E_IDENT:
+    case E_INT:
+    case E_FLOAT:
+    case E_UNARY:
+        return true;
+    case E_BINOP:
+        return !(tt_info[expr->binop.op].flags & TT_RIGHT);
+    default:
+        return false;
+    }
+}
+
+// Children are already shared, so they are compared by address
+static u32 dag_hash(const expr_t *expr, u32 scope) {
+    u64 h = hash_combine(expr->type, scope);
+    switch (expr->type) {
+    case E_IDENT:
+        h = hash_combine(h, (u64)(usz)expr->ident);
+        break;
+    case E_INT:
+        h = hash_combine(h, (u64)expr->int_);
+        break;
+    case E_FLOAT: {
+        u64 bits;
+        memcpy(&bits, &expr->float_, sizeof(bits));
+        h = hash_combine(h, bits);
+    } break;
+    case E_BINOP:
+        h = hash_combine(h, expr->binop.op);
+        h = hash_combine(h, (u64)(usz)expr->binop.lhs);
+        h = hash_combine(h, (u64)(usz)expr->binop.rhs);
+        break;
+    case E_UNARY:
+        h = hash_combine(h, expr->unary.op);
+        h = hash_combine(h, (u64)(usz)expr->unary.operand);
+        break;
+    default:
+        break;
+    }
+    return (u32)h;
+}
+
+// Floats are equal bit for bit, so `0.0` and `-0.0` stay apart
+static bool dag_equal(const expr_t *a, const expr_t *b) {
+    if (a->type != b->type) return false;
+    switch (a->type) {
+    case E_IDENT:
+        return a->ident == b->ident;
+    case E_INT:
+        return a->int_ == b->int_;
+    case E_FLOAT:
+        return memcmp(&a->float_, &b->float_, sizeof(a->float_)) == 0;
+    case E_BINOP:
+        return a->binop.op == b->binop.op && a->binop.lhs == b->binop.lhs &&
+               a->binop.rhs == b->binop.rhs;
+    case E_UNARY:
+        return a->unary.op == b->unary.op &&
+               a->unary.operand == b->unary.operand;
+    default:
+        return false;
+    }
+}
+
+// The slot of the live node equal to `expr`, or the empty one to put it in
+static dag_entry_t *dag_slot(dag_t *dag, const expr_t *expr, u32 hash) {
+    usz mask = dag->capacity - 1;
+    for (usz slot = hash & mask;; slot = (slot + 1) & mask) {
+        dag_entry_t *entry = &dag->entries[slot];
+        if (entry->expr == NULL) return entry;
+        if (entry->hash == hash && entry->scope == dag->scope &&
+            dag_equal(entry->expr, expr))
+            return entry;
+    }
+}
+
+// Nodes that are not found any more still take up their slots
+static void dag_grow(dag_t *dag) {
+    dag_entry_t *old = dag->entries;
+    usz old_capacity = dag->capacity;
+    dag->capacity = old != NULL ? old_capacity * 2 : DAG_INIT_CAP;
+    dag->entries = calloc(dag->capacity, sizeof(dag_entry_t));
+    assert(dag->entries != NULL && "Buy more RAM lol");
+
+    usz mask = dag->capacity - 1;
+    for (usz i = 0; i < old_capacity; i++) {
+        if (old[i].expr == NULL) continue;
+        usz slot = old[i].hash & mask;
+        while (dag->entries[slot].expr != NULL)
+            slot = (slot + 1) & mask;
+        dag->entries[slot] = old[i];
+    }
+    free(old);
+}
+
+void dag_declare(dag_t *dag, const char *name) {
+    if (dag->entries == NULL) return;
+    expr_t ident = {.type = E_IDENT, .ident = (char *)name};
+    dag_entry_t *entry = dag_slot(dag, &ident, dag_hash(&ident, dag->scope));
+    if (entry->expr != NULL) entry->scope = 0;
+}
+
+static expr_t *dag_alloc(arena_t *arena, const expr_t *node) {
+    expr_t *expr = arena_new(arena, expr_t);
+    *expr = *node;
+    return expr;
+}
+
+expr_t *dag_node(dag_t *dag, const expr_t *node, bool share, arena_t *arena) {
+    dag->last = DAG_MADE;
+    if (!share || !dag_shares(node)) return dag_alloc(arena, node);
+
+    if ((dag->count + 1) * 2 > dag->capacity) dag_grow(dag);
+    u32 hash = dag_hash(node, dag->scope);
+    dag_entry_t *entry = dag_slot(dag, node, hash);
+    if (entry->expr != NULL) {
+        da_append(dag->repeats,
+                  ((dag_repeat_t){entry->expr->span, node->span}));
+        dag->last = dag->repeats->count - 1;
+        return entry->expr;
+    }
+
+    *entry = (dag_entry_t){dag_alloc(arena, node), hash, dag->scope};
+    dag->count++;
+    return entry->expr;
+}
+
+expr_t *dag_own(dag_t *dag, expr_t *expr, span_t span, arena_t *arena) {
+    if (!dag_shares(expr)) return expr;
+
+    // just made, so nothing else has it yet
+    if (dag->last == DAG_MADE) {
+        if (dag->entries != NULL) {
+            dag_entry_t *entry =
+                dag_slot(dag, expr, dag_hash(expr, dag->scope));
+            if (entry->expr == expr) entry->scope = 0;
+        }
+        return expr;
+    }
+
+    dag->repeats->items[dag->last].first = (span_t){0};
+    dag->last = DAG_MADE;
+    expr_t *own = dag_alloc(arena, expr);
+    own->span = span;
+    return own;
+}
+
+/* -------------------- SPANS -------------------- */
+
+struct dag_group_t {
+    span_t first; // zero length for an empty slot
+    u32 offset, count; // of its spans in `dag_spans_t.spans`
+    u32 next;          // occurrences handed out
+};
+
+typedef struct dag_group_t dag_group_t;
+
+static dag_group_t *dag_group(dag_spans_t *s, span_t first) {
+    usz mask = s->capacity - 1;
+    for (usz slot = hash_combine(first.start, first.length) & mask;;
+         slot = (slot + 1) & mask) {
+        dag_group_t *group = &s->groups[slot];
+        if (group->first.length == 0 || (group->first.start == first.start &&
+                                         group->first.length == first.length))
+            return group;
+    }
+}
+
+void dag_spans_init(dag_spans_t *s, const dag_repeats_t *repeats) {
+    *s = (dag_spans_t){0};
+    usz live = 0;
+    for (usz i = 0; i < repeats->count; i++)
+        live += repeats->items[i].first.length != 0;
+    if (live == 0) return;
+
+    s->capacity = 16;
+    while (s->capacity < live * 2)
+        s->capacity *= 2;
+    s->groups = calloc(s->capacity, sizeof(dag_group_t));
+    s->spans = malloc(live * sizeof(span_t));
+    assert(s->groups != NULL && s->spans != NULL && "Buy more RAM lol");
+
+    for (usz i = 0; i < repeats->count; i++) {
+        span_t first = repeats->items[i].first;
+        if (first.length == 0) continue;
+        dag_group_t *group = dag_group(s, first);
+        group->first = first;
+        group->count++;
+    }
+    u32 offset = 0;
+    for (usz i = 0; i < s->capacity; i++) {
+        s->groups[i].offset = offset;
+        offset += s->groups[i].count;
+    }
+
+    // repeats are in source order, and so are the spans of each group
+    for (usz i = 0; i < repeats->count; i++) {
+        if (repeats->items[i].first.length == 0) continue;
+        dag_group_t *group = dag_group(s, repeats->items[i].first);
+        s->spans[group->offset + group->next++] = repeats->items[i].span;
+    }
+    for (usz i = 0; i < s->capacity; i++)
+        s->groups[i].next = 0;
+}
+
+void dag_spans_free(dag_spans_t *s) {
+    free(s->groups);
+    free(s->spans);
+}
+
+// The spans of the group's later occurrences are in source order
+span_t dag_span(dag_spans_t *s, span_t first, u32 from) {
+    if (s == NULL || s->groups == NULL || first.start >= from) return first;
+    dag_group_t *group = dag_group(s, first);
+    if (group->first.length == 0) return first;
+
+    span_t *spans = s->spans + group->offset;
+    usz lo = 0, hi = group->count;
+    while (lo < hi) {
+        usz mid = lo + (hi - lo) / 2;
+        if (spans[mid].start < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < group->count ? spans[lo] : first;
+}
+
+span_t dag_next(dag_spans_t *s, span_t first) {
+    if (s == NULL || s->groups == NULL) return first;
+    dag_group_t *group = dag_group(s, first);
+    if (group->first.length == 0) return first;
+
+    u32 next = group->next++;
+    if (next == 0 || next > group->count) return first;
+    return s->spans[group->offset + next - 1];
+}
+
+// Every occurrence of a node is resolved and typed alike, so each visit
+// reports the same diagnostics at the node's span, and visits come in
+// source order: the k-th at that span is about the k-th occurrence.
+void dag_relocate(const dag_repeats_t *repeats, errors_t *errors) {
+    dag_spans_t spans;
+    dag_spans_init(&spans, repeats);
+    for (usz i = 0; i < errors->count && spans.groups != NULL; i++)
+        errors->items[i].span = dag_next(&spans, errors->items[i].span);
+    dag_spans_free(&spans);
+}
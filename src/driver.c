@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "include/driver.h"
+#include "include/intern.h"
+#include "include/log.h"
+#include "include/sax.h"
+#include "include/utf8.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void usage(const char *program) {
+    log_error("Usage: %s <path> [OPT]", program);
+    log_error("       %s --bench [FILTER...]", program);
+    log_error("       %s --server [--socket=PATH] [--jobs=N] [--verbose]",
+              program);
+    log_error("       %s --client [--socket=PATH] <path> [OPT]", program);
+    log_error("Options:");
+    log_error("  --skim     parse function bodies only when they are used");
+    log_error("  --symbols  list top-level declarations and signatures");
+    log_error("  --jobs=N   parse and analyze with N threads (default: one "
+              "per CPU)");
+    log_error("  --stream   compile one declaration at a time in bounded "
+              "memory");
+    log_error("  --check    only report syntax errors, without building "
+              "the AST");
+    log_error("  --pipeline lex large declarations on another thread while "
+              "they are parsed");
+    log_error("  --dag      build repeated expressions of a function once");
+    log_error("  --prune    drop declarations `main` does not use");
+    log_error("  --root=NAME[,NAME...]");
+    log_error("             prune from these declarations instead of `main`");
+    log_error("  --fold     replace arithmetic on literals with its result");
+    log_error("  --stats    count the declarations and nodes kept and removed");
+    log_error("  --verbose  log what each phase does");
+    log_error("  --perf-counters");
+    log_error("             count cycles, cache misses, ... per phase");
+    log_error("  --dump-ast=text|sexpr|json");
+    log_error("             format of the AST written to stdout");
+}
+
+bool parse_options(options_t *opts, int argc, char *argv[]) {
+    *opts = (options_t){0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--skim") == 0) {
+            opts->skim = true;
+        } else if (strcmp(argv[i], "--symbols") == 0) {
+            opts->skim = true;
+            opts->symbols = true;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            opts->stream = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            opts->check = true;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts->pipeline = true;
+        } else if (strcmp(argv[i], "--dag") == 0) {
+            opts->dag = true;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            opts->perf_counters = true;
+        } else if (strcmp(argv[i], "--prune") == 0) {
+            if (opts->roots == NULL) opts->roots = "main";
+        } else if (strncmp(argv[i], "--root=", 7) == 0) {
+            opts->roots = argv[i] + 7;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            opts->stats = true;
+        } else if (strcmp(argv[i], "--fold") == 0) {
+            opts->fold = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            opts->verbose = true;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            char *end;
+            opts->jobs = strtoul(argv[i] + 7, &end, 10);
+            if (*end != '\0' || opts->jobs == 0) {
+                log_error("invalid job count `%s`", argv[i] + 7);
+                return false;
+            }
+        } else if (strncmp(argv[i], "--dump-ast=", 11) == 0) {
+            if (!dump_format(argv[i] + 11, &opts->format)) {
+                log_error("unknown AST format `%s`", argv[i] + 11);
+                return false;
+            }
+        } else {
+            log_error("unknown option `%s`", argv[i]);
+            return false;
+        }
+    }
+    if (opts->stream && (opts->roots != NULL || opts->stats || opts->dag)) {
+        log_error("pruning, `--stats` and `--dag` need the whole file, not "
+                  "`--stream`");
+        return false;
+    }
+    return true;
+}
+
+char *read_source(int fd, usz *length) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return NULL;
+
+    char *source = malloc(st.st_size + 1);
+    if (source == NULL) return NULL;
+
+    usz size = 0;
+    while (size < (usz)st.st_size) {
+        ssize_t n = pread(fd, source + size, st.st_size - size, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += n;
+    }
+    if (size != (usz)st.st_size) {
+        free(source);
+        return NULL;
+    }
+
+    source[size] = '\0';
+    *length = size;
+    return source;
+}
+
+static void lap(compilation_t *c, const char *phase) {
+    if (c->perf != NULL) perf_lap(c->perf, phase);
+}
+
+bool compile(compilation_t *c, char *source, usz length, char *filename,
+             const options_t *opts, arena_pool_t *pool) {
+    sm_init(&c->sources);
+    source_file_t *file = sm_add(&c->sources, filename, source, length);
+    if (file == NULL) {
+        log_error("%s: files larger than 4GB are not supported", filename);
+        sm_free(&c->sources);
+        return false;
+    }
+
+    c->perf = NULL;
+    if (opts->perf_counters) {
+        c->perf = malloc(sizeof(perf_t));
+        assert(c->perf != NULL && "Buy more RAM lol");
+        perf_open(c->perf);
+    }
+
+    unit_options_t unit_opts = {
+        .jobs = opts->jobs,
+        .skim = opts->skim,
+        .pipeline = opts->pipeline,
+        .dag = opts->dag,
+        .pool = pool};
+    unit_parse(&c->unit, file, unit_opts);
+    lap(c, "parse");
+
+    // before anything else looks at the declarations, so unused ones cost
+    // nothing more than their parse
+    c->stats = (stats_t){0};
+    if (opts->roots != NULL) {
+        prune(&c->unit, opts->roots, opts->stats ? &c->stats.pruned : NULL);
+        lap(c, "prune");
+    }
+
+    a_init(&c->analyzer);
+    c->analyzer.jobs = opts->jobs;
+    modules_init(&c->modules, &c->sources, unit_opts);
+    if (!opts->symbols) {
+        modules_import(&c->modules, file, &c->unit.imports, &c->analyzer);
+        lap(c, "imports");
+        a_resolve(&c->analyzer, &c->unit.decls);
+        log_debug("resolved names in %zu declarations", c->unit.decls.count);
+        lap(c, "resolve");
+        a_check(&c->analyzer, &c->unit.decls);
+        log_debug("type checked, %zu diagnostics", c->analyzer.errors.count);
+        dag_relocate(&c->unit.repeats, &c->analyzer.errors);
+        lap(c, "check");
+    }
+
+    // whatever runs over the whole AST from here on is fused into one walk
+    pass_t passes[2];
+    walker_t walker = {.passes = passes};
+    if (opts->fold) passes[walker.count++] = fold_pass(&c->stats.folded);
+    if (opts->stats) passes[walker.count++] = walk_counter(&c->stats.nodes);
+    if (walker.count > 0) {
+        walk_decls(&walker, &c->unit.decls);
+        lap(c, opts->fold ? "fold" : "stats");
+    }
+    c->stats.decls = c->unit.decls.count;
+    return true;
+}
+
+void compilation_free(compilation_t *c) {
+    if (c->perf != NULL) {
+        perf_close(c->perf);
+        free(c->perf);
+    }
+    modules_free(&c->modules);
+    a_free(&c->analyzer);
+    unit_free(&c->unit);
+    sm_free(&c->sources);
+}
+
+static void print_error(writer_t *w, source_loc_t loc, const error_t *error) {
+    w_str(w, "\033[0;1m");
+    w_str(w, loc.file != NULL ? loc.file->name : "<unknown>");
+    w_char(w, ':');
+    w_int(w, loc.line);
+    w_char(w, ':');
+    w_int(w, loc.column);
+    w_str(w, error->warning ? ": \033[33;1mwarning: " : ": \033[31;1merror: ");
+    w_str(w, "\033[0;0m");
+    w_str(w, error->msg);
+    w_char(w, '\n');
+}
+
+// Locations are only resolved here, so the line tables are built once per
+// file with diagnostics and each lookup is a binary search.
+static void print_errors(writer_t *w, source_manager_t *sources,
+                         errors_t *errors) {
+    for (usz i = 0; i < errors->count; i++)
+        print_error(w, sm_resolve(sources, errors->items[i].span.start),
+                    &errors->items[i]);
+}
+
+static void print_stats(writer_t *w, stats_t *stats) {
+    w_str(w, "declarations: ");
+    w_int(w, stats->decls);
+    w_str(w, " kept, ");
+    w_int(w, stats->pruned.decls);
+    w_str(w, " pruned\nnodes: ");
+    w_int(w, stats->nodes - stats->folded);
+    w_str(w, " kept, ");
+    w_int(w, stats->pruned.nodes);
+    w_str(w, " pruned, ");
+    w_int(w, stats->folded);
+    w_str(w, " folded\n");
+}
+
+int report(compilation_t *c, const options_t *opts, int out, int err) {
+    writer_t w;
+    w_init(&w, out);
+    if (opts->symbols)
+        dump_signatures(&w, &c->unit.decls);
+    else
+        dump_decls(&w, &c->unit.decls, opts->format, &c->unit.repeats);
+    if (!w_flush(&w)) log_error("write() failed: %s", strerror(errno));
+    lap(c, "output");
+
+    w.fd = err;
+    w.failed = false;
+    print_errors(&w, &c->sources, &c->modules.errors);
+    print_errors(&w, &c->sources, &c->unit.errors);
+    print_errors(&w, &c->sources, &c->analyzer.errors);
+    w_flush(&w);
+    lap(c, "diagnostics");
+
+    if (opts->stats) {
+        print_stats(&w, &c->stats);
+        w_flush(&w);
+    }
+
+    if (c->perf != NULL) {
+        perf_report(c->perf, &w, c->unit.file->length);
+        w_flush(&w);
+    }
+    w_free(&w);
+    return 0;
+}
+
+int run(const options_t *opts, char *filename, int fd) {
+    if (opts->check) return check(filename, fd, STDERR_FILENO);
+    if (opts->stream)
+        return stream(opts, filename, fd, STDOUT_FILENO, STDERR_FILENO);
+
+    usz size;
+    char *source = read_source(fd, &size);
+    if (source == NULL) {
+        log_error("read() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    compilation_t c;
+    if (!compile(&c, source, size, filename, opts, NULL)) {
+        free(source);
+        return -1;
+    }
+    int status = report(&c, opts, STDOUT_FILENO, STDERR_FILENO);
+
+    compilation_free(&c);
+    free(source);
+    return status;
+}
+
+/* -------------------- STREAMING -------------------- */
+
+// Top-level declarations of the file, as `unit_parse` splits it. Chunk `i`
+// runs from the start of declaration `i` to the start of the next one.
+typedef struct {
+    source_file_t *file;
+    offsets_t starts;
+    usz count;       // number of chunks, at least one
+    errors_t loaded; // diagnostics of declarations parsed ahead, dropped
+} stream_t;
+
+static void stream_chunk(stream_t *s, usz i, usz *start, usz *end) {
+    *start = i == 0 ? 0 : s->starts.items[i];
+    *end = i + 1 < s->count ? s->starts.items[i + 1] : s->file->length;
+}
+
+static void discard_errors(errors_t *errors) {
+    for (usz i = 0; i < errors->count; i++)
+        free(errors->items[i].msg);
+    errors->count = 0;
+}
+
+// Only a signature is needed from a declaration that is used before it is
+// reached, so its function bodies are skipped.
+static decl_t *stream_load(void *ctx, global_t *global, arena_t *arena) {
+    stream_t *s = ctx;
+    usz start, end;
+    stream_chunk(s, global->index, &start, &end);
+    return unit_parse_decl(s->file, start, end, arena, true, NULL,
+                           &s->loaded);
+}
+
+// Registers the name at the start of every chunk, found the same way
+// `unit_split` found the chunk.
+static void stream_declare(stream_t *s, analyzer_t *a) {
+    const char *text = s->file->text, *end = text + s->file->length;
+    for (usz i = 0; i < s->starts.count; i++) {
+        usz start = s->starts.items[i], pos = start, size;
+        while ((size = pos == start ? utf8_ident_start(text + pos, end)
+                                    : utf8_ident_continue(text + pos, end)))
+            pos += size;
+        const char *id = intern(text + start, pos - start);
+        span_t span = {s->file->base + (u32)start, (u32)(pos - start)};
+        while (text[pos] != ':')
+            pos++;
+        a_declare_global(a, i, id, span, text[pos + 1] == ':');
+    }
+}
+
+// Maps the file instead of reading it, so its pages can be dropped again
+// once parsed. Anything that cannot be mapped is read.
+static char *map_source(int fd, usz *length, bool *mapped) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (source != MAP_FAILED) {
+            posix_madvise(source, st.st_size, POSIX_MADV_SEQUENTIAL);
+            *length = st.st_size;
+            *mapped = true;
+            return source;
+        }
+    }
+    *mapped = false;
+    return read_source(fd, length);
+}
+
+int stream(const options_t *opts, char *filename, int fd, int out, int err) {
+    usz size;
+    bool mapped;
+    char *source = map_source(fd, &size, &mapped);
+    if (source == NULL) {
+        log_error("read() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    source_manager_t sources;
+    sm_init(&sources);
+    source_file_t *file = sm_add(&sources, filename, source, size);
+    if (file == NULL) {
+        log_error("%s: files larger than 4GB are not supported", filename);
+        sm_free(&sources);
+        if (mapped)
+            munmap(source, size);
+        else
+            free(source);
+        return -1;
+    }
+
+    // phases are interleaved one declaration at a time, and reading the
+    // counters that often would cost more than the phases themselves
+    perf_t perf;
+    if (opts->perf_counters) perf_open(&perf);
+
+    writer_t w, e;
+    w_init(&w, out);
+    w_init(&e, err);
+    errors_t errors = {0};
+    stream_t s = {.file = file};
+    analyzer_t a;
+    a_init(&a);
+    modules_t modules;
+    modules_init(&modules, &sources,
+                 (unit_options_t){.jobs = opts->jobs, .skim = true});
+    imports_t imports = {0};
+    usz written = 0;
+    usz folded = 0;
+    pass_t fold = fold_pass(&folded);
+    walker_t folding = {.passes = &fold, .count = 1};
+
+    if (!opts->symbols) dump_begin(&w, opts->format);
+    if (unit_validate(file, &errors)) {
+        unit_split(source, size, &s.starts);
+        s.count = s.starts.count > 0 ? s.starts.count : 1;
+        if (!opts->symbols) a_stream_init(&a, s.starts.count, stream_load, &s);
+
+        arena_t arena;
+        arena_init(&arena);
+        for (usz i = 0; i < s.count; i++) {
+            usz start, end;
+            stream_chunk(&s, i, &start, &end);
+            decl_t *decl = unit_parse_decl(file, start, end, &arena, opts->skim,
+                                           i == 0 ? &imports : NULL, &errors);
+            if (i == 0 && !opts->symbols) {
+                // imported names are shadowed by the file's own, which
+                // `a_declare_global` warns about
+                modules_import(&modules, file, &imports, &a);
+                stream_declare(&s, &a);
+                print_errors(&e, &sources, &modules.errors);
+                discard_errors(&modules.errors);
+            }
+
+            if (decl != NULL && opts->symbols) {
+                dump_signature(&w, decl);
+            } else if (decl != NULL) {
+                // a chunk without a name of its own only happens when the
+                // file has no declarations `unit_split` recognizes
+                global_t local = {.index = i, .state = D_UNCHECKED};
+                global_t *global = i < s.starts.count ? &a.globals[i] : &local;
+                a_resolve_global(&a, decl);
+                a_check_global(&a, global, decl);
+                if (opts->fold) walk_decl(&folding, decl);
+                dump_decl(&w, decl, opts->format, written++);
+            }
+
+            print_errors(&e, &sources, &errors);
+            print_errors(&e, &sources, &a.errors);
+            discard_errors(&errors);
+            discard_errors(&s.loaded);
+            a_drop_errors(&a, 0);
+            arena_reset(&arena);
+        }
+        log_debug("streamed %zu declarations, largest arena %zu bytes",
+                  s.count, arena.reserved);
+        arena_free(&arena);
+    } else {
+        print_errors(&e, &sources, &errors);
+        discard_errors(&errors);
+    }
+    if (!opts->symbols) dump_end(&w, opts->format, written);
+
+    if (!w_flush(&w)) log_error("write() failed: %s", strerror(errno));
+    if (opts->perf_counters) {
+        perf_lap(&perf, "stream");
+        perf_report(&perf, &e, size);
+        perf_close(&perf);
+    }
+    w_flush(&e);
+    w_free(&w);
+    w_free(&e);
+    a_free(&a);
+    modules_free(&modules);
+    free(imports.items);
+    free(errors.items);
+    free(s.loaded.items);
+    free(s.starts.items);
+    sm_free(&sources);
+    if (mapped)
+        munmap(source, size);
+    else
+        free(source);
+    return 0;
+}
+
+/* -------------------- CHECKING -------------------- */
+
+// Diagnostics are printed as they come. Each is located by counting lines
+// from the one before rather than with a line table, which would grow with
+// the file; they are in source order but for a token of lookahead.
+typedef struct {
+    writer_t w;
+    source_file_t *file;
+    u32 pos, line, line_start; // line and start of line of `text[pos]`
+    usz errors;
+} check_t;
+
+static void check_error(void *ctx, const error_t *error) {
+    check_t *c = ctx;
+    const char *text = c->file->text;
+    u32 offset = error->span.start - c->file->base;
+    for (; c->pos < offset; c->pos++) {
+        if (text[c->pos] != '\n') continue;
+        c->line++;
+        c->line_start = c->pos + 1;
+    }
+    if (offset < c->pos) {
+        for (; c->pos > offset; c->pos--)
+            if (text[c->pos - 1] == '\n') c->line--;
+        for (c->line_start = offset;
+             c->line_start > 0 && text[c->line_start - 1] != '\n';)
+            c->line_start--;
+    }
+
+    source_loc_t loc = {c->file, c->line, offset - c->line_start + 1};
+    print_error(&c->w, loc, error);
+    c->errors += !error->warning;
+}
+
+int check(char *filename, int fd, int err) {
+    usz size;
+    bool mapped;
+    char *source = map_source(fd, &size, &mapped);
+    if (source == NULL) {
+        log_error("read() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    int status = -1;
+    source_manager_t sources;
+    sm_init(&sources);
+    source_file_t *file = sm_add(&sources, filename, source, size);
+    if (file == NULL) {
+        log_error("%s: files larger than 4GB are not supported", filename);
+    } else {
+        check_t c = {.file = file, .line = 1};
+        w_init(&c.w, err);
+        sax_parse(file, &(sax_handler_t){.error = check_error, .ctx = &c});
+        w_flush(&c.w);
+        w_free(&c.w);
+        status = c.errors > 0;
+    }
+
+    sm_free(&sources);
+    if (mapped)
+        munmap(source, size);
+    else
+        free(source);
+    return status;
+}
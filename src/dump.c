@@ -0,0 +1,561 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "include/dump.h"
+#include "include/number.h"
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* -------------------- WRITER -------------------- */
+
+void w_init(writer_t *w, int fd) {
+    w->fd = fd;
+    w->buffer = malloc(WRITER_CAPACITY);
+    assert(w->buffer != NULL && "Buy more RAM lol");
+    w->length = 0;
+    w->failed = false;
+}
+
+// Writes every byte of `iov`, resuming after short writes.
+static bool w_writev(writer_t *w, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(w->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for (; count > 0 && (usz)n >= iov->iov_len; iov++, count--)
+            n -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+void w_write(writer_t *w, const char *s, usz n) {
+    if (w->length + n <= WRITER_CAPACITY) {
+        memcpy(w->buffer + w->length, s, n);
+        w->length += n;
+        return;
+    }
+
+    // flush the buffer and the payload together in one call
+    struct iovec iov[2] = {
+        {.iov_base = w->buffer, .iov_len = w->length},
+        {.iov_base = (char *)s, .iov_len = n},
+    };
+    if (!w->failed && !w_writev(w, iov, 2)) w->failed = true;
+    w->length = 0;
+}
+
+void w_str(writer_t *w, const char *s) { w_write(w, s, strlen(s)); }
+
+void w_char(writer_t *w, char c) {
+    if (w->length == WRITER_CAPACITY) w_flush(w);
+    w->buffer[w->length++] = c;
+}
+
+void w_int(writer_t *w, i64 value) {
+    char buf[24];
+    w_write(w, buf, num_format_i64(value, buf));
+}
+
+void w_float(writer_t *w, double value) {
+    char buf[NUM_FLOAT_MAX];
+    w_write(w, buf, num_format_float(value, buf));
+}
+
+// Four spaces per level, written in chunks rather than one level at a time
+void w_indent(writer_t *w, usz depth) {
+    static const char spaces[] = "                                "
+                                 "                                ";
+    usz n = depth * 4;
+    for (; n > sizeof(spaces) - 1; n -= sizeof(spaces) - 1)
+        w_write(w, spaces, sizeof(spaces) - 1);
+    w_write(w, spaces, n);
+}
+
+bool w_flush(writer_t *w) {
+    struct iovec iov = {.iov_base = w->buffer, .iov_len = w->length};
+    if (!w->failed && w->length > 0 && !w_writev(w, &iov, 1))
+        w->failed = true;
+    w->length = 0;
+    return !w->failed;
+}
+
+void w_free(writer_t *w) {
+    free(w->buffer);
+    w->buffer = NULL;
+}
+
+/* -------------------- TEXT -------------------- */
+
+static void t_expr(writer_t *, expr_t *, usz);
+
+static void t_type(writer_t *w, type_t *type) {
+    switch (type->type) {
+    case TY_PTR:
+        w_char(w, '*');
+        t_type(w, type->ptr.inner);
+        break;
+
+    case TY_UD:
+        w_str(w, type->ud);
+        break;
+    }
+}
+
+static void t_signature(writer_t *w, expr_t *fn) {
+    w_char(w, '(');
+    for (usz i = 0; i < fn->fn.params.count; i++) {
+        param_t *param = fn->fn.params.items[i];
+        if (i > 0) w_write(w, ", ", 2);
+        w_str(w, param->id);
+        if (param->type != NULL) {
+            w_write(w, ": ", 2);
+            t_type(w, param->type);
+        }
+        if (param->expr != NULL) {
+            w_str(w, param->type == NULL ? " := " : " = ");
+            t_expr(w, param->expr, 0);
+        }
+    }
+    w_char(w, ')');
+    if (fn->fn.ret_type != NULL) {
+        w_write(w, " -> ", 4);
+        t_type(w, fn->fn.ret_type);
+    }
+}
+
+static void t_decl(writer_t *w, decl_t *decl, usz depth) {
+    w_str(w, decl->id);
+    w_str(w, decl->constant ? " :: " : " := ");
+    t_expr(w, decl->value, depth);
+}
+
+static void t_expr(writer_t *w, expr_t *expr, usz depth) {
+    switch (expr->type) {
+    case E_IDENT:
+        w_str(w, expr->ident);
+        break;
+
+    case E_STRING:
+        w_char(w, '"');
+        w_str(w, expr->string);
+        w_char(w, '"');
+        break;
+
+    case E_FN: {
+        t_signature(w, expr);
+        stmts_t *stmts = ast_fn_body(expr);
+        if (stmts->count == 0) {
+            w_write(w, " {}", 3);
+            break;
+        }
+        w_write(w, " {\n", 3);
+        for (usz i = 0; i < stmts->count; i++) {
+            stmt_t *stmt = stmts->items[i];
+            w_indent(w, depth + 1);
+            if (stmt->type == S_DECL)
+                t_decl(w, stmt->decl, depth + 1);
+            else
+                t_expr(w, stmt->expr, depth + 1);
+            w_str(w, i + 1 < stmts->count ? ";\n" : "\n");
+        }
+        w_indent(w, depth);
+        w_char(w, '}');
+    } break;
+
+    case E_INT:
+        w_int(w, expr->int_);
+        break;
+
+    case E_FLOAT:
+        w_float(w, expr->float_);
+        break;
+
+    case E_BINOP:
+        w_char(w, '(');
+        t_expr(w, expr->binop.lhs, depth);
+        w_char(w, ' ');
+        w_str(w, tt_name(expr->binop.op));
+        w_char(w, ' ');
+        t_expr(w, expr->binop.rhs, depth);
+        w_char(w, ')');
+        break;
+
+    case E_UNARY:
+        w_char(w, '(');
+        w_str(w, tt_name(expr->unary.op));
+        t_expr(w, expr->unary.operand, depth);
+        w_char(w, ')');
+        break;
+    }
+}
+
+/* -------------------- S-EXPRESSIONS -------------------- */
+
+static void s_expr(writer_t *, expr_t *, usz);
+
+static void s_type(writer_t *w, type_t *type) {
+    if (type == NULL) {
+        w_char(w, '_');
+        return;
+    }
+
+    switch (type->type) {
+    case TY_PTR:
+        w_write(w, "(* ", 3);
+        s_type(w, type->ptr.inner);
+        w_char(w, ')');
+        break;
+
+    case TY_UD:
+        w_str(w, type->ud);
+        break;
+    }
+}
+
+static void s_decl(writer_t *w, decl_t *decl, usz depth) {
+    w_str(w, decl->constant ? "(:: " : "(:= ");
+    w_str(w, decl->id);
+    w_char(w, ' ');
+    s_expr(w, decl->value, depth);
+    w_char(w, ')');
+}
+
+static void s_expr(writer_t *w, expr_t *expr, usz depth) {
+    switch (expr->type) {
+    case E_IDENT:
+        w_str(w, expr->ident);
+        break;
+
+    case E_STRING:
+        w_char(w, '"');
+        w_str(w, expr->string);
+        w_char(w, '"');
+        break;
+
+    case E_FN: {
+        w_write(w, "(fn (", 5);
+        for (usz i = 0; i < expr->fn.params.count; i++) {
+            param_t *param = expr->fn.params.items[i];
+            if (i > 0) w_char(w, ' ');
+            w_char(w, '(');
+            w_str(w, param->id);
+            w_char(w, ' ');
+            s_type(w, param->type);
+            if (param->expr != NULL) {
+                w_char(w, ' ');
+                s_expr(w, param->expr, depth);
+            }
+            w_char(w, ')');
+        }
+        w_write(w, ") ", 2);
+        s_type(w, expr->fn.ret_type);
+
+        stmts_t *stmts = ast_fn_body(expr);
+        for (usz i = 0; i < stmts->count; i++) {
+            stmt_t *stmt = stmts->items[i];
+            w_char(w, '\n');
+            w_indent(w, depth + 1);
+            if (stmt->type == S_DECL)
+                s_decl(w, stmt->decl, depth + 1);
+            else
+                s_expr(w, stmt->expr, depth + 1);
+        }
+        w_char(w, ')');
+    } break;
+
+    case E_INT:
+        w_int(w, expr->int_);
+        break;
+
+    case E_FLOAT:
+        w_float(w, expr->float_);
+        break;
+
+    case E_BINOP:
+        w_char(w, '(');
+        w_str(w, tt_name(expr->binop.op));
+        w_char(w, ' ');
+        s_expr(w, expr->binop.lhs, depth);
+        w_char(w, ' ');
+        s_expr(w, expr->binop.rhs, depth);
+        w_char(w, ')');
+        break;
+
+    case E_UNARY:
+        w_char(w, '(');
+        w_str(w, tt_name(expr->unary.op));
+        w_char(w, ' ');
+        s_expr(w, expr->unary.operand, depth);
+        w_char(w, ')');
+        break;
+    }
+}
+
+/* -------------------- JSON -------------------- */
+
+// Every node is an object with a "kind", its source "span" as byte offsets
+// and, once checked, its "ty". String literals are written as they appear
+// in the source, escapes included. A node shared in DAG mode is written at
+// each occurrence, with the span of that occurrence from `spans`: the first
+// from where its parent or the sibling before it starts or ends, which
+// still holds once folding left some occurrences out.
+
+static u32 j_expr(writer_t *, expr_t *, dag_spans_t *, u32 from);
+
+static void j_string(writer_t *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    w_char(w, '"');
+    const char *run = s;
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        w_write(w, run, s - run);
+        run = s + 1;
+        switch (c) {
+        case '"':
+            w_write(w, "\\\"", 2);
+            break;
+        case '\\':
+            w_write(w, "\\\\", 2);
+            break;
+        case '\n':
+            w_write(w, "\\n", 2);
+            break;
+        case '\t':
+            w_write(w, "\\t", 2);
+            break;
+        default: {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            w_write(w, escape, sizeof(escape));
+        } break;
+        }
+    }
+    w_write(w, run, s - run);
+    w_char(w, '"');
+}
+
+static void j_node(writer_t *w, const char *kind, span_t span) {
+    w_write(w, "{\"kind\":\"", 9);
+    w_str(w, kind);
+    w_write(w, "\",\"span\":[", 10);
+    w_int(w, (i64)span.start);
+    w_char(w, ',');
+    w_int(w, (i64)span_end(span));
+    w_char(w, ']');
+}
+
+static void j_ty(writer_t *w, tid_t ty) {
+    w_write(w, ",\"ty\":", 6);
+    if (ty == TID_ERROR) {
+        w_write(w, "null", 4);
+        return;
+    }
+    char name[128];
+    ty_format(ty, name, sizeof(name));
+    j_string(w, name);
+}
+
+static void j_type(writer_t *w, type_t *type) {
+    if (type == NULL) {
+        w_write(w, "null", 4);
+        return;
+    }
+
+    switch (type->type) {
+    case TY_PTR:
+        j_node(w, "ptr", type->span);
+        w_write(w, ",\"inner\":", 9);
+        j_type(w, type->ptr.inner);
+        break;
+
+    case TY_UD:
+        j_node(w, "name", type->span);
+        w_write(w, ",\"name\":", 8);
+        j_string(w, type->ud);
+        break;
+    }
+    w_char(w, '}');
+}
+
+static void j_decl(writer_t *w, decl_t *decl, dag_spans_t *spans) {
+    j_node(w, "decl", decl->span);
+    w_write(w, ",\"name\":", 8);
+    j_string(w, decl->id);
+    w_str(w, decl->constant ? ",\"constant\":true" : ",\"constant\":false");
+    j_ty(w, decl->ty);
+    w_write(w, ",\"value\":", 9);
+    j_expr(w, decl->value, spans, decl->span.start);
+    w_char(w, '}');
+}
+
+// Returns where the occurrence of `expr` ends
+static u32 j_expr(writer_t *w, expr_t *expr, dag_spans_t *spans, u32 from) {
+    span_t span = dag_span(spans, expr->span, from);
+    j_node(w, expr_name(expr->type), span);
+    switch (expr->type) {
+    case E_IDENT:
+        w_write(w, ",\"name\":", 8);
+        j_string(w, expr->ident);
+        break;
+
+    case E_STRING:
+        w_write(w, ",\"value\":", 9);
+        j_string(w, expr->string);
+        break;
+
+    case E_FN: {
+        w_write(w, ",\"params\":[", 11);
+        for (usz i = 0; i < expr->fn.params.count; i++) {
+            param_t *param = expr->fn.params.items[i];
+            if (i > 0) w_char(w, ',');
+            j_node(w, "param", param->span);
+            w_write(w, ",\"name\":", 8);
+            j_string(w, param->id);
+            j_ty(w, param->ty);
+            w_write(w, ",\"type\":", 8);
+            j_type(w, param->type);
+            w_write(w, ",\"default\":", 11);
+            if (param->expr != NULL)
+                j_expr(w, param->expr, spans, param->span.start);
+            else
+                w_write(w, "null", 4);
+            w_char(w, '}');
+        }
+        w_write(w, "],\"ret\":", 8);
+        j_type(w, expr->fn.ret_type);
+
+        w_write(w, ",\"body\":[", 9);
+        stmts_t *stmts = ast_fn_body(expr);
+        for (usz i = 0; i < stmts->count; i++) {
+            stmt_t *stmt = stmts->items[i];
+            if (i > 0) w_char(w, ',');
+            if (stmt->type == S_DECL)
+                j_decl(w, stmt->decl, spans);
+            else
+                j_expr(w, stmt->expr, spans, stmt->span.start);
+        }
+        w_char(w, ']');
+    } break;
+
+    case E_INT:
+        w_write(w, ",\"value\":", 9);
+        w_int(w, expr->int_);
+        break;
+
+    case E_FLOAT:
+        w_write(w, ",\"value\":", 9);
+        // JSON has no infinity, which is what overlong literals parse to
+        if (isfinite(expr->float_))
+            w_float(w, expr->float_);
+        else
+            w_write(w, "null", 4);
+        break;
+
+    case E_BINOP:
+        w_write(w, ",\"op\":", 6);
+        j_string(w, tt_name(expr->binop.op));
+        w_write(w, ",\"lhs\":", 7);
+        from = j_expr(w, expr->binop.lhs, spans, span.start);
+        w_write(w, ",\"rhs\":", 7);
+        j_expr(w, expr->binop.rhs, spans, from);
+        break;
+
+    case E_UNARY:
+        w_write(w, ",\"op\":", 6);
+        j_string(w, tt_name(expr->unary.op));
+        w_write(w, ",\"operand\":", 11);
+        j_expr(w, expr->unary.operand, spans, span.start);
+        break;
+    }
+    j_ty(w, expr->ty);
+    w_char(w, '}');
+    return span_end(span);
+}
+
+/* -------------------- DRIVER -------------------- */
+
+bool dump_format(const char *name, dump_format_t *format) {
+#define F(id, str)                                                             \
+    if (strcmp(name, str) == 0) {                                              \
+        *format = id;                                                          \
+        return true;                                                           \
+    }
+    DUMP_FORMATS
+#undef F
+    return false;
+}
+
+void dump_begin(writer_t *w, dump_format_t format) {
+    if (format == DUMP_JSON) w_write(w, "[\n", 2);
+}
+
+// JSON separators go before every declaration but the first, so the output
+// can be written without knowing which declaration is the last one.
+static void d_decl(writer_t *w, decl_t *decl, dump_format_t format, usz index,
+                   dag_spans_t *spans) {
+    switch (format) {
+    case DUMP_TEXT:
+        t_decl(w, decl, 0);
+        w_char(w, '\n');
+        break;
+
+    case DUMP_SEXPR:
+        s_decl(w, decl, 0);
+        w_char(w, '\n');
+        break;
+
+    case DUMP_JSON:
+        if (index > 0) w_write(w, ",\n", 2);
+        j_decl(w, decl, spans);
+        break;
+    }
+}
+
+void dump_decl(writer_t *w, decl_t *decl, dump_format_t format, usz index) {
+    d_decl(w, decl, format, index, NULL);
+}
+
+void dump_end(writer_t *w, dump_format_t format, usz count) {
+    if (format != DUMP_JSON) return;
+    if (count > 0) w_char(w, '\n');
+    w_write(w, "]\n", 2);
+}
+
+void dump_decls(writer_t *w, decls_t *decls, dump_format_t format,
+                const dag_repeats_t *repeats) {
+    dag_spans_t spans = {0};
+    if (format == DUMP_JSON && repeats != NULL)
+        dag_spans_init(&spans, repeats);
+
+    dump_begin(w, format);
+    for (usz i = 0; i < decls->count; i++)
+        d_decl(w, decls->items[i], format, i, &spans);
+    dump_end(w, format, decls->count);
+    dag_spans_free(&spans);
+}
+
+void dump_signature(writer_t *w, decl_t *decl) {
+    w_str(w, decl->id);
+    w_str(w, decl->constant ? " ::" : " :=");
+    if (decl->value->type == E_FN) {
+        w_char(w, ' ');
+        t_signature(w, decl->value);
+    }
+    w_char(w, '\n');
+}
+
+void dump_signatures(writer_t *w, decls_t *decls) {
+    for (usz i = 0; i < decls->count; i++)
+        dump_signature(w, decls->items[i]);
+}
@@ -0,0 +1,440 @@
+#include "include/eval.h"
+#include "include/intern.h"
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* -------------------- KERNELS -------------------- */
+
+// Values in a vector, as many as the target's registers take. Vectors wider
+// than those are split by GCC through the stack.
+#if defined(__AVX__)
+#define EV_LANES 4
+#else
+#define EV_LANES 2
+#endif
+
+// Vectors as they are in columns and registers: any 8-byte alignment, and
+// aliasing the arrays they are read from
+typedef u64 ev_ints_t
+    __attribute__((vector_size(EV_LANES * 8), aligned(8), may_alias));
+typedef double ev_floats_t
+    __attribute__((vector_size(EV_LANES * 8), aligned(8), may_alias));
+
+// A kernel for each shape of operands: two vectors, a vector and a constant,
+// a constant and a vector. `count` is a whole number of vectors.
+#define EV_SIMD(name, V, T, OP)                                                \
+    static void name##_vv(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        V *d = dst;                                                            \
+        const V *a = lhs, *b = rhs;                                            \
+        for (usz i = 0; i < count / EV_LANES; i++)                             \
+            d[i] = a[i] OP b[i];                                               \
+    }                                                                          \
+    static void name##_vc(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        V *d = dst;                                                            \
+        const V *a = lhs;                                                      \
+        T b = *(const T *)rhs;                                                 \
+        for (usz i = 0; i < count / EV_LANES; i++)                             \
+            d[i] = a[i] OP b;                                                  \
+    }                                                                          \
+    static void name##_cv(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        V *d = dst;                                                            \
+        T a = *(const T *)lhs;                                                 \
+        const V *b = rhs;                                                      \
+        for (usz i = 0; i < count / EV_LANES; i++)                             \
+            d[i] = a OP b[i];                                                  \
+    }
+
+// The same for operations that have no vector instructions, one value at a
+// time, but still a batch per call
+#define EV_SCALAR(name, T, FN)                                                 \
+    static void name##_vv(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        T *d = dst;                                                            \
+        const T *a = lhs, *b = rhs;                                            \
+        for (usz i = 0; i < count; i++)                                        \
+            d[i] = FN(a[i], b[i]);                                             \
+    }                                                                          \
+    static void name##_vc(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        T *d = dst;                                                            \
+        const T *a = lhs;                                                      \
+        T b = *(const T *)rhs;                                                 \
+        for (usz i = 0; i < count; i++)                                        \
+            d[i] = FN(a[i], b);                                                \
+    }                                                                          \
+    static void name##_cv(void *dst, const void *lhs, const void *rhs,         \
+                          usz count) {                                         \
+        T *d = dst;                                                            \
+        T a = *(const T *)lhs;                                                 \
+        const T *b = rhs;                                                      \
+        for (usz i = 0; i < count; i++)                                        \
+            d[i] = FN(a, b[i]);                                                \
+    }
+
+// Integers are added, subtracted and multiplied unsigned, which wraps
+static inline i64 ev_div_int(i64 a, i64 b) {
+    if (b == 0) return 0;
+    return b == -1 ? (i64)(0 - (u64)a) : a / b;
+}
+
+static inline i64 ev_mod_int(i64 a, i64 b) {
+    return b == 0 || b == -1 ? 0 : a % b;
+}
+
+EV_SIMD(ev_add_int, ev_ints_t, u64, +)
+EV_SIMD(ev_sub_int, ev_ints_t, u64, -)
+EV_SIMD(ev_mul_int, ev_ints_t, u64, *)
+EV_SCALAR(ev_div_int, i64, ev_div_int)
+EV_SCALAR(ev_mod_int, i64, ev_mod_int)
+EV_SIMD(ev_add_float, ev_floats_t, double, +)
+EV_SIMD(ev_sub_float, ev_floats_t, double, -)
+EV_SIMD(ev_mul_float, ev_floats_t, double, *)
+EV_SIMD(ev_div_float, ev_floats_t, double, /)
+EV_SCALAR(ev_mod_float, double, fmod)
+
+static void ev_neg_int(void *dst, const void *src, const void *unused,
+                       usz count) {
+    (void)unused;
+    ev_ints_t *d = dst;
+    const ev_ints_t *a = src;
+    for (usz i = 0; i < count / EV_LANES; i++)
+        d[i] = -a[i];
+}
+
+static void ev_neg_float(void *dst, const void *src, const void *unused,
+                         usz count) {
+    (void)unused;
+    ev_floats_t *d = dst;
+    const ev_floats_t *a = src;
+    for (usz i = 0; i < count / EV_LANES; i++)
+        d[i] = -a[i];
+}
+
+// Operators over columns, with the kernels for integers and floats
+#define EV_OPS                                                                 \
+    EV_OP(PLUS, add)                                                           \
+    EV_OP(MINUS, sub)                                                          \
+    EV_OP(ASTERISK, mul)                                                       \
+    EV_OP(SLASH, div)                                                          \
+    EV_OP(PERCENT, mod)
+
+enum { EV_VV, EV_VC, EV_CV };
+
+static bool ev_kernel(u8 op, bool ints, int shape, ev_kernel_t *kernel) {
+    switch (op) {
+#define EV_OP(token, name)                                                     \
+    case T_##token: {                                                          \
+        static const ev_kernel_t kernels[2][3] = {                             \
+            {ev_##name##_float_vv, ev_##name##_float_vc,                       \
+             ev_##name##_float_cv},                                            \
+            {ev_##name##_int_vv, ev_##name##_int_vc, ev_##name##_int_cv},      \
+        };                                                                     \
+        *kernel = kernels[ints][shape];                                        \
+        return true;                                                           \
+    }
+        EV_OPS
+#undef EV_OP
+    default:
+        return false;
+    }
+}
+
+// What the kernels compute, for literal operands
+static i64 ev_fold_int(u8 op, i64 a, i64 b) {
+    switch (op) {
+    case T_PLUS:
+        return (i64)((u64)a + (u64)b);
+    case T_MINUS:
+        return (i64)((u64)a - (u64)b);
+    case T_ASTERISK:
+        return (i64)((u64)a * (u64)b);
+    case T_SLASH:
+        return ev_div_int(a, b);
+    default:
+        return ev_mod_int(a, b);
+    }
+}
+
+static double ev_fold_float(u8 op, double a, double b) {
+    switch (op) {
+    case T_PLUS:
+        return a + b;
+    case T_MINUS:
+        return a - b;
+    case T_ASTERISK:
+        return a * b;
+    case T_SLASH:
+        return a / b;
+    default:
+        return fmod(a, b);
+    }
+}
+
+/* -------------------- COMPILER -------------------- */
+
+typedef struct {
+    ev_program_t *p;
+    const ev_column_t *columns;
+    usz count;
+    const ev_column_t **used; // column of each of `p->columns`
+    array_t(u32) free;        // registers whose value is no longer needed
+    errors_t *errors;
+} ev_compiler_t;
+
+static void ev_error(ev_compiler_t *c, span_t span, const char *fmt, ...) {
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    usz size = vsnprintf(NULL, 0, fmt, ap2) + 1;
+    va_end(ap2);
+
+    char *message = malloc(size);
+    assert(message != NULL && "Buy more RAM lol");
+    vsnprintf(message, size, fmt, ap);
+    va_end(ap);
+    da_append(c->errors, ((error_t){.span = span, .msg = message}));
+}
+
+static bool ev_column(ev_compiler_t *c, expr_t *expr, ev_operand_t *out,
+                      tid_t *type) {
+    ev_program_t *p = c->p;
+    const ev_column_t *column = NULL;
+    for (usz i = 0; i < c->count && column == NULL; i++)
+        if (intern_cstr(c->columns[i].name) == expr->ident)
+            column = &c->columns[i];
+    if (column == NULL) {
+        ev_error(c, expr->span, "no column `%s`", expr->ident);
+        return false;
+    }
+
+    *out = (ev_operand_t){.type = EV_COLUMN};
+    *type = column->type;
+    for (; out->index < p->columns.count; out->index++)
+        if (c->used[out->index] == column) return true;
+    c->used[p->columns.count] = column;
+    da_append(&p->columns, (const void *)column->ints);
+    return true;
+}
+
+// An operand the kernels may overwrite in place, as each value is read
+// before the one that replaces it is written
+static void ev_release(ev_compiler_t *c, ev_operand_t *operand) {
+    if (operand->type == EV_REGISTER) da_append(&c->free, operand->index);
+}
+
+static ev_operand_t ev_register(ev_compiler_t *c) {
+    ev_operand_t dst = {.type = EV_REGISTER};
+    dst.index = c->free.count > 0 ? da_pop(&c->free) : c->p->registers++;
+    return dst;
+}
+
+static bool ev_compile_expr(ev_compiler_t *c, expr_t *expr,
+                            ev_operand_t *out, tid_t *type);
+
+static bool ev_compile_neg(ev_compiler_t *c, expr_t *expr, ev_operand_t *out,
+                           tid_t *type) {
+    ev_operand_t operand;
+    if (!ev_compile_expr(c, expr->unary.operand, &operand, type))
+        return false;
+    bool ints = *type == TID_INT;
+    if (operand.type == EV_CONSTANT) {
+        *out = operand;
+        if (ints)
+            out->int_ = (i64)(0 - (u64)operand.int_);
+        else
+            out->float_ = -operand.float_;
+        return true;
+    }
+
+    ev_release(c, &operand);
+    *out = ev_register(c);
+    da_append(&c->p->instrs,
+              ((ev_instr_t){.kernel = ints ? ev_neg_int : ev_neg_float,
+                            .dst = *out,
+                            .lhs = operand}));
+    return true;
+}
+
+static bool ev_compile_binop(ev_compiler_t *c, expr_t *expr,
+                             ev_operand_t *out, tid_t *type) {
+    ev_operand_t lhs, rhs;
+    tid_t rhs_type;
+    if (!ev_compile_expr(c, expr->binop.lhs, &lhs, type) ||
+        !ev_compile_expr(c, expr->binop.rhs, &rhs, &rhs_type))
+        return false;
+
+    u8 op = expr->binop.op;
+    if (*type != rhs_type) {
+        char l[16], r[16]; // `int` or `float`
+        ty_format(*type, l, sizeof(l));
+        ty_format(rhs_type, r, sizeof(r));
+        ev_error(c, expr->span, "mismatched types `%s` and `%s` for `%s`", l,
+                 r, tt_name(op));
+        return false;
+    }
+
+    bool ints = *type == TID_INT;
+    int shape = lhs.type == EV_CONSTANT   ? EV_CV
+                : rhs.type == EV_CONSTANT ? EV_VC
+                                          : EV_VV;
+    ev_kernel_t kernel;
+    if (!ev_kernel(op, ints, shape, &kernel)) {
+        ev_error(c, expr->span, "`%s` cannot be evaluated over columns",
+                 tt_name(op));
+        return false;
+    }
+
+    if (lhs.type == EV_CONSTANT && rhs.type == EV_CONSTANT) {
+        *out = lhs;
+        if (ints)
+            out->int_ = ev_fold_int(op, lhs.int_, rhs.int_);
+        else
+            out->float_ = ev_fold_float(op, lhs.float_, rhs.float_);
+        return true;
+    }
+
+    ev_release(c, &lhs);
+    ev_release(c, &rhs);
+    *out = ev_register(c);
+    da_append(&c->p->instrs, ((ev_instr_t){.kernel = kernel,
+                                           .dst = *out,
+                                           .lhs = lhs,
+                                           .rhs = rhs}));
+    return true;
+}
+
+static bool ev_compile_expr(ev_compiler_t *c, expr_t *expr,
+                            ev_operand_t *out, tid_t *type) {
+    switch (expr->type) {
+    case E_INT:
+        *out = (ev_operand_t){.type = EV_CONSTANT, .int_ = expr->int_};
+        *type = TID_INT;
+        return true;
+
+    case E_FLOAT:
+        *out = (ev_operand_t){.type = EV_CONSTANT, .float_ = expr->float_};
+        *type = TID_FLOAT;
+        return true;
+
+    case E_IDENT:
+        return ev_column(c, expr, out, type);
+
+    case E_BINOP:
+        return ev_compile_binop(c, expr, out, type);
+
+    case E_UNARY:
+        if (expr->unary.op == T_MINUS)
+            return ev_compile_neg(c, expr, out, type);
+        ev_error(c, expr->span, "`%s` cannot be evaluated over columns",
+                 tt_name(expr->unary.op));
+        return false;
+
+    default:
+        ev_error(c, expr->span, "`%s` cannot be evaluated over columns",
+                 expr_name(expr->type));
+        return false;
+    }
+}
+
+bool ev_compile(ev_program_t *p, expr_t *expr, const ev_column_t *columns,
+                usz count, errors_t *errors) {
+    *p = (ev_program_t){0};
+    ev_compiler_t c = {.p = p,
+                       .columns = columns,
+                       .count = count,
+                       .errors = errors};
+    c.used = malloc((count + 1) * sizeof(ev_column_t *));
+    assert(c.used != NULL && "Buy more RAM lol");
+
+    bool ok = ev_compile_expr(&c, expr, &p->result, &p->type);
+    // the last instruction computes the result, straight into the output
+    if (ok && p->result.type == EV_REGISTER)
+        p->instrs.items[p->instrs.count - 1].dst.type = EV_OUTPUT;
+
+    free(c.free.items);
+    free(c.used);
+    if (!ok) ev_free(p);
+    return ok;
+}
+
+void ev_free(ev_program_t *p) {
+    free(p->instrs.items);
+    free(p->columns.items);
+    *p = (ev_program_t){0};
+}
+
+/* -------------------- EVALUATION -------------------- */
+
+typedef struct {
+    char *registers;
+    char **columns; // of the current batch
+    char *output;
+} ev_batch_t;
+
+static void *ev_operand(ev_batch_t *b, ev_operand_t *operand) {
+    switch (operand->type) {
+    case EV_COLUMN:
+        return b->columns[operand->index];
+    case EV_REGISTER:
+        return b->registers + (usz)operand->index * EV_BATCH * 8;
+    case EV_CONSTANT:
+        return &operand->int_;
+    default:
+        return b->output;
+    }
+}
+
+// Batches are evaluated in place in the columns and the output, except for
+// a last one that is not a whole number of vectors, which is copied into
+// buffers padded with zeros
+void ev_run(const ev_program_t *p, usz rows, void *out) {
+    usz columns = p->columns.count;
+    char *buffers = aligned_alloc(
+        64, ((usz)p->registers + columns + 1) * EV_BATCH * 8);
+    char **batch_columns = malloc((columns + 1) * sizeof(char *));
+    assert(buffers != NULL && batch_columns != NULL && "Buy more RAM lol");
+    char *padded = buffers + (usz)p->registers * EV_BATCH * 8;
+    ev_batch_t b = {.registers = buffers, .columns = batch_columns};
+
+    for (usz base = 0; base < rows; base += EV_BATCH) {
+        usz count = rows - base < EV_BATCH ? rows - base : EV_BATCH;
+        usz whole = (count + EV_LANES - 1) / EV_LANES * EV_LANES;
+        bool tail = whole != count;
+        for (usz i = 0; i < columns; i++) {
+            const char *values = (const char *)p->columns.items[i] + base * 8;
+            if (!tail) {
+                b.columns[i] = (char *)values;
+                continue;
+            }
+            b.columns[i] = padded + (i + 1) * EV_BATCH * 8;
+            memcpy(b.columns[i], values, count * 8);
+            memset(b.columns[i] + count * 8, 0, (whole - count) * 8);
+        }
+        b.output = tail ? padded : (char *)out + base * 8;
+
+        for (usz i = 0; i < p->instrs.count; i++) {
+            ev_instr_t instr = p->instrs.items[i];
+            instr.kernel(ev_operand(&b, &instr.dst), ev_operand(&b, &instr.lhs),
+                         ev_operand(&b, &instr.rhs), whole);
+        }
+
+        ev_operand_t result = p->result;
+        if (result.type == EV_COLUMN) {
+            memcpy(b.output, b.columns[result.index], count * 8);
+        } else if (result.type == EV_CONSTANT) {
+            for (usz i = 0; i < count; i++)
+                memcpy(b.output + i * 8, &result.int_, 8);
+        }
+        if (tail) memcpy((char *)out + base * 8, padded, count * 8);
+    }
+
+    free(batch_columns);
+    free(buffers);
+}
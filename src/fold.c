@@ -0,0 +1,88 @@
+#include "include/fold.h"
+#include "include/types.h"
+#include <math.h>
+#include <stdint.h>
+
+static bool fold_int(u8 op, i64 lhs, i64 rhs, i64 *out) {
+    switch (op) {
+    case T_PLUS:
+        return !__builtin_add_overflow(lhs, rhs, out);
+    case T_MINUS:
+        return !__builtin_sub_overflow(lhs, rhs, out);
+    case T_ASTERISK:
+        return !__builtin_mul_overflow(lhs, rhs, out);
+    case T_SLASH:
+    case T_PERCENT:
+        if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) return false;
+        *out = op == T_SLASH ? lhs / rhs : lhs % rhs;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool fold_float(u8 op, double lhs, double rhs, double *out) {
+    switch (op) {
+    case T_PLUS:
+        *out = lhs + rhs;
+        break;
+    case T_MINUS:
+        *out = lhs - rhs;
+        break;
+    case T_ASTERISK:
+        *out = lhs * rhs;
+        break;
+    case T_SLASH:
+        *out = lhs / rhs;
+        break;
+    default:
+        return false;
+    }
+    // an infinity or NaN has no literal to print back
+    return isfinite(*out);
+}
+
+// Children are folded before their parent, so a whole constant expression
+// collapses on the way back up.
+static void fold_expr(void *ctx, expr_t *expr) {
+    usz *folded = ctx;
+    if (expr->ty != TID_INT && expr->ty != TID_FLOAT) return;
+
+    if (expr->type == E_UNARY && expr->unary.op == T_MINUS) {
+        expr_t *operand = expr->unary.operand;
+        if (operand->type == E_INT && operand->int_ != INT64_MIN) {
+            expr->int_ = -operand->int_;
+        } else if (operand->type == E_FLOAT) {
+            expr->float_ = -operand->float_;
+        } else {
+            return;
+        }
+        expr->type = operand->type;
+        *folded += 1;
+        return;
+    }
+
+    if (expr->type != E_BINOP) return;
+    expr_t *lhs = expr->binop.lhs, *rhs = expr->binop.rhs;
+    if (lhs->type != rhs->type) return;
+
+    if (lhs->type == E_INT) {
+        i64 value;
+        if (!fold_int(expr->binop.op, lhs->int_, rhs->int_, &value)) return;
+        expr->type = E_INT;
+        expr->int_ = value;
+    } else if (lhs->type == E_FLOAT) {
+        double value;
+        if (!fold_float(expr->binop.op, lhs->float_, rhs->float_, &value))
+            return;
+        expr->type = E_FLOAT;
+        expr->float_ = value;
+    } else {
+        return;
+    }
+    *folded += 2;
+}
+
+pass_t fold_pass(usz *folded) {
+    return (pass_t){.post_expr = fold_expr, .ctx = folded};
+}
@@ -1,8 +1,111 @@
 #ifndef ANALYZER_H
 #define ANALYZER_H
 
+#include "arena.h"
 #include "ast.h"
 #include "common.h"
+#include "error.h"
 #include "span.h"
+#include "types.h"
 
-#endif // !ANALYZER_H
\ No newline at end of file
+typedef struct {
+    const char *sym; // interned, NULL for an empty slot
+    binding_t binding;
+} symbol_t;
+
+// How many scopes in which a name is declared are open
+typedef struct {
+    const char *sym; // interned, NULL for an empty slot
+    usz scopes;
+} name_count_t;
+
+// A lexical scope: an open-addressing table of the symbols it declares.
+// Scopes live in the analyzer's arena and are popped by rewinding it to
+// where it was when the scope was pushed.
+typedef struct scope_t scope_t;
+
+struct scope_t {
+    scope_t *parent;
+    symbol_t *symbols;
+    usz capacity, count; // capacity is a power of two
+    arena_mark_t mark;
+};
+
+// A top-level declaration when compiling with `--stream`, where
+// declarations are parsed, checked and freed one at a time. This is all of
+// one that stays resident. Declarations imported from other modules are
+// globals too, typed from the start.
+struct global_t {
+    const char *id; // interned
+    span_t span;    // of the name
+    usz index;      // which declaration of the file it is
+    tid_t ty;
+    u8 state; // D_UNCHECKED, D_CHECKING or D_CHECKED, as for `decl_t`
+    bool constant;
+};
+
+// Parses the declaration of a global into `arena` on its own, for when it is
+// used before it is reached. Its diagnostics are dropped: it is parsed again
+// when its turn comes.
+typedef decl_t *(*a_loader_t)(void *ctx, global_t *, arena_t *arena);
+
+typedef struct {
+    arena_t arena;
+    scope_t *scope; // innermost scope
+    errors_t errors;
+
+    // of every name declared in `scope` or around it, so that neither a
+    // declaration nor a name that is not a local looks through all of them
+    name_count_t *counts; // open addressing, capacity a power of two
+    usz counts_capacity, counts_used;
+
+    // streaming mode, see `a_stream_init`
+    global_t *globals;  // in source order
+    global_t **table;   // open addressing by name, capacity a power of two
+    usz table_capacity;
+    a_loader_t load;
+    void *load_ctx;
+    arena_t scratch; // declarations parsed by `load`
+
+    // imported declarations, see `a_import`
+    global_t **imports; // open addressing by name, capacity a power of two
+    usz import_capacity, import_count;
+
+    // parallel analysis, see `a_run`
+    usz jobs;               // threads, 0 for one per CPU
+    struct a_task_t *task;  // what a worker is running, NULL otherwise
+    void *worker;           // the `sched_worker_t` running it
+    array_t(arena_t *) bodies; // skipped bodies parsed by workers
+} analyzer_t;
+
+typedef void (*a_task_fn_t)(analyzer_t *, void *item);
+
+void a_init(analyzer_t *);
+void a_free(analyzer_t *);
+void a_report(analyzer_t *, span_t, bool, const char *, ...);
+void a_drop_errors(analyzer_t *, usz count);
+
+void a_push_scope(analyzer_t *);
+void a_pop_scope(analyzer_t *);
+binding_t *a_lookup(analyzer_t *, const char *);
+void a_bind(analyzer_t *, const char *, span_t, binding_t);
+
+void a_run(analyzer_t *, void **items, usz count, a_task_fn_t);
+void a_spawn(analyzer_t *, a_task_fn_t, void *item);
+stmts_t *a_fn_body(analyzer_t *, expr_t *);
+
+void a_resolve(analyzer_t *, decls_t *);
+
+tid_t a_resolve_type(analyzer_t *, type_t *);
+void a_check(analyzer_t *, decls_t *);
+
+void a_stream_init(analyzer_t *, usz count, a_loader_t, void *ctx);
+global_t *a_declare_global(analyzer_t *, usz index, const char *id,
+                           span_t span, bool constant);
+void a_resolve_global(analyzer_t *, decl_t *);
+
+global_t *a_import(analyzer_t *, const char *id, tid_t, bool constant,
+                   span_t span);
+void a_check_global(analyzer_t *, global_t *, decl_t *);
+
+#endif // !ANALYZER_H
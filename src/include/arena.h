@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "common.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Default size of a block in an arena
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Alignment of every allocation made from an arena
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+typedef struct arena_block_t arena_block_t;
+
+struct arena_block_t {
+    arena_block_t *next;
+    usz size, used;
+    _Alignas(max_align_t) u8 data[];
+};
+
+// A bump allocator. Blocks are never returned to the system until
+// `arena_free`; releasing or resetting an arena only rewinds it, so the
+// memory is reused by the next allocations.
+typedef struct {
+    arena_block_t *first, *current;
+    usz reserved; // total size of all blocks
+} arena_t;
+
+typedef struct {
+    arena_block_t *block;
+    usz used;
+} arena_mark_t;
+
+void arena_init(arena_t *);
+void arena_free(arena_t *);
+void *arena_alloc(arena_t *, usz);
+
+arena_mark_t arena_mark(arena_t *);
+void arena_release(arena_t *, arena_mark_t);
+void arena_reset(arena_t *);
+
+// Arenas kept by a pool for reuse, and the total size of their blocks
+#define ARENA_POOL_MAX 64
+#define ARENA_POOL_MAX_BYTES (256 * 1024 * 1024)
+
+// Reset arenas shared between threads, so a long-running process hands out
+// arenas whose blocks are already allocated.
+typedef struct {
+    pthread_mutex_t lock;
+    arena_t *arenas[ARENA_POOL_MAX];
+    usz count, reserved;
+} arena_pool_t;
+
+void arena_pool_init(arena_pool_t *);
+void arena_pool_free(arena_pool_t *);
+// Returns a reset arena, or a fresh one when the pool is empty
+arena_t *arena_pool_take(arena_pool_t *);
+// Resets `arena` and keeps it, or frees it when the pool is full
+void arena_pool_give(arena_pool_t *, arena_t *);
+
+#define arena_new(arena, T) ((T *)arena_alloc((arena), sizeof(T)))
+
+#endif // !ARENA_H
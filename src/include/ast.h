@@ -1,21 +1,47 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
 #include "common.h"
+#include "error.h"
+#include "source.h"
 #include "span.h"
 #include "tokens.h"
+#include "types.h"
 #include <stdbool.h>
-#include <stdio.h>
 
 typedef struct decl_t decl_t;
 typedef struct expr_t expr_t;
 typedef struct stmt_t stmt_t;
 typedef struct type_t type_t;
 typedef struct param_t param_t;
+typedef struct global_t global_t;
 
 typedef array_t(stmt_t *) stmts_t;
 typedef array_t(expr_t *) exprs_t;
 typedef array_t(param_t *) params_t;
+typedef array_t(decl_t *) decls_t;
+
+// What an identifier refers to, filled in by name resolution
+typedef struct {
+    enum { B_UNRESOLVED, B_DECL, B_PARAM, B_GLOBAL } type;
+
+    union {
+        decl_t *decl;
+        param_t *param;
+        global_t *global; // a top-level declaration in streaming mode
+    };
+} binding_t;
+
+// A function body that was skipped by brace matching in skim mode. It is
+// parsed the first time it is accessed through `ast_fn_body`.
+typedef struct {
+    span_t span; // everything between the braces
+    source_file_t *file;
+    arena_t *arena;   // where the body's nodes are allocated
+    errors_t *errors; // where diagnostics go once the body is parsed
+    u32 depth;        // of the nesting of the body, see `P_MAX_DEPTH`
+} lazy_body_t;
 
 struct decl_t {
     char *id;
@@ -23,10 +49,38 @@ struct decl_t {
     option_t(type_t) type;
     expr_t *value;
     bool constant;
+
+    // filled in by the type checker
+    tid_t ty;
+    enum { D_UNCHECKED, D_CHECKING, D_CHECKED } state;
 };
 
+// Statement kinds, each with the field of its payload, which is a node of
+// that same name: `decl` is a `decl_t`
+#define STMTS                                                                  \
+    S(DECL, decl)                                                              \
+    S(EXPR, expr)
+
+// Expression kinds, with their name in dumps and the expressions directly
+// under them: each `CHILD` is a field holding one, and `FN_CHILDREN` stands
+// for the parameters and body of a function. The walkers in walk.h are
+// generated from this list, so a new kind only has to be added here.
+// E_TEMPLATED_STRING is still to come.
+#define EXPRS                                                                  \
+    E(IDENT, "ident", )                                                        \
+    E(STRING, "string", )                                                      \
+    E(FN, "fn", FN_CHILDREN)                                                   \
+    E(INT, "int", )                                                            \
+    E(FLOAT, "float", )                                                        \
+    E(BINOP, "binop", CHILD(binop.lhs) CHILD(binop.rhs))                       \
+    E(UNARY, "unary", CHILD(unary.operand))
+
 struct stmt_t {
-    enum { S_DECL, S_EXPR } type;
+    enum {
+#define S(id, field) S_##id,
+        STMTS
+#undef S
+    } type;
     span_t span;
 
     union {
@@ -37,18 +91,18 @@ struct stmt_t {
 
 struct expr_t {
     enum {
-        E_IDENT,
-        E_STRING,
-        // E_TEMPLATED_STRING,
-        E_FN,
-        E_INT,
-        E_FLOAT,
-        E_BINOP,
+#define E(id, ...) E_##id,
+        EXPRS
+#undef E
     } type;
     span_t span;
+    tid_t ty; // filled in by the type checker
 
     union {
-        char *ident;
+        struct {
+            char *ident; // interned
+            binding_t binding;
+        };
         const char *string;
         // struct {
         //     exprs_t exprs;
@@ -57,6 +111,7 @@ struct expr_t {
             params_t params;
             option_t(type_t) ret_type;
             stmts_t stmts;
+            option_t(lazy_body_t) lazy; // set until the body is parsed
         } fn;
         i64 int_;
         double float_;
@@ -64,6 +119,10 @@ struct expr_t {
             expr_t *lhs, *rhs;
             u8 op; // FIXME: proper binop type
         } binop;
+        struct {
+            expr_t *operand;
+            u8 op;
+        } unary;
     };
 };
 
@@ -87,120 +146,32 @@ struct param_t {
     span_t span;
     option_t(type_t) type;
     option_t(expr_t) expr;
+    tid_t ty; // filled in by the type checker
 };
 
-/* -------------------- DEBUGING SHIT -------------------- */
-
-static inline void dump_stmt(stmt_t *, u8);
-static inline void dump_expr(expr_t *, u8);
-static inline void dump_type(type_t *);
-static inline void dump_param(param_t *);
-
-static inline void dump_decl(decl_t *decl, u8 indent) {
-    if (decl == NULL) return;
-    if (indent > 0)
-        for (u8 i = 0; i < indent; i++)
-            printf("  ");
-    printf("%s %s ", decl->id, decl->constant ? "::" : ":=");
-    dump_expr(decl->value, 0);
-    printf("\n");
-}
-
-static inline void dump_stmt(stmt_t *stmt, u8 indent) {
-    if (stmt == NULL) return;
-    if (indent > 0)
-        for (u8 i = 0; i < indent; i++)
-            printf("  ");
-
-    switch (stmt->type) {
-    case S_DECL:
-        dump_decl(stmt->decl, indent);
-        break;
-
-    case S_EXPR:
-        dump_expr(stmt->expr, indent);
-        break;
-    }
-}
-
-static inline void dump_expr(expr_t *expr, u8 indent) {
-    if (expr == NULL) return;
-
-    if (indent > 0)
-        for (u8 i = 0; i < indent; i++)
-            printf("  ");
-
-    switch (expr->type) {
-    case E_IDENT:
-        printf("%s", expr->ident);
-        break;
-
-    case E_STRING:
-        printf("\"%s\"", expr->string);
-        break;
-
-    case E_FN: {
-        printf("(");
-        for (usz i = 0; i < expr->fn.params.count; i++) {
-            dump_param(expr->fn.params.items[i]);
-            if (i + 1 < expr->fn.params.count) printf(", ");
-        }
-        printf(")");
-        if (expr->fn.ret_type != NULL) {
-            printf(" -> ");
-            dump_type(expr->fn.ret_type);
-        }
-        printf(" {\n");
-        for (usz i = 0; i < expr->fn.stmts.count; i++) {
-            dump_stmt(expr->fn.stmts.items[i], indent + 1);
-            if (i + 1 < expr->fn.stmts.count) printf(";\n");
-        }
-        printf("\n}");
-    } break;
-
-    case E_INT:
-        printf("%lld", expr->int_);
-        break;
-
-    case E_FLOAT:
-        printf("%f", expr->float_);
-        break;
-
-    case E_BINOP:
-        printf("(");
-        dump_expr(expr->binop.lhs, 0);
-        printf(" %s ", tt_name(expr->binop.op));
-        dump_expr(expr->binop.rhs, 0);
-        printf(")");
-        break;
-    }
-}
-
-static inline void dump_type(type_t *type) {
-    if (type == NULL) return;
-
-    switch (type->type) {
-    case TY_PTR:
-        printf("*");
-        dump_type(type->ptr.inner);
-        break;
-
-    case TY_UD:
-        printf("%s", type->ud);
-        break;
-    }
-}
-
-static inline void dump_param(param_t *param) {
-    printf("%s", param->id);
-    if (param->type != NULL) {
-        printf(": ");
-        dump_type(param->type);
-    }
-    if (param->expr != NULL) {
-        printf(" %s= ", param->type == NULL ? ":" : "");
-        dump_expr(param->expr, 0);
-    }
-}
+// `import name;` at the top of a file
+typedef struct {
+    const char *name; // interned
+    span_t span;
+} import_t;
+
+typedef array_t(import_t) imports_t;
+
+static const char *const expr_names[] = {
+#define E(id, name, ...) [E_##id] = name,
+    EXPRS
+#undef E
+};
+
+static inline const char *expr_name(u8 type) { return expr_names[type]; }
+
+// Returns the statements of an `E_FN`, parsing the body first if it was
+// skipped in skim mode. Implemented in parser.c.
+stmts_t *ast_fn_body(expr_t *);
+
+// Like `ast_fn_body`, but a skipped body is parsed into `arena` and reports
+// to `errors` instead of where it was skipped. Bodies skipped within it keep
+// reporting where the outer one would have.
+stmts_t *ast_fn_body_in(expr_t *, arena_t *, errors_t *);
 
 #endif // !AST_H
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "common.h"
+
+int bench_main(int, char **);
+
+#endif // !BENCH_H
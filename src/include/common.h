@@ -17,14 +17,21 @@ typedef void *ptr;
 typedef const void *cptr;
 
 // Initial capacity of a dynamic array
-#define DA_INIT_CAP 256
+#ifndef DA_INIT_CAP
+#define DA_INIT_CAP 8
+#endif
+
+// Capacity a full dynamic array grows to
+#ifndef DA_GROW
+#define DA_GROW(capacity) ((capacity) * 2)
+#endif
 
 // Append an item to a dynamic array
 #define da_append(da, item)                                                    \
     do {                                                                       \
         if ((da)->count >= (da)->capacity) {                                   \
             (da)->capacity =                                                   \
-                (da)->capacity == 0 ? DA_INIT_CAP : (da)->capacity * 2;        \
+                (da)->capacity == 0 ? DA_INIT_CAP : DA_GROW((da)->capacity);   \
             (da)->items =                                                      \
                 realloc((da)->items, (da)->capacity * sizeof(*(da)->items));   \
             assert((da)->items != NULL && "Buy more RAM lol");                 \
@@ -32,6 +39,16 @@ typedef const void *cptr;
                                                                                \
         (da)->items[(da)->count++] = (item);                                   \
     } while (0)
+// Make room for at least `n` items in total
+#define da_reserve(da, n)                                                      \
+    do {                                                                       \
+        if ((da)->capacity < (n)) {                                            \
+            (da)->capacity = (n);                                              \
+            (da)->items =                                                      \
+                realloc((da)->items, (da)->capacity * sizeof(*(da)->items));   \
+            assert((da)->items != NULL && "Buy more RAM lol");                 \
+        }                                                                      \
+    } while (0)
 #define da_pop(da) ((da)->items[--(da)->count])
 
 #define array_t(T)                                                             \
@@ -0,0 +1,83 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include "arena.h"
+#include "ast.h"
+#include "common.h"
+#include "error.h"
+#include "span.h"
+
+// Another occurrence of a node shared in DAG mode. The node's own span is
+// that of its first occurrence.
+typedef struct {
+    span_t first; // of the node, {0} once the occurrence got one of its own
+    span_t span;
+} dag_repeat_t;
+
+typedef array_t(dag_repeat_t) dag_repeats_t;
+
+typedef struct {
+    expr_t *expr; // NULL for an empty slot
+    u32 hash;
+    u32 scope; // 0 once the node must not be found any more
+} dag_entry_t;
+
+// Hash-consing of the expressions a parsing thread builds: `E_INT`,
+// `E_FLOAT`, `E_IDENT`, `E_UNARY` and `E_BINOP` equal in kind, operator and
+// children are one node, whatever their spans. Nodes are only shared within
+// a function and, for a name, between two of its declarations there, so
+// every occurrence of a node is resolved and typed alike, by the same task.
+typedef struct {
+    dag_entry_t *entries; // open addressing, capacity a power of two
+    usz capacity, count;
+    u32 scope, scopes; // the innermost function, and how many there were
+    usz last; // index in `repeats` of what `dag_node` returned, or DAG_MADE
+    dag_repeats_t *repeats; // where occurrences of existing nodes go
+} dag_t;
+
+#define DAG_MADE ((usz)-1)
+
+void dag_init(dag_t *);
+void dag_free(dag_t *);
+
+// Starts the scope of a function or of a top-level declaration, and returns
+// the one to go back to once it ends
+u32 dag_enter(dag_t *);
+void dag_leave(dag_t *, u32 scope);
+// Starts a top-level declaration, which shares nothing with earlier ones
+void dag_start(dag_t *);
+// `name` is declared in the current scope from here on
+void dag_declare(dag_t *, const char *name);
+
+// Returns the node equal to `node` if there is one, and otherwise a copy of
+// it in `arena`, which only later nodes equal to it share if `share`.
+expr_t *dag_node(dag_t *, const expr_t *node, bool share, arena_t *);
+
+// Gives the occurrence at `span` of `expr`, which `dag_node` returned last,
+// a node of its own: what is reported on in the context of its parent must
+// not be reported at every occurrence.
+expr_t *dag_own(dag_t *, expr_t *, span_t span, arena_t *);
+
+// The spans of every occurrence of the nodes of a unit parsed in DAG mode,
+// for whatever reaches a shared node once per occurrence
+typedef struct {
+    struct dag_group_t *groups; // open addressing by first span
+    usz capacity;
+    span_t *spans; // later occurrences, grouped by node
+} dag_spans_t;
+
+void dag_spans_init(dag_spans_t *, const dag_repeats_t *);
+void dag_spans_free(dag_spans_t *);
+// The span of the first occurrence at or after `from` of the node whose
+// first is at `first`, which is just `first` for a node that is not shared
+// or a NULL `spans`
+span_t dag_span(dag_spans_t *, span_t first, u32 from);
+// The span of the occurrence after the one this returned last, for a visit
+// in source order that misses none
+span_t dag_next(dag_spans_t *, span_t first);
+
+// Moves the diagnostics the analyzer reported at the first occurrence of a
+// shared node on each visit to the occurrences that visit was of
+void dag_relocate(const dag_repeats_t *, errors_t *);
+
+#endif // !DAG_H
@@ -0,0 +1,78 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "analyzer.h"
+#include "common.h"
+#include "dump.h"
+#include "fold.h"
+#include "module.h"
+#include "perf.h"
+#include "prune.h"
+#include "source.h"
+#include "unit.h"
+
+typedef struct {
+    bool skim;    // parse function bodies lazily
+    bool symbols; // only list top-level names and signatures
+    bool verbose; // trace logging, formatted on a background thread
+    bool stream;  // one top-level declaration at a time, see `stream`
+    bool check;   // only report syntax errors, see `check`
+    bool pipeline; // lex large declarations on a thread of their own
+    bool dag;     // share equal expressions within functions, see dag.h
+    bool perf_counters; // hardware counters per phase, see perf.h
+    bool stats;   // sizes of the AST and what pruning and folding removed
+    bool fold;    // replace arithmetic on literals with its result
+    const char *roots; // comma-separated roots to prune from, or NULL
+    usz jobs;     // parsing threads, 0 for one per CPU
+    dump_format_t format;
+} options_t;
+
+// What `--stats` reports
+typedef struct {
+    usz decls, nodes; // in the AST as it is output, before folding
+    prune_stats_t pruned;
+    usz folded;
+} stats_t;
+
+// Everything known about a source file after the front end ran over it.
+typedef struct {
+    source_manager_t sources;
+    unit_t unit;
+    analyzer_t analyzer;
+    modules_t modules;
+    perf_t *perf; // counters per phase with `--perf-counters`, else NULL
+    stats_t stats; // with `--stats`
+} compilation_t;
+
+void usage(const char *program);
+
+// Parses the options following the path in `argv[0]`
+bool parse_options(options_t *, int argc, char *argv[]);
+
+// Reads the whole file at `fd` into a NUL-terminated buffer
+char *read_source(int fd, usz *length);
+
+// Returns false if the source could not be loaded, in which case `c` is
+// left uninitialized.
+bool compile(compilation_t *, char *source, usz length, char *filename,
+             const options_t *, arena_pool_t *);
+void compilation_free(compilation_t *);
+
+// Compiles the file open at `fd` and reports to stdout and stderr
+int run(const options_t *, char *filename, int fd);
+
+// Writes the AST to `out` and the diagnostics to `err`, and returns the exit
+// status of the run.
+int report(compilation_t *, const options_t *, int out, int err);
+
+// Compiles the file open at `fd` one top-level declaration at a time, and
+// reports each before moving on to the next. Memory use is bounded by the
+// largest declaration rather than the size of the file.
+int stream(const options_t *, char *filename, int fd, int out, int err);
+
+// Reports the syntax errors of the file open at `fd` to `err` without
+// building its AST, see `sax_parse`, and returns 1 if there are any. Memory
+// use does not grow with the size of the file.
+int check(char *filename, int fd, int err);
+
+#endif // !DRIVER_H
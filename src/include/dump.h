@@ -0,0 +1,58 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "ast.h"
+#include "common.h"
+#include "dag.h"
+
+// Output is collected in one buffer and handed to the kernel in large
+// writes; payloads bigger than the buffer bypass it with writev.
+#define WRITER_CAPACITY (64 * 1024)
+
+typedef struct {
+    int fd;
+    char *buffer;
+    usz length;
+    bool failed; // a write failed, everything after it is dropped
+} writer_t;
+
+void w_init(writer_t *, int fd);
+void w_write(writer_t *, const char *, usz);
+void w_str(writer_t *, const char *);
+void w_char(writer_t *, char);
+void w_int(writer_t *, i64);
+void w_float(writer_t *, double);
+void w_indent(writer_t *, usz depth);
+bool w_flush(writer_t *);
+void w_free(writer_t *);
+
+#define DUMP_FORMATS                                                           \
+    F(DUMP_TEXT, "text")                                                       \
+    F(DUMP_SEXPR, "sexpr")                                                     \
+    F(DUMP_JSON, "json")
+
+typedef enum {
+#define F(id, name) id,
+    DUMP_FORMATS
+#undef F
+} dump_format_t;
+
+// Looks up a format by its `--dump-ast` name, returns false if unknown.
+bool dump_format(const char *, dump_format_t *);
+
+// `repeats` are those of the unit in DAG mode, and may be NULL
+void dump_decls(writer_t *, decls_t *, dump_format_t,
+                const dag_repeats_t *repeats);
+
+// `dump_decls` a declaration at a time: `index` is the position of the
+// declaration in the output and `count` the number written.
+void dump_begin(writer_t *, dump_format_t);
+void dump_decl(writer_t *, decl_t *, dump_format_t, usz index);
+void dump_end(writer_t *, dump_format_t, usz count);
+
+// Writes only the name and, for functions, the signature of each
+// declaration without touching function bodies.
+void dump_signatures(writer_t *, decls_t *);
+void dump_signature(writer_t *, decl_t *);
+
+#endif // !DUMP_H
@@ -4,11 +4,12 @@
 #include "common.h"
 #include "span.h"
 #include <stdarg.h>
+#include <stdbool.h>
 
 typedef struct {
     span_t span;
-    source_loc_t source_loc;
     char *msg;
+    bool warning;
 } error_t;
 
 typedef array_t(error_t) errors_t;
@@ -0,0 +1,71 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "ast.h"
+#include "common.h"
+#include "error.h"
+#include "types.h"
+#include <stdbool.h>
+
+// Rows evaluated at a time: every intermediate result is a batch of this
+// many values, small enough for all of them to stay in cache
+#define EV_BATCH 1024
+
+// A column of values an identifier of a formula is bound to
+typedef struct {
+    const char *name;
+    tid_t type; // TID_INT or TID_FLOAT
+
+    union {
+        const i64 *ints;
+        const double *floats;
+    };
+} ev_column_t;
+
+// Where an instruction reads or writes its values
+typedef struct {
+    enum { EV_COLUMN, EV_REGISTER, EV_CONSTANT, EV_OUTPUT } type;
+    u32 index; // of the column or register
+
+    union {
+        i64 int_;
+        double float_;
+    };
+} ev_operand_t;
+
+// Computes `count` values of `dst` from those of `lhs` and `rhs`; a constant
+// operand is a single value
+typedef void (*ev_kernel_t)(void *dst, const void *lhs, const void *rhs,
+                            usz count);
+
+typedef struct {
+    ev_kernel_t kernel;
+    ev_operand_t dst, lhs, rhs;
+} ev_instr_t;
+
+// A formula compiled for evaluation over columns. Every instruction is one
+// kernel run over a whole batch, so there is no dispatch per row.
+typedef struct {
+    tid_t type; // of the result
+    array_t(ev_instr_t) instrs;
+    array_t(const void *) columns; // the values of those the formula uses
+    u32 registers;
+    ev_operand_t result; // when the formula is a lone column or constant
+} ev_program_t;
+
+// Compiles `expr`, made of `E_INT`, `E_FLOAT`, `E_IDENT`, `E_BINOP` with
+// `+ - * / %` and unary `-`, binding each identifier to the column of that
+// name. Types are checked as they are by the type checker: both operands of
+// an operator have the same type. Integers wrap, and integer division by
+// zero gives 0. Literal subexpressions are computed here, once. Returns
+// false, with diagnostics appended to `errors`, if `expr` cannot be
+// evaluated.
+bool ev_compile(ev_program_t *, expr_t *, const ev_column_t *, usz count,
+                errors_t *);
+
+// Evaluates the formula on the first `rows` values of its columns into
+// `out`, an array of `rows` values of the program's type
+void ev_run(const ev_program_t *, usz rows, void *out);
+void ev_free(ev_program_t *);
+
+#endif // !EVAL_H
@@ -0,0 +1,13 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "common.h"
+#include "walk.h"
+
+// A pass that replaces arithmetic on literals with its result in type
+// checked expressions, so `2 * 3 + x` becomes `6 + x`. Integer operations
+// that would overflow or divide by zero are left alone. The number of nodes
+// folded away is added to `*folded`.
+pass_t fold_pass(usz *folded);
+
+#endif // !FOLD_H
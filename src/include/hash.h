@@ -0,0 +1,37 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "common.h"
+#include <string.h>
+
+// Hashes `length` bytes eight at a time. Not cryptographic; meant for hash
+// tables and content keys.
+static inline u64 hash_bytes(const void *data, usz length) {
+    const u8 *p = data;
+    u64 h = 0x9E3779B97F4A7C15 ^ (length * 0xC2B2AE3D27D4EB4F);
+    while (length >= 8) {
+        u64 v;
+        memcpy(&v, p, sizeof(v));
+        h = (h ^ v) * 0xFF51AFD7ED558CCD;
+        h ^= h >> 32;
+        p += 8;
+        length -= 8;
+    }
+
+    u64 v = 0;
+    memcpy(&v, p, length);
+    h = (h ^ v) * 0xC4CEB9FE1A85EC53;
+    h ^= h >> 29;
+    h *= 0xFF51AFD7ED558CCD;
+    h ^= h >> 32;
+    return h;
+}
+
+// Mixes `value` into the hash `h`
+static inline u64 hash_combine(u64 h, u64 value) {
+    h ^= value + 0x9E3779B97F4A7C15 + (h << 6) + (h >> 2);
+    h *= 0xFF51AFD7ED558CCD;
+    return h ^ (h >> 32);
+}
+
+#endif // !HASH_H
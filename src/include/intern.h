@@ -0,0 +1,28 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "common.h"
+#include <stddef.h>
+
+// Interned strings are unique per content, so two of them are equal exactly
+// when their pointers are. The interner is global, thread-safe and lives
+// for the whole run; its hash and the length of each string are stored in
+// front of the characters.
+typedef struct {
+    u64 hash;
+    usz length;
+    char chars[];
+} interned_t;
+
+const char *intern(const char *, usz);
+const char *intern_cstr(const char *);
+
+static inline u64 intern_hash(const char *s) {
+    return ((const interned_t *)(s - offsetof(interned_t, chars)))->hash;
+}
+
+static inline usz intern_length(const char *s) {
+    return ((const interned_t *)(s - offsetof(interned_t, chars)))->length;
+}
+
+#endif // !INTERN_H
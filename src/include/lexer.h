@@ -2,16 +2,66 @@
 #define LEXER_H
 
 #include "common.h"
+#include "error.h"
+#include "source.h"
 #include "tokens.h"
 
+// Positions are indexes into the file's text; spans of tokens are offset
+// by the file's base to make them global.
 typedef struct {
-    char *source, *filename;
+    source_file_t *file;
+    char *source;
     usz length, pos;
+    u32 base;
     bool in_string;
+    errors_t errors;
+
+    // leave identifiers, strings and stray characters where they are in the
+    // source: their `string_value` is NULL, and their span says where
+    bool raw;
+
+    // tokens lexed ahead of time, see `l_init_lexed`
+    tokens_t lexed;
+    errors_t lexed_errors;
+    usz next_token, next_error;
+
+    // tokens lexed on another thread, see `l_init_pipelined`
+    struct l_ring_t *ring;
 } lexer_t;
 
-void l_init(lexer_t *, char *, char *);
+void l_init(lexer_t *, source_file_t *);
+void l_init_range(lexer_t *, source_file_t *, usz, usz);
 void l_free(lexer_t *);
 void l_next(lexer_t *, token_t *);
+u8 l_keyword(const char *, usz);
+
+// Lexes `file->text[start..end)` on up to `jobs` threads, 0 for one per CPU,
+// into `tokens`, the last of which is `T_EOF`, and appends the diagnostics
+// to `errors`. Both are exactly what calling `l_next` until it returns
+// `T_EOF` would have produced.
+void l_lex(source_file_t *, usz start, usz end, usz jobs, tokens_t *,
+           errors_t *);
+
+// Initializes a lexer over `file->text[start..end)` whose `l_next` hands out
+// `tokens` and their diagnostics, as returned by `l_lex`, instead of lexing.
+// It takes both over.
+void l_init_lexed(lexer_t *, source_file_t *, usz start, usz end, tokens_t *,
+                  errors_t *);
+
+// Initializes a lexer over `file->text[start..end)` whose `l_next` hands out
+// the tokens a thread of its own lexes ahead, with their diagnostics. Falls
+// back to lexing on the calling thread, and returns false, if the thread
+// cannot be started.
+bool l_init_pipelined(lexer_t *, source_file_t *, usz start, usz end);
+
+// Stops a lexer set up by `l_init_lexed` or `l_init_pipelined` and frees the
+// tokens it did not hand out; does nothing for the others.
+void l_stop(lexer_t *);
+
+// What the lexer skips between tokens. <ctype.h> depends on the locale and
+// is undefined for bytes past 0x7F, which UTF-8 sources are full of.
+static inline bool l_is_space(char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
 
 #endif // !LEXER_H
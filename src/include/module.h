@@ -0,0 +1,45 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "analyzer.h"
+#include "ast.h"
+#include "common.h"
+#include "error.h"
+#include "source.h"
+#include "unit.h"
+
+// A module interface, mapped from its `.cfi` file or built in memory when
+// the module had to be compiled.
+typedef struct {
+    const u8 *data;
+    usz size;
+    bool mapped;
+} interface_t;
+
+typedef struct {
+    char *path; // as resolved by realpath()
+    interface_t interface;
+} module_t;
+
+// The modules one compilation imports, directly or not. Modules that have
+// to be compiled are added to the importer's source manager, so their
+// diagnostics print like its own.
+typedef struct {
+    source_manager_t *sources;
+    unit_options_t opts;
+    errors_t errors;           // diagnostics of the modules compiled
+    array_t(module_t) loaded;  // each module is loaded once per compilation
+    array_t(char *) owned;     // names and texts of the files compiled
+} modules_t;
+
+void modules_init(modules_t *, source_manager_t *, unit_options_t);
+void modules_free(modules_t *);
+
+// Makes the declarations of every module `file` imports visible to `a`.
+// `import name;` refers to `name.cf` next to the importing file. Its
+// interface is read from `name.cfi` when that is up to date, and the module
+// is compiled, and its interface written, when it is not.
+void modules_import(modules_t *, source_file_t *file, imports_t *,
+                    analyzer_t *);
+
+#endif // !MODULE_H
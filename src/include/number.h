@@ -0,0 +1,37 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// What a scanner found in the bytes it consumed
+typedef struct {
+    u64 value;      // unspecified when `overflow` is set
+    usz digits;     // not counting separators
+    bool overflow;  // the literal does not fit in 64 bits
+    bool misplaced; // a `_` that is not between two digits
+} num_scan_t;
+
+// Numeric literal parsing straight from the source buffer. The scanners
+// consume digits and `_` digit separators starting at `s`, never read past
+// `end`, and return the number of bytes consumed.
+usz num_scan_dec(const char *s, const char *end, num_scan_t *);
+usz num_scan_hex(const char *s, const char *end, num_scan_t *);
+usz num_scan_bin(const char *s, const char *end, num_scan_t *);
+
+// Converts a `digits.digits` literal (with optional `_` separators) to the
+// nearest double.
+double num_parse_float(const char *s, usz length);
+
+// Longest output of num_format_float, the smallest subnormal written out in
+// full
+#define NUM_FLOAT_MAX 352
+
+// Write the decimal form of a number to `buf` without a terminating NUL and
+// return its length. Floats are written with the fewest digits that read
+// back as the same double, always in `digits.digits` form.
+usz num_format_u64(u64 value, char *buf);
+usz num_format_i64(i64 value, char *buf);
+usz num_format_float(double value, char *buf);
+
+#endif // !NUMBER_H
@@ -1,30 +1,50 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "arena.h"
 #include "ast.h"
 #include "common.h"
+#include "dag.h"
 #include "error.h"
 #include "lexer.h"
 #include <stdbool.h>
 
+// Deepest nesting of prefix operators, functions and right operands the
+// parser takes. Deeper is a syntax error, so that nothing that recurses
+// over the tree, from the parser to the dumps, runs out of stack.
+#define P_MAX_DEPTH (1 << 18)
+
 typedef struct {
     lexer_t *lexer;
-    token_t token;
+    arena_t *arena; // every node is allocated from here
+    token_t token, next;
+    bool has_next;
+    bool skim; // skip function bodies, see `ast_fn_body`
     errors_t errors;
+    errors_t *body_errors; // where skipped bodies report, `&errors` by default
+    imports_t *imports;    // where leading imports go, NULL to skip them
+    dag_t *dag;            // shares equal expressions, NULL to build a tree
+    // of the expression parsed last, which is not that of its node when
+    // the node is shared
+    span_t span;
+    u32 depth; // of the nesting, up to P_MAX_DEPTH
 } parser_t;
 
-void p_init(parser_t *, lexer_t *);
+void p_init(parser_t *, lexer_t *, arena_t *);
 void p_free(parser_t *);
 
 void p_advance(parser_t *);
+token_t *p_peek(parser_t *);
 bool p_expect(parser_t *, u8);
 void p_error(parser_t *, const char *, ...);
 
 decl_t *p_parse_decl(parser_t *);
+bool p_parse_unit_decl(parser_t *, decl_t **);
 stmt_t *p_parse_stmt(parser_t *);
 
 expr_t *p_parse_expr(parser_t *);
 expr_t *p_parse_precedence(parser_t *, expr_t *, u8);
+expr_t *p_parse_unary(parser_t *);
 expr_t *p_parse_primary(parser_t *);
 
 type_t *p_parse_type(parser_t *);
@@ -0,0 +1,52 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "common.h"
+#include "dump.h"
+#include <stdbool.h>
+
+// The hardware and software events counted with `--perf-counters`
+#define PERF_COUNTERS                                                          \
+    PERF_COUNTER(CYCLES, "cycles")                                             \
+    PERF_COUNTER(INSTRUCTIONS, "instructions")                                 \
+    PERF_COUNTER(BRANCH_MISSES, "branch-misses")                               \
+    PERF_COUNTER(L1D_MISSES, "L1D-misses")                                     \
+    PERF_COUNTER(LLC_MISSES, "LLC-misses")                                     \
+    PERF_COUNTER(PAGE_FAULTS, "page-faults")
+
+enum {
+#define PERF_COUNTER(name, label) PERF_##name,
+    PERF_COUNTERS
+#undef PERF_COUNTER
+    PERF_COUNT,
+};
+
+typedef struct {
+    const char *name;
+    u64 counts[PERF_COUNT];
+    u64 ns; // wall-clock time
+} perf_phase_t;
+
+// Counters of the calling thread and the threads it starts, read between
+// phases. Each phase is what was counted since the previous `perf_lap`.
+typedef struct {
+    int fds[PERF_COUNT]; // -1 where the counter could not be opened
+    int error;           // errno of the first counter that failed to open
+    u64 last[PERF_COUNT];
+    u64 last_ns;
+    array_t(perf_phase_t) phases;
+} perf_t;
+
+// Returns false if no counter could be opened, e.g. when perf_event_paranoid
+// forbids it; `perf_report` then says why.
+bool perf_open(perf_t *);
+void perf_close(perf_t *);
+
+// Attributes everything counted since the previous lap to `phase`. Laps with
+// the same name add up.
+void perf_lap(perf_t *, const char *phase);
+
+// Writes a table of the phases with their IPC and misses per KB of source
+void perf_report(perf_t *, writer_t *, usz source_size);
+
+#endif // !PERF_H
@@ -0,0 +1,23 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include "ast.h"
+#include "common.h"
+#include "unit.h"
+
+// What `prune` removed. Nodes are declarations, statements, parameters and
+// expressions; bodies skipped in skim mode are never parsed and not counted.
+typedef struct {
+    usz decls, nodes;
+} prune_stats_t;
+
+// Removes the top-level declarations that none of `roots`, a comma-separated
+// list of names, refers to, directly or through other declarations. Names
+// are matched without regard to scopes, so a local that shadows a
+// declaration keeps it. Skipped bodies of the declarations that are kept
+// are parsed to find what they refer to; the others are never parsed.
+// What was removed is added to `pruned` unless it is NULL. Returns false,
+// and leaves the unit alone, if none of the roots is declared.
+bool prune(unit_t *, const char *roots, prune_stats_t *);
+
+#endif // !PRUNE_H
@@ -0,0 +1,48 @@
+#ifndef SAX_H
+#define SAX_H
+
+#include "common.h"
+#include "error.h"
+#include "source.h"
+#include "span.h"
+#include "tokens.h"
+
+// A construct of the source, one of the nodes the parser would build
+typedef struct {
+    enum { SAX_IMPORT, SAX_DECL, SAX_PARAM, SAX_TYPE, SAX_EXPR } node;
+    u8 type; // E_* of an expression, TY_* of a type
+    // `::` or `:=` of a declaration, `:` or `:=` of a parameter, the
+    // operator of `E_BINOP` and `E_UNARY`
+    u8 op;
+    u32 depth; // constructs open around this one
+    // on entering, that of the first token, or of the operator of an
+    // `E_BINOP`; on leaving, that of the whole node
+    span_t span;
+    // the name of an import, declaration, parameter or `TY_UD`, or the token
+    // of an `E_IDENT`, `E_STRING`, `E_INT` or `E_FLOAT`. Names and strings
+    // are left in the source, see `lexer_t.raw`.
+    const token_t *token;
+} sax_event_t;
+
+// What `sax_parse` calls; any of them may be NULL. Events and diagnostics
+// are only valid during the call.
+typedef struct {
+    void (*enter)(void *ctx, const sax_event_t *);
+    void (*leave)(void *ctx, const sax_event_t *);
+    void (*error)(void *ctx, const error_t *);
+    void *ctx;
+} sax_handler_t;
+
+// Parses `file` as `unit_parse` does without skim mode, declaration by
+// declaration and with the same diagnostics in the same order, but builds
+// nothing: every construct is entered before its children and left after
+// them. An infix operator is only found after its left operand, which is
+// entered and left just before it, one level up. A declaration with a
+// syntax error is given up on without leaving what is still open, and the
+// next one starts at depth 0 again. Nothing allocated grows with the file
+// but a stack of the prefix operators open, 8 bytes each and P_MAX_DEPTH
+// at most, which are parsed in a loop rather than recursively. Returns the
+// number of diagnostics.
+usz sax_parse(source_file_t *, const sax_handler_t *);
+
+#endif // !SAX_H
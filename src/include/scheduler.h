@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// A Chase-Lev work-stealing deque. Its owner pushes and takes at the bottom;
+// any other thread may steal from the top. It grows as needed; buffers it
+// outgrew are kept until it is freed, since a thief may still be reading
+// one.
+typedef struct {
+    usz capacity; // a power of two
+    _Atomic(void *) items[];
+} deque_buffer_t;
+
+typedef struct {
+    _Atomic i64 top, bottom;
+    _Atomic(deque_buffer_t *) buffer;
+    array_t(deque_buffer_t *) retired;
+} deque_t;
+
+// Returned by `deque_steal` when it lost a race and should be retried
+#define DEQUE_ABORT ((void *)1)
+
+void deque_init(deque_t *);
+void deque_free(deque_t *);
+void deque_push(deque_t *, void *);
+void *deque_take(deque_t *);  // NULL if empty
+void *deque_steal(deque_t *); // NULL if empty, or DEQUE_ABORT
+
+typedef struct sched_t sched_t;
+
+typedef struct {
+    sched_t *sched;
+    deque_t deque;
+    void *ctx; // the worker's state, passed to `sched_run`
+    u64 rng;   // picks whom to steal from
+    pthread_t thread;
+    bool started;
+} sched_worker_t;
+
+typedef void (*sched_fn_t)(sched_worker_t *, void *task);
+
+struct sched_t {
+    sched_fn_t run;
+    sched_worker_t *workers;
+    usz count;
+    atomic_size_t pending; // tasks pushed and not yet finished
+};
+
+// Runs `run` on each of `tasks` and on every task those spawn, on `count`
+// workers of which the calling thread is the first. `contexts[i]` becomes
+// the `ctx` of worker `i`. Tasks run in no particular order.
+void sched_run(void **tasks, usz task_count, sched_fn_t run, void **contexts,
+               usz count);
+
+// Queues a task from within a running one
+void sched_spawn(sched_worker_t *, void *task);
+
+#endif // !SCHEDULER_H
@@ -0,0 +1,29 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "common.h"
+
+// Requests queued between the accepting thread and the workers
+#define SERVER_QUEUE 128
+
+// Largest argument list a client may send
+#define SERVER_MAX_REQUEST (64 * 1024)
+
+// Parse results kept by the server, evicted least recently used first
+#define SERVER_CACHE_BUCKETS 4096
+#define SERVER_CACHE_MAX 1024
+#define SERVER_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+// `coffee --server [--socket=PATH] [--jobs=N] [--verbose]`: compiles files for clients
+// connecting to a Unix socket, with `N` requests served at a time. Interned
+// names, parsed and checked files (keyed by their contents) and arenas are
+// kept across requests.
+int server_main(int argc, char *argv[]);
+
+// `coffee --client [--socket=PATH] <path> [OPT]`: has the server compile
+// `path`. The server reads the file and writes to this process's stdout and
+// stderr through descriptors passed over the socket. Compiles in-process
+// when no server is running.
+int client_main(int argc, char *argv[]);
+
+#endif // !SERVER_H
@@ -0,0 +1,46 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include "common.h"
+#include "span.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+// A file loaded into a source manager. It owns the global offsets
+// `base..base + length`, the last of which stands for its end of file.
+typedef struct {
+    char *name, *text; // borrowed, must outlive the manager
+    u32 base, length;
+    u32 *lines; // offset of the start of every line, built on first lookup
+    u32 line_count;
+} source_file_t;
+
+typedef array_t(source_file_t *) source_files_t;
+
+// Hands out one 32-bit offset space to every file of a compilation, so that
+// a span identifies its file without storing it.
+typedef struct {
+    source_files_t files; // ordered by base
+    u32 next;             // first offset not taken by a file
+    pthread_mutex_t lock;
+} source_manager_t;
+
+typedef struct {
+    const source_file_t *file;
+    u32 line, column; // 1-based, columns count bytes
+} source_loc_t;
+
+void sm_init(source_manager_t *);
+void sm_free(source_manager_t *);
+
+// Adds `text` under `name`, or returns NULL when the offset space is full
+source_file_t *sm_add(source_manager_t *, char *name, char *text, usz length);
+
+// Finds the file that owns `offset`, or NULL if no file does
+source_file_t *sm_file(source_manager_t *, u32 offset);
+
+// Resolves `offset` to a line and column. The file's line table is built the
+// first time one of its offsets is resolved.
+source_loc_t sm_resolve(source_manager_t *, u32 offset);
+
+#endif // !SOURCE_H
@@ -2,27 +2,19 @@
 #define SPAN_H
 
 #include "common.h"
-#include <string.h>
 
+// A range of bytes in the global offset space of a source manager, where
+// every loaded file owns a slice of its own (see source.h). Resolving it to
+// a file, line and column is left to whoever renders a diagnostic.
 typedef struct {
-    usz start, end;
+    u32 start, length;
 } span_t;
 
-typedef struct {
-    usz line, column;
-} source_loc_t;
+static inline u32 span_end(span_t span) { return span.start + span.length; }
 
-static inline source_loc_t span_to_source_loc(span_t span, const char *source) {
-    usz line = 1, column = 1;
-    for (usz i = 0; i < span.start; i++) {
-        if (source[i] == '\n') {
-            line++;
-            column = 1;
-        } else {
-            column++;
-        }
-    }
-    return (source_loc_t){line, column};
+// The span from the start of `from` to the end of `to`
+static inline span_t span_join(span_t from, span_t to) {
+    return (span_t){from.start, span_end(to) - from.start};
 }
 
 #endif // !SPAN_H
@@ -0,0 +1,26 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "common.h"
+#include <pthread.h>
+
+// Stack of the threads that parse and analyze. Parsing and the passes over
+// the AST recurse as deep as the tree, which for generated code, say a sum
+// of a million terms, is much more than the usual 8MB; pages are only used
+// as deep as the recursion goes.
+#define THREAD_STACK_SIZE ((usz)256 << 20)
+
+// `pthread_create` with a THREAD_STACK_SIZE stack, or the default one where
+// that cannot be reserved
+static inline int thread_create(pthread_t *thread, void *(*fn)(void *),
+                                void *arg) {
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0)
+        return pthread_create(thread, NULL, fn, arg);
+    int result = pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    if (result == 0) result = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return result == 0 ? 0 : pthread_create(thread, NULL, fn, arg);
+}
+
+#endif // !THREAD_H
@@ -16,27 +16,27 @@
     T(STRING_END, "<string_end>")                                              \
     T(STRING_MIDDLE, "<string_middle>")                                        \
                                                                                \
-    T_BIN(PLUS, "+", true, 5)                                                  \
-    T_BIN(PLUS_EQUALS, "+=", true, 1)                                          \
-    T_BIN(MINUS, "-", true, 5)                                                 \
-    T_BIN(MINUS_EQUALS, "-=", true, 1)                                         \
+    T_OP(PLUS, "+", TT_INFIX, 5)                                               \
+    T_OP(PLUS_EQUALS, "+=", TT_INFIX | TT_RIGHT, 1)                            \
+    T_OP(MINUS, "-", TT_INFIX | TT_PREFIX, 5)                                  \
+    T_OP(MINUS_EQUALS, "-=", TT_INFIX | TT_RIGHT, 1)                           \
     T(ARROW, "->")                                                             \
-    T_BIN(ASTERISK, "*", true, 6)                                              \
-    T_BIN(ASTERISK_EQUALS, "*=", true, 1)                                      \
-    T_BIN(SLASH, "/", true, 6)                                                 \
-    T_BIN(SLASH_EQUALS, "/=", true, 1)                                         \
-    T_BIN(PERCENT, "%", true, 7)                                               \
-    T_BIN(PERCENT_EQUALS, "%=", true, 1)                                       \
-    T_BIN(EQUALS, "=", true, 1)                                                \
-    T_BIN(EQUALS_EQUALS, "==", true, 2)                                        \
-    T(BANG, "!")                                                               \
-    T_BIN(BANG_EQUALS, "!=", true, 2)                                          \
-    T_BIN(LESS_THAN, "<", true, 3)                                             \
-    T_BIN(LESS_THAN_EQUALS, "<=", true, 3)                                     \
-    T_BIN(GREATER_THAN, ">", true, 3)                                          \
-    T_BIN(GREATER_THAN_EQUALS, ">=", true, 3)                                  \
+    T_OP(ASTERISK, "*", TT_INFIX, 6)                                           \
+    T_OP(ASTERISK_EQUALS, "*=", TT_INFIX | TT_RIGHT, 1)                        \
+    T_OP(SLASH, "/", TT_INFIX, 6)                                              \
+    T_OP(SLASH_EQUALS, "/=", TT_INFIX | TT_RIGHT, 1)                           \
+    T_OP(PERCENT, "%", TT_INFIX, 7)                                            \
+    T_OP(PERCENT_EQUALS, "%=", TT_INFIX | TT_RIGHT, 1)                         \
+    T_OP(EQUALS, "=", TT_INFIX | TT_RIGHT, 1)                                  \
+    T_OP(EQUALS_EQUALS, "==", TT_INFIX, 2)                                     \
+    T_OP(BANG, "!", TT_PREFIX, 0)                                              \
+    T_OP(BANG_EQUALS, "!=", TT_INFIX, 2)                                       \
+    T_OP(LESS_THAN, "<", TT_INFIX, 3)                                          \
+    T_OP(LESS_THAN_EQUALS, "<=", TT_INFIX, 3)                                  \
+    T_OP(GREATER_THAN, ">", TT_INFIX, 3)                                       \
+    T_OP(GREATER_THAN_EQUALS, ">=", TT_INFIX, 3)                               \
     T(QUESTION, "?")                                                           \
-    T_BIN(QUESTION_QUESTION, "??", true, 4)                                    \
+    T_OP(QUESTION_QUESTION, "??", TT_INFIX, 4)                                 \
                                                                                \
     T(OPEN_PAREN, "(")                                                         \
     T(CLOSE_PAREN, ")")                                                        \
@@ -48,48 +48,61 @@
     T(COLON_EQUALS, ":=")                                                      \
     T(COMMA, ",")                                                              \
     T(ERROR, "<error>")                                                        \
-    T(EOF, "<eof>")
+    T(EOF, "<eof>")                                                            \
+                                                                               \
+    T_KW(IF, "if")                                                             \
+    T_KW(ELSE, "else")                                                         \
+    T_KW(WHILE, "while")                                                       \
+    T_KW(RETURN, "return")                                                     \
+    T_KW(STRUCT, "struct")                                                     \
+    T_KW(IMPORT, "import")
 
 enum {
 #define T(id, ...) T_##id,
-#define T_BIN(id, ...) T_##id,
+#define T_OP(id, ...) T_##id,
+#define T_KW(id, ...) T_##id,
     TOKENS
-#undef T_BIN
+#undef T_KW
+#undef T_OP
 #undef T
+    T_COUNT,
 };
 
-static inline const char *tt_name(u8 type) {
-    const char *names[] = {
-#define T(id, name) [T_##id] = name,
-#define T_BIN(id, name, ...) [T_##id] = name,
-        TOKENS
-#undef T_BIN
+// Operator flags. Infix operators are parsed by precedence climbing, prefix
+// operators bind tighter than any infix operator, and right-associative
+// operators (the assignments) accept a chain of operators of their own
+// precedence on their right-hand side.
+#define TT_INFIX (1 << 0)
+#define TT_PREFIX (1 << 1)
+#define TT_POSTFIX (1 << 2)
+#define TT_RIGHT (1 << 3)
+#define TT_KEYWORD (1 << 4)
+
+typedef struct {
+    const char *name;
+    u8 flags;
+    u8 precedence;
+} tt_info_t;
+
+static const tt_info_t tt_info[T_COUNT] = {
+#define T(id, name) [T_##id] = {name, 0, 0},
+#define T_OP(id, name, flags, prec) [T_##id] = {name, (flags), (prec)},
+#define T_KW(id, name) [T_##id] = {name, TT_KEYWORD, 0},
+    TOKENS
+#undef T_KW
+#undef T_OP
 #undef T
-    };
-    return names[type];
-}
+};
+
+static inline const char *tt_name(u8 type) { return tt_info[type].name; }
 
 static inline bool tt_is_binop(u8 type) {
-    bool is_binop[] = {
-#define T(id, ...) [T_##id] = false,
-#define T_BIN(id, _a, binop, ...) [T_##id] = binop,
-        TOKENS
-#undef T_BIN
-#undef T
-    };
-    return is_binop[type];
+    return (tt_info[type].flags & TT_INFIX) != 0;
 }
 
 static inline u8 tt_precedence(u8 type) {
-    i8 precs[] = {
-#define T(id, ...) [T_##id] = -1,
-#define T_BIN(id, _a, _b, prec) [T_##id] = prec,
-        TOKENS
-#undef T_BIN
-#undef T
-    };
-    if (precs[type] < 0) return 128;
-    return (u8)precs[type];
+    if (!tt_is_binop(type)) return 128;
+    return tt_info[type].precedence;
 }
 
 typedef struct token_t token_t;
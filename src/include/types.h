@@ -0,0 +1,50 @@
+#ifndef TYPES_H
+#define TYPES_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// Semantic types are hash-consed into one global table: structurally equal
+// types always get the same id, so comparing two types is comparing two
+// integers. The table is thread-safe and entries never move once created.
+typedef u32 tid_t;
+
+// The builtin types, which always have these ids
+enum {
+    TID_ERROR, // the type of anything that failed to check
+    TID_VOID,
+    TID_INT,
+    TID_FLOAT,
+    TID_BOOL,
+    TID_STRING,
+};
+
+typedef struct {
+    enum {
+        TK_ERROR,
+        TK_VOID,
+        TK_INT,
+        TK_FLOAT,
+        TK_BOOL,
+        TK_STRING,
+        TK_PTR,
+        TK_FN,
+    } kind;
+    tid_t inner;         // TK_PTR: the pointee, TK_FN: the return type
+    u32 param_count;     // TK_FN
+    const tid_t *params; // TK_FN
+} typeinfo_t;
+
+const typeinfo_t *ty_get(tid_t);
+tid_t ty_builtin(const char *);
+tid_t ty_ptr(tid_t);
+tid_t ty_fn(const tid_t *, u32, tid_t);
+usz ty_count(void);
+
+usz ty_format(tid_t, char *, usz);
+
+static inline bool ty_is_numeric(tid_t ty) {
+    return ty == TID_INT || ty == TID_FLOAT;
+}
+
+#endif // !TYPES_H
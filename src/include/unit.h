@@ -0,0 +1,56 @@
+#ifndef UNIT_H
+#define UNIT_H
+
+#include "arena.h"
+#include "ast.h"
+#include "common.h"
+#include "dag.h"
+#include "error.h"
+#include "source.h"
+
+typedef array_t(usz) offsets_t;
+typedef array_t(arena_t *) arenas_t;
+
+typedef struct {
+    usz jobs; // number of parsing threads, 0 for one per CPU
+    bool skim;
+    bool pipeline; // lex large declarations on another thread as they parse
+    bool dag; // share equal expressions within each function, see dag.h
+    arena_pool_t *pool; // where arenas come from and go back to, or NULL
+} unit_options_t;
+
+// A parsed translation unit. Declarations and diagnostics are in source
+// order; the nodes live in `arenas`, one per parsing thread.
+typedef struct {
+    source_file_t *file;
+    decls_t decls;
+    imports_t imports;
+    errors_t errors;
+    arenas_t arenas;
+    arena_pool_t *pool;
+    dag_repeats_t repeats; // in DAG mode, in source order
+} unit_t;
+
+// Where `unit_scan` is in a file
+typedef struct {
+    usz pos, depth;
+} unit_scan_t;
+
+// Finds the start of the next top-level declaration from where `scan` is,
+// which starts out zeroed, and returns false when there is none left
+bool unit_scan(const char *, usz, unit_scan_t *, usz *start);
+
+// Finds the start of every top-level declaration
+void unit_split(const char *, usz, offsets_t *);
+bool unit_validate(source_file_t *, errors_t *);
+
+// Parses `file->text[start..end)` as one top-level declaration, the way a
+// chunk of `unit_parse` is. Diagnostics, including those of bodies skipped
+// in skim mode and parsed later, are appended to `errors`. Leading imports
+// are appended to `imports` unless it is NULL.
+decl_t *unit_parse_decl(source_file_t *, usz start, usz end, arena_t *,
+                        bool skim, imports_t *, errors_t *);
+void unit_parse(unit_t *, source_file_t *, unit_options_t);
+void unit_free(unit_t *);
+
+#endif // !UNIT_H
@@ -0,0 +1,43 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// Checks that `s` is well-formed UTF-8: no overlong forms, surrogates, code
+// points past U+10FFFF or truncated sequences. On failure `error` is set to
+// the offset of the first bad byte. Runs 16 bytes at a time with SSSE3 when
+// the CPU has it, and skips pure-ASCII blocks on either path.
+bool utf8_validate(const char *s, usz length, usz *error);
+
+// Portable version of `utf8_validate`, used when SSSE3 is not available
+bool utf8_validate_scalar(const char *s, usz length, usz *error);
+
+// Decodes the code point at `s` and stores its length in `size`. Expects
+// valid input; a malformed sequence decodes as U+FFFD of length 1.
+u32 utf8_decode(const char *s, const char *end, usz *size);
+
+bool xid_start(u32);
+bool xid_continue(u32);
+
+// Length of the identifier character at `s`, 0 if it cannot start (or
+// continue) an identifier. ASCII letters, digits and `_` are decided inline.
+static inline usz utf8_ident_start(const char *s, const char *end) {
+    u8 ch = (u8)*s;
+    if (ch < 0x80)
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+               ch == '_';
+    usz size;
+    return xid_start(utf8_decode(s, end, &size)) ? size : 0;
+}
+
+static inline usz utf8_ident_continue(const char *s, const char *end) {
+    u8 ch = (u8)*s;
+    if (ch < 0x80)
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+               (ch >= '0' && ch <= '9') || ch == '_';
+    usz size;
+    return xid_continue(utf8_decode(s, end, &size)) ? size : 0;
+}
+
+#endif // !UTF8_H
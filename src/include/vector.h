@@ -0,0 +1,83 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "arena.h"
+#include "common.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Growth policy of a small vector once it outgrows its inline storage
+#ifndef SV_GROW
+#define SV_GROW(capacity) ((capacity) * 2)
+#endif
+
+// A dynamic array whose first N elements are stored inside the struct, for
+// lists that are usually short and built on the stack while parsing. Past N
+// the elements move to the heap, or to `arena` when one is set. Once the
+// list is complete, `sv_finish` copies it to an exact-size `array_t` in an
+// arena and releases the vector.
+#define small_array_t(T, N)                                                    \
+    struct {                                                                   \
+        T *heap; /* NULL while the elements are inline */                      \
+        usz count;                                                             \
+        usz capacity; /* of `heap` */                                          \
+        arena_t *arena;                                                        \
+        T inline_items[N];                                                     \
+    }
+
+#define sv_inline_capacity(sv)                                                 \
+    (sizeof((sv)->inline_items) / sizeof(*(sv)->inline_items))
+#define sv_items(sv) ((sv)->heap != NULL ? (sv)->heap : (sv)->inline_items)
+
+// Moves `count` elements of `size` bytes to storage for SV_GROW(count),
+// which is returned along with its capacity
+static inline void *sv_grow(void *items, bool on_heap, usz count, usz size,
+                            usz *capacity, arena_t *arena) {
+    *capacity = SV_GROW(count);
+    void *grown;
+    if (arena != NULL) {
+        grown = arena_alloc(arena, *capacity * size);
+        memcpy(grown, items, count * size);
+    } else if (on_heap) {
+        grown = realloc(items, *capacity * size);
+        assert(grown != NULL && "Buy more RAM lol");
+    } else {
+        grown = malloc(*capacity * size);
+        assert(grown != NULL && "Buy more RAM lol");
+        memcpy(grown, items, count * size);
+    }
+    return grown;
+}
+
+#define sv_append(sv, item)                                                    \
+    do {                                                                       \
+        if ((sv)->count == ((sv)->heap != NULL ? (sv)->capacity                \
+                                               : sv_inline_capacity(sv)))      \
+            (sv)->heap = sv_grow(sv_items(sv), (sv)->heap != NULL,             \
+                                 (sv)->count, sizeof(*(sv)->inline_items),     \
+                                 &(sv)->capacity, (sv)->arena);                \
+        sv_items(sv)[(sv)->count++] = (item);                                  \
+    } while (0)
+
+#define sv_free(sv)                                                            \
+    do {                                                                       \
+        if ((sv)->heap != NULL && (sv)->arena == NULL) free((sv)->heap);       \
+        (sv)->heap = NULL;                                                     \
+        (sv)->count = 0;                                                       \
+        (sv)->capacity = 0;                                                    \
+    } while (0)
+
+// Stores the elements in `out`, an `array_t` of the same type, allocated
+// from `arena` with no spare capacity
+#define sv_finish(sv, to, out)                                                 \
+    do {                                                                       \
+        usz size_ = (sv)->count * sizeof(*(sv)->inline_items);                 \
+        (out)->items = size_ > 0 ? arena_alloc((to), size_) : NULL;            \
+        if (size_ > 0) memcpy((out)->items, sv_items(sv), size_);              \
+        (out)->count = (out)->capacity = (sv)->count;                          \
+        sv_free(sv);                                                           \
+    } while (0)
+
+#endif // !VECTOR_H
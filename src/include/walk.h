@@ -0,0 +1,44 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include "ast.h"
+#include "common.h"
+#include <stdbool.h>
+
+// Most passes one traversal runs, each is a bit of a mask
+#define WALK_MAX_PASSES 64
+
+// A pass over the AST. `pre_*` is called on a node before its children and
+// returns whether the pass wants to see them, `post_*` after them. Hooks
+// may be NULL, in which case the children are visited.
+typedef struct {
+    bool (*pre_decl)(void *ctx, decl_t *);
+    void (*post_decl)(void *ctx, decl_t *);
+    bool (*pre_stmt)(void *ctx, stmt_t *);
+    void (*post_stmt)(void *ctx, stmt_t *);
+    bool (*pre_param)(void *ctx, param_t *);
+    void (*post_param)(void *ctx, param_t *);
+    bool (*pre_expr)(void *ctx, expr_t *);
+    void (*post_expr)(void *ctx, expr_t *);
+    void *ctx;
+} pass_t;
+
+// Runs several passes in one traversal, which touches every node once
+// however many passes there are. At each node the hooks of the passes are
+// called in order, both on the way down and on the way back up, so a pass
+// sees the nodes the way it would on a traversal of its own, with the
+// changes of the passes before it at that node and below.
+typedef struct {
+    pass_t *passes;
+    usz count;
+    bool bodies; // parse bodies skipped in skim mode rather than leave them out
+} walker_t;
+
+void walk_decls(walker_t *, decls_t *);
+void walk_decl(walker_t *, decl_t *);
+void walk_expr(walker_t *, expr_t *);
+
+// A pass that adds every node it is called on to `*count`
+pass_t walk_counter(usz *count);
+
+#endif // !WALK_H
@@ -0,0 +1,84 @@
+#include "include/intern.h"
+#include "include/arena.h"
+#include "include/hash.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The table is split into shards by the top bits of the hash, each with its
+// own lock, so parser threads rarely contend.
+#define INTERN_SHARD_BITS 6
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_INIT_CAP 256
+
+typedef struct {
+    pthread_mutex_t lock;
+    interned_t **slots; // open addressing, linear probing
+    usz capacity, count;
+    arena_t arena; // the strings themselves
+} intern_shard_t;
+
+static intern_shard_t shards[INTERN_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void intern_init(void) {
+    for (usz i = 0; i < INTERN_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        arena_init(&shards[i].arena);
+    }
+}
+
+static void shard_grow(intern_shard_t *shard) {
+    usz capacity = shard->capacity == 0 ? INTERN_INIT_CAP : shard->capacity * 2;
+    interned_t **slots = calloc(capacity, sizeof(interned_t *));
+    assert(slots != NULL && "Buy more RAM lol");
+
+    for (usz i = 0; i < shard->capacity; i++) {
+        interned_t *entry = shard->slots[i];
+        if (entry == NULL) continue;
+        usz slot = entry->hash & (capacity - 1);
+        while (slots[slot] != NULL)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = entry;
+    }
+
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+}
+
+const char *intern(const char *s, usz length) {
+    pthread_once(&shards_once, intern_init);
+
+    u64 hash = hash_bytes(s, length);
+    intern_shard_t *shard = &shards[hash >> (64 - INTERN_SHARD_BITS)];
+    pthread_mutex_lock(&shard->lock);
+
+    if ((shard->count + 1) * 4 > shard->capacity * 3) shard_grow(shard);
+
+    usz mask = shard->capacity - 1, slot = hash & mask;
+    for (;; slot = (slot + 1) & mask) {
+        interned_t *entry = shard->slots[slot];
+        if (entry == NULL) break;
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->chars, s, length) == 0) {
+            pthread_mutex_unlock(&shard->lock);
+            return entry->chars;
+        }
+    }
+
+    interned_t *entry =
+        arena_alloc(&shard->arena, sizeof(interned_t) + length + 1);
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->chars, s, length);
+    entry->chars[length] = '\0';
+    shard->slots[slot] = entry;
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->lock);
+    return entry->chars;
+}
+
+const char *intern_cstr(const char *s) { return intern(s, strlen(s)); }
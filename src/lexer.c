@@ -1,49 +1,183 @@
 #include "include/lexer.h"
-#include <ctype.h>
+#include "include/intern.h"
+#include "include/log.h"
+#include "include/number.h"
+#include "include/utf8.h"
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-void l_init(lexer_t *l, char *source, char *filename) {
-    l->source = source;
-    l->filename = filename;
-    l->length = strlen(source);
-    l->pos = 0;
+// Keywords are recognized with a perfect hash over the length and the first,
+// second and last byte of an identifier. The table is built from the `T_KW`
+// entries in `TOKENS` by searching for a multiplier that maps every keyword
+// to its own slot, so classifying an identifier is one hash, one probe and
+// one fixed-length compare.
+#define KW_TABLE_BITS 6
+#define KW_TABLE_SIZE (1 << KW_TABLE_BITS)
+#define KW_MIN_LENGTH 2
+#define KW_MAX_LENGTH 8
+
+typedef struct {
+    const char *name;
+    u8 length;
+    u8 type;
+} keyword_t;
+
+static const keyword_t keywords[] = {
+#define T(...)
+#define T_OP(...)
+#define T_KW(id, name) {name, sizeof(name) - 1, T_##id},
+    TOKENS
+#undef T_KW
+#undef T_OP
+#undef T
+};
+
+static keyword_t kw_table[KW_TABLE_SIZE];
+static u32 kw_seed = 0;
+static pthread_once_t kw_once = PTHREAD_ONCE_INIT;
+
+static inline u32 kw_hash(u32 seed, const char *s, usz length) {
+    u32 key = (u32)(u8)s[0] | (u32)(u8)s[1] << 8 |
+              (u32)(u8)s[length - 1] << 16 | (u32)length << 24;
+    return (key * seed) >> (32 - KW_TABLE_BITS);
+}
+
+static void kw_init(void) {
+    usz count = sizeof(keywords) / sizeof(keywords[0]);
+    for (usz i = 0; i < count; i++)
+        assert(keywords[i].length >= KW_MIN_LENGTH &&
+               keywords[i].length <= KW_MAX_LENGTH);
+
+    for (u32 seed = 0x9e3779b1; seed != 0; seed += 2) {
+        bool used[KW_TABLE_SIZE] = {0};
+        bool ok = true;
+        for (usz i = 0; i < count && ok; i++) {
+            u32 slot = kw_hash(seed, keywords[i].name, keywords[i].length);
+            ok = !used[slot];
+            used[slot] = true;
+        }
+        if (!ok) continue;
+
+        for (usz i = 0; i < count; i++)
+            kw_table[kw_hash(seed, keywords[i].name, keywords[i].length)] =
+                keywords[i];
+        kw_seed = seed;
+        return;
+    }
+    assert(false && "no perfect hash for the keyword set");
+}
+
+u8 l_keyword(const char *s, usz length) {
+    if (length < KW_MIN_LENGTH || length > KW_MAX_LENGTH) return T_IDENT;
+    const keyword_t *kw = &kw_table[kw_hash(kw_seed, s, length)];
+    if (kw->length != length || memcmp(kw->name, s, length) != 0)
+        return T_IDENT;
+    return kw->type;
+}
+
+void l_init(lexer_t *l, source_file_t *file) {
+    l_init_range(l, file, 0, file->length);
+}
+
+// Initializes a lexer over `file->text[start..end)`
+void l_init_range(lexer_t *l, source_file_t *file, usz start, usz end) {
+    pthread_once(&kw_once, kw_init);
+
+    l->file = file;
+    l->source = file->text;
+    l->base = file->base;
+    l->length = end;
+    l->pos = start;
+    l->in_string = false;
+    l->errors = (errors_t){0};
+    l->raw = false;
+    l->lexed = (tokens_t){0};
+    l->lexed_errors = (errors_t){0};
+    l->next_token = l->next_error = 0;
+    l->ring = NULL;
 }
 
 void l_free(lexer_t *l) {
-    free(l->source);
+    for (usz i = 0; i < l->errors.count; i++)
+        free(l->errors.items[i].msg);
+    free(l->errors.items);
     free(l);
 }
 
+// The global span of `source[start..end)`
+static inline span_t l_span(const lexer_t *l, usz start, usz end) {
+    return (span_t){l->base + (u32)start, (u32)(end - start)};
+}
+
+static void l_error(lexer_t *l, span_t span, const char *fmt, ...) {
+    va_list ap, ap2;
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+    usz size = vsnprintf(NULL, 0, fmt, ap2) + 1;
+    va_end(ap2);
+
+    char *message = malloc(size);
+    assert(message != NULL && "Buy more RAM lol");
+    vsnprintf(message, size, fmt, ap);
+    va_end(ap);
+
+    error_t err = (error_t){
+        .span = span,
+        .msg = message,
+    };
+    da_append(&l->errors, err);
+}
+
+static inline bool l_is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+static void l_next_lexed(lexer_t *, token_t *);
+static void l_next_ring(lexer_t *, token_t *);
+
 void l_next(lexer_t *l, token_t *token) {
-    if (l->pos >= l->length) {
-        token->type = T_EOF;
-        token->span = (span_t){l->pos, l->pos + 1};
+    if (l->lexed.items != NULL) {
+        l_next_lexed(l, token);
+        return;
+    }
+    if (l->ring != NULL) {
+        l_next_ring(l, token);
         return;
     }
 
-    while (isspace(l->source[l->pos]))
+    while (l->pos < l->length && l_is_space(l->source[l->pos]))
         l->pos++;
 
+    if (l->pos >= l->length) {
+        token->type = T_EOF;
+        token->span = l_span(l, l->pos, l->pos + 1);
+        return;
+    }
+
     char ch = l->source[l->pos];
     switch (ch) {
 
 #define SINGLE(ch, tok)                                                        \
     case (ch): {                                                               \
         token->type = l->in_string ? T_STRING_MIDDLE : (tok);                  \
-        token->span = (span_t){l->pos, l->pos + 1};                            \
+        token->span = l_span(l, l->pos, l->pos + 1);                           \
         l->pos++;                                                              \
     } break
 #define DOUBLE(ch, ch2, tok, tok2)                                             \
     case (ch): {                                                               \
         if (l->pos + 1 < l->length && l->source[l->pos + 1] == (ch2)) {        \
             token->type = l->in_string ? T_STRING_MIDDLE : tok2;               \
-            token->span = (span_t){l->pos, l->pos + 2};                        \
+            token->span = l_span(l, l->pos, l->pos + 2);                       \
             l->pos += 2;                                                       \
         } else {                                                               \
             token->type = l->in_string ? T_STRING_MIDDLE : (tok);              \
-            token->span = (span_t){l->pos, l->pos + 1};                        \
+            token->span = l_span(l, l->pos, l->pos + 1);                       \
             l->pos++;                                                          \
         }                                                                      \
     } break
@@ -53,15 +187,15 @@ void l_next(lexer_t *l, token_t *token) {
     case '-': {
         if (l->pos + 1 < l->length && l->source[l->pos + 1] == '>') {
             token->type = l->in_string ? T_STRING_MIDDLE : T_ARROW;
-            token->span = (span_t){l->pos, l->pos + 2};
+            token->span = l_span(l, l->pos, l->pos + 2);
             l->pos += 2;
         } else if (l->pos + 1 < l->length && l->source[l->pos + 1] == '=') {
             token->type = l->in_string ? T_STRING_MIDDLE : T_MINUS_EQUALS;
-            token->span = (span_t){l->pos, l->pos + 2};
+            token->span = l_span(l, l->pos, l->pos + 2);
             l->pos += 2;
         } else {
             token->type = l->in_string ? T_STRING_MIDDLE : T_MINUS;
-            token->span = (span_t){l->pos, l->pos + 1};
+            token->span = l_span(l, l->pos, l->pos + 1);
             l->pos++;
         }
     } break;
@@ -84,15 +218,15 @@ void l_next(lexer_t *l, token_t *token) {
     case ':': {
         if (l->pos + 1 < l->length && l->source[l->pos + 1] == ':') {
             token->type = l->in_string ? T_STRING_MIDDLE : T_COLON_COLON;
-            token->span = (span_t){l->pos, l->pos + 2};
+            token->span = l_span(l, l->pos, l->pos + 2);
             l->pos += 2;
         } else if (l->pos + 1 < l->length && l->source[l->pos + 1] == '=') {
             token->type = l->in_string ? T_STRING_MIDDLE : T_COLON_EQUALS;
-            token->span = (span_t){l->pos, l->pos + 2};
+            token->span = l_span(l, l->pos, l->pos + 2);
             l->pos += 2;
         } else {
             token->type = l->in_string ? T_STRING_MIDDLE : T_COLON;
-            token->span = (span_t){l->pos, l->pos + 1};
+            token->span = l_span(l, l->pos, l->pos + 1);
             l->pos++;
         }
     } break;
@@ -104,12 +238,12 @@ void l_next(lexer_t *l, token_t *token) {
         // if (!l->in_string) {
         //     l->in_string = true;
         //     token->type = T_STRING_START;
-        //     token->span = (span_t){l->pos, l->pos + 1};
+        //     token->span = l_span(l, l->pos, l->pos + 1);
         //     l->pos++;
         // } else {
         //     l->in_string = false;
         //     token->type = T_STRING_END;
-        //     token->span = (span_t){l->pos, l->pos + 1};
+        //     token->span = l_span(l, l->pos, l->pos + 1);
         //     l->pos++;
         // }
 
@@ -118,88 +252,474 @@ void l_next(lexer_t *l, token_t *token) {
         usz start = l->pos;
         while (l->pos < l->length && l->source[l->pos] != '"')
             l->pos++;
-        token->span = (span_t){start, l->pos};
-        token->string_value = malloc(l->pos - start);
-        strncpy(token->string_value, l->source + start, l->pos - start);
-        token->string_value[l->pos - start] = '\0';
+        token->span = l_span(l, start, l->pos);
+        token->string_value = NULL;
+        if (!l->raw) {
+            token->string_value = malloc(l->pos - start + 1);
+            assert(token->string_value && "Buy more RAM lol");
+            strncpy(token->string_value, l->source + start, l->pos - start);
+            token->string_value[l->pos - start] = '\0';
+        }
         l->pos++;
         break;
     } break;
 
     default: {
-        if (isalpha(ch)) {
-            token->type = l->in_string ? T_STRING_MIDDLE : T_IDENT;
+        const char *end = l->source + l->length;
+        usz size = utf8_ident_start(l->source + l->pos, end);
+        if (size > 0) {
             usz start = l->pos;
-            while (l->pos < l->length && isalnum(l->source[l->pos]))
-                l->pos++;
-            token->span = (span_t){start, l->pos};
-            token->string_value = malloc(l->pos - start);
-            strncpy(token->string_value, l->source + start, l->pos - start);
-            token->string_value[l->pos - start] = '\0';
+            l->pos += size;
+            while (l->pos < l->length &&
+                   (size = utf8_ident_continue(l->source + l->pos, end)) > 0)
+                l->pos += size;
+            usz length = l->pos - start;
+            u8 type = l_keyword(l->source + start, length);
+            token->type = l->in_string ? T_STRING_MIDDLE : type;
+            token->span = l_span(l, start, l->pos);
+            if (type != T_IDENT) break;
+
+            token->string_value =
+                l->raw ? NULL : (char *)intern(l->source + start, length);
             break;
         }
 
-        if (isdigit(ch)) {
-            token->type = l->in_string ? T_STRING_MIDDLE : T_INT;
+        if (l_is_digit(ch)) {
+            // literals are converted in place from the source buffer, see
+            // number.c
             usz start = l->pos;
+            const char *s = l->source + start;
+            u8 type = T_INT;
+            num_scan_t scan;
 
-            enum { I_DEC, I_HEX, I_BIN } int_type = I_DEC;
-
-            if (ch == '0' && l->pos + 1 < l->length &&
-                l->source[l->pos + 1] == 'x') {
-                int_type = I_HEX;
-                l->pos += 2;
-                while (l->pos < l->length && isxdigit(l->source[l->pos]))
-                    l->pos++;
-            } else if (ch == '0' && l->pos + 1 < l->length &&
-                       l->source[l->pos + 1] == 'b') {
-                int_type = I_BIN;
-                l->pos += 2;
-                l->pos += 2;
-                while (l->pos < l->length &&
-                       (l->source[l->pos] == '0' || l->source[l->pos] == '1'))
-                    l->pos++;
+            if (ch == '0' && end - s > 1 && (s[1] == 'x' || s[1] == 'b')) {
+                l->pos += 2 + (s[1] == 'x' ? num_scan_hex(s + 2, end, &scan)
+                                           : num_scan_bin(s + 2, end, &scan));
+                if (scan.digits == 0) {
+                    l_error(l, l_span(l, start, l->pos),
+                            "expected digits after `%.2s`", s);
+                    scan.misplaced = false;
+                }
             } else {
-                while (l->pos < l->length && isdigit(l->source[l->pos]))
-                    l->pos++;
+                l->pos += num_scan_dec(s, end, &scan);
 
-                if (l->source[l->pos] == '.') {
-                    token->type = T_FLOAT;
+                if (l->pos < l->length && l->source[l->pos] == '.') {
+                    type = T_FLOAT;
                     l->pos++;
-                    while (l->pos < l->length && isdigit(l->source[l->pos]))
-                        l->pos++;
+                    // `_` right before the `.` was reported by the scan
+                    for (; l->pos < l->length; l->pos++) {
+                        char c = l->source[l->pos];
+                        if (c != '_') {
+                            if (!l_is_digit(c)) break;
+                            continue;
+                        }
+                        scan.misplaced |=
+                            !l_is_digit(l->source[l->pos - 1]) ||
+                            l->pos + 1 >= l->length ||
+                            !l_is_digit(l->source[l->pos + 1]);
+                    }
+                    token->float_value = num_parse_float(s, l->pos - start);
                 }
             }
 
-            token->span = (span_t){start, l->pos};
-            char *buffer = malloc(l->pos - start);
-            strncpy(buffer, l->source + start, l->pos - start);
-            buffer[l->pos - start] = '\0';
-            if (token->type == T_INT) {
-                switch (int_type) {
-                case I_DEC:
-                    token->int_value = atoll(buffer);
-                    break;
-                case I_HEX:
-                    token->int_value = strtoll(buffer, NULL, 16);
-                    break;
-                case I_BIN:
-                    token->int_value = strtoll(buffer, NULL, 2);
-                    break;
-                }
-            } else token->float_value = atof(buffer);
+            token->type = l->in_string ? T_STRING_MIDDLE : type;
+            token->span = l_span(l, start, l->pos);
+            if (scan.misplaced)
+                l_error(l, token->span,
+                        "`_` in number literal `%.*s` must be between two "
+                        "digits",
+                        (int)(l->pos - start), s);
+            if (type == T_INT) {
+                if (scan.overflow)
+                    l_error(l, token->span,
+                            "integer literal `%.*s` does not fit in 64 bits",
+                            (int)(l->pos - start), s);
+                token->int_value = (i64)scan.value;
+            } else if (!isfinite(token->float_value)) {
+                l_error(l, token->span,
+                        "float literal `%.*s` is too large for a double",
+                        (int)(l->pos - start), s);
+            }
             break;
         }
 
         token->type = l->in_string ? T_STRING_MIDDLE : T_ERROR;
-        token->span = (span_t){l->pos, l->pos + 1};
-        token->string_value = realloc(token->string_value, 1);
-        token->string_value[0] = ch;
-        token->string_value[1] = '\0';
-        l->pos++;
+        // sources are validated up front, so a stray character is always a
+        // whole code point
+        utf8_decode(l->source + l->pos, end, &size);
+        token->span = l_span(l, l->pos, l->pos + size);
+        token->string_value = NULL;
+        if (!l->raw) {
+            token->string_value = malloc(size + 1);
+            assert(token->string_value && "Buy more RAM lol");
+            memcpy(token->string_value, l->source + l->pos, size);
+            token->string_value[size] = '\0';
+        }
+        l->pos += size;
     } break;
     }
 
 #undef SINGLE
 #undef DOUBLE
-}
\ No newline at end of file
+}
+/* -------------------- PARALLEL LEXING -------------------- */
+
+// Fewest bytes worth lexing on a thread of their own
+#define L_MIN_CHUNK (64 * 1024)
+
+// The only state the lexer carries from one token to the next is whether it
+// is inside a string literal, and as every `"` opens or closes one, that is
+// the parity of the quotes before a position. Chunks are cut after a newline,
+// which separates tokens unless it is in a string; the quotes of each chunk
+// are counted in parallel, and a cut that turns out to be in a string is
+// moved past its closing quote. The chunks are then lexed in parallel, from
+// positions where a sequential lexer starts a token too, and with spans that
+// are global from the start.
+typedef struct l_job_t l_job_t;
+
+struct l_job_t {
+    source_file_t *file;
+    usz count;
+    usz *bounds; // chunk `i` is `text[bounds[i]..bounds[i + 1])`
+    usz *quotes;
+    tokens_t *tokens; // of each chunk, without its `T_EOF`
+    errors_t *errors;
+    token_t *eofs;
+    void (*run)(l_job_t *, usz);
+    atomic_size_t next;
+};
+
+static void l_count_quotes(l_job_t *job, usz i) {
+    const char *text = job->file->text;
+    usz count = 0;
+    for (usz pos = job->bounds[i]; pos < job->bounds[i + 1]; pos++)
+        count += text[pos] == '"';
+    job->quotes[i] = count;
+}
+
+static void l_lex_chunk(l_job_t *job, usz i) {
+    lexer_t lexer;
+    l_init_range(&lexer, job->file, job->bounds[i], job->bounds[i + 1]);
+    tokens_t tokens = {0};
+    for (;;) {
+        token_t token;
+        l_next(&lexer, &token);
+        if (token.type == T_EOF) {
+            job->eofs[i] = token;
+            break;
+        }
+        da_append(&tokens, token);
+    }
+    job->tokens[i] = tokens;
+    job->errors[i] = lexer.errors;
+}
+
+static void *l_worker(void *arg) {
+    l_job_t *job = arg;
+    for (usz i; (i = atomic_fetch_add(&job->next, 1)) < job->count;)
+        job->run(job, i);
+    return NULL;
+}
+
+// Runs `run` on every chunk; chunks are claimed one at a time, so a thread
+// that fails to start just leaves more for the others
+static void l_run(l_job_t *job, void (*run)(l_job_t *, usz),
+                  pthread_t *threads) {
+    job->run = run;
+    atomic_store(&job->next, 0);
+    bool *started = calloc(job->count, sizeof(bool));
+    assert(started != NULL && "Buy more RAM lol");
+    for (usz i = 1; i < job->count; i++)
+        started[i] = pthread_create(&threads[i], NULL, l_worker, job) == 0;
+    l_worker(job);
+    for (usz i = 1; i < job->count; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+    free(started);
+}
+
+void l_lex(source_file_t *file, usz start, usz end, usz jobs,
+           tokens_t *tokens, errors_t *errors) {
+    pthread_once(&kw_once, kw_init);
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (usz)cpus : 1;
+    }
+    usz count = (end - start) / L_MIN_CHUNK;
+    if (count > jobs) count = jobs;
+    if (count == 0) count = 1;
+
+    const char *text = file->text;
+    l_job_t job = {.file = file, .count = count};
+    job.bounds = malloc((count + 1) * sizeof(usz));
+    job.quotes = malloc(count * sizeof(usz));
+    job.tokens = malloc(count * sizeof(tokens_t));
+    job.errors = malloc(count * sizeof(errors_t));
+    job.eofs = malloc(count * sizeof(token_t));
+    pthread_t *threads = malloc(count * sizeof(pthread_t));
+    assert(job.bounds != NULL && job.quotes != NULL && job.tokens != NULL &&
+           job.errors != NULL && job.eofs != NULL && threads != NULL &&
+           "Buy more RAM lol");
+
+    job.bounds[0] = start;
+    job.bounds[count] = end;
+    for (usz i = 1; i < count; i++) {
+        usz cut = start + (end - start) / count * i;
+        if (cut < job.bounds[i - 1]) cut = job.bounds[i - 1];
+        const char *newline = memchr(text + cut, '\n', end - cut);
+        job.bounds[i] = newline != NULL ? (usz)(newline - text) + 1 : end;
+    }
+
+    if (count > 1) {
+        l_run(&job, l_count_quotes, threads);
+        bool in_string = false;
+        for (usz i = 1; i < count; i++) {
+            in_string ^= job.quotes[i - 1] & 1;
+            usz cut = job.bounds[i];
+            if (in_string) {
+                const char *quote = memchr(text + cut, '"', end - cut);
+                cut = quote != NULL ? (usz)(quote - text) + 1 : end;
+            }
+            // a string may run past the next cuts, which move along
+            job.bounds[i] = cut > job.bounds[i - 1] ? cut : job.bounds[i - 1];
+        }
+    }
+    l_run(&job, l_lex_chunk, threads);
+
+    usz total = 1;
+    for (usz i = 0; i < count; i++)
+        total += job.tokens[i].count;
+    da_reserve(tokens, tokens->count + total);
+    // an unterminated string leaves the lexer past the end, so the `T_EOF`
+    // is the one of the last chunk with anything in it
+    token_t eof = job.eofs[count - 1];
+    for (usz i = 0; i < count; i++) {
+        for (usz j = 0; j < job.tokens[i].count; j++)
+            da_append(tokens, job.tokens[i].items[j]);
+        for (usz j = 0; j < job.errors[i].count; j++)
+            da_append(errors, job.errors[i].items[j]);
+        if (job.bounds[i] < job.bounds[i + 1]) eof = job.eofs[i];
+        free(job.tokens[i].items);
+        free(job.errors[i].items);
+    }
+    da_append(tokens, eof);
+    log_debug("lexed %zu tokens in %zu chunks", tokens->count, count);
+
+    free(threads);
+    free(job.eofs);
+    free(job.errors);
+    free(job.tokens);
+    free(job.quotes);
+    free(job.bounds);
+}
+
+void l_init_lexed(lexer_t *l, source_file_t *file, usz start, usz end,
+                  tokens_t *tokens, errors_t *errors) {
+    l_init_range(l, file, start, end);
+    l->lexed = *tokens;
+    l->lexed_errors = *errors;
+    *tokens = (tokens_t){0};
+    *errors = (errors_t){0};
+}
+
+static void l_free_token(token_t *token) {
+    if (token->type == T_STRING || token->type == T_ERROR)
+        free(token->string_value);
+}
+
+// Hands out the next token the way `l_next` would have lexed it. The parser
+// skips function bodies in skim mode by moving `pos` past them, so tokens
+// and diagnostics before `pos` are dropped: they will be lexed again when the
+// body is parsed.
+static void l_next_lexed(lexer_t *l, token_t *token) {
+    u32 pos = l->base + (u32)l->pos;
+    while (l->next_token + 1 < l->lexed.count &&
+           l->lexed.items[l->next_token].span.start < pos)
+        l_free_token(&l->lexed.items[l->next_token++]);
+    while (l->next_error < l->lexed_errors.count &&
+           l->lexed_errors.items[l->next_error].span.start < pos)
+        free(l->lexed_errors.items[l->next_error++].msg);
+
+    // the last token is `T_EOF`, which is handed out for good
+    *token = l->lexed.items[l->next_token];
+    if (token->type == T_EOF) return;
+    l->next_token++;
+    l->pos = token->span.start + token->span.length - l->base +
+             (token->type == T_STRING);
+
+    // diagnostics are reported on the token they are about
+    while (l->next_error < l->lexed_errors.count &&
+           l->lexed_errors.items[l->next_error].span.start <=
+               token->span.start)
+        da_append(&l->errors, l->lexed_errors.items[l->next_error++]);
+}
+
+static void l_free_lexed(lexer_t *l) {
+    for (usz i = l->next_token; i < l->lexed.count; i++)
+        l_free_token(&l->lexed.items[i]);
+    for (usz i = l->next_error; i < l->lexed_errors.count; i++)
+        free(l->lexed_errors.items[i].msg);
+    free(l->lexed.items);
+    free(l->lexed_errors.items);
+    l->lexed = (tokens_t){0};
+    l->lexed_errors = (errors_t){0};
+}
+
+/* -------------------- PIPELINED LEXING -------------------- */
+
+// Tokens in flight between the lexer thread and the parser, a power of two
+#define L_RING_SLOTS 4096
+#define L_CACHE_LINE 64
+
+// A token as it crosses the ring, two to a cache line. The diagnostics the
+// lexer reported while lexing it travel with it.
+typedef struct {
+    u8 type;
+    u32 error_count;
+    span_t span;
+    union {
+        char *string_value;
+        i64 int_value;
+        double float_value;
+    };
+    error_t *errors;
+} l_slot_t;
+
+static_assert(sizeof(l_slot_t) * 2 == L_CACHE_LINE, "l_slot_t grew");
+
+// A single-producer, single-consumer ring. Each side keeps its own position
+// and the last position of the other it saw on a line of its own, and only
+// loads the other's, which is on yet another line, when the ring looks full
+// or empty; both wait by yielding, which is what gives the lexer
+// backpressure.
+typedef struct l_ring_t {
+    _Alignas(L_CACHE_LINE) atomic_size_t tail; // next slot the lexer fills
+    _Alignas(L_CACHE_LINE) atomic_size_t head; // next slot the parser takes
+    _Alignas(L_CACHE_LINE) atomic_bool stopped; // the parser is done
+    _Alignas(L_CACHE_LINE) usz lexer_tail, lexer_head;
+    lexer_t lexer;
+    _Alignas(L_CACHE_LINE) usz parser_head, parser_tail;
+    bool done; // `eof` was taken, and is handed out for good
+    token_t eof;
+    pthread_t thread;
+    _Alignas(L_CACHE_LINE) l_slot_t slots[L_RING_SLOTS];
+} l_ring_t;
+
+static void l_free_slot(l_slot_t *slot) {
+    if (slot->type == T_STRING || slot->type == T_ERROR)
+        free(slot->string_value);
+    for (u32 i = 0; i < slot->error_count; i++)
+        free(slot->errors[i].msg);
+    free(slot->errors);
+}
+
+static void *l_ring_lex(void *arg) {
+    l_ring_t *r = arg;
+    lexer_t *l = &r->lexer;
+    for (;;) {
+        token_t token;
+        l_next(l, &token);
+        l_slot_t slot = {.type = token.type,
+                         .span = token.span,
+                         .int_value = token.int_value};
+        if (l->errors.count > 0) {
+            slot.error_count = (u32)l->errors.count;
+            slot.errors = l->errors.items;
+            l->errors = (errors_t){0};
+        }
+
+        // the parser may stop before the end, on the first declaration of a
+        // chunk with several, and no longer take anything
+        bool stopped;
+        while (!(stopped = atomic_load_explicit(&r->stopped,
+                                                memory_order_relaxed)) &&
+               r->lexer_tail - r->lexer_head == L_RING_SLOTS) {
+            r->lexer_head =
+                atomic_load_explicit(&r->head, memory_order_acquire);
+            if (r->lexer_tail - r->lexer_head == L_RING_SLOTS) sched_yield();
+        }
+        if (stopped) {
+            l_free_slot(&slot);
+            return NULL;
+        }
+
+        r->slots[r->lexer_tail & (L_RING_SLOTS - 1)] = slot;
+        atomic_store_explicit(&r->tail, ++r->lexer_tail, memory_order_release);
+        if (token.type == T_EOF) return NULL;
+    }
+}
+
+bool l_init_pipelined(lexer_t *l, source_file_t *file, usz start, usz end) {
+    l_init_range(l, file, start, end);
+    l_ring_t *r = aligned_alloc(L_CACHE_LINE, sizeof(l_ring_t));
+    assert(r != NULL && "Buy more RAM lol");
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->stopped, false);
+    r->lexer_tail = r->lexer_head = r->parser_head = r->parser_tail = 0;
+    r->done = false;
+    l_init_range(&r->lexer, file, start, end);
+    if (pthread_create(&r->thread, NULL, l_ring_lex, r) != 0) {
+        free(r);
+        return false;
+    }
+    l->ring = r;
+    return true;
+}
+
+// Takes the next token off the ring. As with tokens lexed ahead, those the
+// parser skipped over in skim mode are dropped with their diagnostics.
+static void l_next_ring(lexer_t *l, token_t *token) {
+    l_ring_t *r = l->ring;
+    u32 pos = l->base + (u32)l->pos;
+    for (;;) {
+        if (r->done) {
+            *token = r->eof;
+            return;
+        }
+        while (r->parser_head == r->parser_tail) {
+            r->parser_tail =
+                atomic_load_explicit(&r->tail, memory_order_acquire);
+            if (r->parser_head == r->parser_tail) sched_yield();
+        }
+        l_slot_t slot = r->slots[r->parser_head & (L_RING_SLOTS - 1)];
+        atomic_store_explicit(&r->head, ++r->parser_head,
+                              memory_order_release);
+
+        if (slot.type != T_EOF && slot.span.start < pos) {
+            l_free_slot(&slot);
+            continue;
+        }
+        token->type = slot.type;
+        token->span = slot.span;
+        token->int_value = slot.int_value;
+        for (u32 i = 0; i < slot.error_count; i++)
+            da_append(&l->errors, slot.errors[i]);
+        free(slot.errors);
+
+        if (token->type == T_EOF) {
+            r->done = true;
+            r->eof = *token;
+            return;
+        }
+        l->pos = token->span.start + token->span.length - l->base +
+                 (token->type == T_STRING);
+        return;
+    }
+}
+
+static void l_stop_ring(lexer_t *l) {
+    l_ring_t *r = l->ring;
+    atomic_store_explicit(&r->stopped, true, memory_order_relaxed);
+    pthread_join(r->thread, NULL);
+    usz tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    for (usz i = r->parser_head; i < tail; i++)
+        l_free_slot(&r->slots[i & (L_RING_SLOTS - 1)]);
+    free(r->lexer.errors.items);
+    free(r);
+    l->ring = NULL;
+}
+
+void l_stop(lexer_t *l) {
+    l_free_lexed(l);
+    if (l->ring != NULL) l_stop_ring(l);
+}
@@ -20,8 +20,19 @@
  * IN THE SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "include/log.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
 #define MAX_CALLBACKS 32
 
 typedef struct {
@@ -117,32 +128,575 @@ static void init_event(log_Event *ev, void *udata) {
     ev->udata = udata;
 }
 
-void log_log(int level, const char *file, int line, const char *fmt, ...) {
-    log_Event ev = {
-        .fmt = fmt,
-        .file = file,
-        .line = line,
-        .level = level,
-    };
-
-    lock();
+static bool wanted(int level) {
+    if (!L.quiet && level >= L.level) return true;
+    for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++)
+        if (level >= L.callbacks[i].level) return true;
+    return false;
+}
 
-    if (!L.quiet && level >= L.level) {
-        init_event(&ev, stderr);
-        va_start(ev.ap, fmt);
-        stdout_callback(&ev);
-        va_end(ev.ap);
+static void dispatch(log_Event *ev, va_list ap) {
+    if (!L.quiet && ev->level >= L.level) {
+        init_event(ev, stderr);
+        va_copy(ev->ap, ap);
+        stdout_callback(ev);
+        va_end(ev->ap);
     }
 
     for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
         Callback *cb = &L.callbacks[i];
-        if (level >= cb->level) {
-            init_event(&ev, cb->udata);
-            va_start(ev.ap, fmt);
-            cb->fn(&ev);
-            va_end(ev.ap);
+        if (ev->level >= cb->level) {
+            init_event(ev, cb->udata);
+            va_copy(ev->ap, ap);
+            cb->fn(ev);
+            va_end(ev->ap);
+        }
+    }
+}
+
+/* -------------------- ASYNC -------------------- */
+
+/* Every thread that logs owns a single-producer ring of variable sized
+ * records; the background thread is the only consumer of all of them. A ring
+ * is handed to the next new thread once its owner exits. */
+
+#define RING_CAPACITY (64 * 1024) /* bytes, a power of two */
+#define RECORD_MAX 4096           /* captured arguments are cut to fit */
+#define MESSAGE_MAX 4096          /* formatted messages are cut to fit */
+#define IDLE_NANOSECONDS 500000   /* consumer sleep when every ring is empty */
+
+typedef struct Ring {
+    _Alignas(64) _Atomic(uint64_t) head; /* advanced by the owning thread */
+    _Alignas(64) _Atomic(uint64_t) tail; /* advanced by the consumer */
+    atomic_bool owned;
+    struct Ring *next;
+    _Alignas(8) unsigned char data[RING_CAPACITY];
+} Ring;
+
+/* A record is followed by the arguments in the order the format consumes
+ * them: integers widened to 64 bits, doubles, pointers and strings as a
+ * length, the bytes and a NUL. A size of 0 marks the end of the ring. */
+typedef struct {
+    uint32_t size;
+    uint32_t args; /* bytes of arguments */
+    int level;
+    int line;
+    const char *file;
+    const char *fmt;
+    struct timespec time;
+} Record;
+
+static struct {
+    atomic_bool enabled;
+    atomic_bool stop;
+    atomic_int capturing; /* threads between reading `enabled` and pushing */
+    bool at_exit;
+    pthread_t thread;
+    _Atomic(Ring *) rings;
+} A;
+
+static _Thread_local Ring *local_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void ring_release(void *ring) {
+    atomic_store_explicit(&((Ring *)ring)->owned, false, memory_order_release);
+}
+
+static void ring_key_init(void) { pthread_key_create(&ring_key, ring_release); }
+
+static Ring *ring_acquire(void) {
+    if (local_ring) return local_ring;
+    pthread_once(&ring_once, ring_key_init);
+
+    Ring *ring = atomic_load_explicit(&A.rings, memory_order_acquire);
+    for (; ring; ring = ring->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&ring->owned, &expected, true))
+            break;
+    }
+
+    if (!ring) {
+        ring = calloc(1, sizeof(Ring));
+        if (!ring) return NULL;
+        atomic_init(&ring->owned, true);
+        ring->next = atomic_load_explicit(&A.rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak(&A.rings, &ring->next, ring))
+            ;
+    }
+
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    return ring;
+}
+
+static uint64_t align8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+static void ring_push(Ring *ring, const Record *record) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t size = align8(record->size);
+    uint64_t contiguous = RING_CAPACITY - (head & (RING_CAPACITY - 1));
+    uint64_t needed = size <= contiguous ? size : contiguous + size;
+
+    /* a full ring means the consumer is behind, wait for it */
+    while (head + needed -
+               atomic_load_explicit(&ring->tail, memory_order_acquire) >
+           RING_CAPACITY)
+        sched_yield();
+
+    if (size > contiguous) {
+        uint32_t end = 0;
+        memcpy(ring->data + (head & (RING_CAPACITY - 1)), &end, sizeof(end));
+        head += contiguous;
+    }
+    memcpy(ring->data + (head & (RING_CAPACITY - 1)), record, record->size);
+    atomic_store_explicit(&ring->head, head + size, memory_order_release);
+}
+
+static Record *ring_peek(Ring *ring) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == head) return NULL;
+
+        Record *record = (Record *)(ring->data + (tail & (RING_CAPACITY - 1)));
+        if (record->size != 0) return record;
+        tail += RING_CAPACITY - (tail & (RING_CAPACITY - 1));
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+static void ring_pop(Ring *ring, Record *record) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + align8(record->size),
+                          memory_order_release);
+}
+
+/* One printf conversion. Producer and consumer walk the format with the
+ * same parser, so they agree on which argument is which. */
+typedef struct {
+    const char *start;  /* the '%' */
+    const char *length; /* the length modifier, or the conversion */
+    int stars;          /* '*' arguments before the value */
+    int precision;      /* literal precision, -1 if none, -2 for '*' */
+    char modifier[3];
+    char conv;
+} Spec;
+
+static const char *parse_spec(const char *p, Spec *spec) {
+    spec->start = p++;
+    spec->stars = 0;
+    spec->precision = -1;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            spec->precision = -2;
+            p++;
+        } else {
+            spec->precision = 0;
+            for (; *p >= '0' && *p <= '9'; p++)
+                spec->precision = spec->precision * 10 + (*p - '0');
+        }
+    }
+
+    spec->length = p;
+    int n = 0;
+    while (*p && strchr("hlLzjt", *p) && n < 2) spec->modifier[n++] = *p++;
+    spec->modifier[n] = '\0';
+    spec->conv = *p;
+    return *p ? p + 1 : p;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t length, capacity;
+    bool truncated;
+} Args;
+
+static bool put(Args *args, const void *value, size_t size) {
+    if (args->length + size > args->capacity) {
+        args->truncated = true;
+        return false;
+    }
+    memcpy(args->data + args->length, value, size);
+    args->length += size;
+    return true;
+}
+
+static bool put_int(Args *args, int64_t value) {
+    return put(args, &value, sizeof(value));
+}
+
+static bool put_string(Args *args, const char *s, int precision) {
+    if (!s) s = "(null)";
+    size_t length = precision >= 0 ? strnlen(s, precision) : strlen(s);
+    size_t room = args->capacity - args->length;
+    if (room < sizeof(uint32_t) + 1) {
+        args->truncated = true;
+        return false;
+    }
+    if (length > room - sizeof(uint32_t) - 1)
+        length = room - sizeof(uint32_t) - 1;
+
+    uint32_t n = length;
+    put(args, &n, sizeof(n));
+    put(args, s, length);
+    return put(args, "", 1);
+}
+
+static int64_t signed_arg(const Spec *spec, va_list *ap) {
+    const char *m = spec->modifier;
+    if (!strcmp(m, "hh")) return (signed char)va_arg(*ap, int);
+    if (!strcmp(m, "h")) return (short)va_arg(*ap, int);
+    if (!strcmp(m, "l")) return va_arg(*ap, long);
+    if (!strcmp(m, "ll")) return va_arg(*ap, long long);
+    if (!strcmp(m, "z")) return (ssize_t)va_arg(*ap, size_t);
+    if (!strcmp(m, "j")) return va_arg(*ap, intmax_t);
+    if (!strcmp(m, "t")) return va_arg(*ap, ptrdiff_t);
+    return va_arg(*ap, int);
+}
+
+static uint64_t unsigned_arg(const Spec *spec, va_list *ap) {
+    const char *m = spec->modifier;
+    if (!strcmp(m, "hh")) return (unsigned char)va_arg(*ap, unsigned);
+    if (!strcmp(m, "h")) return (unsigned short)va_arg(*ap, unsigned);
+    if (!strcmp(m, "l")) return va_arg(*ap, unsigned long);
+    if (!strcmp(m, "ll")) return va_arg(*ap, unsigned long long);
+    if (!strcmp(m, "z")) return va_arg(*ap, size_t);
+    if (!strcmp(m, "j")) return va_arg(*ap, uintmax_t);
+    if (!strcmp(m, "t")) return (uint64_t)va_arg(*ap, ptrdiff_t);
+    return va_arg(*ap, unsigned);
+}
+
+/* Copies the arguments `fmt` refers to, stopping once the record is full. */
+static void capture(Args *args, const char *fmt, va_list *ap) {
+    for (const char *p = fmt; *p;) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+
+        Spec spec;
+        p = parse_spec(p, &spec);
+        if (spec.conv == '%') continue;
+
+        int precision = spec.precision;
+        for (int i = 0; i < spec.stars; i++) {
+            int star = va_arg(*ap, int);
+            if (i + 1 == spec.stars && spec.precision == -2) precision = star;
+            if (!put_int(args, star)) return;
+        }
+
+        bool ok = true;
+        switch (spec.conv) {
+        case 'd':
+        case 'i':
+            ok = put_int(args, signed_arg(&spec, ap));
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            ok = put_int(args, (int64_t)unsigned_arg(&spec, ap));
+            break;
+        case 'c':
+            ok = put_int(args, va_arg(*ap, int));
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (spec.modifier[0] == 'L') {
+                long double value = va_arg(*ap, long double);
+                ok = put(args, &value, sizeof(value));
+            } else {
+                double value = va_arg(*ap, double);
+                ok = put(args, &value, sizeof(value));
+            }
+            break;
+        case 's':
+            ok = put_string(args, va_arg(*ap, const char *), precision);
+            break;
+        case 'p': {
+            void *value = va_arg(*ap, void *);
+            ok = put(args, &value, sizeof(value));
+        } break;
+        default: /* %n and unknown conversions are not supported */
+            return;
+        }
+        if (!ok) return;
+    }
+}
+
+static bool log_capture(int level, const char *file, int line, const char *fmt,
+                        va_list ap) {
+    Ring *ring = ring_acquire();
+    if (!ring) return false;
+
+    _Alignas(8) unsigned char buffer[RECORD_MAX];
+    Record *record = (Record *)buffer;
+    *record = (Record){.level = level, .line = line, .file = file, .fmt = fmt};
+    clock_gettime(CLOCK_REALTIME, &record->time);
+
+    Args args = {.data = buffer + sizeof(Record),
+                 .capacity = RECORD_MAX - sizeof(Record)};
+    va_list copy;
+    va_copy(copy, ap);
+    capture(&args, fmt, &copy);
+    va_end(copy);
+
+    record->args = args.length;
+    record->size = sizeof(Record) + args.length;
+    ring_push(ring, record);
+    return true;
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t length, offset;
+} Reader;
+
+static bool take(Reader *r, void *value, size_t size) {
+    if (r->offset + size > r->length) return false;
+    memcpy(value, r->data + r->offset, size);
+    r->offset += size;
+    return true;
+}
+
+/* Position after an snprintf into a buffer of `size` bytes at `n` */
+static size_t advance(size_t n, size_t size, int written) {
+    if (written <= 0) return n;
+    return (size_t)written < size - n ? n + written : size - 1;
+}
+
+/* Formats the record into `out`, one conversion at a time since there is no
+ * va_list to hand to vsnprintf. */
+static void format_record(const Record *record, char *out, size_t size) {
+    Reader r = {(const unsigned char *)(record + 1), record->args, 0};
+    size_t n = 0;
+
+#define APPEND(...)                                                            \
+    (n = advance(n, size, snprintf(out + n, size - n, __VA_ARGS__)))
+
+#define EMIT(value)                                                            \
+    (spec.stars == 0   ? APPEND(conv, value)                                   \
+     : spec.stars == 1 ? APPEND(conv, stars[0], value)                         \
+                       : APPEND(conv, stars[0], stars[1], value))
+
+    for (const char *p = record->fmt; *p && n + 1 < size;) {
+        const char *literal = p;
+        while (*p && *p != '%') p++;
+        APPEND("%.*s", (int)(p - literal), literal);
+        if (!*p) break;
+
+        Spec spec;
+        p = parse_spec(p, &spec);
+        if (spec.conv == '%') {
+            APPEND("%%");
+            continue;
+        }
+
+        int stars[2];
+        int64_t star;
+        for (int i = 0; i < spec.stars; i++) {
+            if (!take(&r, &star, sizeof(star))) goto truncated;
+            stars[i] = (int)star;
+        }
+
+        /* the spec with the length modifier normalized to what was stored */
+        char conv[32];
+        int prefix = (int)(spec.length - spec.start);
+        if (prefix > 24) prefix = 24;
+        const char *modifier = "";
+        if (strchr("diuxXo", spec.conv)) modifier = "ll";
+        if (strchr("fFeEgGaA", spec.conv) && spec.modifier[0] == 'L')
+            modifier = "L";
+        snprintf(conv, sizeof(conv), "%.*s%s%c", prefix, spec.start, modifier,
+                 spec.conv);
+
+        switch (spec.conv) {
+        case 'd':
+        case 'i': {
+            int64_t value;
+            if (!take(&r, &value, sizeof(value))) goto truncated;
+            EMIT((long long)value);
+        } break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+            uint64_t value;
+            if (!take(&r, &value, sizeof(value))) goto truncated;
+            EMIT((unsigned long long)value);
+        } break;
+        case 'c': {
+            int64_t value;
+            if (!take(&r, &value, sizeof(value))) goto truncated;
+            EMIT((int)value);
+        } break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (spec.modifier[0] == 'L') {
+                long double value;
+                if (!take(&r, &value, sizeof(value))) goto truncated;
+                EMIT(value);
+            } else {
+                double value;
+                if (!take(&r, &value, sizeof(value))) goto truncated;
+                EMIT(value);
+            }
+            break;
+        case 's': {
+            uint32_t length;
+            if (!take(&r, &length, sizeof(length)) ||
+                r.offset + length + 1 > r.length)
+                goto truncated;
+            EMIT((const char *)r.data + r.offset);
+            r.offset += length + 1;
+        } break;
+        case 'p': {
+            void *value;
+            if (!take(&r, &value, sizeof(value))) goto truncated;
+            EMIT(value);
+        } break;
+        default:
+            goto truncated;
         }
     }
+    return;
+
+truncated:
+    APPEND("...");
 
+#undef EMIT
+#undef APPEND
+}
+
+static void message_dispatch(log_Event *ev, ...) {
+    va_list ap;
+    va_start(ap, ev);
+    dispatch(ev, ap);
+    va_end(ap);
+}
+
+static void *log_thread(void *arg) {
+    (void)arg;
+    char message[MESSAGE_MAX];
+    struct tm tm;
+    time_t second = -1;
+
+    for (;;) {
+        bool stopping = atomic_load_explicit(&A.stop, memory_order_acquire);
+
+        /* oldest pending record first, so threads interleave in time order */
+        Ring *ring = NULL;
+        Record *record = NULL;
+        Ring *r = atomic_load_explicit(&A.rings, memory_order_acquire);
+        for (; r; r = r->next) {
+            Record *candidate = ring_peek(r);
+            if (candidate &&
+                (!record ||
+                 candidate->time.tv_sec < record->time.tv_sec ||
+                 (candidate->time.tv_sec == record->time.tv_sec &&
+                  candidate->time.tv_nsec < record->time.tv_nsec))) {
+                ring = r;
+                record = candidate;
+            }
+        }
+
+        if (!record) {
+            if (stopping) break;
+            struct timespec idle = {0, IDLE_NANOSECONDS};
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        if (record->time.tv_sec != second) {
+            second = record->time.tv_sec;
+            localtime_r(&second, &tm);
+        }
+
+        format_record(record, message, sizeof(message));
+        log_Event ev = {
+            .fmt = "%s",
+            .file = record->file,
+            .line = record->line,
+            .level = record->level,
+            .time = &tm,
+        };
+        lock();
+        message_dispatch(&ev, message);
+        unlock();
+        ring_pop(ring, record);
+    }
+    return NULL;
+}
+
+static void log_stop_async(void) { log_set_async(false); }
+
+void log_set_async(bool enable) {
+    if (enable == atomic_load(&A.enabled)) return;
+
+    if (enable) {
+        atomic_store(&A.stop, false);
+        if (pthread_create(&A.thread, NULL, log_thread, NULL) != 0) return;
+        if (!A.at_exit) A.at_exit = atexit(log_stop_async) == 0;
+        atomic_store(&A.enabled, true);
+    } else {
+        /* a thread that saw `enabled` may still be pushing a record, which
+         * the thread would otherwise miss on its last pass */
+        atomic_store(&A.enabled, false);
+        while (atomic_load(&A.capturing) > 0)
+            sched_yield();
+        atomic_store(&A.stop, true);
+        pthread_join(A.thread, NULL);
+    }
+}
+
+/* -------------------- LOG -------------------- */
+
+void log_log(int level, const char *file, int line, const char *fmt, ...) {
+    if (!wanted(level)) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    if (atomic_load_explicit(&A.enabled, memory_order_relaxed)) {
+        /* announced before `enabled` is read again, see `log_set_async` */
+        atomic_fetch_add(&A.capturing, 1);
+        bool captured = atomic_load(&A.enabled) &&
+                        log_capture(level, file, line, fmt, ap);
+        atomic_fetch_sub(&A.capturing, 1);
+        if (captured) {
+            va_end(ap);
+            return;
+        }
+    }
+
+    log_Event ev = {
+        .fmt = fmt,
+        .file = file,
+        .line = line,
+        .level = level,
+    };
+    lock();
+    dispatch(&ev, ap);
     unlock();
+    va_end(ap);
 }
@@ -1,97 +1,67 @@
-#include "include/analyzer.h"
-#include "include/ast.h"
-#include "include/error.h"
-#include "include/lexer.h"
+#include "include/bench.h"
+#include "include/driver.h"
 #include "include/log.h"
-#include "include/parser.h"
-#include "include/tokens.h"
+#include "include/server.h"
+#include "include/thread.h"
 #include <errno.h>
-#include <stdio.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        log_error("Usage: %s <path> [OPT]", argv[0]);
-        return -1;
-    }
+typedef struct {
+    int argc;
+    char **argv;
+    int status;
+} main_args_t;
 
-    FILE *fp = fopen(argv[1], "rb");
-    if (fp == NULL) {
-        log_error("fopen() failed: %s", strerror(errno));
+static int coffee_main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
         return -1;
     }
 
-    fseek(fp, 0, SEEK_END);
-    isz size = ftell(fp);
-    rewind(fp);
+    log_set_level(LOG_INFO);
+    if (strcmp(argv[1], "--bench") == 0) return bench_main(argc - 1, argv + 1);
+    if (strcmp(argv[1], "--server") == 0)
+        return server_main(argc - 1, argv + 1);
+    if (strcmp(argv[1], "--client") == 0)
+        return client_main(argc - 1, argv + 1);
 
-    char *source = malloc(size);
-    if (source == NULL) {
-        log_error("malloc() failed: %s", strerror(errno));
+    options_t opts;
+    if (!parse_options(&opts, argc - 1, argv + 1)) {
+        usage(argv[0]);
         return -1;
     }
 
-    int read = fread(source, 1, size, fp);
-    if (read != size) {
-        log_error("fread() failed: %s", strerror(errno));
-        return -1;
+    if (opts.verbose) {
+        log_set_level(LOG_TRACE);
+        log_set_async(true);
     }
 
-    lexer_t *lexer = malloc(sizeof(lexer_t));
-    if (lexer == NULL) {
-        log_error("malloc() failed: %s", strerror(errno));
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        log_error("open() failed: %s", strerror(errno));
         return -1;
     }
 
-    parser_t *parser = malloc(sizeof(parser_t));
-    if (lexer == NULL) {
-        log_error("malloc() failed: %s", strerror(errno));
-        return -1;
-    }
-
-    l_init(lexer, source, argv[1]);
-    p_init(parser, lexer);
-
-    // token_t token = {0};
-    // do {
-    //     l_next(lexer, &token);
-    //     printf("%s", tt_name(token.type));
-    //     if (token.type == T_IDENT || token.type == T_ERROR)
-    //         printf(" (%s)", token.string_value);
-    //     if (token.type == T_INT) printf(" (%lld)", token.int_value);
-    //     printf("\n");
-    //     if (token.type == T_EOF || token.type == T_ERROR) break;
-    // } while (1);
-
-    decl_t *decl = p_parse_decl(parser);
-
-    if (parser->errors.count > 0) {
-        for (usz i = 0; i < parser->errors.count; i++) {
-            error_t error = parser->errors.items[i];
-            fprintf(stderr,
-                    "\033[0;1m%s:%ld:%ld: \033[31;1merror: \033[0;0m%s\n",
-                    argv[1], error.source_loc.line, error.source_loc.column,
-                    error.msg);
-        }
-    }
-
-    dump_decl(decl, 0);
-
-    // analyzer_t *analyzer = malloc(sizeof(analyzer_t));
-    // if (analyzer == NULL) {
-    //     log_error("malloc() failed: %s", strerror(errno));
-    //     return -1;
-    // }
-
-    // a_init(analyzer, source, argv[1]);
-
-    // decl = a_eval_decl(analyzer, decl);
-    // dump_decl(decl, 0);
+    int status = run(&opts, argv[1], fd);
+    close(fd);
+    return status;
+}
 
-    p_free(parser);
-    l_free(lexer);
-    fclose(fp);
+static void *main_thread(void *arg) {
+    main_args_t *args = arg;
+    args->status = coffee_main(args->argc, args->argv);
+    return NULL;
+}
 
-    return 0;
+// Everything runs on a thread with a stack as deep as the others'
+int main(int argc, char *argv[]) {
+    main_args_t args = {.argc = argc, .argv = argv};
+    pthread_t thread;
+    if (thread_create(&thread, main_thread, &args) != 0)
+        return coffee_main(argc, argv);
+    pthread_join(thread, NULL);
+    return args.status;
 }
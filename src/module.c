@@ -0,0 +1,592 @@
+#define _XOPEN_SOURCE 700
+
+#include "include/module.h"
+#include "include/driver.h"
+#include "include/hash.h"
+#include "include/intern.h"
+#include "include/log.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* -------------------- INTERFACE FILES -------------------- */
+
+// A `.cfi` file is a header followed by four tables:
+//
+//   deps     the modules this one imports and the hashes of their interfaces
+//   types    the types of the exports, as u32 words: `[kind]` for a builtin,
+//            `[TK_PTR, inner]` or `[TK_FN, ret, n, params...]`, where types
+//            refer to earlier ones by their position in the table
+//   symbols  every top-level declaration: its name, type and flags
+//   strings  the names, NUL-terminated
+//
+// It is written in the byte order of the machine and meant to be mapped and
+// read in place.
+#define CFI_MAGIC 0x00494643 // "CFI\0"
+#define CFI_VERSION 1
+
+typedef struct {
+    u32 magic, version;
+    u64 hash; // of the types, symbols and strings: all that importers see
+    u64 source_size;
+    i64 source_sec, source_nsec; // when the source was last modified
+    u32 dep_count, type_words, symbol_count, strings_size;
+} cfi_header_t;
+
+typedef struct {
+    u32 name;
+    u32 reserved;
+    u64 hash;
+} cfi_dep_t;
+
+enum { CFI_CONSTANT = 1 };
+
+typedef struct {
+    u32 name, type, flags;
+} cfi_symbol_t;
+
+// Pointers into an interface that passed `cfi_open`
+typedef struct {
+    const cfi_header_t *header;
+    const cfi_dep_t *deps;
+    const u32 *types;
+    const cfi_symbol_t *symbols;
+    const char *strings;
+} cfi_t;
+
+static usz cfi_size(const cfi_header_t *h) {
+    return sizeof(cfi_header_t) + (usz)h->dep_count * sizeof(cfi_dep_t) +
+           (usz)h->type_words * sizeof(u32) +
+           (usz)h->symbol_count * sizeof(cfi_symbol_t) + h->strings_size;
+}
+
+// Checks that an interface is well-formed enough to read without bounds
+// checks, except for the types, which `cfi_types` checks as it goes.
+static bool cfi_open(const interface_t *iface, cfi_t *out) {
+    if (iface->size < sizeof(cfi_header_t)) return false;
+    const cfi_header_t *h = (const cfi_header_t *)iface->data;
+    if (h->magic != CFI_MAGIC || h->version != CFI_VERSION) return false;
+    if (cfi_size(h) != iface->size) return false;
+
+    out->header = h;
+    out->deps = (const cfi_dep_t *)(h + 1);
+    out->types = (const u32 *)(out->deps + h->dep_count);
+    out->symbols = (const cfi_symbol_t *)(out->types + h->type_words);
+    out->strings = (const char *)(out->symbols + h->symbol_count);
+
+    if (h->strings_size == 0 || out->strings[h->strings_size - 1] != '\0')
+        return false;
+    for (u32 i = 0; i < h->dep_count; i++)
+        if (out->deps[i].name >= h->strings_size) return false;
+    for (u32 i = 0; i < h->symbol_count; i++)
+        if (out->symbols[i].name >= h->strings_size) return false;
+    return true;
+}
+
+// Turns the type table into type ids. Returns the number of types, or -1 if
+// the table is malformed.
+static i64 cfi_types(const cfi_t *cfi, tid_t **out) {
+    u32 words = cfi->header->type_words;
+    const u32 *w = cfi->types;
+    tid_t *tids = malloc((words + 1) * sizeof(tid_t));
+    assert(tids != NULL && "Buy more RAM lol");
+
+    u32 count = 0;
+    for (u32 i = 0; i < words;) {
+        u32 kind = w[i++];
+        switch (kind) {
+        case TK_ERROR:
+        case TK_VOID:
+        case TK_INT:
+        case TK_FLOAT:
+        case TK_BOOL:
+        case TK_STRING:
+            // builtin kinds and ids line up
+            tids[count++] = kind;
+            break;
+
+        case TK_PTR:
+            if (i >= words || w[i] >= count) goto malformed;
+            tids[count] = ty_ptr(tids[w[i++]]);
+            count++;
+            break;
+
+        case TK_FN: {
+            if (i + 2 > words || w[i] >= count) goto malformed;
+            tid_t ret = tids[w[i++]];
+            u32 n = w[i++];
+            if (n > words - i) goto malformed;
+            tid_t *params = malloc((n + 1) * sizeof(tid_t));
+            assert(params != NULL && "Buy more RAM lol");
+            for (u32 j = 0; j < n; j++) {
+                if (w[i + j] >= count) {
+                    free(params);
+                    goto malformed;
+                }
+                params[j] = tids[w[i + j]];
+            }
+            i += n;
+            tids[count++] = ty_fn(params, n, ret);
+            free(params);
+        } break;
+
+        default:
+            goto malformed;
+        }
+    }
+    *out = tids;
+    return count;
+
+malformed:
+    free(tids);
+    return -1;
+}
+
+static u64 cfi_hash(const cfi_t *cfi) {
+    const u8 *start = (const u8 *)cfi->types;
+    const u8 *end = (const u8 *)cfi->strings + cfi->header->strings_size;
+    return hash_bytes(start, end - start);
+}
+
+// An interface being written
+typedef struct {
+    array_t(cfi_dep_t) deps;
+    array_t(u32) types;
+    array_t(cfi_symbol_t) symbols;
+    array_t(char) strings;
+    u32 type_count;
+    u32 *type_index; // position + 1 of every type id in the table, or 0
+    usz type_index_size;
+} cfi_builder_t;
+
+static void cfi_builder_free(cfi_builder_t *b) {
+    free(b->deps.items);
+    free(b->types.items);
+    free(b->symbols.items);
+    free(b->strings.items);
+    free(b->type_index);
+}
+
+static u32 cfi_string(cfi_builder_t *b, const char *s) {
+    u32 offset = b->strings.count;
+    usz length = strlen(s) + 1;
+    da_reserve(&b->strings, b->strings.count + length);
+    memcpy(b->strings.items + b->strings.count, s, length);
+    b->strings.count += length;
+    return offset;
+}
+
+// Adds a type after the types it refers to, once
+static u32 cfi_type(cfi_builder_t *b, tid_t ty) {
+    if (ty >= b->type_index_size) {
+        usz size = ty_count() > ty ? ty_count() : ty + 1;
+        b->type_index = realloc(b->type_index, size * sizeof(u32));
+        assert(b->type_index != NULL && "Buy more RAM lol");
+        memset(b->type_index + b->type_index_size, 0,
+               (size - b->type_index_size) * sizeof(u32));
+        b->type_index_size = size;
+    }
+    if (b->type_index[ty] != 0) return b->type_index[ty] - 1;
+
+    const typeinfo_t *info = ty_get(ty);
+    switch (info->kind) {
+    case TK_PTR: {
+        u32 inner = cfi_type(b, info->inner);
+        da_append(&b->types, TK_PTR);
+        da_append(&b->types, inner);
+    } break;
+
+    case TK_FN: {
+        u32 *params = malloc((info->param_count + 1) * sizeof(u32));
+        assert(params != NULL && "Buy more RAM lol");
+        for (u32 i = 0; i < info->param_count; i++)
+            params[i] = cfi_type(b, info->params[i]);
+        u32 ret = cfi_type(b, info->inner);
+        da_append(&b->types, TK_FN);
+        da_append(&b->types, ret);
+        da_append(&b->types, info->param_count);
+        for (u32 i = 0; i < info->param_count; i++)
+            da_append(&b->types, params[i]);
+        free(params);
+    } break;
+
+    default:
+        da_append(&b->types, info->kind);
+        break;
+    }
+    b->type_index[ty] = ++b->type_count;
+    return b->type_count - 1;
+}
+
+// memcpy() but for tables that may be empty, and so NULL
+static u8 *cfi_copy(u8 *p, const void *items, usz size) {
+    if (size > 0) memcpy(p, items, size);
+    return p + size;
+}
+
+static interface_t cfi_build(cfi_builder_t *b, const struct stat *st) {
+    if (b->strings.count == 0) cfi_string(b, "");
+
+    cfi_header_t h = {
+        .magic = CFI_MAGIC,
+        .version = CFI_VERSION,
+        .source_size = st->st_size,
+        .source_sec = st->st_mtim.tv_sec,
+        .source_nsec = st->st_mtim.tv_nsec,
+        .dep_count = b->deps.count,
+        .type_words = b->types.count,
+        .symbol_count = b->symbols.count,
+        .strings_size = b->strings.count,
+    };
+    usz size = cfi_size(&h);
+    u8 *data = malloc(size);
+    assert(data != NULL && "Buy more RAM lol");
+
+    u8 *p = data + sizeof(h);
+    p = cfi_copy(p, b->deps.items, b->deps.count * sizeof(cfi_dep_t));
+    u8 *exported = p;
+    p = cfi_copy(p, b->types.items, b->types.count * sizeof(u32));
+    p = cfi_copy(p, b->symbols.items,
+                 b->symbols.count * sizeof(cfi_symbol_t));
+    p = cfi_copy(p, b->strings.items, b->strings.count);
+
+    h.hash = hash_bytes(exported, p - exported);
+    memcpy(data, &h, sizeof(h));
+    return (interface_t){.data = data, .size = size};
+}
+
+// Writes to a temporary file first, so a concurrent compilation never maps
+// a partly written interface.
+static void cfi_write(const char *path, const interface_t *iface) {
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_warn("%s: cannot write interface: %s", path, strerror(errno));
+        return;
+    }
+
+    usz written = 0;
+    while (written < iface->size) {
+        ssize_t n = write(fd, iface->data + written, iface->size - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    bool ok = close(fd) == 0 && written == iface->size &&
+              rename(tmp, path) == 0;
+    if (!ok) {
+        log_warn("%s: cannot write interface: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+static bool cfi_map(const char *path, interface_t *out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+    if (ok) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok)
+            *out = (interface_t){
+                .data = data, .size = st.st_size, .mapped = true};
+    }
+    close(fd);
+    return ok;
+}
+
+static void interface_free(interface_t *iface) {
+    if (iface->mapped)
+        munmap((void *)iface->data, iface->size);
+    else
+        free((void *)iface->data);
+}
+
+/* -------------------- MODULES -------------------- */
+
+void modules_init(modules_t *m, source_manager_t *sources,
+                  unit_options_t opts) {
+    *m = (modules_t){.sources = sources, .opts = opts};
+}
+
+void modules_free(modules_t *m) {
+    for (usz i = 0; i < m->errors.count; i++)
+        free(m->errors.items[i].msg);
+    for (usz i = 0; i < m->loaded.count; i++) {
+        free(m->loaded.items[i].path);
+        interface_free(&m->loaded.items[i].interface);
+    }
+    for (usz i = 0; i < m->owned.count; i++)
+        free(m->owned.items[i]);
+    free(m->errors.items);
+    free(m->loaded.items);
+    free(m->owned.items);
+}
+
+// The modules being loaded, innermost first, to detect import cycles
+typedef struct chain_t {
+    const struct chain_t *parent;
+    const char *path;
+} chain_t;
+
+// `name.cf` in the directory of `importer`
+static char *module_path(const char *importer, const char *name) {
+    const char *slash = strrchr(importer, '/');
+    usz dir = slash != NULL ? (usz)(slash - importer + 1) : 0;
+    usz size = dir + strlen(name) + sizeof(".cf");
+    char *path = malloc(size);
+    assert(path != NULL && "Buy more RAM lol");
+    snprintf(path, size, "%.*s%s.cf", (int)dir, importer, name);
+    return path;
+}
+
+// `path` with the `.cf` extension replaced by `.cfi`
+static char *interface_path(const char *path) {
+    usz size = strlen(path) + 2;
+    char *out = malloc(size);
+    assert(out != NULL && "Buy more RAM lol");
+    snprintf(out, size, "%si", path);
+    return out;
+}
+
+static bool module_load(modules_t *, const chain_t *, const char *path,
+                        const char *name, interface_t *, bool *cycle);
+
+static void import_all(modules_t *, const chain_t *, const char *path,
+                       const char *name, imports_t *, analyzer_t *,
+                       cfi_builder_t *);
+
+// An interface is up to date if it was made from the source as it is now,
+// and from the same interfaces of its imports as they are now.
+static bool module_fresh(modules_t *m, const chain_t *chain, const char *path,
+                         const char *name, const struct stat *st,
+                         const interface_t *iface) {
+    cfi_t cfi;
+    if (!cfi_open(iface, &cfi)) return false;
+    const cfi_header_t *h = cfi.header;
+    if (h->source_size != (u64)st->st_size ||
+        h->source_sec != st->st_mtim.tv_sec ||
+        h->source_nsec != st->st_mtim.tv_nsec || h->hash != cfi_hash(&cfi))
+        return false;
+
+    for (u32 i = 0; i < h->dep_count; i++) {
+        const char *dep = cfi.strings + cfi.deps[i].name;
+        char *dep_path = module_path(path, dep);
+        char *real = realpath(dep_path, NULL);
+        free(dep_path);
+        if (real == NULL) return false;
+
+        char *dep_name = module_path(name, dep);
+        interface_t dep_iface;
+        bool cycle;
+        bool ok = module_load(m, chain, real, dep_name, &dep_iface, &cycle);
+        free(dep_name);
+        free(real);
+        if (!ok) return false;
+
+        cfi_t dep_cfi;
+        if (!cfi_open(&dep_iface, &dep_cfi) ||
+            dep_cfi.header->hash != cfi.deps[i].hash)
+            return false;
+    }
+    return true;
+}
+
+// Compiles a module whose interface is missing or out of date. The interface
+// is only written if the module compiled without errors, so that they are
+// reported again next time.
+static bool module_compile(modules_t *m, const chain_t *chain,
+                           const char *path, const char *name,
+                           interface_t *out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    usz length;
+    char *text = fstat(fd, &st) == 0 ? read_source(fd, &length) : NULL;
+    close(fd);
+    if (text == NULL) return false;
+
+    char *owned_name = strdup(name);
+    assert(owned_name != NULL && "Buy more RAM lol");
+    da_append(&m->owned, text);
+    da_append(&m->owned, owned_name);
+    source_file_t *file = sm_add(m->sources, owned_name, text, length);
+    if (file == NULL) {
+        log_error("%s: files larger than 4GB are not supported", name);
+        return false;
+    }
+    log_debug("%s: compiling module", name);
+
+    unit_t u;
+    unit_parse(&u, file, m->opts);
+    analyzer_t a;
+    a_init(&a);
+    a.jobs = m->opts.jobs;
+    cfi_builder_t b = {0};
+
+    import_all(m, chain, path, name, &u.imports, &a, &b);
+    a_resolve(&a, &u.decls);
+    a_check(&a, &u.decls);
+    dag_relocate(&u.repeats, &a.errors);
+
+    for (usz i = 0; i < u.decls.count; i++) {
+        decl_t *decl = u.decls.items[i];
+        cfi_symbol_t symbol = {.name = cfi_string(&b, decl->id),
+                               .type = cfi_type(&b, decl->ty),
+                               .flags = decl->constant ? CFI_CONSTANT : 0};
+        da_append(&b.symbols, symbol);
+    }
+    *out = cfi_build(&b, &st);
+    cfi_builder_free(&b);
+
+    bool failed = u.errors.count > 0;
+    for (usz i = 0; i < u.errors.count; i++)
+        da_append(&m->errors, u.errors.items[i]);
+    for (usz i = 0; i < a.errors.count; i++) {
+        failed |= !a.errors.items[i].warning;
+        da_append(&m->errors, a.errors.items[i]);
+    }
+    u.errors.count = 0;
+    a.errors.count = 0;
+    a_free(&a);
+    unit_free(&u);
+
+    if (!failed) {
+        char *cfi_path = interface_path(path);
+        cfi_write(cfi_path, out);
+        free(cfi_path);
+    }
+    return true;
+}
+
+// Finds the interface of the module at `path`, mapping or compiling it the
+// first time. `name` is how diagnostics refer to the module's file.
+static bool module_load(modules_t *m, const chain_t *chain, const char *path,
+                        const char *name, interface_t *out, bool *cycle) {
+    *cycle = false;
+    for (usz i = 0; i < m->loaded.count; i++) {
+        if (strcmp(m->loaded.items[i].path, path) == 0) {
+            *out = m->loaded.items[i].interface;
+            return true;
+        }
+    }
+    for (const chain_t *link = chain; link != NULL; link = link->parent) {
+        if (strcmp(link->path, path) == 0) {
+            *cycle = true;
+            return false;
+        }
+    }
+
+    chain_t link = {.parent = chain, .path = path};
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+
+    interface_t iface;
+    char *cfi_path = interface_path(path);
+    bool mapped = cfi_map(cfi_path, &iface);
+    free(cfi_path);
+    if (mapped && module_fresh(m, &link, path, name, &st, &iface)) {
+        log_debug("%s: using its interface", name);
+    } else {
+        if (mapped) interface_free(&iface);
+        if (!module_compile(m, &link, path, name, &iface)) return false;
+    }
+
+    char *owned_path = strdup(path);
+    assert(owned_path != NULL && "Buy more RAM lol");
+    da_append(&m->loaded, ((module_t){owned_path, iface}));
+    *out = iface;
+    return true;
+}
+
+// Declares what the module exports in `a`, and records it as a dependency
+// in `b` if the importer is itself a module.
+static void import_one(modules_t *m, const chain_t *chain, const char *path,
+                       const char *name, import_t *import, analyzer_t *a,
+                       cfi_builder_t *b) {
+    char *module = module_path(path, import->name);
+    char *real = realpath(module, NULL);
+    free(module);
+    if (real == NULL) {
+        a_report(a, import->span, false, "cannot find module `%s`",
+                 import->name);
+        return;
+    }
+
+    char *module_name = module_path(name, import->name);
+    interface_t iface;
+    bool cycle;
+    bool ok = module_load(m, chain, real, module_name, &iface, &cycle);
+    free(module_name);
+    free(real);
+
+    cfi_t cfi;
+    tid_t *tids = NULL;
+    i64 type_count = -1;
+    if (ok && cfi_open(&iface, &cfi)) type_count = cfi_types(&cfi, &tids);
+    if (cycle) {
+        a_report(a, import->span, false, "import cycle through `%s`",
+                 import->name);
+        return;
+    } else if (type_count < 0) {
+        a_report(a, import->span, false, "cannot load module `%s`",
+                 import->name);
+        return;
+    }
+
+    for (u32 i = 0; i < cfi.header->symbol_count; i++) {
+        const cfi_symbol_t *symbol = &cfi.symbols[i];
+        const char *id = intern_cstr(cfi.strings + symbol->name);
+        tid_t ty = symbol->type < type_count ? tids[symbol->type] : TID_ERROR;
+        if (a_import(a, id, ty, symbol->flags & CFI_CONSTANT, import->span) ==
+            NULL)
+            a_report(a, import->span, false,
+                     "`%s` is imported from more than one module", id);
+    }
+    free(tids);
+
+    if (b != NULL) {
+        cfi_dep_t dep = {.name = cfi_string(b, import->name),
+                         .hash = cfi.header->hash};
+        da_append(&b->deps, dep);
+    }
+}
+
+static void import_all(modules_t *m, const chain_t *chain, const char *path,
+                       const char *name, imports_t *imports, analyzer_t *a,
+                       cfi_builder_t *b) {
+    for (usz i = 0; i < imports->count; i++) {
+        import_t *import = &imports->items[i];
+        bool repeated = false;
+        for (usz j = 0; j < i && !repeated; j++)
+            repeated = imports->items[j].name == import->name;
+        if (repeated)
+            a_report(a, import->span, true, "`%s` is already imported",
+                     import->name);
+        else
+            import_one(m, chain, path, name, import, a, b);
+    }
+}
+
+void modules_import(modules_t *m, source_file_t *file, imports_t *imports,
+                    analyzer_t *a) {
+    if (imports->count == 0) return;
+
+    // a file that is not on disk imports relative to the working directory
+    char *path = realpath(file->name, NULL);
+    if (path == NULL) path = strdup(file->name);
+    assert(path != NULL && "Buy more RAM lol");
+    chain_t root = {.path = path};
+    import_all(m, &root, path, file->name, imports, a, NULL);
+    free(path);
+}
@@ -0,0 +1,556 @@
+#include "include/number.h"
+#include "include/pow5.h"
+#include "include/ryu.h"
+#include <stdlib.h>
+#include <string.h>
+
+__extension__ typedef unsigned __int128 u128;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUM_SWAR 1
+#else
+#define NUM_SWAR 0
+#endif
+
+/* -------------------- INTEGERS -------------------- */
+
+static inline u64 load8(const char *s) {
+    u64 v;
+    memcpy(&v, s, sizeof(v));
+    return v;
+}
+
+// True when all eight bytes of `v` are ASCII digits.
+static inline bool is_eight_digits(u64 v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0) |
+             (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+            0x3333333333333333);
+}
+
+// Converts eight ASCII digits, first digit in the lowest byte, in three
+// multiplications.
+static inline u32 parse_eight_digits(u64 v) {
+    const u64 mask = 0x000000FF000000FF;
+    const u64 mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+    const u64 mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (u32)v;
+}
+
+static inline bool is_dec_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+// A separator is only allowed between two digits of the literal's base
+static inline bool separates(const char *s, const char *p, const char *end,
+                             bool (*is_digit)(char)) {
+    return p > s && is_digit(p[-1]) && p + 1 < end && is_digit(p[1]);
+}
+
+usz num_scan_dec(const char *s, const char *end, num_scan_t *out) {
+    const char *p = s;
+    u64 v = 0;
+    bool of = false;
+    *out = (num_scan_t){0};
+
+    while (p < end) {
+        if (NUM_SWAR && end - p >= 8 && is_eight_digits(load8(p))) {
+            of |= __builtin_mul_overflow(v, 100000000, &v);
+            of |= __builtin_add_overflow(v, parse_eight_digits(load8(p)), &v);
+            out->digits += 8;
+            p += 8;
+            continue;
+        }
+
+        char ch = *p;
+        if (ch == '_') {
+            out->misplaced |= !separates(s, p, end, is_dec_digit);
+            p++;
+            continue;
+        }
+        if (!is_dec_digit(ch)) break;
+        of |= __builtin_mul_overflow(v, 10, &v);
+        of |= __builtin_add_overflow(v, (u64)(ch - '0'), &v);
+        out->digits++;
+        p++;
+    }
+
+    out->value = v;
+    out->overflow = of;
+    return p - s;
+}
+
+static const i8 hex_values[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static bool is_hex_digit(char ch) { return hex_values[(u8)ch] != 0; }
+
+static bool is_bin_digit(char ch) { return ch == '0' || ch == '1'; }
+
+usz num_scan_hex(const char *s, const char *end, num_scan_t *out) {
+    const char *p = s;
+    u64 v = 0;
+    bool of = false;
+    *out = (num_scan_t){0};
+
+    for (; p < end; p++) {
+        if (*p == '_') {
+            out->misplaced |= !separates(s, p, end, is_hex_digit);
+            continue;
+        }
+        // hex_values is offset by one so that 0 means "not a hex digit"
+        i8 digit = hex_values[(u8)*p];
+        if (digit == 0) break;
+        of |= (v >> 60) != 0;
+        v = (v << 4) | (u64)(digit - 1);
+        out->digits++;
+    }
+
+    out->value = v;
+    out->overflow = of;
+    return p - s;
+}
+
+usz num_scan_bin(const char *s, const char *end, num_scan_t *out) {
+    const char *p = s;
+    u64 v = 0;
+    bool of = false;
+    *out = (num_scan_t){0};
+
+    for (; p < end; p++) {
+        if (*p == '_') {
+            out->misplaced |= !separates(s, p, end, is_bin_digit);
+            continue;
+        }
+        if (!is_bin_digit(*p)) break;
+        of |= (v >> 63) != 0;
+        v = (v << 1) | (u64)(*p - '0');
+        out->digits++;
+    }
+
+    out->value = v;
+    out->overflow = of;
+    return p - s;
+}
+
+/* -------------------- FLOATS -------------------- */
+
+// IEEE 754 binary64 parameters
+#define F64_MANTISSA_BITS 52
+#define F64_MINIMUM_EXPONENT (-1023)
+#define F64_INFINITE_POWER 0x7FF
+#define F64_MIN_EXPONENT_ROUND_TO_EVEN (-4)
+#define F64_MAX_EXPONENT_ROUND_TO_EVEN 23
+#define F64_MAX_EXACT_POWER 22
+#define F64_MAX_EXACT_MANTISSA ((u64)1 << 53)
+
+// At most 19 decimal digits always fit in a u64
+#define MAX_MANTISSA_DIGITS 19
+
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+typedef struct {
+    u64 mantissa;
+    i32 power2; // biased binary exponent, or -1 when undecidable
+} adjusted_mantissa_t;
+
+static inline double am_to_double(adjusted_mantissa_t am) {
+    u64 bits = am.mantissa | (u64)am.power2 << F64_MANTISSA_BITS;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// floor(log2(10^q)) + 63, valid for q in [-1500, 1500]
+static inline i32 power_of_ten_log2(i32 q) {
+    return (((152170 + 65536) * q) >> 16) + 63;
+}
+
+// Eisel-Lemire: computes w * 10^q correctly rounded to binary64 using the
+// 128-bit truncated power of five table. The 128-bit product is always
+// precise enough to decide the rounding of a 64-bit `w`.
+static adjusted_mantissa_t compute_float(i64 q, u64 w) {
+    adjusted_mantissa_t answer = {0};
+    if (w == 0 || q < POW5_SMALLEST_POWER) return answer;
+    if (q > POW5_LARGEST_POWER) {
+        answer.power2 = F64_INFINITE_POWER;
+        return answer;
+    }
+
+    i32 lz = __builtin_clzll(w);
+    w <<= lz;
+
+    // w * 5^q, with the second table word only needed when the bits below
+    // the 55 we keep are all ones
+    usz index = 2 * (usz)(q - POW5_SMALLEST_POWER);
+    const u64 precision_mask = 0xFFFFFFFFFFFFFFFF >> (F64_MANTISSA_BITS + 3);
+    u128 first = (u128)w * pow5_128[index];
+    u64 high = (u64)(first >> 64), low = (u64)first;
+    if ((high & precision_mask) == precision_mask) {
+        u128 second = (u128)w * pow5_128[index + 1];
+        u64 second_high = (u64)(second >> 64);
+        low += second_high;
+        if (second_high > low) high++;
+    }
+
+    i32 upperbit = (i32)(high >> 63);
+    i32 shift = upperbit + 64 - F64_MANTISSA_BITS - 3;
+    answer.mantissa = high >> shift;
+    answer.power2 = power_of_ten_log2((i32)q) + upperbit - lz -
+                    F64_MINIMUM_EXPONENT;
+
+    if (answer.power2 <= 0) {
+        // subnormal, or zero if everything would be shifted out
+        if (-answer.power2 + 1 >= 64) {
+            answer.power2 = 0;
+            answer.mantissa = 0;
+            return answer;
+        }
+        answer.mantissa >>= -answer.power2 + 1;
+        answer.mantissa += answer.mantissa & 1;
+        answer.mantissa >>= 1;
+        answer.power2 =
+            answer.mantissa < ((u64)1 << F64_MANTISSA_BITS) ? 0 : 1;
+        return answer;
+    }
+
+    // exactly halfway between two floats: round to even
+    if (low <= 1 && q >= F64_MIN_EXPONENT_ROUND_TO_EVEN &&
+        q <= F64_MAX_EXPONENT_ROUND_TO_EVEN && (answer.mantissa & 3) == 1 &&
+        (answer.mantissa << shift) == high)
+        answer.mantissa &= ~(u64)1;
+
+    answer.mantissa += answer.mantissa & 1;
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= ((u64)2 << F64_MANTISSA_BITS)) {
+        answer.mantissa = (u64)1 << F64_MANTISSA_BITS;
+        answer.power2++;
+    }
+    answer.mantissa &= ~((u64)1 << F64_MANTISSA_BITS);
+
+    if (answer.power2 >= F64_INFINITE_POWER) {
+        answer.power2 = F64_INFINITE_POWER;
+        answer.mantissa = 0;
+    }
+    return answer;
+}
+
+// Correctly rounded fallback for literals with more significant digits than
+// fit in the mantissa when the truncated digits affect the rounding.
+static double parse_float_slow(const char *s, usz length) {
+    char small[128];
+    char *buffer = length < sizeof(small) ? small : malloc(length + 1);
+
+    usz n = 0;
+    for (usz i = 0; i < length; i++)
+        if (s[i] != '_') buffer[n++] = s[i];
+    buffer[n] = '\0';
+
+    double d = strtod(buffer, NULL);
+    if (buffer != small) free(buffer);
+    return d;
+}
+
+double num_parse_float(const char *s, usz length) {
+    const char *p = s, *end = s + length;
+    u64 w = 0;
+    i64 exponent = 0;
+    u32 digits = 0;
+    bool truncated = false, fraction = false;
+
+    while (p < end) {
+        // whole blocks of eight digits once past the leading zeros
+        if (NUM_SWAR && w != 0 && digits + 8 <= MAX_MANTISSA_DIGITS &&
+            end - p >= 8 && is_eight_digits(load8(p))) {
+            w = w * 100000000 + parse_eight_digits(load8(p));
+            digits += 8;
+            if (fraction) exponent -= 8;
+            p += 8;
+            continue;
+        }
+
+        char ch = *p++;
+        if (ch == '_') continue;
+        if (ch == '.') {
+            fraction = true;
+            continue;
+        }
+
+        if (digits < MAX_MANTISSA_DIGITS) {
+            w = w * 10 + (u64)(ch - '0');
+            if (w != 0) digits++;
+            if (fraction) exponent--;
+        } else {
+            truncated |= ch != '0';
+            if (!fraction) exponent++;
+        }
+    }
+
+    // Clinger's fast path: both operands are exact doubles
+    if (!truncated && w <= F64_MAX_EXACT_MANTISSA &&
+        exponent >= -F64_MAX_EXACT_POWER && exponent <= F64_MAX_EXACT_POWER) {
+        double d = (double)w;
+        return exponent < 0 ? d / exact_powers_of_ten[-exponent]
+                            : d * exact_powers_of_ten[exponent];
+    }
+
+    adjusted_mantissa_t am = compute_float(exponent, w);
+    if (truncated) {
+        // the true value lies between w and w + 1, which must round the same
+        adjusted_mantissa_t upper = compute_float(exponent, w + 1);
+        if (am.mantissa != upper.mantissa || am.power2 != upper.power2)
+            return parse_float_slow(s, length);
+    }
+    return am_to_double(am);
+}
+
+/* -------------------- FORMATTING -------------------- */
+
+static const char digit_pairs[200] = {
+    '0', '0', '0', '1', '0', '2', '0', '3', '0', '4', '0', '5', '0', '6', '0',
+    '7', '0', '8', '0', '9', '1', '0', '1', '1', '1', '2', '1', '3', '1', '4',
+    '1', '5', '1', '6', '1', '7', '1', '8', '1', '9', '2', '0', '2', '1', '2',
+    '2', '2', '3', '2', '4', '2', '5', '2', '6', '2', '7', '2', '8', '2', '9',
+    '3', '0', '3', '1', '3', '2', '3', '3', '3', '4', '3', '5', '3', '6', '3',
+    '7', '3', '8', '3', '9', '4', '0', '4', '1', '4', '2', '4', '3', '4', '4',
+    '4', '5', '4', '6', '4', '7', '4', '8', '4', '9', '5', '0', '5', '1', '5',
+    '2', '5', '3', '5', '4', '5', '5', '5', '6', '5', '7', '5', '8', '5', '9',
+    '6', '0', '6', '1', '6', '2', '6', '3', '6', '4', '6', '5', '6', '6', '6',
+    '7', '6', '8', '6', '9', '7', '0', '7', '1', '7', '2', '7', '3', '7', '4',
+    '7', '5', '7', '6', '7', '7', '7', '8', '7', '9', '8', '0', '8', '1', '8',
+    '2', '8', '3', '8', '4', '8', '5', '8', '6', '8', '7', '8', '8', '8', '9',
+    '9', '0', '9', '1', '9', '2', '9', '3', '9', '4', '9', '5', '9', '6', '9',
+    '7', '9', '8', '9', '9',
+};
+
+static u32 decimal_length(u64 v) {
+    u32 n = 1;
+    for (; v >= 10000; v /= 10000)
+        n += 4;
+    return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+// Writes exactly `length` digits of `v` ending at `out + length`.
+static void write_digits(char *out, u64 v, u32 length) {
+    char *p = out + length;
+    while (v >= 100) {
+        u32 pair = (u32)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+}
+
+usz num_format_u64(u64 value, char *buf) {
+    u32 length = decimal_length(value);
+    write_digits(buf, value, length);
+    return length;
+}
+
+usz num_format_i64(i64 value, char *buf) {
+    if (value >= 0) return num_format_u64((u64)value, buf);
+    buf[0] = '-';
+    return 1 + num_format_u64(-(u64)value, buf + 1);
+}
+
+// The float formatter is Ryu (Ulf Adams, PLDI 2018): it computes the
+// shortest decimal in the rounding interval of the double directly, using
+// the 125-bit powers of five in ryu.h.
+
+// ceil(log2(5^e)), floor(log10(2^e)) and floor(log10(5^e)) for small e
+static inline u32 pow5_bits(i32 e) { return (((u32)e * 1217359) >> 19) + 1; }
+static inline u32 log10_pow2(i32 e) { return ((u32)e * 78913) >> 18; }
+static inline u32 log10_pow5(i32 e) { return ((u32)e * 732923) >> 20; }
+
+static inline u32 pow5_factor(u64 value) {
+    u32 count = 0;
+    for (; value % 5 == 0; value /= 5)
+        count++;
+    return count;
+}
+
+static inline bool multiple_of_pow5(u64 value, u32 p) {
+    return pow5_factor(value) >= p;
+}
+
+static inline bool multiple_of_pow2(u64 value, u32 p) {
+    return (value & (((u64)1 << p) - 1)) == 0;
+}
+
+static inline u64 mul_shift(u64 m, const u64 *mul, i32 j) {
+    u128 b0 = (u128)m * mul[0];
+    u128 b2 = (u128)m * mul[1];
+    return (u64)(((b0 >> 64) + b2) >> (j - 64));
+}
+
+typedef struct {
+    u64 mantissa;
+    i32 exponent; // value is mantissa * 10^exponent
+} decimal_t;
+
+static decimal_t shortest_decimal(u64 ieee_mantissa, u32 ieee_exponent) {
+    i32 e2;
+    u64 m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 + F64_MINIMUM_EXPONENT - F64_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (i32)ieee_exponent + F64_MINIMUM_EXPONENT - F64_MANTISSA_BITS - 2;
+        m2 = ((u64)1 << F64_MANTISSA_BITS) | ieee_mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    // the interval of decimals that round to this double is (vm, vp), scaled
+    // by 4 so that the halfway points are integers
+    u64 mv = 4 * m2;
+    u32 mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    u64 vr, vp, vm;
+    i32 e10;
+    bool vm_trailing_zeros = false, vr_trailing_zeros = false;
+    if (e2 >= 0) {
+        u32 q = log10_pow2(e2) - (e2 > 3);
+        e10 = (i32)q;
+        i32 k = RYU_POW5_INV_BITCOUNT + (i32)pow5_bits((i32)q) - 1;
+        i32 i = -e2 + (i32)q + k;
+        vr = mul_shift(4 * m2, ryu_pow5_inv[q], i);
+        vp = mul_shift(4 * m2 + 2, ryu_pow5_inv[q], i);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, ryu_pow5_inv[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                vp -= multiple_of_pow5(mv + 2, q);
+        }
+    } else {
+        u32 q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = (i32)q + e2;
+        i32 i = -e2 - (i32)q;
+        i32 k = (i32)pow5_bits(i) - RYU_POW5_BITCOUNT;
+        i32 j = (i32)q - k;
+        vr = mul_shift(4 * m2, ryu_pow5[i], j);
+        vp = mul_shift(4 * m2 + 2, ryu_pow5[i], j);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, ryu_pow5[i], j);
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        } else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    // drop digits while vp and vm still differ in the remaining prefix
+    i32 removed = 0;
+    u8 last_removed = 0;
+    u64 output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (u8)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (u8)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        // exactly halfway: round to even
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                       last_removed >= 5);
+    } else {
+        // the common case, where no bound is a trailing-zero multiple
+        bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+
+    return (decimal_t){output, e10 + removed};
+}
+
+usz num_format_float(double value, char *buf) {
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    u64 ieee_mantissa = bits & (((u64)1 << F64_MANTISSA_BITS) - 1);
+    u32 ieee_exponent = (u32)(bits >> F64_MANTISSA_BITS) & F64_INFINITE_POWER;
+    bool sign = bits >> 63;
+
+    char *p = buf;
+    if (sign) *p++ = '-';
+    if (ieee_exponent == F64_INFINITE_POWER) {
+        memcpy(p, ieee_mantissa != 0 ? "nan" : "inf", 3);
+        return (usz)(p - buf) + 3;
+    }
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        memcpy(p, "0.0", 3);
+        return (usz)(p - buf) + 3;
+    }
+
+    decimal_t d = shortest_decimal(ieee_mantissa, ieee_exponent);
+    u32 length = decimal_length(d.mantissa);
+    i32 point = (i32)length + d.exponent; // digits before the decimal point
+
+    // always fixed notation, since literals have no exponent syntax
+    if (point <= 0) {
+        memcpy(p, "0.", 2);
+        p += 2;
+        memset(p, '0', (usz)-point);
+        p += -point;
+        write_digits(p, d.mantissa, length);
+        p += length;
+    } else if (d.exponent >= 0) {
+        write_digits(p, d.mantissa, length);
+        p += length;
+        memset(p, '0', (usz)d.exponent);
+        p += d.exponent;
+        memcpy(p, ".0", 2);
+        p += 2;
+    } else {
+        write_digits(p, d.mantissa, length);
+        memmove(p + point + 1, p + point, length - (u32)point);
+        p[point] = '.';
+        p += length + 1;
+    }
+    return (usz)(p - buf);
+}
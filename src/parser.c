@@ -1,24 +1,71 @@
 #include "include/parser.h"
+#include "include/vector.h"
 #include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-void p_init(parser_t *p, lexer_t *l) {
+void p_init(parser_t *p, lexer_t *l, arena_t *arena) {
     p->lexer = l;
-    p_advance(p);
+    p->arena = arena;
+    p->token = (token_t){0};
+    p->next = (token_t){0};
+    p->has_next = false;
+    p->skim = false;
     p->errors = (errors_t){0};
+    p->body_errors = &p->errors;
+    p->imports = NULL;
+    p->dag = NULL;
+    p->span = (span_t){0};
+    p->depth = 0;
+    p_advance(p);
 }
 
 void p_free(parser_t *p) { free(p); }
 
-void p_advance(parser_t *p) { l_next(p->lexer, &p->token); }
+// Lexes the next token into `token` and moves any diagnostics the lexer
+// reported for it over to the parser, so they stay in source order.
+static void p_lex(parser_t *p, token_t *token) {
+    l_next(p->lexer, token);
 
-bool p_expect(parser_t *p, u8 type) {
-    if (p->token.type == T_ERROR) {
+    errors_t *errors = &p->lexer->errors;
+    for (usz i = 0; i < errors->count; i++)
+        da_append(&p->errors, errors->items[i]);
+    errors->count = 0;
+}
+
+void p_advance(parser_t *p) {
+    if (p->has_next) {
+        p->token = p->next;
+        p->has_next = false;
+        return;
+    }
+    p_lex(p, &p->token);
+}
+
+token_t *p_peek(parser_t *p) {
+    if (!p->has_next) {
+        p_lex(p, &p->next);
+        p->has_next = true;
+    }
+    return &p->next;
+}
+
+// Stray characters are reported and skipped rather than ending the process,
+// which may be a compile server with other requests in flight. Whatever
+// reads the current token before `p_expect` skips them first, as their
+// strings are freed.
+static void p_skip_errors(parser_t *p) {
+    while (p->token.type == T_ERROR) {
         p_error(p, "unexpected character `%s`", p->token.string_value);
-        exit(1);
+        free(p->token.string_value);
+        p_advance(p);
     }
+}
+
+bool p_expect(parser_t *p, u8 type) {
+    p_skip_errors(p);
     if (p->token.type != type) return false;
     p_advance(p);
     return true;
@@ -41,14 +88,11 @@ void p_error(parser_t *p, const char *msg, ...) {
     va_list ap;
     va_start(ap, msg);
 
-    source_loc_t loc = span_to_source_loc(p->token.span, p->lexer->source);
-
     char *message;
     vasprintf(&message, msg, ap);
 
     error_t err = (error_t){
         .span = p->token.span,
-        .source_loc = loc,
         .msg = message,
     };
     da_append(&p->errors, err);
@@ -58,11 +102,12 @@ void p_error(parser_t *p, const char *msg, ...) {
 
 #define E_EXPECT(parser, expected)                                             \
     p_error((parser), "expected `%s`, but got `%s` instead",                   \
-            tt_name(expected), tt_name(parser->token.type))
+            tt_name(expected), tt_name((parser)->token.type))
 
 decl_t *p_parse_decl(parser_t *p) {
-    decl_t *decl = malloc(sizeof(decl_t));
+    decl_t *decl = arena_new(p->arena, decl_t);
 
+    p_skip_errors(p);
     decl->id = p->token.string_value;
     decl->span = p->token.span;
     if (!p_expect(p, T_IDENT)) {
@@ -70,41 +115,90 @@ decl_t *p_parse_decl(parser_t *p) {
         return NULL;
     }
 
-    decl->constant = true;
-    if (!p_expect(p, T_COLON_COLON)) {
+    if (p_expect(p, T_COLON_COLON)) {
+        decl->constant = true;
+    } else if (p_expect(p, T_COLON_EQUALS)) {
+        decl->constant = false;
+    } else {
         E_EXPECT(p, T_COLON_COLON);
         return NULL;
     }
 
+    // the name means something else from where name resolution binds it
+    if (p->dag != NULL && decl->constant) dag_declare(p->dag, decl->id);
     expr_t *value = p_parse_expr(p);
     if (value == NULL) return NULL;
+    if (p->dag != NULL && !decl->constant) dag_declare(p->dag, decl->id);
     decl->value = value;
+    decl->type = NULL;
+    decl->ty = TID_ERROR;
+    decl->state = D_UNCHECKED;
 
     return decl;
 }
 
-stmt_t *p_parse_stmt(parser_t *p) {
-    stmt_t *stmt = malloc(sizeof(stmt_t));
+// `import name;`
+static bool p_parse_import(parser_t *p) {
+    span_t span = p->token.span;
+    p_advance(p);
 
-    // in the case where p_parse_decl fails, we need to rollback the parser
-    // to before we attempted to parse it to make sure that all the state
-    // is as it should be before we return NULL
-    usz error_count = p->errors.count;
-    usz token_index = p->lexer->pos;
-    span_t token_span = p->token.span;
+    p_skip_errors(p);
+    import_t import = {.name = p->token.string_value};
+    import.span = span_join(span, p->token.span);
+    if (!p_expect(p, T_IDENT)) {
+        E_EXPECT(p, T_IDENT);
+        return false;
+    }
+    if (!p_expect(p, T_SEMICOLON)) {
+        E_EXPECT(p, T_SEMICOLON);
+        return false;
+    }
+    if (p->imports != NULL) da_append(p->imports, import);
+    return true;
+}
+
+// Parses a chunk of a translation unit that holds exactly one top-level
+// declaration, see unit.c. `*out` stays NULL for a chunk with nothing in it.
+// The first chunk may start with imports, which go to `p->imports`.
+bool p_parse_unit_decl(parser_t *p, decl_t **out) {
+    *out = NULL;
+    while (p->token.type == T_IMPORT)
+        if (!p_parse_import(p)) return false;
+    if (p->token.type == T_EOF) return true;
 
     decl_t *decl = p_parse_decl(p);
-    if (decl != NULL) {
+    if (decl == NULL) return false;
+    p_expect(p, T_SEMICOLON);
+
+    // the declaration itself is fine whatever follows it
+    *out = decl;
+    if (p->token.type == T_IMPORT) {
+        p_error(p, "imports must come before the first declaration");
+        return false;
+    }
+    if (p->token.type != T_EOF) {
+        p_error(p, "expected a declaration, but got `%s` instead",
+                tt_name(p->token.type));
+        return false;
+    }
+    return true;
+}
+
+stmt_t *p_parse_stmt(parser_t *p) {
+    stmt_t *stmt = arena_new(p->arena, stmt_t);
+
+    // an identifier directly followed by `::` or `:=` starts a declaration,
+    // anything else is an expression statement. one token of lookahead is
+    // enough to decide, so there is no need to speculatively parse a
+    // declaration and rewind the lexer when that fails
+    if (p->token.type == T_IDENT && (p_peek(p)->type == T_COLON_COLON ||
+                                     p_peek(p)->type == T_COLON_EQUALS)) {
+        decl_t *decl = p_parse_decl(p);
+        if (decl == NULL) return NULL;
         stmt->type = S_DECL;
+        stmt->span = decl->span;
         stmt->decl = decl;
     } else {
-        while (p->errors.count > error_count) {
-            error_t error = da_pop(&p->errors);
-            free(error.msg);
-        }
-        p->lexer->pos = token_index;
-        p->token.span = token_span;
-
         expr_t *expr = p_parse_expr(p);
         if (expr == NULL) {
             p_error(p, "expected a statement, but got `%s` instead",
@@ -113,98 +207,255 @@ stmt_t *p_parse_stmt(parser_t *p) {
         }
 
         stmt->type = S_EXPR;
+        stmt->span = p->span;
         stmt->expr = expr;
     }
 
     return stmt;
 }
 
+// Allocates `node`, or finds the node equal to it in DAG mode. The left
+// operand of an assignment is what was parsed last before the operator, and
+// is never shared, see `dag_own`.
+static expr_t *p_node(parser_t *p, const expr_t *node) {
+    p->span = node->span;
+    if (p->dag != NULL)
+        return dag_node(p->dag, node,
+                        !(tt_info[p->token.type].flags & TT_RIGHT), p->arena);
+
+    expr_t *expr = arena_new(p->arena, expr_t);
+    *expr = *node;
+    return expr;
+}
+
+// Enters a level of nesting, which the caller leaves unless it fails: a
+// syntax error gives up on the whole declaration
+static bool p_nest(parser_t *p) {
+    if (p->depth < P_MAX_DEPTH) {
+        p->depth++;
+        return true;
+    }
+    p_error(p, "nesting deeper than %d levels", P_MAX_DEPTH);
+    return false;
+}
+
 expr_t *p_parse_expr(parser_t *p) {
-    expr_t *lhs = p_parse_primary(p);
+    expr_t *lhs = p_parse_unary(p);
     if (lhs == NULL) return NULL;
     return p_parse_precedence(p, lhs, 0);
 }
 
+// `lhs` is the expression parsed last, at `p->span`
+// that of a right operand is a level deeper once it takes an operator
 expr_t *p_parse_precedence(parser_t *p, expr_t *lhs, u8 min_precedence) {
-    lhs->span.end = p->token.span.start;
-    token_t lookahead = p->token;
+    bool nested = false;
+    for (;;) {
+        const tt_info_t *info = &tt_info[p->token.type];
+        if (!(info->flags & TT_INFIX) || info->precedence < min_precedence)
+            break;
+        if (min_precedence > 0 && !nested) {
+            if (!p_nest(p)) return NULL;
+            nested = true;
+        }
 
-    while (tt_is_binop(lookahead.type) &&
-           tt_precedence(lookahead.type) >= min_precedence) {
-        u8 op = lookahead.type;
+        span_t span = p->span;
+        u8 op = p->token.type;
         p_advance(p);
-        expr_t *rhs = p_parse_primary(p);
+        expr_t *rhs = p_parse_unary(p);
         if (rhs == NULL) return NULL;
-        lookahead = p->token;
 
-        while (tt_is_binop(lookahead.type) &&
-               tt_precedence(lookahead.type) > tt_precedence(op)) {
-            rhs = p_parse_precedence(p, rhs, tt_precedence(op) + 1);
-            lookahead = p->token;
-        }
+        // left-associative operators only let tighter operators into their
+        // right-hand side, right-associative ones also take their own level
+        u8 rhs_precedence = info->precedence + !(info->flags & TT_RIGHT);
+        rhs = p_parse_precedence(p, rhs, rhs_precedence);
+        if (rhs == NULL) return NULL;
+        if (p->dag != NULL && info->flags & TT_RIGHT)
+            rhs = dag_own(p->dag, rhs, p->span, p->arena);
 
-        expr_t *expr = malloc(sizeof(expr_t));
-        expr->type = E_BINOP;
-        expr->binop.lhs = lhs;
-        expr->binop.rhs = rhs;
-        expr->binop.op = op;
-        lhs = expr;
-        lhs->span.end = rhs->span.end;
+        lhs = p_node(p, &(expr_t){.type = E_BINOP,
+                                  .ty = TID_ERROR,
+                                  .span = span_join(span, p->span),
+                                  .binop = {lhs, rhs, op}});
     }
 
+    p->depth -= nested;
     return lhs;
 }
 
+expr_t *p_parse_unary(parser_t *p) {
+    if (!(tt_info[p->token.type].flags & TT_PREFIX)) return p_parse_primary(p);
+
+    if (!p_nest(p)) return NULL;
+    span_t span = p->token.span;
+    u8 op = p->token.type;
+    p_advance(p);
+
+    expr_t *operand = p_parse_unary(p);
+    if (operand == NULL) return NULL;
+    p->depth--;
+
+    return p_node(p, &(expr_t){.type = E_UNARY,
+                               .ty = TID_ERROR,
+                               .span = span_join(span, p->span),
+                               .unary = {operand, op}});
+}
+
+// Parses the `;` separated statements of a function body up to its closing
+// brace, or up to the end of input for a body that is parsed lazily.
+static bool p_parse_body(parser_t *p, stmts_t *out) {
+    small_array_t(stmt_t *, 8) stmts = {0};
+    bool ok = true;
+    for (;;) {
+        if (p->token.type == T_CLOSE_BRACE || p->token.type == T_EOF) break;
+        stmt_t *stmt = p_parse_stmt(p);
+        if (stmt == NULL) {
+            ok = false;
+            break;
+        }
+        sv_append(&stmts, stmt);
+
+        if (p->token.type != T_SEMICOLON) break;
+        p_expect(p, T_SEMICOLON);
+    }
+    sv_finish(&stmts, p->arena, out);
+    return ok;
+}
+
+// Skips over a function body by matching braces directly on the source
+// bytes, without lexing it, and records where it is so that `ast_fn_body`
+// can parse it later. The current token must be the opening brace.
+static bool p_skip_body(parser_t *p, expr_t *fn) {
+    assert(!p->has_next && "cannot skip a body after peeking past `{`");
+
+    lexer_t *l = p->lexer;
+    usz start = l->pos, pos = l->pos, depth = 1;
+    for (; pos < l->length; pos++) {
+        char ch = l->source[pos];
+        if (ch == '"') {
+            pos++;
+            while (pos < l->length && l->source[pos] != '"')
+                pos++;
+        } else if (ch == '{') {
+            depth++;
+        } else if (ch == '}' && --depth == 0) {
+            break;
+        }
+    }
+
+    if (depth != 0) {
+        p_error(p, "unterminated function body");
+        return false;
+    }
+
+    lazy_body_t *lazy = arena_new(p->arena, lazy_body_t);
+    *lazy = (lazy_body_t){
+        .span = {l->base + (u32)start, (u32)(pos - start)},
+        .file = l->file,
+        .arena = p->arena,
+        .errors = p->body_errors,
+        .depth = p->depth,
+    };
+    fn->fn.lazy = lazy;
+    fn->span.length = l->base + (u32)pos + 1 - fn->span.start;
+
+    l->pos = pos + 1;
+    p_advance(p);
+    return true;
+}
+
+stmts_t *ast_fn_body(expr_t *fn) {
+    lazy_body_t *lazy = fn->fn.lazy;
+    if (lazy == NULL) return &fn->fn.stmts;
+    return ast_fn_body_in(fn, lazy->arena, lazy->errors);
+}
+
+stmts_t *ast_fn_body_in(expr_t *fn, arena_t *arena, errors_t *errors) {
+    lazy_body_t *lazy = fn->fn.lazy;
+    if (lazy == NULL) return &fn->fn.stmts;
+    fn->fn.lazy = NULL;
+
+    lexer_t lexer;
+    u32 start = lazy->span.start - lazy->file->base;
+    l_init_range(&lexer, lazy->file, start, start + lazy->span.length);
+    parser_t parser;
+    p_init(&parser, &lexer, arena);
+    parser.skim = true;
+    parser.body_errors = lazy->errors;
+    parser.depth = lazy->depth;
+
+    if (p_parse_body(&parser, &fn->fn.stmts) && parser.token.type != T_EOF)
+        E_EXPECT(&parser, T_CLOSE_BRACE);
+
+    for (usz i = 0; i < parser.errors.count; i++)
+        da_append(errors, parser.errors.items[i]);
+    free(parser.errors.items);
+    free(lexer.errors.items);
+
+    return &fn->fn.stmts;
+}
+
 expr_t *p_parse_primary(parser_t *p) {
-    expr_t *expression = malloc(sizeof(expr_t));
-    expression->span = p->token.span;
+    expr_t expression = {.span = p->token.span, .ty = TID_ERROR};
 
     switch (p->token.type) {
 
     case T_IDENT: {
-        expression->type = E_IDENT;
-        expression->ident = p->token.string_value;
+        expression.type = E_IDENT;
+        expression.ident = p->token.string_value;
+        expression.binding = (binding_t){B_UNRESOLVED};
         p_advance(p);
     } break;
 
     case T_STRING: {
-        expression->type = E_STRING;
-        expression->string = p->token.string_value;
+        // the lexer's copy is moved next to the node, so that it goes away
+        // with the arena; in streaming mode nothing else would free it
+        usz size = strlen(p->token.string_value) + 1;
+        char *string = arena_alloc(p->arena, size);
+        memcpy(string, p->token.string_value, size);
+        free(p->token.string_value);
+        expression.type = E_STRING;
+        expression.string = string;
         p_advance(p);
     } break;
 
     case T_INT: {
-        expression->type = E_INT;
-        expression->int_ = p->token.int_value;
+        expression.type = E_INT;
+        expression.int_ = p->token.int_value;
         p_advance(p);
     } break;
 
     case T_FLOAT: {
-        expression->type = E_FLOAT;
-        expression->float_ = p->token.float_value;
+        expression.type = E_FLOAT;
+        expression.float_ = p->token.float_value;
         p_advance(p);
     } break;
 
     case T_OPEN_PAREN: {
-        expression->type = E_FN;
+        expression.type = E_FN;
 
+        if (!p_nest(p)) return NULL;
         if (!p_expect(p, T_OPEN_PAREN)) {
             E_EXPECT(p, T_OPEN_PAREN);
             return NULL;
         }
+        // a scope of its own: names in it are only shared within it
+        u32 outer = p->dag != NULL ? dag_enter(p->dag) : 0;
 
-        params_t params = {0};
+        small_array_t(param_t *, 4) params = {0};
         for (;;) {
             if (p->token.type == T_CLOSE_PAREN) break;
 
             param_t *param = p_parse_param(p);
-            if (param == NULL) return NULL;
-            da_append(&params, param);
+            if (param == NULL) {
+                sv_free(&params);
+                return NULL;
+            }
+            sv_append(&params, param);
 
             if (p->token.type != T_COMMA) break;
             p_expect(p, T_COMMA);
         }
-        expression->fn.params = params;
+        sv_finish(&params, p->arena, &expression.fn.params);
 
         if (!p_expect(p, T_CLOSE_PAREN)) {
             E_EXPECT(p, T_CLOSE_PAREN);
@@ -217,29 +468,31 @@ expr_t *p_parse_primary(parser_t *p) {
             if (type == NULL) return NULL;
             return_type = type;
         }
-        expression->fn.ret_type = return_type;
+        expression.fn.ret_type = return_type;
+
+        expression.fn.stmts = (stmts_t){0};
+        expression.fn.lazy = NULL;
+        if (p->skim && p->token.type == T_OPEN_BRACE) {
+            if (!p_skip_body(p, &expression)) return NULL;
+            if (p->dag != NULL) dag_leave(p->dag, outer);
+            p->depth--;
+            break;
+        }
 
         if (!p_expect(p, T_OPEN_BRACE)) {
             E_EXPECT(p, T_OPEN_BRACE);
             return NULL;
         }
 
-        stmts_t stmts = {0};
-        for (;;) {
-            if (p->token.type == T_CLOSE_BRACE) break;
-            stmt_t *stmt = p_parse_stmt(p);
-            if (stmt == NULL) return NULL;
-            da_append(&stmts, stmt);
-
-            if (p->token.type != T_SEMICOLON) break;
-            p_expect(p, T_SEMICOLON);
-        }
-        expression->fn.stmts = stmts;
+        if (!p_parse_body(p, &expression.fn.stmts)) return NULL;
 
+        expression.span = span_join(expression.span, p->token.span);
         if (!p_expect(p, T_CLOSE_BRACE)) {
             E_EXPECT(p, T_CLOSE_BRACE);
             return NULL;
         }
+        if (p->dag != NULL) dag_leave(p->dag, outer);
+        p->depth--;
     } break;
 
     default: {
@@ -249,11 +502,11 @@ expr_t *p_parse_primary(parser_t *p) {
     }
     }
 
-    return expression;
+    return p_node(p, &expression);
 }
 
 type_t *p_parse_type(parser_t *p) {
-    type_t *type = malloc(sizeof(type_t));
+    type_t *type = arena_new(p->arena, type_t);
     type->span = p->token.span;
 
     switch (p->token.type) {
@@ -268,7 +521,7 @@ type_t *p_parse_type(parser_t *p) {
         p_advance(p);
         type_t *inner = p_parse_type(p);
         if (inner == NULL) return NULL;
-        type->span.end = inner->span.end;
+        type->span = span_join(type->span, inner->span);
         type->ptr.inner = inner;
     } break;
 
@@ -283,8 +536,9 @@ type_t *p_parse_type(parser_t *p) {
 }
 
 param_t *p_parse_param(parser_t *p) {
-    param_t *param = malloc(sizeof(param_t));
+    param_t *param = arena_new(p->arena, param_t);
 
+    p_skip_errors(p);
     char *id = p->token.string_value;
     param->span = p->token.span;
     if (!p_expect(p, T_IDENT)) {
@@ -308,6 +562,8 @@ param_t *p_parse_param(parser_t *p) {
         if (p_expect(p, T_EQUALS)) {
             expr_t *ex = p_parse_expr(p);
             if (ex == NULL) return NULL;
+            // checked against the type, and reported on in its context
+            if (p->dag != NULL) ex = dag_own(p->dag, ex, p->span, p->arena);
             expr = ex;
         }
     } else {
@@ -318,6 +574,8 @@ param_t *p_parse_param(parser_t *p) {
 
     param->type = type;
     param->expr = expr;
+    param->ty = TID_ERROR;
+    if (p->dag != NULL) dag_declare(p->dag, id);
 
     return param;
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+#define _DEFAULT_SOURCE
+
+#include "include/perf.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PERF_CACHE(cache, op, result)                                          \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+    u32 type;
+    u64 config;
+} perf_events[PERF_COUNT] = {
+    [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                         PERF_CACHE(PERF_COUNT_HW_CACHE_L1D,
+                                    PERF_COUNT_HW_CACHE_OP_READ,
+                                    PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [PERF_LLC_MISSES] = {PERF_TYPE_HW_CACHE,
+                         PERF_CACHE(PERF_COUNT_HW_CACHE_LL,
+                                    PERF_COUNT_HW_CACHE_OP_READ,
+                                    PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [PERF_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static const char *perf_labels[PERF_COUNT] = {
+#define PERF_COUNTER(name, label) label,
+    PERF_COUNTERS
+#undef PERF_COUNTER
+};
+
+static u64 perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int perf_event_open(u32 type, u64 config, int group) {
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .type = type,
+        .config = config,
+        .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING,
+        // the parsing threads are started after the counters are opened
+        // and joined before the phase ends, so their counts are in the
+        // phase's
+        .inherit = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+// Counters that do not fit on the PMU are multiplexed, in which case the
+// count is scaled up to the time the counter was enabled.
+static u64 perf_read(int fd) {
+    u64 values[3]; // value, time enabled, time running
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+        return 0;
+    if (values[2] == values[1]) return values[0];
+    return (u64)((double)values[0] * values[1] / values[2]);
+}
+
+static void perf_read_all(perf_t *p, u64 *out) {
+    for (usz i = 0; i < PERF_COUNT; i++)
+        out[i] = p->fds[i] >= 0 ? perf_read(p->fds[i]) : 0;
+}
+
+// All counters are in one group, so they are scheduled together and the
+// ratios between them are meaningful. A counter the group cannot take is
+// tried on its own.
+bool perf_open(perf_t *p) {
+    *p = (perf_t){.error = 0};
+    int group = -1;
+    bool any = false;
+    for (usz i = 0; i < PERF_COUNT; i++) {
+        int fd = perf_event_open(perf_events[i].type, perf_events[i].config,
+                                 group);
+        if (fd < 0 && group >= 0)
+            fd = perf_event_open(perf_events[i].type, perf_events[i].config,
+                                 -1);
+        if (fd < 0 && p->error == 0) p->error = errno;
+        if (fd >= 0 && group < 0) group = fd;
+        p->fds[i] = fd;
+        any |= fd >= 0;
+    }
+    perf_read_all(p, p->last);
+    p->last_ns = perf_now();
+    return any;
+}
+
+void perf_close(perf_t *p) {
+    for (usz i = 0; i < PERF_COUNT; i++)
+        if (p->fds[i] >= 0) close(p->fds[i]);
+    free(p->phases.items);
+}
+
+void perf_lap(perf_t *p, const char *phase) {
+    u64 now[PERF_COUNT];
+    perf_read_all(p, now);
+    u64 ns = perf_now();
+
+    perf_phase_t *entry = NULL;
+    for (usz i = 0; i < p->phases.count && entry == NULL; i++)
+        if (strcmp(p->phases.items[i].name, phase) == 0)
+            entry = &p->phases.items[i];
+    if (entry == NULL) {
+        da_append(&p->phases, ((perf_phase_t){.name = phase}));
+        entry = &p->phases.items[p->phases.count - 1];
+    }
+
+    for (usz i = 0; i < PERF_COUNT; i++) {
+        // scaled counts are estimates, which may go backwards a little
+        entry->counts[i] += now[i] > p->last[i] ? now[i] - p->last[i] : 0;
+        p->last[i] = now[i];
+    }
+    entry->ns += ns - p->last_ns;
+    p->last_ns = ns;
+}
+
+// Column widths of the table; the misses columns are per KB of source
+#define PERF_W_NAME 12
+#define PERF_W_MS 8
+#define PERF_W_COUNT 13
+
+static void perf_cell(writer_t *w, int width, int precision, double value,
+                      bool ok) {
+    char buf[64];
+    if (ok)
+        snprintf(buf, sizeof(buf), " %*.*f", width, precision, value);
+    else
+        snprintf(buf, sizeof(buf), " %*s", width, "n/a");
+    w_str(w, buf);
+}
+
+static void perf_heading(writer_t *w, usz width, const char *label) {
+    w_char(w, ' ');
+    for (usz i = strlen(label); i < width; i++)
+        w_char(w, ' ');
+    w_str(w, label);
+}
+
+void perf_report(perf_t *p, writer_t *w, usz source_size) {
+    bool any = false;
+    for (usz i = 0; i < PERF_COUNT; i++)
+        any |= p->fds[i] >= 0;
+    if (!any) {
+        w_str(w, "perf counters unavailable: ");
+        w_str(w, strerror(p->error));
+        if (p->error == EACCES || p->error == EPERM)
+            w_str(w, " (see /proc/sys/kernel/perf_event_paranoid)");
+        w_char(w, '\n');
+        return;
+    }
+
+    // counters that opened but were never scheduled read as zero
+    bool counted[PERF_COUNT];
+    for (usz i = 0; i < PERF_COUNT; i++) {
+        counted[i] = false;
+        for (usz j = 0; j < p->phases.count; j++)
+            counted[i] |= p->phases.items[j].counts[i] > 0;
+    }
+
+    char buf[64];
+    w_str(w, "phase       ");
+    perf_heading(w, PERF_W_MS, "ms");
+    perf_heading(w, PERF_W_COUNT, "cycles");
+    perf_heading(w, PERF_W_COUNT, "instructions");
+    perf_heading(w, PERF_W_MS, "IPC");
+    for (usz i = PERF_BRANCH_MISSES; i <= PERF_LLC_MISSES; i++) {
+        snprintf(buf, sizeof(buf), "%s/KB", perf_labels[i]);
+        perf_heading(w, PERF_W_COUNT + 4, buf);
+    }
+    perf_heading(w, PERF_W_COUNT, perf_labels[PERF_PAGE_FAULTS]);
+    w_char(w, '\n');
+
+    double kb = source_size > 0 ? source_size / 1024.0 : 1;
+    for (usz j = 0; j < p->phases.count; j++) {
+        perf_phase_t *phase = &p->phases.items[j];
+        const u64 *c = phase->counts;
+        snprintf(buf, sizeof(buf), "%-*s", PERF_W_NAME, phase->name);
+        w_str(w, buf);
+        perf_cell(w, PERF_W_MS, 2, phase->ns / 1e6, true);
+        perf_cell(w, PERF_W_COUNT, 0, c[PERF_CYCLES], counted[PERF_CYCLES]);
+        perf_cell(w, PERF_W_COUNT, 0, c[PERF_INSTRUCTIONS],
+                  counted[PERF_INSTRUCTIONS]);
+        perf_cell(w, PERF_W_MS, 2,
+                  c[PERF_CYCLES] > 0
+                      ? (double)c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]
+                      : 0,
+                  counted[PERF_CYCLES] && counted[PERF_INSTRUCTIONS]);
+        for (usz i = PERF_BRANCH_MISSES; i <= PERF_LLC_MISSES; i++)
+            perf_cell(w, PERF_W_COUNT + 4, 2, c[i] / kb, counted[i]);
+        perf_cell(w, PERF_W_COUNT, 0, c[PERF_PAGE_FAULTS],
+                  counted[PERF_PAGE_FAULTS]);
+        w_char(w, '\n');
+    }
+
+    if (p->error == 0) return;
+    w_str(w, "could not open");
+    for (usz i = 0; i < PERF_COUNT; i++) {
+        if (p->fds[i] >= 0) continue;
+        w_char(w, ' ');
+        w_str(w, perf_labels[i]);
+    }
+    w_str(w, ": ");
+    w_str(w, strerror(p->error));
+    w_char(w, '\n');
+}
@@ -0,0 +1,109 @@
+#include "include/prune.h"
+#include "include/intern.h"
+#include "include/log.h"
+#include "include/walk.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The reference graph is never built as such: declarations are visited
+// depth-first from the roots, and the names each one uses are its edges.
+typedef struct {
+    decls_t *decls;
+    usz *table; // open addressing by name, index + 1 of the first decl or 0
+    usz capacity;
+    usz *next;  // index + 1 of the next declaration of the same name, or 0
+    bool *reached;
+    array_t(usz) stack; // reached but not yet visited
+} pruner_t;
+
+static usz *prune_slot(pruner_t *p, const char *id) {
+    usz mask = p->capacity - 1;
+    for (usz slot = intern_hash(id) & mask;; slot = (slot + 1) & mask)
+        if (p->table[slot] == 0 ||
+            p->decls->items[p->table[slot] - 1]->id == id)
+            return &p->table[slot];
+}
+
+// Marks every declaration named `id`, redefinitions included, so they are
+// still reported as such
+static bool prune_reach(pruner_t *p, const char *id) {
+    usz index = *prune_slot(p, id);
+    for (usz i = index; i != 0; i = p->next[i - 1]) {
+        if (p->reached[i - 1]) continue;
+        p->reached[i - 1] = true;
+        da_append(&p->stack, i - 1);
+    }
+    return index != 0;
+}
+
+static bool prune_ident(void *ctx, expr_t *expr) {
+    if (expr->type == E_IDENT) prune_reach(ctx, expr->ident);
+    return true;
+}
+
+bool prune(unit_t *unit, const char *roots, prune_stats_t *pruned) {
+    decls_t *decls = &unit->decls;
+    pruner_t p = {.decls = decls, .capacity = 8};
+    while (p.capacity * 3 < decls->count * 4)
+        p.capacity *= 2;
+    p.table = calloc(p.capacity, sizeof(usz));
+    p.next = calloc(decls->count + 1, sizeof(usz));
+    p.reached = calloc(decls->count + 1, sizeof(bool));
+    assert(p.table != NULL && p.next != NULL && p.reached != NULL &&
+           "Buy more RAM lol");
+
+    // later declarations of a name are chained behind the first
+    usz *last = calloc(decls->count + 1, sizeof(usz));
+    assert(last != NULL && "Buy more RAM lol");
+    for (usz i = 0; i < decls->count; i++) {
+        usz *slot = prune_slot(&p, decls->items[i]->id);
+        if (*slot == 0)
+            *slot = i + 1;
+        else
+            p.next[last[*slot - 1] - 1] = i + 1;
+        last[*slot - 1] = i + 1;
+    }
+    free(last);
+
+    bool any = false;
+    for (const char *root = roots; *root != '\0';) {
+        usz length = strcspn(root, ",");
+        if (length > 0 && prune_reach(&p, intern(root, length)))
+            any = true;
+        else if (length > 0)
+            log_warn("no declaration `%.*s` to keep", (int)length, root);
+        root += length + (root[length] == ',');
+    }
+
+    pass_t names = {.pre_expr = prune_ident, .ctx = &p};
+    walker_t walker = {.passes = &names, .count = 1, .bodies = true};
+    while (p.stack.count > 0)
+        walk_expr(&walker,
+                  decls->items[p.stack.items[--p.stack.count]]->value);
+
+    if (any) {
+        // bodies the walk did not need were never parsed, and are not now
+        pass_t counter = walk_counter(pruned != NULL ? &pruned->nodes : NULL);
+        walker_t counting = {.passes = &counter, .count = 1};
+        usz kept = 0;
+        for (usz i = 0; i < decls->count; i++) {
+            decl_t *decl = decls->items[i];
+            if (p.reached[i]) {
+                decls->items[kept++] = decl;
+            } else if (pruned != NULL) {
+                pruned->decls++;
+                walk_decl(&counting, decl);
+            }
+        }
+        log_debug("pruned %zu of %zu declarations", decls->count - kept,
+                  decls->count);
+        decls->count = kept;
+    }
+
+    free(p.stack.items);
+    free(p.reached);
+    free(p.next);
+    free(p.table);
+    return any;
+}
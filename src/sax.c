@@ -0,0 +1,453 @@
+#include "include/sax.h"
+#include "include/ast.h"
+#include "include/lexer.h"
+#include "include/parser.h"
+#include "include/unit.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// An operator of a run of prefix operators, to leave once its operand is
+typedef struct {
+    u32 start;
+    u8 op;
+} sax_prefix_t;
+
+// The grammar and diagnostics are those of parser.c, function by function;
+// only what is done with a construct differs.
+typedef struct {
+    const sax_handler_t *handler;
+    source_file_t *file;
+    lexer_t lexer;
+    token_t token, next;
+    bool has_next;
+    u32 depth;
+    u32 nesting; // `parser_t.depth`
+    usz errors;
+    array_t(sax_prefix_t) prefixes; // open ones, innermost last
+} sax_t;
+
+static void sax_report(sax_t *s, const error_t *error) {
+    if (s->handler->error != NULL) s->handler->error(s->handler->ctx, error);
+    s->errors++;
+}
+
+// Messages are a line and a few token names, and so is this buffer
+static void sax_error(sax_t *s, const char *fmt, ...) {
+    char message[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+    sax_report(s, &(error_t){.span = s->token.span, .msg = message});
+}
+
+#define SAX_EXPECTED(s, expected)                                              \
+    sax_error((s), "expected `%s`, but got `%s` instead", tt_name(expected),   \
+              tt_name((s)->token.type))
+
+// `p_nest`
+static bool sax_nest(sax_t *s) {
+    if (s->nesting < P_MAX_DEPTH) {
+        s->nesting++;
+        return true;
+    }
+    sax_error(s, "nesting deeper than %d levels", P_MAX_DEPTH);
+    return false;
+}
+
+static void sax_enter(sax_t *s, sax_event_t *event) {
+    event->depth = s->depth++;
+    if (s->handler->enter != NULL) s->handler->enter(s->handler->ctx, event);
+}
+
+static void sax_leave(sax_t *s, sax_event_t *event, span_t span) {
+    event->depth = --s->depth;
+    event->span = span;
+    if (s->handler->leave != NULL) s->handler->leave(s->handler->ctx, event);
+}
+
+// Diagnostics of the lexer are passed on as soon as it reports them, so
+// they stay in source order
+static void sax_lex(sax_t *s, token_t *token) {
+    l_next(&s->lexer, token);
+
+    errors_t *errors = &s->lexer.errors;
+    for (usz i = 0; i < errors->count; i++) {
+        sax_report(s, &errors->items[i]);
+        free(errors->items[i].msg);
+    }
+    errors->count = 0;
+}
+
+static void sax_advance(sax_t *s) {
+    if (s->has_next) {
+        s->token = s->next;
+        s->has_next = false;
+        return;
+    }
+    sax_lex(s, &s->token);
+}
+
+static token_t *sax_peek(sax_t *s) {
+    if (!s->has_next) {
+        sax_lex(s, &s->next);
+        s->has_next = true;
+    }
+    return &s->next;
+}
+
+// `p_skip_errors`
+static void sax_skip_errors(sax_t *s) {
+    while (s->token.type == T_ERROR) {
+        span_t span = s->token.span;
+        sax_error(s, "unexpected character `%.*s`", (int)span.length,
+                  s->file->text + (span.start - s->file->base));
+        sax_advance(s);
+    }
+}
+
+static bool sax_expect(sax_t *s, u8 type) {
+    sax_skip_errors(s);
+    if (s->token.type != type) return false;
+    sax_advance(s);
+    return true;
+}
+
+static bool sax_expr(sax_t *, span_t *);
+static bool sax_unary(sax_t *, span_t *);
+
+static bool sax_decl(sax_t *s) {
+    sax_skip_errors(s);
+    token_t name = s->token;
+    sax_event_t event = {.node = SAX_DECL, .span = name.span, .token = &name};
+    if (!sax_expect(s, T_IDENT)) {
+        SAX_EXPECTED(s, T_IDENT);
+        return false;
+    }
+
+    if (sax_expect(s, T_COLON_COLON)) {
+        event.op = T_COLON_COLON;
+    } else if (sax_expect(s, T_COLON_EQUALS)) {
+        event.op = T_COLON_EQUALS;
+    } else {
+        SAX_EXPECTED(s, T_COLON_COLON);
+        return false;
+    }
+
+    sax_enter(s, &event);
+    span_t value;
+    if (!sax_expr(s, &value)) return false;
+    sax_leave(s, &event, name.span);
+    return true;
+}
+
+static bool sax_import(sax_t *s) {
+    span_t span = s->token.span;
+    sax_advance(s);
+
+    sax_skip_errors(s);
+    token_t name = s->token;
+    sax_event_t event = {.node = SAX_IMPORT, .span = span, .token = &name};
+    span = span_join(span, name.span);
+    if (!sax_expect(s, T_IDENT)) {
+        SAX_EXPECTED(s, T_IDENT);
+        return false;
+    }
+    if (!sax_expect(s, T_SEMICOLON)) {
+        SAX_EXPECTED(s, T_SEMICOLON);
+        return false;
+    }
+    sax_enter(s, &event);
+    sax_leave(s, &event, span);
+    return true;
+}
+
+// `p_parse_unit_decl`
+static void sax_unit_decl(sax_t *s) {
+    while (s->token.type == T_IMPORT)
+        if (!sax_import(s)) return;
+    if (s->token.type == T_EOF) return;
+
+    if (!sax_decl(s)) return;
+    sax_expect(s, T_SEMICOLON);
+
+    if (s->token.type == T_IMPORT)
+        sax_error(s, "imports must come before the first declaration");
+    else if (s->token.type != T_EOF)
+        sax_error(s, "expected a declaration, but got `%s` instead",
+                  tt_name(s->token.type));
+}
+
+static bool sax_stmt(sax_t *s) {
+    if (s->token.type == T_IDENT && (sax_peek(s)->type == T_COLON_COLON ||
+                                     sax_peek(s)->type == T_COLON_EQUALS))
+        return sax_decl(s);
+
+    span_t span;
+    if (!sax_expr(s, &span)) {
+        sax_error(s, "expected a statement, but got `%s` instead",
+                  tt_name(s->token.type));
+        return false;
+    }
+    return true;
+}
+
+// `p_parse_precedence`, with the span of the left operand in `*lhs` and that
+// of the whole expression once it returns
+static bool sax_precedence(sax_t *s, span_t *lhs, u8 min_precedence) {
+    bool nested = false;
+    for (;;) {
+        const tt_info_t *info = &tt_info[s->token.type];
+        if (!(info->flags & TT_INFIX) || info->precedence < min_precedence)
+            break;
+        if (min_precedence > 0 && !nested) {
+            if (!sax_nest(s)) return false;
+            nested = true;
+        }
+
+        sax_event_t event = {.node = SAX_EXPR,
+                             .type = E_BINOP,
+                             .op = s->token.type,
+                             .span = s->token.span};
+        sax_enter(s, &event);
+        sax_advance(s);
+        span_t rhs;
+        if (!sax_unary(s, &rhs)) return false;
+
+        u8 rhs_precedence = info->precedence + !(info->flags & TT_RIGHT);
+        if (!sax_precedence(s, &rhs, rhs_precedence)) return false;
+
+        *lhs = span_join(*lhs, rhs);
+        sax_leave(s, &event, *lhs);
+    }
+    s->nesting -= nested;
+    return true;
+}
+
+static bool sax_expr(sax_t *s, span_t *span) {
+    if (!sax_unary(s, span)) return false;
+    return sax_precedence(s, span, 0);
+}
+
+static bool sax_type(sax_t *s, span_t *span) {
+    token_t token = s->token;
+    sax_event_t event = {.node = SAX_TYPE, .span = token.span};
+    *span = token.span;
+
+    switch (token.type) {
+    case T_IDENT: {
+        event.type = TY_UD;
+        event.token = &token;
+        sax_enter(s, &event);
+        sax_leave(s, &event, token.span);
+        sax_advance(s);
+    } break;
+
+    case T_ASTERISK: {
+        event.type = TY_PTR;
+        sax_enter(s, &event);
+        sax_advance(s);
+        span_t inner;
+        if (!sax_type(s, &inner)) return false;
+        *span = span_join(token.span, inner);
+        sax_leave(s, &event, *span);
+    } break;
+
+    default: {
+        sax_error(s, "expected a type, but got `%s` instead",
+                  tt_name(token.type));
+        return false;
+    }
+    }
+
+    return true;
+}
+
+static bool sax_param(sax_t *s) {
+    sax_skip_errors(s);
+    token_t name = s->token;
+    sax_event_t event = {.node = SAX_PARAM, .span = name.span, .token = &name};
+    if (!sax_expect(s, T_IDENT)) {
+        SAX_EXPECTED(s, T_IDENT);
+        return false;
+    }
+
+    span_t span;
+    if (sax_expect(s, T_COLON_EQUALS)) {
+        event.op = T_COLON_EQUALS;
+        sax_enter(s, &event);
+        if (!sax_expr(s, &span)) return false;
+    } else if (sax_expect(s, T_COLON)) {
+        event.op = T_COLON;
+        sax_enter(s, &event);
+        if (!sax_type(s, &span)) return false;
+        if (sax_expect(s, T_EQUALS) && !sax_expr(s, &span)) return false;
+    } else {
+        sax_error(s, "expected either `:` or `:=` but got %s instead",
+                  tt_name(s->token.type));
+        return false;
+    }
+
+    sax_leave(s, &event, name.span);
+    return true;
+}
+
+// `p_parse_body`
+static bool sax_body(sax_t *s) {
+    for (;;) {
+        if (s->token.type == T_CLOSE_BRACE || s->token.type == T_EOF) break;
+        if (!sax_stmt(s)) return false;
+
+        if (s->token.type != T_SEMICOLON) break;
+        sax_expect(s, T_SEMICOLON);
+    }
+    return true;
+}
+
+static bool sax_fn(sax_t *s, span_t *span) {
+    sax_event_t event = {
+        .node = SAX_EXPR, .type = E_FN, .span = s->token.span};
+    span_t start = s->token.span;
+    if (!sax_nest(s)) return false;
+    if (!sax_expect(s, T_OPEN_PAREN)) {
+        SAX_EXPECTED(s, T_OPEN_PAREN);
+        return false;
+    }
+    sax_enter(s, &event);
+
+    for (;;) {
+        if (s->token.type == T_CLOSE_PAREN) break;
+        if (!sax_param(s)) return false;
+
+        if (s->token.type != T_COMMA) break;
+        sax_expect(s, T_COMMA);
+    }
+
+    if (!sax_expect(s, T_CLOSE_PAREN)) {
+        SAX_EXPECTED(s, T_CLOSE_PAREN);
+        return false;
+    }
+
+    span_t type;
+    if (sax_expect(s, T_ARROW) && !sax_type(s, &type)) return false;
+
+    if (!sax_expect(s, T_OPEN_BRACE)) {
+        SAX_EXPECTED(s, T_OPEN_BRACE);
+        return false;
+    }
+    if (!sax_body(s)) return false;
+
+    *span = span_join(start, s->token.span);
+    if (!sax_expect(s, T_CLOSE_BRACE)) {
+        SAX_EXPECTED(s, T_CLOSE_BRACE);
+        return false;
+    }
+    sax_leave(s, &event, *span);
+    s->nesting--;
+    return true;
+}
+
+static bool sax_primary(sax_t *s, span_t *span) {
+    const token_t *token = &s->token;
+    sax_event_t event = {.node = SAX_EXPR, .span = token->span, .token = token};
+    *span = token->span;
+
+    switch (token->type) {
+    case T_IDENT:
+        event.type = E_IDENT;
+        break;
+    case T_STRING:
+        event.type = E_STRING;
+        break;
+    case T_INT:
+        event.type = E_INT;
+        break;
+    case T_FLOAT:
+        event.type = E_FLOAT;
+        break;
+    case T_OPEN_PAREN:
+        return sax_fn(s, span);
+    default:
+        sax_error(s, "expected an expression, but got `%s` instead",
+                  tt_name(token->type));
+        return false;
+    }
+
+    sax_enter(s, &event);
+    sax_leave(s, &event, *span);
+    sax_advance(s);
+    return true;
+}
+
+// `p_parse_unary`. A run of prefix operators nests as deep as it is long,
+// so it is entered in a loop and left in another rather than by recursion.
+static bool sax_unary(sax_t *s, span_t *span) {
+    usz base = s->prefixes.count;
+    bool ok = true;
+    while (tt_info[s->token.type].flags & TT_PREFIX) {
+        if (!sax_nest(s)) {
+            ok = false;
+            break;
+        }
+        span_t start = s->token.span;
+        sax_event_t event = {.node = SAX_EXPR,
+                             .type = E_UNARY,
+                             .op = s->token.type,
+                             .span = start};
+        sax_enter(s, &event);
+        da_append(&s->prefixes, ((sax_prefix_t){start.start, event.op}));
+        sax_advance(s);
+    }
+
+    ok = ok && sax_primary(s, span);
+    for (; ok && s->prefixes.count > base; s->prefixes.count--) {
+        sax_prefix_t *prefix = &s->prefixes.items[s->prefixes.count - 1];
+        *span = span_join((span_t){prefix->start, 1}, *span);
+        sax_event_t event = {
+            .node = SAX_EXPR, .type = E_UNARY, .op = prefix->op};
+        sax_leave(s, &event, *span);
+        s->nesting--;
+    }
+    s->prefixes.count = base;
+    return ok;
+}
+
+// A chunk of `unit_parse`, lexed with the list of diagnostics of the last
+static void sax_chunk(sax_t *s, usz start, usz end) {
+    errors_t errors = s->lexer.errors;
+    l_init_range(&s->lexer, s->file, start, end);
+    s->lexer.errors = errors;
+    s->lexer.raw = true;
+    s->has_next = false;
+    s->depth = s->nesting = 0;
+    sax_advance(s);
+    sax_unit_decl(s);
+}
+
+usz sax_parse(source_file_t *file, const sax_handler_t *handler) {
+    sax_t s = {.handler = handler, .file = file};
+
+    errors_t invalid = {0};
+    if (!unit_validate(file, &invalid)) {
+        sax_report(&s, &invalid.items[0]);
+        free(invalid.items[0].msg);
+        free(invalid.items);
+        return s.errors;
+    }
+
+    // chunks are found one ahead, as each ends where the next starts; the
+    // first also takes whatever precedes the first declaration
+    unit_scan_t scan = {0};
+    usz start = 0, end;
+    unit_scan(file->text, file->length, &scan, &end);
+    for (bool last = false; !last; start = end) {
+        last = !unit_scan(file->text, file->length, &scan, &end);
+        if (last) end = file->length;
+        sax_chunk(&s, start, end);
+    }
+
+    free(s.prefixes.items);
+    free(s.lexer.errors.items);
+    return s.errors;
+}
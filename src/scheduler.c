@@ -0,0 +1,183 @@
+#include "include/scheduler.h"
+#include "include/thread.h"
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+// Initial number of slots in a deque
+#define DEQUE_INIT_CAP 64
+
+// Steal attempts between checks for whether everything is done
+#define SCHED_STEAL_TRIES 32
+
+/* -------------------- DEQUE -------------------- */
+
+// The memory orders follow Lê et al., "Correct and Efficient Work-Stealing
+// for Weak Memory Models" (PPoPP 2013).
+
+static deque_buffer_t *deque_buffer_new(usz capacity) {
+    deque_buffer_t *buffer =
+        malloc(sizeof(deque_buffer_t) + capacity * sizeof(void *));
+    assert(buffer != NULL && "Buy more RAM lol");
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+void deque_init(deque_t *d) {
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    atomic_init(&d->buffer, deque_buffer_new(DEQUE_INIT_CAP));
+    d->retired.items = NULL;
+    d->retired.count = d->retired.capacity = 0;
+}
+
+void deque_free(deque_t *d) {
+    free(atomic_load_explicit(&d->buffer, memory_order_relaxed));
+    for (usz i = 0; i < d->retired.count; i++)
+        free(d->retired.items[i]);
+    free(d->retired.items);
+}
+
+static deque_buffer_t *deque_grow(deque_t *d, deque_buffer_t *old, i64 top,
+                                  i64 bottom) {
+    deque_buffer_t *buffer = deque_buffer_new(old->capacity * 2);
+    for (i64 i = top; i < bottom; i++)
+        atomic_store_explicit(
+            &buffer->items[i & (buffer->capacity - 1)],
+            atomic_load_explicit(&old->items[i & (old->capacity - 1)],
+                                 memory_order_relaxed),
+            memory_order_relaxed);
+    da_append(&d->retired, old);
+    atomic_store_explicit(&d->buffer, buffer, memory_order_release);
+    return buffer;
+}
+
+void deque_push(deque_t *d, void *item) {
+    i64 bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    i64 top = atomic_load_explicit(&d->top, memory_order_acquire);
+    deque_buffer_t *buffer =
+        atomic_load_explicit(&d->buffer, memory_order_relaxed);
+    if (bottom - top > (i64)buffer->capacity - 1)
+        buffer = deque_grow(d, buffer, top, bottom);
+
+    // a release store rather than the paper's release fence and relaxed
+    // store, which is the same on x86 and clearer to ThreadSanitizer
+    atomic_store_explicit(&buffer->items[bottom & (buffer->capacity - 1)],
+                          item, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, bottom + 1, memory_order_release);
+}
+
+void *deque_take(deque_t *d) {
+    i64 bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    deque_buffer_t *buffer =
+        atomic_load_explicit(&d->buffer, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void *item = atomic_load_explicit(
+        &buffer->items[bottom & (buffer->capacity - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // the last item, which a thief may be taking at the same time
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            item = NULL;
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+void *deque_steal(deque_t *d) {
+    i64 top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= bottom) return NULL;
+
+    deque_buffer_t *buffer =
+        atomic_load_explicit(&d->buffer, memory_order_acquire);
+    void *item = atomic_load_explicit(
+        &buffer->items[top & (buffer->capacity - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return DEQUE_ABORT;
+    return item;
+}
+
+/* -------------------- SCHEDULER -------------------- */
+
+void sched_spawn(sched_worker_t *w, void *task) {
+    atomic_fetch_add_explicit(&w->sched->pending, 1, memory_order_relaxed);
+    deque_push(&w->deque, task);
+}
+
+static void *sched_find(sched_worker_t *w) {
+    void *task = deque_take(&w->deque);
+    if (task != NULL) return task;
+
+    sched_t *s = w->sched;
+    for (usz i = 0; i < SCHED_STEAL_TRIES && s->count > 1; i++) {
+        // xorshift
+        w->rng ^= w->rng << 13;
+        w->rng ^= w->rng >> 7;
+        w->rng ^= w->rng << 17;
+        sched_worker_t *victim = &s->workers[w->rng % s->count];
+        if (victim == w) continue;
+        task = deque_steal(&victim->deque);
+        if (task != NULL && task != DEQUE_ABORT) return task;
+    }
+    return NULL;
+}
+
+static void *sched_worker(void *arg) {
+    sched_worker_t *w = arg;
+    sched_t *s = w->sched;
+    for (;;) {
+        void *task = sched_find(w);
+        if (task != NULL) {
+            s->run(w, task);
+            atomic_fetch_sub_explicit(&s->pending, 1, memory_order_acq_rel);
+        } else if (atomic_load_explicit(&s->pending, memory_order_acquire) ==
+                   0) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+void sched_run(void **tasks, usz task_count, sched_fn_t run, void **contexts,
+               usz count) {
+    sched_t s = {.run = run, .count = count};
+    atomic_init(&s.pending, task_count);
+    s.workers = calloc(count, sizeof(sched_worker_t));
+    assert(s.workers != NULL && "Buy more RAM lol");
+
+    for (usz i = 0; i < count; i++) {
+        sched_worker_t *w = &s.workers[i];
+        *w = (sched_worker_t){
+            .sched = &s, .ctx = contexts[i], .rng = 0x9E3779B97F4A7C15 * (i + 1)};
+        deque_init(&w->deque);
+    }
+    // dealt out in reverse, so each worker takes its share in order
+    for (usz i = task_count; i-- > 0;)
+        deque_push(&s.workers[i % count].deque, tasks[i]);
+
+    for (usz i = 1; i < count; i++)
+        s.workers[i].started = thread_create(&s.workers[i].thread,
+                                             sched_worker, &s.workers[i]) == 0;
+    sched_worker(&s.workers[0]);
+    for (usz i = 1; i < count; i++)
+        if (s.workers[i].started) pthread_join(s.workers[i].thread, NULL);
+
+    for (usz i = 0; i < count; i++)
+        deque_free(&s.workers[i].deque);
+    free(s.workers);
+}
@@ -0,0 +1,597 @@
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "include/server.h"
+#include "include/driver.h"
+#include "include/hash.h"
+#include "include/log.h"
+#include "include/thread.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A request is a 4-byte length with the client's source, stdout and stderr
+// descriptors attached, followed by that many bytes of NUL-terminated
+// arguments, the path first. The reply is the 4-byte exit status.
+enum { FD_SOURCE, FD_OUT, FD_ERR, FD_COUNT };
+
+/* -------------------- SOCKET -------------------- */
+
+static bool socket_path(char *buf, usz size, const char *path) {
+    if (path != NULL) return (usz)snprintf(buf, size, "%s", path) < size;
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    int n = runtime != NULL && runtime[0] != '\0'
+                ? snprintf(buf, size, "%s/coffee.sock", runtime)
+                : snprintf(buf, size, "/tmp/coffee-%u.sock", getuid());
+    return (usz)n < size;
+}
+
+static bool socket_address(struct sockaddr_un *addr, const char *path) {
+    *addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr->sun_path)) return false;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static int socket_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (!socket_address(&addr, path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Whether the process at the other end of `fd` runs as this user. Without
+// XDG_RUNTIME_DIR the socket is in /tmp, where anyone may bind it first:
+// neither side hands the other descriptors or trusts its replies otherwise.
+static bool socket_trusted(int fd) {
+    // `struct ucred`, which needs _GNU_SOURCE and its `error_t` with it
+    struct {
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+    } cred;
+    socklen_t size = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) == 0 &&
+           size == sizeof(cred) && cred.uid == getuid();
+}
+
+static bool read_all(int fd, void *buf, usz size) {
+    for (usz done = 0; done < size;) {
+        ssize_t n = read(fd, (char *)buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, usz size) {
+    for (usz done = 0; done < size;) {
+        ssize_t n = write(fd, (const char *)buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+/* -------------------- CACHE -------------------- */
+
+typedef struct entry_t entry_t;
+
+// A compiled file. Entries are shared by concurrent requests for the same
+// path and contents and freed once evicted and no longer in use.
+struct entry_t {
+    u64 hash;
+    usz length;
+    bool symbols; // compiled for --symbols, so not checked
+    char *source, *filename;
+    compilation_t c;
+    pthread_mutex_t lock; // reporting can parse skipped bodies
+    usz refs;             // guarded by the cache lock
+    bool evicted;
+    entry_t *chain;       // next in the bucket
+    entry_t *prev, *next; // most recently used first
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    entry_t *buckets[SERVER_CACHE_BUCKETS];
+    entry_t *first, *last;
+    usz count, bytes;
+} cache_t;
+
+static void entry_free(entry_t *e) {
+    compilation_free(&e->c);
+    pthread_mutex_destroy(&e->lock);
+    free(e->source);
+    free(e->filename);
+    free(e);
+}
+
+static void lru_unlink(cache_t *cache, entry_t *e) {
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        cache->first = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        cache->last = e->prev;
+}
+
+static void lru_push(cache_t *cache, entry_t *e) {
+    e->prev = NULL;
+    e->next = cache->first;
+    if (cache->first != NULL) cache->first->prev = e;
+    cache->first = e;
+    if (cache->last == NULL) cache->last = e;
+}
+
+// Diagnostics name the file, so the path is part of the key
+static bool entry_matches(entry_t *e, u64 hash, const char *filename,
+                          const char *source, usz length, bool symbols) {
+    return e->hash == hash && e->length == length && e->symbols == symbols &&
+           strcmp(e->filename, filename) == 0 &&
+           memcmp(e->source, source, length) == 0;
+}
+
+// Returns the entry for `source` with a reference taken, or NULL
+static entry_t *cache_get(cache_t *cache, u64 hash, const char *filename,
+                          const char *source, usz length, bool symbols) {
+    pthread_mutex_lock(&cache->lock);
+    entry_t *e = cache->buckets[hash % SERVER_CACHE_BUCKETS];
+    while (e != NULL &&
+           !entry_matches(e, hash, filename, source, length, symbols))
+        e = e->chain;
+    if (e != NULL) {
+        e->refs++;
+        lru_unlink(cache, e);
+        lru_push(cache, e);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+static void cache_evict(cache_t *cache, entry_t *e) {
+    entry_t **link = &cache->buckets[e->hash % SERVER_CACHE_BUCKETS];
+    while (*link != e)
+        link = &(*link)->chain;
+    *link = e->chain;
+    lru_unlink(cache, e);
+    cache->count--;
+    cache->bytes -= e->length;
+    e->evicted = true;
+}
+
+// Inserts `e` with a reference taken for the caller. When another request
+// compiled the same contents first, `e` is freed and that entry returned.
+static entry_t *cache_put(cache_t *cache, entry_t *e) {
+    pthread_mutex_lock(&cache->lock);
+    entry_t **bucket = &cache->buckets[e->hash % SERVER_CACHE_BUCKETS];
+    for (entry_t *other = *bucket; other != NULL; other = other->chain) {
+        if (entry_matches(other, e->hash, e->filename, e->source, e->length,
+                          e->symbols)) {
+            other->refs++;
+            pthread_mutex_unlock(&cache->lock);
+            entry_free(e);
+            return other;
+        }
+    }
+
+    e->refs = 1;
+    e->chain = *bucket;
+    *bucket = e;
+    lru_push(cache, e);
+    cache->count++;
+    cache->bytes += e->length;
+
+    // the entry just inserted is first, so it is never evicted here
+    while (cache->last != e && (cache->count > SERVER_CACHE_MAX ||
+                                cache->bytes > SERVER_CACHE_MAX_BYTES)) {
+        entry_t *victim = cache->last;
+        cache_evict(cache, victim);
+        if (victim->refs == 0) entry_free(victim);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+static void cache_release(cache_t *cache, entry_t *e) {
+    pthread_mutex_lock(&cache->lock);
+    bool dead = --e->refs == 0 && e->evicted;
+    pthread_mutex_unlock(&cache->lock);
+    if (dead) entry_free(e);
+}
+
+/* -------------------- SERVER -------------------- */
+
+typedef struct {
+    cache_t cache;
+    arena_pool_t pool;
+
+    // accepted connections waiting for a worker
+    pthread_mutex_t lock;
+    pthread_cond_t ready, space;
+    int queue[SERVER_QUEUE];
+    usz head, count;
+} server_t;
+
+// Receives the length of the request and the descriptors sent with it
+static bool receive_header(int conn, u32 *length, int fds[FD_COUNT]) {
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int) * FD_COUNT)];
+    } control;
+    struct iovec iov = {.iov_base = length, .iov_len = sizeof(*length)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t n;
+    do
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+
+    // take whatever descriptors arrived, so they are closed even when the
+    // request is malformed
+    int received = 0;
+    for (struct cmsghdr *cmsg = n >= 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+         cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        usz count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (usz i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (received < FD_COUNT)
+                fds[received++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    bool ok = n > 0 && received == FD_COUNT;
+    if (ok && (usz)n < sizeof(*length))
+        ok = read_all(conn, (char *)length + n, sizeof(*length) - n);
+    if (!ok)
+        for (int i = 0; i < received; i++)
+            close(fds[i]);
+    return ok;
+}
+
+static int serve(server_t *server, int fds[FD_COUNT], char *args,
+                 u32 length) {
+    char *argv[64];
+    int argc = 0;
+    for (char *p = args; p < args + length && argc < 64; p += strlen(p) + 1)
+        argv[argc++] = p;
+
+    options_t opts;
+    if (argc == 0 || !parse_options(&opts, argc, argv)) return -1;
+    // requests are already served in parallel
+    if (opts.jobs == 0) opts.jobs = 1;
+
+    // nothing is kept from a streamed or checked file
+    if (opts.check) return check(argv[0], fds[FD_SOURCE], fds[FD_ERR]);
+    if (opts.stream)
+        return stream(&opts, argv[0], fds[FD_SOURCE], fds[FD_OUT],
+                      fds[FD_ERR]);
+
+    usz size;
+    char *source = read_source(fds[FD_SOURCE], &size);
+    if (source == NULL) return -1;
+
+    // counters are per compilation, so a cached one has nothing to show,
+    // and the cache key does not cover what was pruned or folded
+    bool uncached = opts.perf_counters || opts.roots != NULL || opts.stats ||
+                    opts.fold;
+    u64 hash = hash_bytes(source, size);
+    entry_t *e = uncached ? NULL
+                                    : cache_get(&server->cache, hash, argv[0],
+                                                source, size, opts.symbols);
+    log_debug("%s: %s", argv[0], e != NULL ? "cached" : "compiling");
+    if (e != NULL) {
+        free(source);
+    } else {
+        e = calloc(1, sizeof(entry_t));
+        assert(e != NULL && "Buy more RAM lol");
+        *e = (entry_t){.hash = hash,
+                       .length = size,
+                       .symbols = opts.symbols,
+                       .source = source,
+                       .filename = strdup(argv[0])};
+        if (!compile(&e->c, e->source, size, e->filename, &opts,
+                     &server->pool)) {
+            free(e->source);
+            free(e->filename);
+            free(e);
+            return -1;
+        }
+        pthread_mutex_init(&e->lock, NULL);
+
+        // what a file with imports means depends on other files, which the
+        // cache key does not cover; their interfaces make this cheap anyway
+        if (e->c.unit.imports.count > 0 || uncached) {
+            int status = report(&e->c, &opts, fds[FD_OUT], fds[FD_ERR]);
+            entry_free(e);
+            return status;
+        }
+        e = cache_put(&server->cache, e);
+    }
+
+    pthread_mutex_lock(&e->lock);
+    int status = report(&e->c, &opts, fds[FD_OUT], fds[FD_ERR]);
+    pthread_mutex_unlock(&e->lock);
+    cache_release(&server->cache, e);
+    return status;
+}
+
+static void serve_connection(server_t *server, int conn) {
+    if (!socket_trusted(conn)) {
+        log_warn("refused a client run by another user");
+        return;
+    }
+
+    u32 length;
+    int fds[FD_COUNT];
+    if (!receive_header(conn, &length, fds)) return;
+
+    i32 status = -1;
+    char *args = NULL;
+    if (length > 0 && length <= SERVER_MAX_REQUEST &&
+        (args = malloc(length + 1)) != NULL && read_all(conn, args, length)) {
+        args[length] = '\0';
+        status = serve(server, fds, args, length);
+    }
+    write_all(conn, &status, sizeof(status));
+
+    free(args);
+    for (int i = 0; i < FD_COUNT; i++)
+        close(fds[i]);
+}
+
+static void *server_worker(void *arg) {
+    server_t *server = arg;
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->count == 0)
+            pthread_cond_wait(&server->ready, &server->lock);
+        int conn = server->queue[server->head];
+        server->head = (server->head + 1) % SERVER_QUEUE;
+        server->count--;
+        pthread_cond_signal(&server->space);
+        pthread_mutex_unlock(&server->lock);
+
+        serve_connection(server, conn);
+        close(conn);
+    }
+    return NULL;
+}
+
+static char server_socket[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static void server_stop(int signal) {
+    (void)signal;
+    unlink(server_socket);
+    _exit(0);
+}
+
+// Binds the socket, replacing a stale one left by a server that died
+static int server_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (!socket_address(&addr, path)) {
+        log_error("socket path too long: %s", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("socket() failed: %s", strerror(errno));
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 &&
+        errno == EADDRINUSE) {
+        int other = socket_connect(path);
+        if (other >= 0) {
+            close(other);
+            close(fd);
+            log_error("a server is already listening on %s", path);
+            return -1;
+        }
+        unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            log_error("bind() failed: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SERVER_QUEUE) != 0) {
+        log_error("listen() failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int server_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    usz jobs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0) {
+            path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            log_set_level(LOG_TRACE);
+            log_set_async(true);
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            char *end;
+            jobs = strtoul(argv[i] + 7, &end, 10);
+            if (*end != '\0' || jobs == 0) {
+                log_error("invalid job count `%s`", argv[i] + 7);
+                return -1;
+            }
+        } else {
+            log_error("unknown option `%s`", argv[i]);
+            usage("coffee");
+            return -1;
+        }
+    }
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (usz)cpus : 1;
+    }
+
+    if (!socket_path(server_socket, sizeof(server_socket), path)) {
+        log_error("socket path too long");
+        return -1;
+    }
+    int listener = server_listen(server_socket);
+    if (listener < 0) return -1;
+
+    // clients going away must not take the server with them
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction stop = {.sa_handler = server_stop};
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    server_t *server = calloc(1, sizeof(server_t));
+    assert(server != NULL && "Buy more RAM lol");
+    pthread_mutex_init(&server->cache.lock, NULL);
+    arena_pool_init(&server->pool);
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    pthread_cond_init(&server->space, NULL);
+
+    for (usz i = 0; i < jobs; i++) {
+        pthread_t thread;
+        if (thread_create(&thread, server_worker, server) != 0) {
+            log_error("pthread_create() failed");
+            return -1;
+        }
+        pthread_detach(thread);
+    }
+    log_info("listening on %s with %zu workers", server_socket, jobs);
+
+    for (;;) {
+        int conn = accept(listener, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                log_error("accept() failed: %s", strerror(errno));
+            continue;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        while (server->count == SERVER_QUEUE)
+            pthread_cond_wait(&server->space, &server->lock);
+        server->queue[(server->head + server->count) % SERVER_QUEUE] = conn;
+        server->count++;
+        pthread_cond_signal(&server->ready);
+        pthread_mutex_unlock(&server->lock);
+    }
+}
+
+/* -------------------- CLIENT -------------------- */
+
+static bool send_request(int conn, int fds[FD_COUNT], int argc, char *argv[]) {
+    usz length = 0;
+    for (int i = 0; i < argc; i++)
+        length += strlen(argv[i]) + 1;
+    if (length > SERVER_MAX_REQUEST) return false;
+    u32 header = length;
+
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int) * FD_COUNT)];
+    } control = {0};
+    struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * FD_COUNT);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * FD_COUNT);
+
+    ssize_t n;
+    do
+        n = sendmsg(conn, &msg, 0);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    if ((usz)n < sizeof(header) &&
+        !write_all(conn, (char *)&header + n, sizeof(header) - n))
+        return false;
+
+    for (int i = 0; i < argc; i++)
+        if (!write_all(conn, argv[i], strlen(argv[i]) + 1)) return false;
+    return true;
+}
+
+int client_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    int first = 1;
+    if (first < argc && strncmp(argv[first], "--socket=", 9) == 0)
+        path = argv[first++] + 9;
+
+    options_t opts;
+    if (first >= argc || !parse_options(&opts, argc - first, argv + first)) {
+        usage("coffee");
+        return -1;
+    }
+
+    char socket[sizeof(server_socket)];
+    if (!socket_path(socket, sizeof(socket), path)) {
+        log_error("socket path too long");
+        return -1;
+    }
+
+    int source = open(argv[first], O_RDONLY | O_CLOEXEC);
+    if (source < 0) {
+        log_error("open() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (opts.verbose) log_set_level(LOG_TRACE);
+    int conn = socket_connect(socket);
+    if (conn >= 0 && !socket_trusted(conn)) {
+        log_warn("the server on %s is run by another user", socket);
+        close(conn);
+        conn = -1;
+    }
+    if (conn < 0) {
+        log_debug("no server on %s, compiling in-process", socket);
+        int status = run(&opts, argv[first], source);
+        close(source);
+        return status;
+    }
+
+    i32 status = -1;
+    int fds[FD_COUNT] = {source, STDOUT_FILENO, STDERR_FILENO};
+    if (!send_request(conn, fds, argc - first, argv + first) ||
+        !read_all(conn, &status, sizeof(status)))
+        log_error("lost the connection to the server on %s", socket);
+
+    close(conn);
+    close(source);
+    return status;
+}
@@ -0,0 +1,100 @@
+#include "include/source.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+void sm_init(source_manager_t *sm) {
+    *sm = (source_manager_t){0};
+    pthread_mutex_init(&sm->lock, NULL);
+}
+
+void sm_free(source_manager_t *sm) {
+    for (usz i = 0; i < sm->files.count; i++) {
+        free(sm->files.items[i]->lines);
+        free(sm->files.items[i]);
+    }
+    free(sm->files.items);
+    pthread_mutex_destroy(&sm->lock);
+}
+
+source_file_t *sm_add(source_manager_t *sm, char *name, char *text,
+                      usz length) {
+    pthread_mutex_lock(&sm->lock);
+    // one more offset for the end of file
+    if (length >= (usz)UINT32_MAX - sm->next) {
+        pthread_mutex_unlock(&sm->lock);
+        return NULL;
+    }
+
+    source_file_t *file = malloc(sizeof(source_file_t));
+    assert(file != NULL && "Buy more RAM lol");
+    *file = (source_file_t){
+        .name = name, .text = text, .base = sm->next, .length = (u32)length};
+    sm->next += (u32)length + 1;
+    da_append(&sm->files, file);
+    pthread_mutex_unlock(&sm->lock);
+    return file;
+}
+
+static source_file_t *sm_find(source_manager_t *sm, u32 offset) {
+    usz lo = 0, hi = sm->files.count;
+    while (lo < hi) {
+        usz mid = (lo + hi) / 2;
+        source_file_t *file = sm->files.items[mid];
+        if (offset < file->base)
+            hi = mid;
+        else if (offset > file->base + file->length)
+            lo = mid + 1;
+        else
+            return file;
+    }
+    return NULL;
+}
+
+source_file_t *sm_file(source_manager_t *sm, u32 offset) {
+    pthread_mutex_lock(&sm->lock);
+    source_file_t *file = sm_find(sm, offset);
+    pthread_mutex_unlock(&sm->lock);
+    return file;
+}
+
+static void sm_build_lines(source_file_t *file) {
+    usz capacity = 64, count = 0;
+    u32 *lines = malloc(capacity * sizeof(u32));
+    assert(lines != NULL && "Buy more RAM lol");
+    lines[count++] = 0;
+    for (u32 i = 0; i < file->length; i++) {
+        if (file->text[i] != '\n') continue;
+        if (count == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(u32));
+            assert(lines != NULL && "Buy more RAM lol");
+        }
+        lines[count++] = i + 1;
+    }
+    file->lines = lines;
+    file->line_count = (u32)count;
+}
+
+source_loc_t sm_resolve(source_manager_t *sm, u32 offset) {
+    pthread_mutex_lock(&sm->lock);
+    source_file_t *file = sm_find(sm, offset);
+    if (file == NULL) {
+        pthread_mutex_unlock(&sm->lock);
+        return (source_loc_t){0};
+    }
+    if (file->lines == NULL) sm_build_lines(file);
+    pthread_mutex_unlock(&sm->lock);
+
+    // last line starting at or before the offset
+    u32 local = offset - file->base;
+    u32 lo = 0, hi = file->line_count;
+    while (hi - lo > 1) {
+        u32 mid = (lo + hi) / 2;
+        if (file->lines[mid] <= local)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (source_loc_t){file, lo + 1, local - file->lines[lo] + 1};
+}
@@ -0,0 +1,200 @@
+#include "include/types.h"
+#include "include/arena.h"
+#include "include/hash.h"
+#include "include/intern.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Entries are stored in fixed-size chunks so that pointers returned by
+// `ty_get` stay valid while other threads add types.
+#define TYPE_CHUNK_BITS 10
+#define TYPE_CHUNK_SIZE (1 << TYPE_CHUNK_BITS)
+#define TYPE_MAX_CHUNKS 4096
+#define TYPE_INIT_CAP 256
+
+static struct {
+    pthread_mutex_t lock;
+    typeinfo_t *chunks[TYPE_MAX_CHUNKS];
+    u32 count;
+    u32 *slots; // open addressing over ids, offset by one so 0 is empty
+    usz capacity;
+    arena_t arena; // parameter lists of function types
+    const char *builtin_names[TID_STRING + 1];
+} T = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_once_t types_once = PTHREAD_ONCE_INIT;
+
+static u64 ty_hash(const typeinfo_t *info) {
+    u64 h = hash_combine(info->kind, info->inner);
+    h = hash_combine(h, info->param_count);
+    for (u32 i = 0; i < info->param_count; i++)
+        h = hash_combine(h, info->params[i]);
+    return h;
+}
+
+static bool ty_equal(const typeinfo_t *a, const typeinfo_t *b) {
+    return a->kind == b->kind && a->inner == b->inner &&
+           a->param_count == b->param_count &&
+           (a->param_count == 0 ||
+            memcmp(a->params, b->params, a->param_count * sizeof(tid_t)) == 0);
+}
+
+static void ty_grow(void) {
+    usz capacity = T.capacity == 0 ? TYPE_INIT_CAP : T.capacity * 2;
+    u32 *slots = calloc(capacity, sizeof(u32));
+    assert(slots != NULL && "Buy more RAM lol");
+
+    for (usz i = 0; i < T.capacity; i++) {
+        if (T.slots[i] == 0) continue;
+        usz slot = ty_hash(ty_get(T.slots[i] - 1)) & (capacity - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = T.slots[i];
+    }
+
+    free(T.slots);
+    T.slots = slots;
+    T.capacity = capacity;
+}
+
+// Returns the id of the type described by `info`, adding it to the table
+// if this is the first time it is seen.
+static tid_t ty_intern_locked(const typeinfo_t *info) {
+    if ((T.count + 1) * 4 > T.capacity * 3) ty_grow();
+
+    usz mask = T.capacity - 1;
+    usz slot = ty_hash(info) & mask;
+    for (; T.slots[slot] != 0; slot = (slot + 1) & mask)
+        if (ty_equal(ty_get(T.slots[slot] - 1), info))
+            return T.slots[slot] - 1;
+
+    tid_t id = T.count;
+    usz chunk = id >> TYPE_CHUNK_BITS;
+    assert(chunk < TYPE_MAX_CHUNKS && "too many types");
+    if (T.chunks[chunk] == NULL) {
+        T.chunks[chunk] = calloc(TYPE_CHUNK_SIZE, sizeof(typeinfo_t));
+        assert(T.chunks[chunk] != NULL && "Buy more RAM lol");
+    }
+
+    typeinfo_t *entry = &T.chunks[chunk][id & (TYPE_CHUNK_SIZE - 1)];
+    *entry = *info;
+    if (info->param_count > 0) {
+        tid_t *params =
+            arena_alloc(&T.arena, info->param_count * sizeof(tid_t));
+        memcpy(params, info->params, info->param_count * sizeof(tid_t));
+        entry->params = params;
+    }
+
+    T.slots[slot] = id + 1;
+    T.count++;
+    return id;
+}
+
+static void ty_init(void) {
+    static const struct {
+        const char *name;
+        u8 kind;
+    } builtins[] = {
+        [TID_ERROR] = {"<error>", TK_ERROR}, [TID_VOID] = {"void", TK_VOID},
+        [TID_INT] = {"int", TK_INT},         [TID_FLOAT] = {"float", TK_FLOAT},
+        [TID_BOOL] = {"bool", TK_BOOL},      [TID_STRING] = {"string", TK_STRING},
+    };
+
+    arena_init(&T.arena);
+    for (usz i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        tid_t id = ty_intern_locked(&(typeinfo_t){.kind = builtins[i].kind});
+        assert(id == i && "builtin types must come first");
+        T.builtin_names[i] = intern_cstr(builtins[i].name);
+    }
+}
+
+static tid_t ty_intern(const typeinfo_t *info) {
+    pthread_once(&types_once, ty_init);
+    pthread_mutex_lock(&T.lock);
+    tid_t id = ty_intern_locked(info);
+    pthread_mutex_unlock(&T.lock);
+    return id;
+}
+
+const typeinfo_t *ty_get(tid_t id) {
+    return &T.chunks[id >> TYPE_CHUNK_BITS][id & (TYPE_CHUNK_SIZE - 1)];
+}
+
+// Looks up a builtin type by its interned name, returns TID_ERROR for
+// anything else.
+tid_t ty_builtin(const char *name) {
+    pthread_once(&types_once, ty_init);
+    for (tid_t id = TID_VOID; id <= TID_STRING; id++)
+        if (T.builtin_names[id] == name) return id;
+    return TID_ERROR;
+}
+
+tid_t ty_ptr(tid_t inner) {
+    return ty_intern(&(typeinfo_t){.kind = TK_PTR, .inner = inner});
+}
+
+tid_t ty_fn(const tid_t *params, u32 count, tid_t ret) {
+    return ty_intern(&(typeinfo_t){
+        .kind = TK_FN,
+        .inner = ret,
+        .param_count = count,
+        .params = params,
+    });
+}
+
+usz ty_count(void) {
+    pthread_once(&types_once, ty_init);
+    pthread_mutex_lock(&T.lock);
+    usz count = T.count;
+    pthread_mutex_unlock(&T.lock);
+    return count;
+}
+
+// Writes the source spelling of a type into `buf`, truncating if needed, and
+// returns the length it would have had.
+usz ty_format(tid_t id, char *buf, usz size) {
+    // builtin ids are constants, so they can get here before anything was
+    // interned
+    pthread_once(&types_once, ty_init);
+    const typeinfo_t *info = ty_get(id);
+    usz n = 0;
+
+#define EMIT(...)                                                              \
+    n += snprintf(buf + (n < size ? n : size), n < size ? size - n : 0,        \
+                  __VA_ARGS__)
+
+    switch (info->kind) {
+    case TK_ERROR:
+    case TK_VOID:
+    case TK_INT:
+    case TK_FLOAT:
+    case TK_BOOL:
+    case TK_STRING:
+        EMIT("%s", T.builtin_names[id]);
+        break;
+
+    case TK_PTR:
+        EMIT("*");
+        n += ty_format(info->inner, buf + (n < size ? n : size),
+                       n < size ? size - n : 0);
+        break;
+
+    case TK_FN:
+        EMIT("(");
+        for (u32 i = 0; i < info->param_count; i++) {
+            if (i > 0) EMIT(", ");
+            n += ty_format(info->params[i], buf + (n < size ? n : size),
+                           n < size ? size - n : 0);
+        }
+        EMIT(") -> ");
+        n += ty_format(info->inner, buf + (n < size ? n : size),
+                       n < size ? size - n : 0);
+        break;
+    }
+
+#undef EMIT
+    return n;
+}
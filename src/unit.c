@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+#include "include/unit.h"
+#include "include/lexer.h"
+#include "include/log.h"
+#include "include/parser.h"
+#include "include/thread.h"
+#include "include/utf8.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Number of declarations a worker claims at a time
+#define UNIT_BATCH 64
+
+// Smallest declaration that is lexed on every thread before it is parsed,
+// when it is more than a thread's share of the file
+#define UNIT_LEX_PARALLEL (1 << 20)
+
+// Smallest declaration that is lexed on a thread of its own while it is
+// parsed, in pipelined mode
+#define UNIT_PIPELINE (64 * 1024)
+
+// Finds where the next top-level declaration starts: an identifier followed
+// by `::` or `:=` outside of any braces or parentheses and outside of string
+// literals.
+// This is a byte-level scan that is much cheaper than lexing.
+bool unit_scan(const char *source, usz length, unit_scan_t *scan, usz *start) {
+    // inside brackets nothing but them and quotes matters, and no identifier
+    // has any of them, so the bytes in between are skipped at one a cycle
+    static const bool brackets[256] = {
+        ['"'] = true, ['{'] = true, ['('] = true, ['}'] = true, [')'] = true};
+
+    usz depth = scan->depth;
+    for (usz i = scan->pos; i < length; i++) {
+        if (depth > 0)
+            while (i < length && !brackets[(u8)source[i]])
+                i++;
+        if (i == length) break;
+
+        char ch = source[i];
+        switch (ch) {
+        case '"':
+            i++;
+            while (i < length && source[i] != '"')
+                i++;
+            break;
+
+        case '{':
+        case '(':
+            depth++;
+            break;
+
+        case '}':
+        case ')':
+            if (depth > 0) depth--;
+            break;
+
+        default: {
+            const char *end = source + length;
+            usz size = utf8_ident_start(source + i, end);
+            if (size == 0) break;
+
+            usz ident = i;
+            usz j = i + size;
+            while (j < length && (size = utf8_ident_continue(source + j, end)))
+                j += size;
+            i = j - 1;
+            if (depth != 0) break;
+
+            while (j < length && l_is_space(source[j]))
+                j++;
+            if (j + 1 < length && source[j] == ':' &&
+                (source[j + 1] == ':' || source[j + 1] == '=')) {
+                *scan = (unit_scan_t){i + 1, depth};
+                *start = ident;
+                return true;
+            }
+        } break;
+        }
+    }
+    *scan = (unit_scan_t){length, depth};
+    return false;
+}
+
+void unit_split(const char *source, usz length, offsets_t *out) {
+    unit_scan_t scan = {0};
+    usz start;
+    while (unit_scan(source, length, &scan, &start))
+        da_append(out, start);
+}
+
+typedef struct {
+    tokens_t tokens; // see `l_lex`, NULL items if not lexed ahead
+    errors_t errors;
+} unit_lexed_t;
+
+typedef struct {
+    unit_t *unit;
+    offsets_t starts;
+    usz count;        // number of chunks
+    decl_t **decls;   // one slot per chunk
+    errors_t *errors; // one list per chunk
+    unit_lexed_t *lexed; // one slot per chunk
+    dag_repeats_t *repeats; // one list per chunk in DAG mode, else NULL
+    atomic_size_t next;
+    bool skim;
+    bool pipeline;
+} unit_job_t;
+
+typedef struct {
+    unit_job_t *job;
+    arena_t *arena;
+    dag_t dag;
+    pthread_t thread;
+    bool started;
+} unit_worker_t;
+
+// The lexer and the splitter assume well-formed UTF-8
+bool unit_validate(source_file_t *file, errors_t *errors) {
+    usz bad;
+    if (utf8_validate(file->text, file->length, &bad)) return true;
+
+    span_t span = {file->base + (u32)bad, 1};
+    char *msg = malloc(32);
+    assert(msg != NULL && "Buy more RAM lol");
+    snprintf(msg, 32, "invalid UTF-8 byte 0x%02x", (u8)file->text[bad]);
+    da_append(errors, ((error_t){.span = span, .msg = msg}));
+    return false;
+}
+
+decl_t *unit_parse_decl(source_file_t *file, usz start, usz end,
+                        arena_t *arena, bool skim, imports_t *imports,
+                        errors_t *errors) {
+    lexer_t lexer;
+    l_init_range(&lexer, file, start, end);
+    parser_t parser;
+    p_init(&parser, &lexer, arena);
+    parser.skim = skim;
+    parser.body_errors = errors;
+    parser.imports = imports;
+
+    decl_t *decl;
+    p_parse_unit_decl(&parser, &decl);
+    for (usz i = 0; i < parser.errors.count; i++)
+        da_append(errors, parser.errors.items[i]);
+    free(parser.errors.items);
+    free(lexer.errors.items);
+    return decl;
+}
+
+// Chunk `i` runs from the start of declaration `i` to the start of the next
+// one. The first chunk also takes whatever precedes the first declaration,
+// so stray tokens there are still reported.
+static void unit_chunk(unit_job_t *job, usz i, usz *start, usz *end) {
+    *start = i == 0 ? 0 : job->starts.items[i];
+    *end = i + 1 < job->count ? job->starts.items[i + 1]
+                              : job->unit->file->length;
+}
+
+static void unit_parse_chunk(unit_job_t *job, unit_worker_t *w, usz i) {
+    unit_t *u = job->unit;
+    usz start, end;
+    unit_chunk(job, i, &start, &end);
+
+    lexer_t lexer;
+    unit_lexed_t *lexed = &job->lexed[i];
+    if (lexed->tokens.items != NULL)
+        l_init_lexed(&lexer, u->file, start, end, &lexed->tokens,
+                     &lexed->errors);
+    else if (job->pipeline && end - start >= UNIT_PIPELINE)
+        l_init_pipelined(&lexer, u->file, start, end);
+    else
+        l_init_range(&lexer, u->file, start, end);
+    parser_t parser;
+    p_init(&parser, &lexer, w->arena);
+    parser.skim = job->skim;
+    parser.body_errors = &u->errors;
+    if (i == 0) parser.imports = &u->imports;
+    if (job->repeats != NULL) {
+        // nothing is shared between declarations, which are analyzed apart
+        w->dag.repeats = &job->repeats[i];
+        dag_start(&w->dag);
+        parser.dag = &w->dag;
+    }
+
+    p_parse_unit_decl(&parser, &job->decls[i]);
+    job->errors[i] = parser.errors;
+    l_stop(&lexer);
+    free(lexer.errors.items);
+}
+
+static void *unit_worker(void *arg) {
+    unit_worker_t *w = arg;
+    unit_job_t *job = w->job;
+    for (;;) {
+        usz first = atomic_fetch_add(&job->next, UNIT_BATCH);
+        if (first >= job->count) break;
+        usz last = first + UNIT_BATCH < job->count ? first + UNIT_BATCH
+                                                   : job->count;
+        for (usz i = first; i < last; i++)
+            unit_parse_chunk(job, w, i);
+        log_trace("parsed declarations %zu..%zu", first, last);
+    }
+    return NULL;
+}
+
+// Parses a whole translation unit. The declarations are found with
+// `unit_split` and parsed independently by a pool of threads, each with its
+// own parser and arena; results are merged back in source order, so the
+// outcome does not depend on the number of threads.
+void unit_parse(unit_t *u, source_file_t *file, unit_options_t opts) {
+    *u = (unit_t){.file = file, .pool = opts.pool};
+    char *source = file->text;
+    usz length = file->length;
+
+    if (!unit_validate(file, &u->errors)) return;
+
+    unit_job_t job = {.unit = u, .skim = opts.skim, .pipeline = opts.pipeline};
+    unit_split(source, length, &job.starts);
+    job.count = job.starts.count > 0 ? job.starts.count : 1;
+    job.decls = calloc(job.count, sizeof(decl_t *));
+    job.errors = calloc(job.count, sizeof(errors_t));
+    job.lexed = calloc(job.count, sizeof(unit_lexed_t));
+    assert(job.decls != NULL && job.errors != NULL && job.lexed != NULL &&
+           "Buy more RAM lol");
+    if (opts.dag) {
+        job.repeats = calloc(job.count, sizeof(dag_repeats_t));
+        assert(job.repeats != NULL && "Buy more RAM lol");
+    }
+    atomic_init(&job.next, 0);
+
+    usz jobs = opts.jobs;
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (usz)cpus : 1;
+    }
+
+    // a declaration that big would keep one thread busy while the others
+    // run out of work, typically because it is all there is; pipelining
+    // takes its lexing off that thread instead
+    for (usz i = 0; i < job.count && jobs > 1 && !opts.pipeline; i++) {
+        usz start, end;
+        unit_chunk(&job, i, &start, &end);
+        if (end - start >= UNIT_LEX_PARALLEL && (end - start) * jobs > length)
+            l_lex(file, start, end, jobs, &job.lexed[i].tokens,
+                  &job.lexed[i].errors);
+    }
+
+    usz batches = (job.count + UNIT_BATCH - 1) / UNIT_BATCH;
+    if (jobs > batches) jobs = batches;
+    log_debug("%s: %zu declarations on %zu threads", file->name, job.count,
+              jobs);
+
+    unit_worker_t *workers = calloc(jobs, sizeof(unit_worker_t));
+    assert(workers != NULL && "Buy more RAM lol");
+    for (usz i = 0; i < jobs; i++) {
+        arena_t *arena;
+        if (u->pool != NULL) {
+            arena = arena_pool_take(u->pool);
+        } else {
+            arena = malloc(sizeof(arena_t));
+            assert(arena != NULL && "Buy more RAM lol");
+            arena_init(arena);
+        }
+        da_append(&u->arenas, arena);
+        workers[i] = (unit_worker_t){.job = &job, .arena = arena};
+        dag_init(&workers[i].dag);
+    }
+
+    // the calling thread is worker 0; work is claimed dynamically, so a
+    // thread that fails to start just leaves more for the others
+    for (usz i = 1; i < jobs; i++)
+        workers[i].started =
+            thread_create(&workers[i].thread, unit_worker, &workers[i]) == 0;
+    unit_worker(&workers[0]);
+    for (usz i = 1; i < jobs; i++)
+        if (workers[i].started) pthread_join(workers[i].thread, NULL);
+
+    da_reserve(&u->decls, job.count);
+    for (usz i = 0; i < job.count; i++) {
+        if (job.decls[i] != NULL) da_append(&u->decls, job.decls[i]);
+        for (usz j = 0; j < job.errors[i].count; j++)
+            da_append(&u->errors, job.errors[i].items[j]);
+        free(job.errors[i].items);
+    }
+    for (usz i = 0; i < job.count && job.repeats != NULL; i++) {
+        for (usz j = 0; j < job.repeats[i].count; j++)
+            da_append(&u->repeats, job.repeats[i].items[j]);
+        free(job.repeats[i].items);
+    }
+
+    for (usz i = 0; i < jobs; i++)
+        dag_free(&workers[i].dag);
+    free(workers);
+    free(job.repeats);
+    free(job.lexed);
+    free(job.errors);
+    free(job.decls);
+    free(job.starts.items);
+}
+
+void unit_free(unit_t *u) {
+    for (usz i = 0; i < u->arenas.count; i++) {
+        if (u->pool != NULL) {
+            arena_pool_give(u->pool, u->arenas.items[i]);
+            continue;
+        }
+        arena_free(u->arenas.items[i]);
+        free(u->arenas.items[i]);
+    }
+    for (usz i = 0; i < u->errors.count; i++)
+        free(u->errors.items[i].msg);
+    free(u->arenas.items);
+    free(u->errors.items);
+    free(u->decls.items);
+    free(u->imports.items);
+    free(u->repeats.items);
+}
@@ -0,0 +1,309 @@
+#include "include/utf8.h"
+#include "include/xid.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define UTF8_SSSE3 1
+#else
+#define UTF8_SSSE3 0
+#endif
+
+/* -------------------- DECODING -------------------- */
+
+u32 utf8_decode(const char *s, const char *end, usz *size) {
+    const u8 *p = (const u8 *)s;
+    usz left = (usz)(end - s);
+    u32 cp;
+    usz n;
+    if (p[0] < 0x80) {
+        *size = 1;
+        return p[0];
+    } else if ((p[0] & 0xE0) == 0xC0) {
+        cp = p[0] & 0x1F;
+        n = 2;
+    } else if ((p[0] & 0xF0) == 0xE0) {
+        cp = p[0] & 0x0F;
+        n = 3;
+    } else if ((p[0] & 0xF8) == 0xF0) {
+        cp = p[0] & 0x07;
+        n = 4;
+    } else {
+        *size = 1;
+        return 0xFFFD;
+    }
+
+    if (n > left) {
+        *size = 1;
+        return 0xFFFD;
+    }
+    for (usz i = 1; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *size = 1;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+    *size = n;
+    return cp;
+}
+
+static bool in_ranges(const u32 (*ranges)[2], usz count, u32 cp) {
+    usz lo = 0, hi = count;
+    while (lo < hi) {
+        usz mid = (lo + hi) / 2;
+        if (cp < ranges[mid][0])
+            hi = mid;
+        else if (cp > ranges[mid][1])
+            lo = mid + 1;
+        else
+            return true;
+    }
+    return false;
+}
+
+bool xid_start(u32 cp) {
+    return in_ranges(xid_start_ranges, sizeof(xid_start_ranges) /
+                                           sizeof(*xid_start_ranges),
+                     cp);
+}
+
+bool xid_continue(u32 cp) {
+    return in_ranges(xid_continue_ranges, sizeof(xid_continue_ranges) /
+                                              sizeof(*xid_continue_ranges),
+                     cp);
+}
+
+/* -------------------- SCALAR -------------------- */
+
+bool utf8_validate_scalar(const char *s, usz length, usz *error) {
+    const u8 *p = (const u8 *)s;
+    usz i = 0;
+    while (i < length) {
+        // eight ASCII bytes at a time
+        if (i + 8 <= length) {
+            u64 v;
+            memcpy(&v, p + i, sizeof(v));
+            if ((v & 0x8080808080808080) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        u8 ch = p[i];
+        if (ch < 0x80) {
+            i++;
+            continue;
+        }
+
+        usz n;
+        u32 min;
+        if (ch >= 0xC2 && ch <= 0xDF) {
+            n = 2;
+            min = 0x80;
+        } else if ((ch & 0xF0) == 0xE0) {
+            n = 3;
+            min = 0x800;
+        } else if (ch >= 0xF0 && ch <= 0xF4) {
+            n = 4;
+            min = 0x10000;
+        } else {
+            *error = i;
+            return false;
+        }
+
+        u32 cp = ch & (0x7F >> n);
+        for (usz k = 1; k < n; k++) {
+            if (i + k >= length || (p[i + k] & 0xC0) != 0x80) {
+                *error = i;
+                return false;
+            }
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+        }
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            *error = i;
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+/* -------------------- SSSE3 -------------------- */
+
+// The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less Than
+// One Instruction Per Byte" (simdjson). Three 16-entry tables indexed by the
+// nibbles of each byte and the byte before it flag every two-byte error
+// pattern; lengths of 3 and 4 byte sequences are checked by comparing
+// against the bytes two and three positions back.
+#if UTF8_SSSE3
+
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS ((char)0x80)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+typedef struct {
+    __m128i error, prev_input, prev_incomplete;
+} utf8_state_t;
+
+SSSE3 static inline __m128i lookup(__m128i table, __m128i nibbles) {
+    return _mm_shuffle_epi8(table, nibbles);
+}
+
+SSSE3 static inline __m128i high_nibbles(__m128i v) {
+    return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+}
+
+SSSE3 static inline __m128i check_special_cases(__m128i input, __m128i prev1) {
+    const __m128i byte_1_high_table = _mm_setr_epi8(
+        // 0_______ ________ <ASCII in byte 1>
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TOO_LONG,
+        // 10______ ________ <continuation in byte 1>
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        // 1100____ ________ <two byte lead in byte 1>
+        TOO_SHORT | OVERLONG_2,
+        // 1101____ ________ <two byte lead in byte 1>
+        TOO_SHORT,
+        // 1110____ ________ <three byte lead in byte 1>
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        // 1111____ ________ <four+ byte lead in byte 1>
+        (char)(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+
+    const __m128i byte_1_low_table = _mm_setr_epi8(
+        // ____0000 ________
+        (char)(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        // ____0001 ________
+        (char)(CARRY | OVERLONG_2),
+        // ____001_ ________
+        (char)CARRY, (char)CARRY,
+        // ____0100 ________
+        (char)(CARRY | TOO_LARGE),
+        // ____0101 ________
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____011_ ________
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____1___ ________
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____1101 ________
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        (char)(CARRY | TOO_LARGE | TOO_LARGE_1000));
+
+    const __m128i byte_2_high_table = _mm_setr_epi8(
+        // ________ 0_______ <ASCII in byte 2>
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT,
+        // ________ 1000____
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+               TOO_LARGE_1000 | OVERLONG_4),
+        // ________ 1001____
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        // ________ 101_____
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        (char)(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        // ________ 11______
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    __m128i byte_1_high = lookup(byte_1_high_table, high_nibbles(prev1));
+    __m128i byte_1_low =
+        lookup(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+    __m128i byte_2_high = lookup(byte_2_high_table, high_nibbles(input));
+    return _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+}
+
+SSSE3 static inline __m128i check_multibyte_lengths(__m128i input,
+                                                    __m128i prev_input,
+                                                    __m128i special_cases) {
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+    // only 111_____ and 1111____ respectively end up with the top bit set
+    __m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+    __m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+    __m128i must_be_continuation =
+        _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte),
+                      _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must_be_continuation, special_cases);
+}
+
+// Whether the block ends in the middle of a multi-byte sequence
+SSSE3 static inline __m128i is_incomplete(__m128i input) {
+    const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                      -1, -1, -1, (char)(0xF0 - 1),
+                                      (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm_subs_epu8(input, max);
+}
+
+SSSE3 static inline void check_block(utf8_state_t *st, __m128i input) {
+    __m128i prev1 = _mm_alignr_epi8(input, st->prev_input, 16 - 1);
+    __m128i special_cases = check_special_cases(input, prev1);
+    st->error = _mm_or_si128(
+        st->error,
+        check_multibyte_lengths(input, st->prev_input, special_cases));
+    st->prev_incomplete = is_incomplete(input);
+    st->prev_input = input;
+}
+
+// Validates 64 bytes, skipping the work when they are all ASCII
+SSSE3 static inline void check_chunk(utf8_state_t *st, const u8 *p) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(p + 48));
+    __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+    if (_mm_movemask_epi8(any) == 0) {
+        st->error = _mm_or_si128(st->error, st->prev_incomplete);
+        return;
+    }
+    check_block(st, a);
+    check_block(st, b);
+    check_block(st, c);
+    check_block(st, d);
+}
+
+SSSE3 static bool utf8_validate_ssse3(const char *s, usz length) {
+    const u8 *p = (const u8 *)s;
+    utf8_state_t st = {_mm_setzero_si128(), _mm_setzero_si128(),
+                       _mm_setzero_si128()};
+
+    usz i = 0;
+    for (; i + 64 <= length; i += 64)
+        check_chunk(&st, p + i);
+
+    // the tail is padded with ASCII, which also catches a sequence cut off
+    // by the end of the input
+    u8 tail[64] = {0};
+    memcpy(tail, p + i, length - i);
+    check_chunk(&st, tail);
+    st.error = _mm_or_si128(st.error, st.prev_incomplete);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(st.error, _mm_setzero_si128())) ==
+           0xFFFF;
+}
+
+#endif
+
+bool utf8_validate(const char *s, usz length, usz *error) {
+#if UTF8_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        if (utf8_validate_ssse3(s, length)) return true;
+        // only the slow path knows where the error is
+        return utf8_validate_scalar(s, length, error);
+    }
+#endif
+    return utf8_validate_scalar(s, length, error);
+}
@@ -0,0 +1,134 @@
+#include "include/walk.h"
+#include <assert.h>
+
+// Each node is visited with a mask of the passes that asked for it, and its
+// children with the passes whose `pre` hook did not decline them.
+#define WALK_HOOKS(type, name)                                                 \
+    static u64 walk_pre_##name(walker_t *w, u64 active, type *node) {          \
+        u64 children = active;                                                 \
+        for (u64 m = active; m != 0; m &= m - 1) {                             \
+            pass_t *pass = &w->passes[__builtin_ctzll(m)];                     \
+            if (pass->pre_##name != NULL &&                                    \
+                !pass->pre_##name(pass->ctx, node))                            \
+                children &= ~(m & -m);                                         \
+        }                                                                      \
+        return children;                                                       \
+    }                                                                          \
+                                                                               \
+    static void walk_post_##name(walker_t *w, u64 active, type *node) {        \
+        for (u64 m = active; m != 0; m &= m - 1) {                             \
+            pass_t *pass = &w->passes[__builtin_ctzll(m)];                     \
+            if (pass->post_##name != NULL) pass->post_##name(pass->ctx, node); \
+        }                                                                      \
+    }
+
+WALK_HOOKS(decl_t, decl)
+WALK_HOOKS(stmt_t, stmt)
+WALK_HOOKS(param_t, param)
+WALK_HOOKS(expr_t, expr)
+
+#undef WALK_HOOKS
+
+static void walk_decl_in(walker_t *, decl_t *, u64);
+static void walk_expr_in(walker_t *, expr_t *, u64);
+
+static void walk_stmt_in(walker_t *w, stmt_t *stmt, u64 active) {
+    u64 children = walk_pre_stmt(w, active, stmt);
+    if (children != 0) {
+        switch (stmt->type) {
+#define S(id, field)                                                           \
+    case S_##id:                                                               \
+        walk_##field##_in(w, stmt->field, children);                           \
+        break;
+            STMTS
+#undef S
+        }
+    }
+    walk_post_stmt(w, active, stmt);
+}
+
+static void walk_param_in(walker_t *w, param_t *param, u64 active) {
+    u64 children = walk_pre_param(w, active, param);
+    if (children != 0 && param->expr != NULL)
+        walk_expr_in(w, param->expr, children);
+    walk_post_param(w, active, param);
+}
+
+static void walk_fn(walker_t *w, expr_t *fn, u64 active) {
+    for (usz i = 0; i < fn->fn.params.count; i++)
+        walk_param_in(w, fn->fn.params.items[i], active);
+
+    // a skipped body has no statements until it is parsed
+    stmts_t *stmts = w->bodies ? ast_fn_body(fn) : &fn->fn.stmts;
+    for (usz i = 0; i < stmts->count; i++)
+        walk_stmt_in(w, stmts->items[i], active);
+}
+
+static void walk_expr_in(walker_t *w, expr_t *expr, u64 active) {
+    u64 children = walk_pre_expr(w, active, expr);
+    if (children != 0) {
+        switch (expr->type) {
+#define CHILD(field) walk_expr_in(w, expr->field, children);
+#define FN_CHILDREN walk_fn(w, expr, children);
+#define E(id, name, ...)                                                       \
+    case E_##id:                                                               \
+        __VA_ARGS__ break;
+            EXPRS
+#undef E
+#undef FN_CHILDREN
+#undef CHILD
+        }
+    }
+    walk_post_expr(w, active, expr);
+}
+
+static void walk_decl_in(walker_t *w, decl_t *decl, u64 active) {
+    u64 children = walk_pre_decl(w, active, decl);
+    if (children != 0) walk_expr_in(w, decl->value, children);
+    walk_post_decl(w, active, decl);
+}
+
+static u64 walk_all(walker_t *w) {
+    assert(w->count <= WALK_MAX_PASSES && "too many passes to fuse");
+    return w->count == WALK_MAX_PASSES ? ~(u64)0 : ((u64)1 << w->count) - 1;
+}
+
+void walk_decls(walker_t *w, decls_t *decls) {
+    u64 active = walk_all(w);
+    for (usz i = 0; i < decls->count && active != 0; i++)
+        walk_decl_in(w, decls->items[i], active);
+}
+
+void walk_decl(walker_t *w, decl_t *decl) {
+    u64 active = walk_all(w);
+    if (active != 0) walk_decl_in(w, decl, active);
+}
+
+void walk_expr(walker_t *w, expr_t *expr) {
+    u64 active = walk_all(w);
+    if (active != 0) walk_expr_in(w, expr, active);
+}
+
+/* -------------------- COUNTING -------------------- */
+
+#define WALK_COUNT(type, name)                                                 \
+    static bool walk_count_##name(void *ctx, type *node) {                     \
+        (void)node;                                                            \
+        (*(usz *)ctx)++;                                                       \
+        return true;                                                           \
+    }
+
+WALK_COUNT(decl_t, decl)
+WALK_COUNT(stmt_t, stmt)
+WALK_COUNT(param_t, param)
+WALK_COUNT(expr_t, expr)
+
+#undef WALK_COUNT
+
+pass_t walk_counter(usz *count) {
+    return (pass_t){.pre_decl = walk_count_decl,
+                    .pre_stmt = walk_count_stmt,
+                    .pre_param = walk_count_param,
+                    .pre_expr = walk_count_expr,
+                    .ctx = count};
+}
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+# Generates src/include/pow5.h, the table of 128-bit truncated powers of five
+# used by the Eisel-Lemire float parser in src/number.c.
+#
+#     python3 tools/gen_pow5.py > src/include/pow5.h
+
+SMALLEST = -342
+LARGEST = 308
+
+
+def entries():
+    for q in range(SMALLEST, 0):
+        power5 = 5 ** -q
+        z = power5.bit_length()
+        if q >= -27:
+            c = 2 ** (z + 127) // power5 + 1
+        else:
+            c = 2 ** (2 * z + 2 * 64) // power5 + 1
+            while c >= 1 << 128:
+                c //= 2
+        yield q, c
+    for q in range(0, LARGEST + 1):
+        power5 = 5 ** q
+        while power5 < 1 << 127:
+            power5 *= 2
+        while power5 >= 1 << 128:
+            power5 //= 2
+        yield q, power5
+
+
+print("// Generated by tools/gen_pow5.py, do not edit.")
+print()
+print("#ifndef POW5_H")
+print("#define POW5_H")
+print()
+print('#include "common.h"')
+print()
+print(f"#define POW5_SMALLEST_POWER ({SMALLEST})")
+print(f"#define POW5_LARGEST_POWER {LARGEST}")
+print()
+print("// 5^q normalized to 128 bits, stored as {high, low} pairs for")
+print("// q = POW5_SMALLEST_POWER..POW5_LARGEST_POWER")
+print("static const u64 pow5_128[] = {")
+for q, c in entries():
+    print(f"    0x{c >> 64:016x}, 0x{c & (2**64 - 1):016x}, // 5^{q}")
+print("};")
+print()
+print("#endif // !POW5_H")
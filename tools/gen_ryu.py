@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+# Generates src/include/ryu.h, the tables of 125-bit powers of five used by
+# the shortest round-trip float formatter in src/number.c.
+#
+#     python3 tools/gen_ryu.py > src/include/ryu.h
+
+POW5_INV_BITCOUNT = 125
+POW5_BITCOUNT = 125
+POW5_INV_COUNT = 342
+POW5_COUNT = 326
+
+
+def split(c):
+    return f"{{0x{c & (2**64 - 1):016x}, 0x{c >> 64:016x}}}"
+
+
+print("// Generated by tools/gen_ryu.py, do not edit.")
+print()
+print("#ifndef RYU_H")
+print("#define RYU_H")
+print()
+print('#include "common.h"')
+print()
+print(f"#define RYU_POW5_INV_BITCOUNT {POW5_INV_BITCOUNT}")
+print(f"#define RYU_POW5_BITCOUNT {POW5_BITCOUNT}")
+print()
+print("// ceil(2^k / 5^q) + 1 for q = 0..341, where k = bitlength(5^q) - 1 + 125,")
+print("// stored as {low, high} pairs")
+print(f"static const u64 ryu_pow5_inv[{POW5_INV_COUNT}][2] = {{")
+for q in range(POW5_INV_COUNT):
+    power5 = 5**q
+    j = power5.bit_length() - 1 + POW5_INV_BITCOUNT
+    print(f"    {split((1 << j) // power5 + 1)}, // 5^-{q}")
+print("};")
+print()
+print("// 5^i truncated to its top 125 bits, stored as {low, high} pairs")
+print(f"static const u64 ryu_pow5[{POW5_COUNT}][2] = {{")
+for i in range(POW5_COUNT):
+    power5 = 5**i
+    j = power5.bit_length() - POW5_BITCOUNT
+    c = power5 >> j if j >= 0 else power5 << -j
+    print(f"    {split(c)}, // 5^{i}")
+print("};")
+print()
+print("#endif // !RYU_H")
@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+# Generates src/include/xid.h, the non-ASCII code point ranges of the Unicode
+# XID_Start and XID_Continue properties used for identifiers by the lexer.
+# Python's str.isidentifier implements the same rules (UAX #31).
+#
+#     python3 tools/gen_xid.py > src/include/xid.h
+
+import sys
+import unicodedata
+
+
+def ranges(pred):
+    out, start = [], None
+    for cp in range(0x80, sys.maxunicode + 2):
+        ok = cp <= sys.maxunicode and pred(chr(cp))
+        if ok and start is None:
+            start = cp
+        elif not ok and start is not None:
+            out.append((start, cp - 1))
+            start = None
+    return out
+
+
+def table(name, rs):
+    print(f"static const u32 {name}_ranges[][2] = {{")
+    for lo, hi in rs:
+        print(f"    {{0x{lo:05x}, 0x{hi:05x}}},")
+    print("};")
+
+
+start = ranges(lambda c: c.isidentifier())
+cont = ranges(lambda c: ("a" + c).isidentifier())
+
+print(f"// Generated by tools/gen_xid.py from Unicode {unicodedata.unidata_version}, do not edit.")
+print()
+print("#ifndef XID_H")
+print("#define XID_H")
+print()
+print('#include "common.h"')
+print()
+print("// Sorted, inclusive ranges of code points at or above U+0080")
+table("xid_start", start)
+print()
+table("xid_continue", cont)
+print()
+print("#endif // !XID_H")